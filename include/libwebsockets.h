@@ -89,6 +89,7 @@ typedef unsigned long long lws_intptr_t;
 #define LWS_O_WRONLY _O_WRONLY
 #define LWS_O_CREAT _O_CREAT
 #define LWS_O_TRUNC _O_TRUNC
+#define LWS_O_EXCL _O_EXCL
 
 #ifndef __func__
 #define __func__ __FUNCTION__
@@ -110,6 +111,7 @@ typedef unsigned long long lws_intptr_t;
 #define LWS_O_WRONLY O_WRONLY
 #define LWS_O_CREAT O_CREAT
 #define LWS_O_TRUNC O_TRUNC
+#define LWS_O_EXCL O_EXCL
 
 #if !defined(LWS_PLAT_OPTEE) && !defined(OPTEE_TA) && !defined(LWS_WITH_ESP32)
 #include <poll.h>
@@ -406,6 +408,7 @@ struct lws;
 #include <libwebsockets/lws-cgi.h>
 #include <libwebsockets/lws-vfs.h>
 #include <libwebsockets/lws-lejp.h>
+#include <libwebsockets/lws-json-out.h>
 #include <libwebsockets/lws-stats.h>
 #include <libwebsockets/lws-threadpool.h>
 #include <libwebsockets/lws-tokenize.h>
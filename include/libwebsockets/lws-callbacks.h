@@ -840,4 +840,5 @@ lws_callback_function(struct lws *wsi, enum lws_callback_reasons reason,
 #define LWS_CB_REASON_AUX_BF__CGI_HEADERS	8
 #define LWS_CB_REASON_AUX_BF__PROXY_TRANS_END	16
 #define LWS_CB_REASON_AUX_BF__PROXY_HEADERS	32
+#define LWS_CB_REASON_AUX_BF__FCGI		64
 ///@}
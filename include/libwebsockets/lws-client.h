@@ -47,6 +47,12 @@ enum lws_client_connect_ssl_connection_flags {
 		 * HTTP/1.1: always possible... uses pipelining
 		 * HTTP/2:   always possible... uses parallel streams
 		 * */
+	LCCSCF_KEEPALIVE			= (1 << 17),
+		/**< Don't ask the server to close the connection after the
+		 * transaction, without pipelining anything else on it.  lws
+		 * uses this for the upstream connections of reverse proxy
+		 * mounts, which it keeps in its own pool for reuse.
+		 */
 };
 
 /** struct lws_client_connect_info - parameters to connect with when using
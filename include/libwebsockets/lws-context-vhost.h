@@ -204,6 +204,13 @@ enum lws_context_options {
 	 * recommended.
 	 */
 
+	LWS_SERVER_OPTION_HTTP_PRECOMPRESSED			= (1 << 30),
+	/**< (VH) When serving a file foo from a file mount on this vhost,
+	 * serve a sibling file foo.br or foo.gz instead if it exists, is not
+	 * older than foo, and the client said it accepts that content-encoding.
+	 * Responses from the vhost's file mounts get a "vary: Accept-Encoding"
+	 * header then. */
+
 	/****** add new things just above ---^ ******/
 };
 
@@ -211,6 +218,15 @@ enum lws_context_options {
 
 struct lws_plat_file_ops;
 
+/** enum lws_access_log_format - how vhost access log lines are written */
+enum lws_access_log_format {
+	LWS_ACCESS_LOG_FORMAT_COMBINED,
+	/**< Apache combined log format, one request per line */
+	LWS_ACCESS_LOG_FORMAT_JSON,
+	/**< one JSON object per line, with the same information plus the
+	 * request latency in us */
+};
+
 /** struct lws_context_creation_info - parameters to create context and /or vhost with
  *
  * This is also used to create vhosts.... if LWS_SERVER_OPTION_EXPLICIT_VHOSTS
@@ -592,6 +608,89 @@ struct lws_context_creation_info {
 	/**< VHOST: NULL for default, or force accepted incoming connections to
 	 * bind to this vhost protocol name.
 	 */
+	unsigned int proxy_pool_max_idle;
+	/**< VHOST: 0 for default of 4, or the most idle keepalive connections
+	 * to keep open to each upstream host:port of the vhost's http reverse
+	 * proxy mounts, for reuse by later proxied transactions. */
+	unsigned int proxy_pool_max_conns;
+	/**< VHOST: 0 for no limit, or the most connections open to each
+	 * upstream host:port of the vhost's http reverse proxy mounts, busy or
+	 * idle.  Proxied transactions that would need more are answered with
+	 * 503. */
+	unsigned int proxy_pool_idle_secs;
+	/**< VHOST: 0 for default of 4, or how many seconds an idle upstream
+	 * connection is kept open waiting to be reused.  This should be less
+	 * than the keepalive timeout of the upstream server. */
+	unsigned int listen_accept_budget;
+	/**< VHOST: 0 for no limit, or the most connections accepted from the
+	 * vhost's listen socket each time it signals, before other connections
+	 * get serviced.  Any left in the queue are accepted next time around
+	 * the event loop. */
+	unsigned int tcp_defer_accept;
+	/**< VHOST: 0 to accept connections as soon as they are made, or where
+	 * the platform supports TCP_DEFER_ACCEPT, up to how many seconds the
+	 * kernel may wait for the client to send some data before completing
+	 * the accept.  Connections that don't send anything first, eg, where
+	 * the server is expected to speak first, are delayed by this long. */
+	const int *pt_cpus;
+	/**< CONTEXT: NULL, or an array of count_threads cpu numbers, one for
+	 * each service thread.  Where the platform supports it, each service
+	 * thread is pinned to its cpu the first time it services, and the
+	 * per-thread listen sockets steer each new connection to the service
+	 * thread pinned to the cpu that received it, so the connection stays
+	 * on the cpu that handles its network queue.  Use -1 for a service
+	 * thread that shouldn't be pinned.  The network interface irqs should
+	 * also be spread over the same cpus.  With libuv, libev or libevent,
+	 * the thread is pinned when it calls lws_service() to run the pt's
+	 * loop... if you run the loops yourself, pin those threads yourself. */
+	unsigned int fcgi_pool_max_idle;
+	/**< VHOST: 0 for default of 4, or the most idle connections to keep
+	 * open to each FastCGI worker address of the vhost's fcgi:// mounts,
+	 * for reuse by later requests. */
+	unsigned int fcgi_pool_idle_secs;
+	/**< VHOST: 0 for default of 5, or how many seconds an idle FastCGI
+	 * worker connection is kept open waiting to be reused. */
+	unsigned int compressed_cache_max;
+	/**< VHOST: 0 to disable, or the most bytes of http stream compressed
+	 * file bodies from the vhost's file mounts to keep in memory, so later
+	 * requests for the same version of the file in the same encoding are
+	 * served without compressing it again.  Files bigger than 1/8 of this
+	 * aren't kept.  Needs LWS_WITH_HTTP_STREAM_COMPRESSION. */
+	uint32_t ip_limit_req_rate;
+	/**< CONTEXT: 0 for no limit, or how many http requests per second a
+	 * single IP may start, with bursts of up to a second's worth.  An IP
+	 * over its rate isn't disconnected, its connections stop being
+	 * serviced until it is back within it.  Needs LWS_WITH_PEER_LIMITS. */
+	uint32_t ip_limit_byte_rate;
+	/**< CONTEXT: 0 for no limit, or how many bytes per second a single IP
+	 * may send and receive over all its connections, applied like
+	 * ip_limit_req_rate.  Needs LWS_WITH_PEER_LIMITS. */
+	uint32_t vh_limit_req_rate;
+	/**< VHOST: 0 for no limit, or how many http requests per second all
+	 * the IPs connected to the vhost may start together, applied like
+	 * ip_limit_req_rate.  Needs LWS_WITH_PEER_LIMITS. */
+	uint32_t vh_limit_byte_rate;
+	/**< VHOST: 0 for no limit, or how many bytes per second all the IPs
+	 * connected to the vhost may send and receive together, applied like
+	 * ip_limit_req_rate.  Needs LWS_WITH_PEER_LIMITS. */
+	unsigned int max_http_header_data_small;
+	/**< CONTEXT: 0 to allocate every ah with the full max_http_header_data,
+	 * or a smaller size that ah are allocated with first.  Only an ah
+	 * whose headers don't fit in that is grown to max_http_header_data,
+	 * while it's parsing them, and it's shrunk again when the ah is
+	 * reset for the next transaction.  So the max can be set to allow
+	 * for the rare huge request, without most connections paying for
+	 * it. */
+	unsigned int access_log_format;
+	/**< VHOST: an lws_access_log_format, LWS_ACCESS_LOG_FORMAT_COMBINED
+	 * (0) or LWS_ACCESS_LOG_FORMAT_JSON, for the lines written to the
+	 * log_filepath access log.  Needs LWS_WITH_ACCESS_LOG. */
+	unsigned int prof_stall_us;
+	/**< CONTEXT: 0 for default of 100ms, or how many us a protocol
+	 * callback or role handler may hold the service thread before it's
+	 * logged as a stall, with a backtrace of where lws called it from.
+	 * Where there are pthreads, a watchdog thread also logs stalls still
+	 * in progress.  Needs LWS_WITH_PROFILER. */
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility
@@ -843,6 +942,10 @@ lws_get_vhost_iface(struct lws_vhost *vhost);
  * \param vh: the vhost
  * \param buf: buffer to fill with JSON
  * \param len: max length of buf
+ *
+ * Returns the length of the NUL-terminated JSON in buf, or -1 if it would
+ * not fit in len, in which case buf is left empty rather than holding
+ * truncated JSON.
  */
 LWS_VISIBLE LWS_EXTERN int
 lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len);
@@ -855,12 +958,57 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len);
  * \param len: max length of buf
  * \param hide_vhosts: nonzero to not provide per-vhost mount etc information
  *
- * Generates a JSON description of vhost state into buf
+ * Generates a JSON description of vhost state into buf.  Returns the length
+ * of the NUL-terminated JSON, or -1 if it would not fit in len, in which case
+ * buf is left empty rather than holding truncated JSON.  You can retry with
+ * a bigger buffer.
  */
 LWS_VISIBLE LWS_EXTERN int
 lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 		      int hide_vhosts);
 
+/**
+ * struct lws_metrics_render - where lws_metrics_render() got up to
+ *
+ * Zero it and set .openmetrics as needed before the first call, then pass the
+ * same one to each call until .done is set.
+ */
+struct lws_metrics_render {
+	struct lws_vhost *vh; /**< internal: vhost of the item, if per-vhost */
+	int family;	/**< internal: family being rendered */
+	int item;	/**< internal: vhost or pt index + 1, 0 = family header */
+	int sample;	/**< internal: sample of the item */
+	unsigned char openmetrics; /**< 1 = OpenMetrics, 0 = Prometheus text */
+	unsigned char done; /**< set by lws when everything was rendered */
+};
+
+/**
+ * lws_metrics_render() - render context, vhost and pt metrics as text
+ *
+ * \param context: the context
+ * \param r: the render state, zeroed before the first call
+ * \param buf: buffer to fill
+ * \param len: max length of buf
+ *
+ * Renders as many whole lines of metrics as fit in buf, in OpenMetrics or
+ * Prometheus text exposition format, and notes in r where it got to so the
+ * next call carries on from there.  Nothing is allocated, so it can be
+ * called from each HTTP_WRITEABLE callback to stream the metrics out a
+ * chunk at a time.
+ *
+ * It covers per-vhost connection, transaction, TLS handshake and timeout
+ * counts, per-pt connections, ah pool, buflist, h2 stream and event loop
+ * iteration time, and the LWSSTATS_ stats if lws was built with
+ * LWS_WITH_STATS.
+ *
+ * buf should be at least 512 bytes so any one line fits.  Available when
+ * lws was built with LWS_WITH_SERVER_STATUS or LWS_WITH_STATS.  Returns the
+ * length rendered into buf.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_metrics_render(struct lws_context *context, struct lws_metrics_render *r,
+		   char *buf, int len);
+
 /**
  * lws_vhost_user() - get the user data associated with the vhost
  * \param vhost: Websocket vhost
@@ -915,6 +1063,7 @@ enum lws_mount_protocols {
 	LWSMPRO_REDIR_HTTP	= 4, /**< redirect to http:// url */
 	LWSMPRO_REDIR_HTTPS	= 5, /**< redirect to https:// url */
 	LWSMPRO_CALLBACK	= 6, /**< hand by named protocol's callback */
+	LWSMPRO_FCGI		= 7, /**< pass to a FastCGI worker to handle */
 };
 
 /** struct lws_http_mount
@@ -935,7 +1084,8 @@ struct lws_http_mount {
 
 	const struct lws_protocol_vhost_options *cgienv;
 	/**< optional linked-list of cgi options.  These are created
-	 * as environment variables for the cgi process
+	 * as environment variables for the cgi process, or passed as
+	 * FCGI_PARAMS to the worker for fcgi:// mounts
 	 */
 	const struct lws_protocol_vhost_options *extra_mimetypes;
 	/**< optional linked-list of mimetype mappings */
@@ -943,7 +1093,8 @@ struct lws_http_mount {
 	/**< optional linked-list of files to be interpreted */
 
 	int cgi_timeout;
-	/**< seconds cgi is allowed to live, if cgi://mount type */
+	/**< seconds cgi is allowed to live, if cgi://mount type, or to wait
+	 * for the worker, if fcgi://mount type */
 	int cache_max_age;
 	/**< max-age for reuse of client cache of files, seconds */
 	unsigned int auth_mask;
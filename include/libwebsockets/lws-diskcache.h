@@ -37,22 +37,29 @@
  *
  * `lws_diskcache_trim()` should be called at eg, 1s intervals to perform the
  * cache dir monitoring and LRU autodelete in the background lazily.  It can
- * be done in its own thread or on a timer... it monitors the directories in a
- * stateful way that stats one or more file in the cache per call, and keeps
- * a list of the oldest files as it goes.  When it completes a scan, if the
- * aggregate size is over the limit, it will delete oldest files first to try
- * to keep it under the limit.
- *
- * The cache size monitoring is extremely efficient in time and memory even when
- * the cache directory becomes huge.
+ * be done in its own thread or on a timer... the first 256 calls each read
+ * one of the cache subdirs into an index kept in memory, with the size of
+ * each file and a list of the files in the order they were last used.  After
+ * that, if the aggregate size is over the limit, each call deletes the least
+ * recently used files from the index and the disk to try to keep it under
+ * the limit.
+ *
+ * Once the index is complete, cache hits and trimming don't need to open or
+ * stat the cached files, at the cost of around 100 bytes of heap per cached
+ * file.  Every couple of seconds a trim call rereads one subdir, only statting
+ * files it hasn't indexed yet, so files added by other processes sharing the
+ * cache dir are counted within around ten minutes.
+ * Temp files that are still being written are never trimmed.
  *
  * `lws_diskcache_query()` is used to determine if the file already exists in
  * the cache, or if it must be created.  If it must be created, then the file
  * is opened using a temp name that must be converted to a findable name with
  * `lws_diskcache_finalize_name()` when the generation of the file contents are
  * complete.  Aborted cached files that did not complete generation will be
- * flushed by the LRU eventually.  If the file already exists, it is 'touched'
- * to make it new again and the fd returned.
+ * flushed by the LRU eventually.  If the file already exists, it is made the
+ * most recently used in the index and the fd returned.  The mtime of the file
+ * on disk is also updated if it is more than 10 minutes old, so the LRU order
+ * survives restarts.
  *
  */
 ///@{
@@ -159,15 +166,14 @@ lws_diskcache_finalize_name(char *cache);
  *
  * \param lds: The opaque object representing the cache
  *
- * This should be called periodically to statefully walk the cache on disk
- * collecting the oldest files.  When it has visited every file, if the cache
- * is oversize it will delete the oldest files until it's back under size again.
- *
- * Each time it's called, it will look at one or more dir in the cache.  If
- * called when the cache is oversize, it increases the amount of work done each
- * call until it is reduced again.  Typically it will take 256 calls before it
- * deletes anything, so if called once per second, it will delete files once
- * every 4 minutes.  Each call is very inexpensive both in memory and time.
+ * This should be called periodically.  The first 256 calls build the index
+ * of the cache by reading one cache subdir each.  After that, each call
+ * rereads one subdir to find files added by others, learns the size of newly
+ * created cache files, and if the cache is oversize, deletes up to 128 of the
+ * least recently used files to get it back under size again.  Until the index
+ * is complete, nothing is deleted, so if called once per second, trimming
+ * starts about 4 minutes after startup.  Temp files of cache files still
+ * being created are not deleted, unless they weren't written to for an hour.
  */
 LWS_VISIBLE LWS_EXTERN int
 lws_diskcache_trim(struct lws_diskcache_scan *lds);
@@ -102,6 +102,45 @@ lws_fts_create(int fd);
 LWS_VISIBLE LWS_EXTERN void
 lws_fts_destroy(struct lws_fts **trie);
 
+/**
+ * lws_fts_shard_create() - Create a shard to index some input files in parallel
+ *
+ * \param t: The previously opened index being written
+ *
+ * A shard is a separate in-memory trie with the same api as \p t, for use by a
+ * different thread, so several threads may each index a subset of the input
+ * files at the same time.  The shard writes its per-input data directly into
+ * the index file of \p t as it goes, and must be merged into \p t using
+ * lws_fts_shard_merge() once the thread is finished with it.
+ *
+ * It's OK to use lws_fts_file_index() and lws_fts_fill() on \p t and any
+ * number of its shards from different threads at the same time, but each
+ * shard must only be used by one thread at a time.  All the shards must be
+ * merged before lws_fts_serialize() on \p t.
+ *
+ * If lws was built without pthreads, \p t and its shards may only be used
+ * from one thread.
+ */
+LWS_VISIBLE LWS_EXTERN struct lws_fts *
+lws_fts_shard_create(struct lws_fts *t);
+
+/**
+ * lws_fts_shard_merge() - Merge and destroy a shard
+ *
+ * \param t: The index the shard was created from
+ * \param shard: pointer to the shard pointer, set to NULL afterwards
+ *
+ * Merges the trie of a shard that has finished indexing its input files into
+ * \p t, and destroys the shard.  This must not happen at the same time as
+ * anything else using \p t, eg, from the thread that owns \p t after the thread
+ * that used the shard has finished.  Any input file \p t was filling from is
+ * completed first, so it can't be continued afterwards.
+ *
+ * Returns 0 for OK.  The shard is destroyed either way.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_fts_shard_merge(struct lws_fts *t, struct lws_fts **shard);
+
 /**
  * lws_fts_file_index() - Create a new entry in the trie file for an input path
  *
@@ -142,6 +181,77 @@ lws_fts_fill(struct lws_fts *t, uint32_t file_index, const char *buf,
 LWS_VISIBLE LWS_EXTERN int
 lws_fts_serialize(struct lws_fts *t);
 
+/*
+ * incremental update functions
+ *
+ * An index at "path" may be followed by delta segments "path.1", "path.2"...
+ * each of which is a complete, small index of some input files added since,
+ * and a list of removed filepaths "path.tomb".  Opening the index with
+ * LWSFTS_F_OPEN_SEGMENTS searches all of them together.
+ *
+ * They may be called on the same index from different threads or processes:
+ * each holds an exclusive flock() on "path.lock" while it works, so they
+ * take turns.  The index may be opened and searched while they do.
+ */
+
+/**
+ * lws_fts_segment_add() - Index some input files into a new delta segment
+ *
+ * \param index_path: The filepath of the base index
+ * \param filepaths: array of input filepaths to index
+ * \param count: number of filepaths in the array
+ *
+ * Indexes the given files into the next delta segment after the existing ones,
+ * which is renamed into place when complete.  If the same filepath exists in
+ * the base index or an older segment, the new one supersedes it in results.
+ * If there is no base index yet, it is created from the files instead.
+ *
+ * Returns the ordinal of the new segment (0 if the base index was created), or
+ * -1 for failure.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_fts_segment_add(const char *index_path, const char * const *filepaths,
+		    int count);
+
+/**
+ * lws_fts_tombstone() - Remove a filepath from an index's results
+ *
+ * \param index_path: The filepath of the base index
+ * \param filepath: The input filepath to remove
+ *
+ * Appends the filepath to the index's removed list, so file results for it
+ * from the base index or any existing delta segment are no longer returned.
+ * Adding it again later with lws_fts_segment_add() brings it back.
+ *
+ * Autocomplete suggestion counts still include removed filepaths, and older
+ * copies of filepaths that were added again, until the index is compacted.
+ *
+ * Returns 0 for OK.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_fts_tombstone(const char *index_path, const char *filepath);
+
+/**
+ * lws_fts_compact() - Fold delta segments and removals into the base index
+ *
+ * \param index_path: The filepath of the base index
+ * \param min_segments: do nothing unless at least this many delta segments
+ *
+ * Builds a new base index from the current version of every filepath that
+ * is still live in the base index and its delta segments, by reading the
+ * input files again, and renames it over the base index before deleting the
+ * delta segments and removed list.  Searches that already opened the index
+ * continue to use the old files.
+ *
+ * This takes about as long as creating the index from scratch, so it is
+ * intended to be called periodically from a worker thread, eg, from an
+ * lws_threadpool task.
+ *
+ * Returns 0 for OK, including when there was nothing to do.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_fts_compact(const char *index_path, int min_segments);
+
 /*
  * index search functions
  */
@@ -157,6 +267,34 @@ lws_fts_serialize(struct lws_fts *t);
 LWS_VISIBLE LWS_EXTERN struct lws_fts_file *
 lws_fts_open(const char *filepath);
 
+#define LWSFTS_F_OPEN_NO_MMAP		(1 << 0)
+#define LWSFTS_F_OPEN_SEGMENTS		(1 << 1)
+
+/**
+ * lws_fts_open_flags() - Open an existing index file with options
+ *
+ * \param filepath: The filepath to the index file to open
+ * \param flags: combination of LWSFTS_F_OPEN_* flags
+ *
+ * As lws_fts_open(), which is the same as this with \p flags of 0.
+ *
+ * Where the platform supports it, by default the whole index file is mapped
+ * read-only and searches walk the trie in place in the mapping, without any
+ * syscalls or copying.  Concurrent searches on the same lws_fts_file, even
+ * from different threads, then share the one mapping.  If the mapping fails,
+ * or \p flags contains LWSFTS_F_OPEN_NO_MMAP, searches read the parts of the
+ * index they need from the fd instead, and the lws_fts_file must not be used
+ * for more than one search at a time.
+ *
+ * If \p flags contains LWSFTS_F_OPEN_SEGMENTS, any delta segments and removed
+ * filepaths for the index are opened along with it, and searches return the
+ * combined results.
+ *
+ * The index file must not be modified while it is open.
+ */
+LWS_VISIBLE LWS_EXTERN struct lws_fts_file *
+lws_fts_open_flags(const char *filepath, int flags);
+
 #define LWSFTS_F_QUERY_AUTOCOMPLETE	(1 << 0)
 #define LWSFTS_F_QUERY_FILES		(1 << 1)
 #define LWSFTS_F_QUERY_FILE_LINES	(1 << 2)
@@ -197,6 +335,9 @@ struct lws_fts_search_params {
  * and filepath data, along with some sundry information.  This does not need
  * to be freed since freeing the lwsac will also remove this and everything it
  * points to.
+ *
+ * Returns NULL if the search failed, eg, an index segment couldn't be read.
+ * ftsp->results_head is NULL then and there is nothing to free.
  */
 LWS_VISIBLE LWS_EXTERN struct lws_fts_result *
 lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp);
@@ -653,6 +653,23 @@ lws_http_redirect(struct lws *wsi, int code, const unsigned char *loc, int len,
 LWS_VISIBLE LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_http_transaction_completed(struct lws *wsi);
 
+#if defined(LWS_WITH_LWSAC)
+/**
+ * lws_http_transaction_alloc() - allocate memory for the current transaction
+ * \param wsi:	http connection
+ * \param size:	bytes needed
+ *
+ *	Returns size bytes of memory that stay valid until the current http
+ *	transaction on wsi completes (after LWS_CALLBACK_HTTP_DROP_PROTOCOL),
+ *	or wsi closes, whichever is first.  There's no need to free it, the
+ *	allocations for the transaction are all dropped together then.
+ *
+ *	Returns NULL for OOM.
+ */
+LWS_VISIBLE LWS_EXTERN void *
+lws_http_transaction_alloc(struct lws *wsi, size_t size);
+#endif
+
 /**
  * lws_http_compression_apply() - apply an http compression transform
  *
@@ -0,0 +1,220 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * included from libwebsockets.h
+ */
+
+/** \defgroup jsonout JSON writer
+ * ##JSON generation related functions
+ * \ingroup lwsapi
+ *
+ * The output counterpart to lejp: a streaming JSON emitter that never
+ * allocates and never truncates.
+ *
+ * You give it a window of memory, typically the area after LWS_PRE in your
+ * tx buffer, and make calls to emit objects, arrays and values into it.  The
+ * writer takes care of commas, quoting and escaping.
+ *
+ * When a call can't complete in the space left in the window it returns
+ * LWSJO_FULL.  You should send what was written so far (`j->p - start`),
+ * wait for the next WRITEABLE callback, set a new window with
+ * lws_json_out_window() and then repeat **the same call with the same
+ * arguments**.  It picks up exactly where it left off, so a single string
+ * may be split over as many windows as it takes.
+ *
+ * Calls that return LWSJO_OK have completely issued their output.
+ */
+//@{
+
+#define LWS_JSON_OUT_MAX_DEPTH 32
+
+enum lws_json_out_ret {
+	LWSJO_OK	=  0,
+	/**< the call completed */
+	LWSJO_FULL	=  1,
+	/**< the window filled: send it and repeat the call in a new window */
+	LWSJO_ERR	= -1,
+	/**< usage error, eg, key missing in an object or nesting too deep */
+};
+
+struct lws_json_out {
+	char *p;
+	/**< next byte to be written in the current window */
+	char *end;
+	/**< one past the last byte of the current window */
+
+	/* private */
+
+	size_t off;
+	uint32_t members;
+	uint32_t is_obj;
+	unsigned char piece;
+	unsigned char depth;
+};
+
+/**
+ * lws_json_out_init() - prepare a JSON writer
+ *
+ * \param j: the writer struct, usually in your pss
+ * \param buf: start of the first output window
+ * \param len: length of the first output window
+ *
+ * Resets the writer to the top level and sets the first window.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lws_json_out_init(struct lws_json_out *j, char *buf, size_t len);
+
+/**
+ * lws_json_out_window() - give the writer a new output window
+ *
+ * \param j: the writer
+ * \param buf: start of the new output window
+ * \param len: length of the new output window
+ *
+ * Call this after you have sent the contents of the last window, eg, at the
+ * start of each WRITEABLE callback.  Nesting and resume state is kept.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lws_json_out_window(struct lws_json_out *j, char *buf, size_t len);
+
+/**
+ * lws_json_out_obj() - open an object
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ *
+ * Returns LWSJO_OK, LWSJO_FULL or LWSJO_ERR as described above.  Close the
+ * object later with lws_json_out_end().
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_obj(struct lws_json_out *j, const char *key);
+
+/**
+ * lws_json_out_arr() - open an array
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ *
+ * Returns LWSJO_OK, LWSJO_FULL or LWSJO_ERR as described above.  Close the
+ * array later with lws_json_out_end().
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_arr(struct lws_json_out *j, const char *key);
+
+/**
+ * lws_json_out_end() - close the innermost open object or array
+ *
+ * \param j: the writer
+ *
+ * Returns LWSJO_OK, LWSJO_FULL or LWSJO_ERR as described above.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_end(struct lws_json_out *j);
+
+/**
+ * lws_json_out_strn() - emit a string value, escaping it as needed
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param s: the string, which does not need to be NUL terminated
+ * \param len: the length of the string in bytes
+ *
+ * Quotes, backslashes and control characters are escaped, everything else
+ * including UTF-8 is passed through unchanged.  A NULL \p s is emitted as
+ * JSON null.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_strn(struct lws_json_out *j, const char *key, const char *s,
+		  size_t len);
+
+/**
+ * lws_json_out_str() - emit a NUL-terminated string value
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param s: the NUL-terminated string, or NULL to emit JSON null
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_str(struct lws_json_out *j, const char *key, const char *s);
+
+/**
+ * lws_json_out_int() - emit a signed integer value
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param v: the value
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_int(struct lws_json_out *j, const char *key, int64_t v);
+
+/**
+ * lws_json_out_uint() - emit an unsigned integer value
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param v: the value
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_uint(struct lws_json_out *j, const char *key, uint64_t v);
+
+/**
+ * lws_json_out_bool() - emit true or false
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param v: nonzero for true
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_bool(struct lws_json_out *j, const char *key, int v);
+
+/**
+ * lws_json_out_null() - emit null
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_null(struct lws_json_out *j, const char *key);
+
+/**
+ * lws_json_out_raw() - emit a preformatted JSON value as-is
+ *
+ * \param j: the writer
+ * \param key: the member name if we are inside an object, else NULL
+ * \param json: a complete, valid JSON value, eg, "1.5e3"
+ *
+ * The writer adds the comma and key but does not check or escape \p json.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_raw(struct lws_json_out *j, const char *key, const char *json);
+
+/**
+ * lws_json_out_done() - check if the top level value is complete
+ *
+ * \param j: the writer
+ *
+ * Returns nonzero if every object and array opened has been closed again.
+ */
+static LWS_INLINE int
+lws_json_out_done(const struct lws_json_out *j)
+{
+	return !j->depth && !j->piece;
+}
+//@}
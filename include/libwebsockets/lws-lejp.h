@@ -156,7 +156,8 @@ enum lejp_callbacks {
  *			ctx->buf, which is as much as we can buffer, so we are
  *			spilling it.  If all your strings are less than
  *			LEJP_STRING_CHUNK - 1 bytes, you will never see this
- *			callback.
+ *			callback.  lejp_set_string_chunk() can make the
+ *			pieces smaller.
  *
  *  LEJPCB_VAL_STR_END:	String parsing has completed, the last chunk of the
  *			string is in ctx->buf.
@@ -182,6 +183,10 @@ typedef signed char (*lejp_callback)(struct lejp_ctx *ctx, char reason);
 #ifndef LEJP_MAX_PATH
 #define LEJP_MAX_PATH 128
 #endif
+#ifndef LEJP_MAX_COMPILED_PATHS
+/* paths after this many are still matched, just without the shortcut */
+#define LEJP_MAX_COMPILED_PATHS 128
+#endif
 #ifndef LEJP_STRING_CHUNK
 /* must be >= 30 to assemble floats */
 #define LEJP_STRING_CHUNK 254
@@ -227,6 +232,7 @@ struct lejp_ctx {
 	/* short */
 
 	uint16_t uni;
+	uint16_t str_chunk; /* deliver string values in pieces of this */
 
 	/* char */
 
@@ -240,6 +246,10 @@ struct lejp_ctx {
 	uint8_t path_match;
 	uint8_t path_match_len;
 	uint8_t wildcount;
+
+	/* added later, kept at the end so the members above don't move */
+
+	uint8_t path_lcp[LEJP_MAX_COMPILED_PATHS]; /* prefix shared w/ prev */
 };
 
 LWS_VISIBLE LWS_EXTERN void
@@ -257,6 +267,9 @@ LWS_VISIBLE LWS_EXTERN void
 lejp_change_callback(struct lejp_ctx *ctx,
 		     signed char (*callback)(struct lejp_ctx *ctx, char reason));
 
+LWS_VISIBLE LWS_EXTERN void
+lejp_set_string_chunk(struct lejp_ctx *ctx, unsigned int chunk);
+
 /* exported for use when reevaluating a path for use with a subcontext */
 LWS_VISIBLE LWS_EXTERN void
 lejp_check_path_match(struct lejp_ctx *ctx);
@@ -110,6 +110,20 @@ lwsac_use(struct lwsac **head, size_t ensure, size_t chunk_size);
 LWS_VISIBLE LWS_EXTERN void
 lwsac_free(struct lwsac **head);
 
+/**
+ * lwsac_reset - deallocate all but the first chunk and make it empty again
+ *
+ * \param head: pointer to the lwsac list object
+ *
+ * Like lwsac_free(), all lwsac_use() pointers are invalidated in one hit, but
+ * the first chunk is kept to be allocated from again, so an lwsac that is
+ * used over and over for a similar amount of objects each time usually does
+ * not have to go to the heap at all after the first time.  It's OK to call
+ * this on a NULL lwsac.
+ */
+LWS_VISIBLE LWS_EXTERN void
+lwsac_reset(struct lwsac **head);
+
 /*
  * Optional helpers useful for where consumers may need to defer destruction
  * until all consumers are finished with the lwsac
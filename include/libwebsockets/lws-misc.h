@@ -610,6 +610,8 @@ enum {
 	LWS_RXFLOW_REASON_USER_BOOL		= (1 << 0),
 	LWS_RXFLOW_REASON_HTTP_RXBUFFER		= (1 << 6),
 	LWS_RXFLOW_REASON_H2_PPS_PENDING	= (1 << 7),
+	LWS_RXFLOW_REASON_SPLICE_PENDING	= (1 << 8),
+	LWS_RXFLOW_REASON_RATELIMIT		= (1 << 9),
 
 	LWS_RXFLOW_REASON_APPLIES		= (1 << 14),
 	LWS_RXFLOW_REASON_APPLIES_ENABLE_BIT	= (1 << 13),
@@ -635,6 +637,14 @@ enum {
  * b5..b0 set to idicate which bits to enable or disable.  If any bits are
  * enabled, rx on the connection is suppressed.
  *
+ * LWS_RXFLOW_REASON_SPLICE_PENDING is used by lws itself while a raw proxy
+ * connection relaying with lws_raw_proxy_splice() waits for its peer to
+ * accept what it already read.
+ *
+ * LWS_RXFLOW_REASON_RATELIMIT is used by lws itself while a connection is
+ * held back because its peer or vhost went over a configured request or byte
+ * rate.
+ *
  * LWS_RXFLOW_REASON_FLAG_PROCESS_NOW  flag may also be given to force any change
  * in rxflowbstatus to benapplied immediately, this should be used when you are
  * changing a wsi flow control state from outside a callback on that wsi.
@@ -95,6 +95,31 @@ lws_spa_create(struct lws *wsi, const char * const *param_names,
 	       int count_params, int max_storage, lws_spa_fileupload_cb opt_cb,
 	       void *opt_data);
 
+/**
+ * lws_spa_set_upload_dir() - save uploaded files directly into a directory
+ *
+ * \param spa: the parser object previously created
+ * \param dir: directory to create the uploaded files in
+ *
+ * Instead of passing file upload content to opt_cb, the spa writes it
+ * straight from the received data into a file in \p dir, named with the last
+ * path element of the client's filename.  Filenames that are empty or start
+ * with '.' are refused and fail the parse.  The file is created exclusively,
+ * so if something already exists in \p dir with that name, it is left alone
+ * and the parse fails.  A file that couldn't be completed, because writing it
+ * failed or the spa was finalized or destroyed partway through it, is deleted
+ * so the upload can be tried again.
+ *
+ * If opt_cb was given, it is still called with LWS_UFS_OPEN before the file
+ * is created, and can return -1 to refuse it, and with LWS_UFS_FINAL_CONTENT
+ * once it has been closed.  Both calls have a NULL buf and zero len, and the
+ * sanitized filename.
+ *
+ * Returns 0 if OK or -1 on OOM.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_spa_set_upload_dir(struct lws_spa *spa, const char *dir);
+
 /**
  * lws_spa_process() - parses a chunk of input data
  *
@@ -55,21 +55,87 @@ enum {
 	LWSSTATS_MS_SSL_RX_DELAY, /**< aggregate delay between ssl accept complete and first RX */
 	LWSSTATS_C_PEER_LIMIT_AH_DENIED, /**< number of times we would have given an ah but for the peer limit */
 	LWSSTATS_C_PEER_LIMIT_WSI_DENIED, /**< number of times we would have given a wsi but for the peer limit */
+	LWSSTATS_C_HTTP_TXN_ALLOCS, /**< count of allocations made from http transaction lwsacs */
+	LWSSTATS_C_HTTP_TXN_HEAP_ALLOCS, /**< count of heap chunks the http transaction lwsacs needed */
+	LWSSTATS_C_AH_POOL_WAITS, /**< count of times a wsi had to wait for an ah */
+	LWSSTATS_C_AH_PROMOTIONS, /**< count of small ah grown to max_http_header_data */
+	LWSSTATS_C_ACCESS_LOG_DROPPED, /**< count of access log lines lost because the log writes were too far behind */
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility */
 	LWSSTATS_SIZE
 };
 
+/*
+ * Latency stats that also keep a histogram, so percentiles can be read back
+ * and not just the aggregate.  The aggregate and count are still available
+ * from the matching LWSSTATS_MS_ and LWSSTATS_C_ stats above.
+ */
+
+enum {
+	LWSSTATS_H_WRITABLE_DELAY, /**< delay between asking for writable and getting cb */
+	LWSSTATS_H_SSL_ACCEPT_DELAY, /**< delay in accepting SSL connection */
+	LWSSTATS_H_SSL_RX_DELAY, /**< delay between ssl accept complete and first RX */
+
+	/* Add new things just above here ---^
+	 * This is part of the ABI, don't needlessly break compatibility */
+	LWSSTATS_H_SIZE
+};
+
 #if defined(LWS_WITH_STATS)
 
+/**
+ * lws_stats_get() - get the current value of a stat
+ *
+ * \param context: the lws_context
+ * \param index: LWSSTATS_ index of the stat
+ *
+ * Each service thread keeps its own copy of the stats so it can update them
+ * without locking, this adds them together (or for the _WORST_ stats, takes
+ * the largest) at the time of the call.
+ */
 LWS_VISIBLE LWS_EXTERN uint64_t
 lws_stats_get(struct lws_context *context, int index);
+/**
+ * lws_stats_hist_get() - get a percentile of a latency stat in us
+ *
+ * \param context: the lws_context
+ * \param index: LWSSTATS_H_ index of the latency stat
+ * \param per_mille: the percentile wanted, eg, 990 for p99
+ *
+ * Returns the percentile in microseconds, read from a histogram with four
+ * buckets per power of two, so it is within 25% of the exact value.  Returns
+ * 0 if nothing was recorded yet.
+ */
+LWS_VISIBLE LWS_EXTERN uint64_t
+lws_stats_hist_get(struct lws_context *context, int index, int per_mille);
+/**
+ * lws_stats_prometheus() - render the stats in Prometheus text format
+ *
+ * \param context: the lws_context
+ * \param buf: buffer to render into
+ * \param len: length of buf
+ *
+ * Renders the counters, and the latency stats as summaries with the p50,
+ * p90, p99 and p999 quantiles, in the Prometheus text exposition format,
+ * along with the rest of what lws_metrics_render() covers, in one go.
+ * Nothing is allocated.
+ *
+ * Returns the length rendered, or -1 if buf was too small to hold it all.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_stats_prometheus(struct lws_context *context, char *buf, int len);
 LWS_VISIBLE LWS_EXTERN void
 lws_stats_log_dump(struct lws_context *context);
 #else
 static LWS_INLINE uint64_t
 lws_stats_get(struct lws_context *context, int index) { (void)context; (void)index;  return 0; }
+static LWS_INLINE uint64_t
+lws_stats_hist_get(struct lws_context *context, int index, int per_mille) {
+	(void)context; (void)index; (void)per_mille; return 0; }
+static LWS_INLINE int
+lws_stats_prometheus(struct lws_context *context, char *buf, int len) {
+	(void)context; (void)buf; (void)len; return -1; }
 static LWS_INLINE void
 lws_stats_log_dump(struct lws_context *context) { (void)context; }
 #endif
@@ -64,13 +64,24 @@ enum lws_threadpool_task_return {
 	LWS_TP_RETURN_FLAG_OUTLIVE = 64
 };
 
+/*
+ * Tasks are queued in one of LWS_THREADPOOL_PRIORITIES priority classes.  A
+ * free worker always takes a task from the highest-numbered class that has
+ * one queued, so class 0 (the default) is the lowest priority.  Tasks in the
+ * same class with the same deadline are started in the order they were
+ * enqueued.
+ */
+#define LWS_THREADPOOL_PRIORITIES 4
+
 struct lws_threadpool_create_args {
 	int threads;
 	int max_queue_depth;
 };
 
 struct lws_threadpool_task_args {
-	struct lws *wsi;	/**< user must set to wsi task is bound to */
+	struct lws *wsi;	/**< user must set to wsi task is bound to, or
+				     NULL for an async_task not bound to any
+				     wsi, that is reaped when it completes */
 	void *user;		/**< user may set (user-private pointer) */
 	const char *name;	/**< user may set to describe task */
 	char async_task;	/**< set to allow the task to shrug off the loss
@@ -88,6 +99,29 @@ struct lws_threadpool_task_args {
 	 * wsi may be NULL on entry, indicating the task got detached due to the
 	 * wsi closing before.
 	 */
+	unsigned char priority;
+	/**< user may set, 0 .. LWS_THREADPOOL_PRIORITIES - 1.  Queued tasks in
+	 * a higher class are always started before those in a lower class.
+	 * Default 0 is the lowest priority. */
+	lws_usec_t deadline_us;
+	/**< user may set, 0 means no deadline.  Otherwise the task must be
+	 * started by a worker within this many us of being enqueued.  Within a
+	 * priority class, tasks with the earliest deadline are started first.
+	 * If the deadline passes while the task is still queued, it is never
+	 * run but moves to LWS_TP_STATUS_STOPPED and is cleaned up the same
+	 * way as any other stopped task.  That's noticed when a task is
+	 * enqueued or started, or else by the service thread within a second
+	 * or so, so the context must be serviced. */
+};
+
+struct lws_threadpool_class_stats {
+	int queue_depth;	/**< tasks of this class currently queued */
+	int queue_depth_peak;	/**< highest queue_depth seen */
+	uint64_t enqueued;	/**< tasks of this class ever enqueued */
+	uint64_t started;	/**< tasks of this class picked up by a worker */
+	uint64_t expired;	/**< tasks dropped because deadline passed */
+	lws_usec_t wait_us_total; /**< sum of queued time of started tasks */
+	lws_usec_t wait_us_max;	/**< longest queued time of a started task */
 };
 
 /**
@@ -212,6 +246,21 @@ lws_threadpool_task_status_wsi(struct lws *wsi,
 LWS_VISIBLE LWS_EXTERN void
 lws_threadpool_task_sync(struct lws_threadpool_task *task, int stop);
 
+/**
+ * lws_threadpool_class_stats() - get queueing stats for one priority class
+ *
+ * \param tp: The threadpool to query
+ * \param priority: the class, 0 .. LWS_THREADPOOL_PRIORITIES - 1
+ * \param stats: struct to receive a snapshot of the stats
+ *
+ * Returns 0 if \p stats was filled, or -1 if \p priority is out of range.
+ *
+ * The average wait for the class is wait_us_total / started.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_threadpool_class_stats(struct lws_threadpool *tp, int priority,
+			   struct lws_threadpool_class_stats *stats);
+
 /**
  * lws_threadpool_dump() - dump the state of a threadpool to the log
  *
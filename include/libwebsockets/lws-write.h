@@ -260,4 +260,32 @@ lws_write_ws_flags(int initial, int is_start, int is_end)
 LWS_VISIBLE LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_raw_transaction_completed(struct lws *wsi);
 
+/**
+ * lws_raw_proxy_splice() - Relay two raw-proxy connections inside the kernel
+ *
+ * \param wsi: one established raw-proxy connection
+ * \param peer: the established raw-proxy connection to relay it with
+ *
+ * Where the platform has splice(), and both connections are plain sockets
+ * without tls on the same service thread, this pairs them so from now on,
+ * whatever is received on either is moved to the other through a pipe by the
+ * kernel, without being copied into userspace or seen by the protocol
+ * callback.  When one side can't accept more, rx on the other is flow
+ * controlled with LWS_RXFLOW_REASON_SPLICE_PENDING until it drains.
+ *
+ * The RX callbacks are no longer called for either connection, but the
+ * WRITEABLE callbacks still are, after data was moved, and the CLOSE callbacks
+ * as usual.  When a connection sees the remote side close, it is closed after
+ * everything it received has been passed on to its peer.
+ *
+ * Anything the protocol already queued to write to either connection is sent
+ * before any spliced data.
+ *
+ * Returns 0 if the connections are paired, or nonzero if splicing isn't
+ * possible for them, in which case the caller should go on relaying the data
+ * itself.
+ */
+LWS_VISIBLE LWS_EXTERN int
+lws_raw_proxy_splice(struct lws *wsi, struct lws *peer);
+
 ///@}
@@ -95,19 +95,26 @@ lws_create_new_server_wsi(struct lws_vhost *vhost, int fixed_tsi)
 	 * outermost create notification for wsi
 	 * no user_space because no protocol selection
 	 */
-	vhost->protocols[0].callback(new_wsi, LWS_CALLBACK_WSI_CREATE, NULL,
-				     NULL, 0);
+	lws_protocol_cb(vhost->protocols[0].callback, new_wsi,
+			LWS_CALLBACK_WSI_CREATE, NULL, NULL, 0);
 
 	return new_wsi;
 }
 
 
-/* if not a socket, it's a raw, non-ssl file descriptor */
+/*
+ * if not a socket, it's a raw, non-ssl file descriptor
+ *
+ * fixed_tsi is -1 to bind it to the idlest pt, or the pt it must be bound to
+ *
+ * sa is NULL, or the peer address if the caller already has it from accept()
+ */
 
-LWS_VISIBLE struct lws *
-lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
-			   lws_sock_file_fd_type fd, const char *vh_prot_name,
-			   struct lws *parent)
+struct lws *
+lws_adopt_descriptor_vhost_tsi(struct lws_vhost *vh, lws_adoption_type type,
+			       lws_sock_file_fd_type fd,
+			       const char *vh_prot_name, struct lws *parent,
+			       int fixed_tsi, const struct sockaddr *sa)
 {
 	struct lws_context *context = vh->context;
 	struct lws *new_wsi;
@@ -118,7 +125,7 @@ lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 	struct lws_peer *peer = NULL;
 
 	if (type & LWS_ADOPT_SOCKET) {
-		peer = lws_get_or_create_peer(vh, fd.sockfd);
+		peer = lws_get_or_create_peer(vh, fd.sockfd, sa);
 
 		if (peer && context->ip_limit_wsi &&
 		    peer->count_wsi >= context->ip_limit_wsi) {
@@ -132,7 +139,7 @@ lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
 	}
 #endif
 
-	n = -1;
+	n = fixed_tsi;
 	if (parent)
 		n = parent->tsi;
 	new_wsi = lws_create_new_server_wsi(vh, n);
@@ -249,6 +256,15 @@ bail:
 	return NULL;
 }
 
+LWS_VISIBLE struct lws *
+lws_adopt_descriptor_vhost(struct lws_vhost *vh, lws_adoption_type type,
+			   lws_sock_file_fd_type fd, const char *vh_prot_name,
+			   struct lws *parent)
+{
+	return lws_adopt_descriptor_vhost_tsi(vh, type, fd, vh_prot_name,
+					      parent, -1, NULL);
+}
+
 LWS_VISIBLE struct lws *
 lws_adopt_socket_vhost(struct lws_vhost *vh, lws_sockfd_type accept_fd)
 {
@@ -284,8 +300,8 @@ adopt_socket_readbuf(struct lws *wsi, const char *readbuf, size_t len)
 
 	pt = &wsi->context->pt[(int)wsi->tsi];
 
-	n = lws_buflist_append_segment(&wsi->buflist, (const uint8_t *)readbuf,
-				       len);
+	n = lws_wsi_buflist_append(wsi, &wsi->buflist, (const uint8_t *)readbuf,
+				   len);
 	if (n < 0)
 		goto bail;
 	if (n)
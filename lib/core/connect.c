@@ -132,6 +132,7 @@ lws_client_connect_via_info(const struct lws_client_connect_info *i)
 
 	wsi->protocol = &wsi->vhost->protocols[0];
 	wsi->client_pipeline = !!(i->ssl_connection & LCCSCF_PIPELINE);
+	wsi->client_keepalive = !!(i->ssl_connection & LCCSCF_KEEPALIVE);
 
 	/*
 	 * PHASE 5: handle external user_space now, generic alloc is done in
@@ -210,7 +210,8 @@ static const char * const mount_protocols[] = {
 	"cgi://",
 	">http://",
 	">https://",
-	"callback://"
+	"callback://",
+	"fcgi://"
 };
 
 LWS_VISIBLE void *
@@ -375,7 +376,7 @@ lws_protocol_init(struct lws_context *context)
 			 * NOTE the wsi is all zeros except for the context, vh
 			 * + protocol ptrs so lws_get_context(wsi) etc can work
 			 */
-			if (vh->protocols[n].callback(&wsi,
+			if (lws_protocol_cb(vh->protocols[n].callback, &wsi,
 					LWS_CALLBACK_PROTOCOL_INIT, NULL,
 					(void *)pvo, 0)) {
 				lws_free(vh->protocol_vh_privs[n]);
@@ -469,6 +470,26 @@ lws_create_vhost(struct lws_context *context,
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	vh->http.error_document_404 = info->error_document_404;
 #endif
+#if defined(LWS_WITH_HTTP_PROXY)
+	vh->http.proxy_pool_max_idle = info->proxy_pool_max_idle;
+	if (!vh->http.proxy_pool_max_idle)
+		vh->http.proxy_pool_max_idle = 4;
+	vh->http.proxy_pool_max_conns = info->proxy_pool_max_conns;
+	vh->http.proxy_pool_idle_secs = info->proxy_pool_idle_secs;
+	if (!vh->http.proxy_pool_idle_secs)
+		vh->http.proxy_pool_idle_secs = 4;
+#endif
+#if defined(LWS_ROLE_FCGI)
+	vh->http.fcgi_pool_max_idle = info->fcgi_pool_max_idle;
+	if (!vh->http.fcgi_pool_max_idle)
+		vh->http.fcgi_pool_max_idle = 4;
+	vh->http.fcgi_pool_idle_secs = info->fcgi_pool_idle_secs;
+	if (!vh->http.fcgi_pool_idle_secs)
+		vh->http.fcgi_pool_idle_secs = 5;
+#endif
+#if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
+	vh->http.compr_cache.max = info->compressed_cache_max;
+#endif
 
 	if (info->options & LWS_SERVER_OPTION_ONLY_RAW)
 		lwsl_info("%s set to only support RAW\n", vh->name);
@@ -701,6 +722,12 @@ lws_create_vhost(struct lws_context *context,
 	vh->ka_time = info->ka_time;
 	vh->ka_interval = info->ka_interval;
 	vh->ka_probes = info->ka_probes;
+	vh->listen_accept_budget = info->listen_accept_budget;
+	vh->tcp_defer_accept = info->tcp_defer_accept;
+#if defined(LWS_WITH_PEER_LIMITS)
+	lws_tokenbucket_init(&vh->tb_req, info->vh_limit_req_rate);
+	lws_tokenbucket_init(&vh->tb_bytes, info->vh_limit_byte_rate);
+#endif
 
 	if (vh->options & LWS_SERVER_OPTION_STS)
 		lwsl_notice("   STS enabled\n");
@@ -723,6 +750,7 @@ lws_create_vhost(struct lws_context *context,
 #endif
 	} else
 		vh->log_fd = (int)LWS_INVALID_FILE;
+	vh->log_format = (unsigned char)info->access_log_format;
 #endif
 	if (lws_context_init_server_ssl(info, vh)) {
 		lwsl_err("%s: lws_context_init_server_ssl failed\n", __func__);
@@ -949,6 +977,7 @@ lws_create_context(const struct lws_context_creation_info *info)
 #if LWS_MAX_SMP > 1
 	lws_mutex_refcount_init(&context->mr);
 #endif
+	lws_access_log_init(context);
 
 #if defined(LWS_WITH_ESP32)
 	context->last_free_heap = esp_get_free_heap_size();
@@ -1104,6 +1133,14 @@ lws_create_context(const struct lws_context_creation_info *info)
 		else
 			context->max_http_header_data = LWS_DEF_HEADER_LEN;
 
+	/* ah are first allocated at the small size class, if one is given */
+	context->max_http_header_data_small = context->max_http_header_data;
+	if (info->max_http_header_data_small &&
+	    (int)info->max_http_header_data_small <
+					context->max_http_header_data)
+		context->max_http_header_data_small =
+					info->max_http_header_data_small;
+
 	if (info->max_http_header_pool)
 		context->max_http_header_pool = info->max_http_header_pool;
 	else
@@ -1133,6 +1170,7 @@ lws_create_context(const struct lws_context_creation_info *info)
 
 		context->pt[n].context = context;
 		context->pt[n].tid = n;
+		context->pt[n].cpu = info->pt_cpus ? info->pt_cpus[n] : -1;
 
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 		context->pt[n].http.ah_list = NULL;
@@ -1150,18 +1188,14 @@ lws_create_context(const struct lws_context_creation_info *info)
 	}
 
 #if defined(LWS_WITH_PEER_LIMITS)
-	/* scale the peer hash table according to the max fds for the process,
-	 * so that the max list depth averages 16.  Eg, 1024 fd -> 64,
-	 * 102400 fd -> 6400
-	 */
-
-	context->pl_hash_elements =
-		(context->count_threads * context->fd_limit_per_thread) / 16;
-	context->pl_hash_table = lws_zalloc(sizeof(struct lws_peer *) *
-			context->pl_hash_elements, "peer limits hash table");
-
 	context->ip_limit_ah = info->ip_limit_ah;
 	context->ip_limit_wsi = info->ip_limit_wsi;
+	context->ip_limit_req_rate = info->ip_limit_req_rate;
+	context->ip_limit_byte_rate = info->ip_limit_byte_rate;
+#endif
+#if defined(LWS_WITH_PROFILER)
+	context->prof_stall_us = info->prof_stall_us ? info->prof_stall_us :
+						       100000;
 #endif
 
 	lwsl_info(" mem: context:         %5lu B (%ld ctx + (%ld thr x %d))\n",
@@ -1205,6 +1239,16 @@ lws_create_context(const struct lws_context_creation_info *info)
 	if (lws_plat_init(context, info))
 		goto bail;
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	if (lws_peer_limits_init(context))
+		goto bail;
+#endif
+
+#if defined(LWS_WITH_PROFILER)
+	if (lws_prof_init(context))
+		goto bail;
+#endif
+
 	if (context->event_loop_ops->init_context)
 		if (context->event_loop_ops->init_context(context, info))
 			goto bail;
@@ -1238,7 +1282,10 @@ lws_create_context(const struct lws_context_creation_info *info)
 			for (n = 0; n < context->count_threads; n++)
 				lws_free_set_NULL(context->pt[n].serv_buf);
 #if defined(LWS_WITH_PEER_LIMITS)
-			lws_free_set_NULL(context->pl_hash_table);
+			lws_peer_limits_destroy(context);
+#endif
+#if defined(LWS_WITH_PROFILER)
+			lws_prof_destroy(context);
 #endif
 			lws_free_set_NULL(context->pt[0].fds);
 			lws_plat_context_late_destroy(context);
@@ -1443,8 +1490,9 @@ __lws_vhost_destroy2(struct lws_vhost *vh)
 		n = 0;
 		while (n < vh->count_protocols) {
 			wsi.protocol = protocol;
-			protocol->callback(&wsi, LWS_CALLBACK_PROTOCOL_DESTROY,
-					   NULL, NULL, 0);
+			lws_protocol_cb(protocol->callback, &wsi,
+					LWS_CALLBACK_PROTOCOL_DESTROY,
+					NULL, NULL, 0);
 			protocol++;
 			n++;
 		}
@@ -1521,9 +1569,19 @@ __lws_vhost_destroy2(struct lws_vhost *vh)
 			ar->destroy_vhost(vh);
 	LWS_FOR_EVERY_AVAILABLE_ROLE_END;
 
-#ifdef LWS_WITH_ACCESS_LOG
-	if (vh->log_fd != (int)LWS_INVALID_FILE)
-		close(vh->log_fd);
+	lws_access_log_vhost_destroy(vh);
+
+#if defined(LWS_WITH_HTTP_PROXY)
+	lws_http_proxy_pool_destroy(vh);
+#endif
+#if defined(LWS_ROLE_FCGI)
+	lws_fcgi_pool_destroy(vh);
+#endif
+#if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
+	lws_compr_cache_destroy(vh);
+#endif
+#if defined(LWS_WITH_PROFILER)
+	lws_prof_vhost_destroy(vh);
 #endif
 
 #if defined (LWS_WITH_TLS)
@@ -1707,6 +1765,10 @@ lws_context_destroy3(struct lws_context *context)
 #endif
 	}
 
+#if defined(LWS_WITH_PROFILER)
+	lws_prof_destroy(context);
+#endif
+
 	if (context->pt[0].fds)
 		lws_free_set_NULL(context->pt[0].fds);
 
@@ -1725,9 +1787,6 @@ void
 lws_context_destroy2(struct lws_context *context)
 {
 	struct lws_vhost *vh = NULL, *vh1;
-#if defined(LWS_WITH_PEER_LIMITS)
-	uint32_t nu;
-#endif
 
 	lwsl_info("%s: ctx %p\n", __func__, context);
 
@@ -1752,6 +1811,10 @@ lws_context_destroy2(struct lws_context *context)
 		/* removes itself from list */
 		__lws_vhost_destroy2(context->vhost_pending_destruction_list);
 
+	/* the vhosts have queued the last of their access logs */
+
+	lws_access_log_destroy(context);
+
 
 	lws_stats_log_dump(context);
 
@@ -1759,16 +1822,7 @@ lws_context_destroy2(struct lws_context *context)
 	lws_plat_context_late_destroy(context);
 
 #if defined(LWS_WITH_PEER_LIMITS)
-	for (nu = 0; nu < context->pl_hash_elements; nu++)	{
-		lws_start_foreach_llp(struct lws_peer **, peer,
-				      context->pl_hash_table[nu]) {
-			struct lws_peer *df = *peer;
-			*peer = df->next;
-			lws_free(df);
-			continue;
-		} lws_end_foreach_llp(peer, next);
-	}
-	lws_free(context->pl_hash_table);
+	lws_peer_limits_destroy(context);
 #endif
 
 	if (context->external_baggage_free_on_destroy)
@@ -1846,6 +1900,11 @@ lws_context_destroy(struct lws_context *context)
 	context->being_destroyed1 = 1;
 	context->requested_kill = 1;
 
+#if defined(LWS_WITH_PROFILER)
+	/* the pts are about to be torn down under him */
+	lws_prof_watchdog_stop(context);
+#endif
+
 	memset(&wsi, 0, sizeof(wsi));
 	wsi.context = context;
 
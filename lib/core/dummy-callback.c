@@ -120,6 +120,14 @@ lws_callback_http_dummy(struct lws *wsi, enum lws_callback_reasons reason,
 #endif
 
 	case LWS_CALLBACK_HTTP_WRITEABLE:
+#if defined(LWS_ROLE_FCGI)
+		if (wsi->reason_bf & LWS_CB_REASON_AUX_BF__FCGI) {
+			wsi->reason_bf &= ~LWS_CB_REASON_AUX_BF__FCGI;
+			if (lws_fcgi_write_stdout(wsi) < 0)
+				return -1;
+			break;
+		}
+#endif
 #ifdef LWS_WITH_CGI
 		if (wsi->reason_bf & (LWS_CB_REASON_AUX_BF__CGI_HEADERS |
 				      LWS_CB_REASON_AUX_BF__CGI)) {
@@ -173,7 +181,8 @@ lws_callback_http_dummy(struct lws *wsi, enum lws_callback_reasons reason,
 				      wsi->http.pending_return_headers_len,
 				      LWS_WRITE_HTTP_HEADERS);
 
-			lws_free_set_NULL(wsi->http.pending_return_headers);
+			lws_http_txn_free_set_NULL(
+					wsi->http.pending_return_headers);
 
 			if (n < 0) {
 				lwsl_err("%s: EST_CLIENT_HTTP: write failed\n",
@@ -345,8 +354,9 @@ lws_callback_http_dummy(struct lws *wsi, enum lws_callback_reasons reason,
 		parent->http.pending_return_headers_len =
 					lws_ptr_diff(p, start);
 		parent->http.pending_return_headers =
-			lws_malloc(parent->http.pending_return_headers_len +
-				    LWS_PRE, "return proxy headers");
+			lws_http_txn_malloc(parent,
+				parent->http.pending_return_headers_len +
+				LWS_PRE, "return proxy headers");
 		if (!parent->http.pending_return_headers)
 			return -1;
 
@@ -172,8 +172,8 @@ __lws_free_wsi(struct lws *wsi)
 	    wsi->user_space && !wsi->user_space_externally_allocated)
 		lws_free(wsi->user_space);
 
-	lws_buflist_destroy_all_segments(&wsi->buflist);
-	lws_buflist_destroy_all_segments(&wsi->buflist_out);
+	lws_wsi_buflist_destroy(wsi, &wsi->buflist);
+	lws_wsi_buflist_destroy(wsi, &wsi->buflist_out);
 	lws_free_set_NULL(wsi->udp);
 
 	if (wsi->vhost && wsi->vhost->lserv_wsi == wsi)
@@ -185,6 +185,12 @@ __lws_free_wsi(struct lws *wsi)
 
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	__lws_header_table_detach(wsi, 0);
+#if defined(LWS_ROLE_FCGI)
+	lws_fcgi_txn_destroy(wsi);
+#endif
+#if defined(LWS_WITH_LWSAC)
+	lwsac_free(&wsi->http.txn_ac);
+#endif
 #endif
 	__lws_same_vh_protocol_remove(wsi);
 #if !defined(LWS_NO_CLIENT)
@@ -196,6 +202,7 @@ __lws_free_wsi(struct lws *wsi)
 		wsi->role_ops->destroy_role(wsi);
 
 #if defined(LWS_WITH_PEER_LIMITS)
+	__lws_peer_ratelimit_remove(wsi);
 	lws_peer_track_wsi_close(wsi->context, wsi->peer);
 	wsi->peer = NULL;
 #endif
@@ -405,9 +412,9 @@ lws_set_timer_usecs(struct lws *wsi, lws_usec_t usecs)
 lws_usec_t
 __lws_hrtimer_service(struct lws_context_per_thread *pt)
 {
+	lws_usec_t t, r = LWS_HRTIMER_NOWAIT;
 	struct timeval now;
 	struct lws *wsi;
-	lws_usec_t t;
 
 	gettimeofday(&now, NULL);
 	t = (now.tv_sec * 1000000ll) + now.tv_usec;
@@ -428,16 +435,22 @@ __lws_hrtimer_service(struct lws_context_per_thread *pt)
 		/* it's time for the timer to be serviced */
 
 		if (wsi->protocol &&
-		    wsi->protocol->callback(wsi, LWS_CALLBACK_TIMER,
-					    wsi->user_space, NULL, 0))
+		    lws_protocol_cb(wsi->protocol->callback, wsi,
+				    LWS_CALLBACK_TIMER, wsi->user_space,
+				    NULL, 0))
 			__lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS,
 					     "timer cb errored");
 	} lws_end_foreach_dll_safe(d, d1);
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	/* connections held for rate limiting may be due to be released */
+	r = __lws_peer_ratelimit_service(pt);
+#endif
+
 	/* return an estimate how many us until next timer hit */
 
 	if (!pt->dll_head_hrtimer.next)
-		return LWS_HRTIMER_NOWAIT;
+		return r;
 
 	wsi = lws_container_of(pt->dll_head_hrtimer.next, struct lws,
 			       dll_hrtimer);
@@ -448,7 +461,10 @@ __lws_hrtimer_service(struct lws_context_per_thread *pt)
 	if (wsi->pending_timer < t)
 		return 0;
 
-	return wsi->pending_timer - t;
+	if (wsi->pending_timer - t < r)
+		return wsi->pending_timer - t;
+
+	return r;
 }
 
 void
@@ -577,9 +593,10 @@ lws_remove_child_from_any_parent(struct lws *wsi)
 				  wsi, wsi->parent);
 
 			if (wsi->parent->protocol)
-				wsi->parent->protocol->callback(wsi,
-						LWS_CALLBACK_CHILD_CLOSING,
-					       wsi->parent->user_space, wsi, 0);
+				lws_protocol_cb(
+					wsi->parent->protocol->callback, wsi,
+					LWS_CALLBACK_CHILD_CLOSING,
+					wsi->parent->user_space, wsi, 0);
 
 			*pwsi = wsi->sibling_list;
 			seen = 1;
@@ -602,7 +619,7 @@ lws_bind_protocol(struct lws *wsi, const struct lws_protocols *p,
 	const struct lws_protocols *vp = wsi->vhost->protocols, *vpo;
 
 	if (wsi->protocol && wsi->protocol_bind_balance) {
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 		       wsi->role_ops->protocol_unbind_cb[!!lwsi_role_server(wsi)],
 					wsi->user_space, (void *)reason, 0);
 		wsi->protocol_bind_balance = 0;
@@ -640,9 +657,10 @@ lws_bind_protocol(struct lws *wsi, const struct lws_protocols *p,
 				 __func__, p, wsi->vhost->name);
 	}
 
-	if (wsi->protocol->callback(wsi, wsi->role_ops->protocol_bind_cb[
-				    !!lwsi_role_server(wsi)],
-				    wsi->user_space, NULL, 0))
+	if (lws_protocol_cb(wsi->protocol->callback, wsi,
+			    wsi->role_ops->protocol_bind_cb[
+					!!lwsi_role_server(wsi)],
+			    wsi->user_space, NULL, 0))
 		return 1;
 
 	wsi->protocol_bind_balance = 1;
@@ -691,6 +709,10 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason,
 			__lws_close_free_wsi(w, -1, "trans q leader closing");
 		} lws_end_foreach_dll_safe(d, d1);
 
+#if defined(LWS_WITH_HTTP_PROXY)
+		__lws_http_proxy_pool_remove(wsi);
+#endif
+
 		/*
 		 * !!! If we are closing, but we have pending pipelined
 		 * transaction results we already sent headers for, that's going
@@ -724,8 +746,9 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason,
 	if (wsi->role_ops == &role_ops_raw_file) {
 		lws_remove_child_from_any_parent(wsi);
 		__remove_wsi_socket_from_fds(wsi);
-		wsi->protocol->callback(wsi, wsi->role_ops->close_cb[0],
-					wsi->user_space, NULL, 0);
+		lws_protocol_cb(wsi->protocol->callback, wsi,
+				wsi->role_ops->close_cb[0],
+				wsi->user_space, NULL, 0);
 		goto async_close;
 	}
 
@@ -751,6 +774,10 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason,
 	if (wsi->http.cgi)
 		lws_cgi_remove_and_kill(wsi);
 #endif
+#if defined(LWS_ROLE_FCGI)
+	if (wsi->http.fcgi_txn)
+		__lws_fcgi_txn_close(wsi);
+#endif
 
 #if !defined(LWS_NO_CLIENT)
 	lws_client_stash_destroy(wsi);
@@ -818,7 +845,7 @@ __lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason,
 
 	if (!wsi->told_user_closed && wsi->user_space && wsi->protocol &&
 	    wsi->protocol_bind_balance) {
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 				wsi->role_ops->protocol_unbind_cb[
 				       !!lwsi_role_server(wsi)],
 				       wsi->user_space, (void *)__func__, 0);
@@ -853,7 +880,7 @@ just_kill_connection:
 	    wsi->protocol_bind_balance) {
 		lwsl_debug("%s: %p: DROP_PROTOCOL %s\n", __func__, wsi,
 		       wsi->protocol->name);
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 				wsi->role_ops->protocol_unbind_cb[
 				       !!lwsi_role_server(wsi)],
 				       wsi->user_space, (void *)__func__, 0);
@@ -862,7 +889,7 @@ just_kill_connection:
 
 	if ((lwsi_state(wsi) == LRS_WAITING_SERVER_REPLY ||
 	     lwsi_state(wsi) == LRS_WAITING_CONNECT) && !wsi->already_did_cce)
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 				        LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 						wsi->user_space, NULL, 0);
 
@@ -937,7 +964,7 @@ just_kill_connection:
 #endif
 
 	if (wsi->http.pending_return_headers)
-		lws_free_set_NULL(wsi->http.pending_return_headers);
+		lws_http_txn_free_set_NULL(wsi->http.pending_return_headers);
 
 	/*
 	 * we won't be servicing or receiving anything further from this guy
@@ -958,8 +985,11 @@ just_kill_connection:
 		__lws_same_vh_protocol_remove(wsi);
 
 	lwsi_set_state(wsi, LRS_DEAD_SOCKET);
-	lws_buflist_destroy_all_segments(&wsi->buflist);
+	lws_wsi_buflist_destroy(wsi, &wsi->buflist);
 	lws_dll_lws_remove(&wsi->dll_buflist);
+#if defined(LWS_WITH_PEER_LIMITS)
+	__lws_peer_ratelimit_remove(wsi);
+#endif
 
 	if (wsi->role_ops->close_role)
 	    wsi->role_ops->close_role(pt, wsi);
@@ -983,7 +1013,7 @@ just_kill_connection:
 			 * one too many times as the children do it and then
 			 * the closing network stream.
 			 */
-			pro->callback(wsi,
+			lws_protocol_cb(pro->callback, wsi,
 			      wsi->role_ops->close_cb[lwsi_role_server(wsi)],
 			      wsi->user_space, NULL, 0);
 		wsi->told_user_closed = 1;
@@ -1016,8 +1046,9 @@ __lws_close_free_wsi_final(struct lws *wsi)
 
 	/* outermost destroy notification for wsi (user_space still intact) */
 	if (wsi->vhost)
-		wsi->vhost->protocols[0].callback(wsi, LWS_CALLBACK_WSI_DESTROY,
-						  wsi->user_space, NULL, 0);
+		lws_protocol_cb(wsi->vhost->protocols[0].callback, wsi,
+				LWS_CALLBACK_WSI_DESTROY,
+				wsi->user_space, NULL, 0);
 
 #ifdef LWS_WITH_CGI
 	if (wsi->http.cgi) {
@@ -1168,6 +1199,51 @@ lws_buflist_use_segment(struct lws_buflist **head, size_t len)
 	return (int)((*head)->len - (*head)->pos);
 }
 
+#if defined(LWS_WITH_METRICS)
+static uint64_t *
+lws_wsi_buflist_total(struct lws *wsi, struct lws_buflist **head)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+
+	if (head == &wsi->buflist_out)
+		return &pt->buflist_tx_bytes;
+
+	return &pt->buflist_rx_bytes;
+}
+
+int
+lws_wsi_buflist_append(struct lws *wsi, struct lws_buflist **head,
+		       const uint8_t *buf, size_t len)
+{
+	int n = lws_buflist_append_segment(head, buf, len);
+
+	if (n >= 0)
+		*lws_wsi_buflist_total(wsi, head) += len;
+
+	return n;
+}
+
+int
+lws_wsi_buflist_use(struct lws *wsi, struct lws_buflist **head, size_t len)
+{
+	*lws_wsi_buflist_total(wsi, head) -= len;
+
+	return lws_buflist_use_segment(head, len);
+}
+
+void
+lws_wsi_buflist_destroy(struct lws *wsi, struct lws_buflist **head)
+{
+	uint64_t *total = lws_wsi_buflist_total(wsi, head);
+	struct lws_buflist *b;
+
+	for (b = *head; b; b = b->next)
+		*total -= b->len - b->pos;
+
+	lws_buflist_destroy_all_segments(head);
+}
+#endif
+
 void
 lws_buflist_describe(struct lws_buflist **head, void *id)
 {
@@ -1499,8 +1575,9 @@ lws_callback_all_protocol(struct lws_context *context,
 			if (!wsi)
 				continue;
 			if (wsi->protocol == protocol)
-				protocol->callback(wsi, reason, wsi->user_space,
-						   NULL, 0);
+				lws_protocol_cb(protocol->callback, wsi,
+						reason, wsi->user_space,
+						NULL, 0);
 		}
 		pt++;
 	}
@@ -1525,7 +1602,7 @@ lws_callback_all_protocol_vhost_args(struct lws_vhost *vh,
 				continue;
 			if (wsi->vhost == vh && (wsi->protocol == protocol ||
 						 !protocol))
-				wsi->protocol->callback(wsi, reason,
+				lws_protocol_cb(wsi->protocol->callback, wsi, reason,
 						wsi->user_space, argp, len);
 		}
 		pt++;
@@ -1547,7 +1624,8 @@ lws_callback_vhost_protocols(struct lws *wsi, int reason, void *in, int len)
 	int n;
 
 	for (n = 0; n < wsi->vhost->count_protocols; n++)
-		if (wsi->vhost->protocols[n].callback(wsi, reason, NULL, in, len))
+		if (lws_protocol_cb(wsi->vhost->protocols[n].callback, wsi,
+				    reason, NULL, in, len))
 			return 1;
 
 	return 0;
@@ -1565,7 +1643,8 @@ lws_callback_vhost_protocols_vhost(struct lws_vhost *vh, int reason, void *in,
 
 	for (n = 0; n < wsi->vhost->count_protocols; n++) {
 		wsi->protocol = &vh->protocols[n];
-		if (wsi->protocol->callback(wsi, reason, NULL, in, len)) {
+		if (lws_protocol_cb(wsi->protocol->callback, wsi, reason,
+				    NULL, in, len)) {
 			lws_free(wsi);
 			return 1;
 		}
@@ -1782,9 +1861,9 @@ lws_rx_flow_control(struct lws *wsi, int _enable)
 
 	/* any bit set in rxflow_bitmap DISABLEs rxflow control */
 	if (en & LWS_RXFLOW_REASON_APPLIES_ENABLE_BIT)
-		wsi->rxflow_bitmap &= ~(en & 0xff);
+		wsi->rxflow_bitmap &= ~(en & 0xfff);
 	else
-		wsi->rxflow_bitmap |= en & 0xff;
+		wsi->rxflow_bitmap |= en & 0xfff;
 
 	if ((LWS_RXFLOW_PENDING_CHANGE | (!wsi->rxflow_bitmap)) ==
 	    wsi->rxflow_change_to)
@@ -1847,7 +1926,8 @@ lws_broadcast(struct lws_context *context, int reason, void *in, size_t len)
 		for (n = 0; n < v->count_protocols; n++) {
 			wsi.protocol = p;
 			if (p->callback &&
-			    p->callback(&wsi, reason, NULL, in, len))
+			    lws_protocol_cb(p->callback, &wsi, reason, NULL,
+					    in, len))
 				ret |= 1;
 			p++;
 		}
@@ -1895,7 +1975,7 @@ int user_callback_handle_rxflow(lws_callback_function callback_function,
 	int n;
 
 	wsi->rxflow_will_be_applied = 1;
-	n = callback_function(wsi, reason, user, in, len);
+	n = lws_protocol_cb(callback_function, wsi, reason, user, in, len);
 	wsi->rxflow_will_be_applied = 0;
 	if (!n)
 		n = __lws_rx_flow_control(wsi);
@@ -3523,6 +3603,9 @@ lws_sum_stats(const struct lws_context *ctx, struct lws_conn_stats *cs)
 		cs->h2_alpn += vh->conn_stats.h2_alpn;
 		cs->h2_subs += vh->conn_stats.h2_subs;
 		cs->rejected += vh->conn_stats.rejected;
+		cs->tls_hs += vh->conn_stats.tls_hs;
+		cs->tls_hs_failed += vh->conn_stats.tls_hs_failed;
+		cs->timeouts += vh->conn_stats.timeouts;
 
 		vh = vh->vhost_next;
 	}
@@ -3552,8 +3635,51 @@ lws_cmdline_option(int argc, const char **argv, const char *val)
 
 #ifdef LWS_WITH_SERVER_STATUS
 
-LWS_EXTERN int
-lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
+/*
+ * The dumps go through the JSON writer, so names are escaped properly and if
+ * the caller's buffer is too small we can tell them, rather than hand back
+ * JSON cut off at some random point.  The helpers return nonzero when the
+ * writer is out of room.
+ */
+
+static int
+lws_json_dump_strf(struct lws_json_out *j, const char *key,
+		   const char *format, ...)
+{
+	char s[384];
+	va_list ap;
+	int n;
+
+	va_start(ap, format);
+	n = vsnprintf(s, sizeof(s), format, ap);
+	va_end(ap);
+
+	if (n < 0 || n >= (int)sizeof(s)) {
+		lwsl_err("%s: %s too long\n", __func__, key);
+		return 1;
+	}
+
+	return lws_json_out_strn(j, key, s, (size_t)n);
+}
+
+static int
+lws_json_dump_conn_stats(struct lws_json_out *j,
+			 const struct lws_conn_stats *cs)
+{
+	return lws_json_out_quint(j, "rx", cs->rx) ||
+	       lws_json_out_quint(j, "tx", cs->tx) ||
+	       lws_json_out_quint(j, "h1_conn", cs->h1_conn) ||
+	       lws_json_out_quint(j, "h1_trans", cs->h1_trans) ||
+	       lws_json_out_quint(j, "h2_trans", cs->h2_trans) ||
+	       lws_json_out_quint(j, "ws_upg", cs->ws_upg) ||
+	       lws_json_out_quint(j, "rejected", cs->rejected) ||
+	       lws_json_out_quint(j, "h2_upg", cs->h2_upg) ||
+	       lws_json_out_quint(j, "h2_alpn", cs->h2_alpn) ||
+	       lws_json_out_quint(j, "h2_subs", cs->h2_subs);
+}
+
+static int
+lws_json_dump_vh(struct lws_json_out *j, const struct lws_vhost *vh)
 {
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	static const char * const prots[] = {
@@ -3563,116 +3689,163 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 		"cgi://",
 		">http://",
 		">https://",
-		"callback://"
+		"callback://",
+		"fcgi://"
 	};
 #endif
-	char *orig = buf, *end = buf + len - 1, first = 1;
-	int n = 0;
-
-	if (len < 100)
-		return 0;
+	int n;
 
-	buf += lws_snprintf(buf, end - buf,
-			"{\n \"name\":\"%s\",\n"
-			" \"port\":\"%d\",\n"
-			" \"use_ssl\":\"%d\",\n"
-			" \"sts\":\"%d\",\n"
-			" \"rx\":\"%llu\",\n"
-			" \"tx\":\"%llu\",\n"
-			" \"h1_conn\":\"%lu\",\n"
-			" \"h1_trans\":\"%lu\",\n"
-			" \"h2_trans\":\"%lu\",\n"
-			" \"ws_upg\":\"%lu\",\n"
-			" \"rejected\":\"%lu\",\n"
-			" \"h2_upg\":\"%lu\",\n"
-			" \"h2_alpn\":\"%lu\",\n"
-			" \"h2_subs\":\"%lu\""
-			,
-			vh->name, vh->listen_port,
+	if (lws_json_out_obj(j, NULL) ||
+	    lws_json_out_str(j, "name", vh->name) ||
+	    lws_json_out_qint(j, "port", vh->listen_port) ||
 #if defined(LWS_WITH_TLS)
-			vh->tls.use_ssl & LCCSCF_USE_SSL,
+	    lws_json_out_qint(j, "use_ssl", vh->tls.use_ssl & LCCSCF_USE_SSL) ||
 #else
-			0,
-#endif
-			!!(vh->options & LWS_SERVER_OPTION_STS),
-			vh->conn_stats.rx, vh->conn_stats.tx,
-			vh->conn_stats.h1_conn,
-			vh->conn_stats.h1_trans,
-			vh->conn_stats.h2_trans,
-			vh->conn_stats.ws_upg,
-			vh->conn_stats.rejected,
-			vh->conn_stats.h2_upg,
-			vh->conn_stats.h2_alpn,
-			vh->conn_stats.h2_subs
-	);
+	    lws_json_out_qint(j, "use_ssl", 0) ||
+#endif
+	    lws_json_out_qint(j, "sts",
+			      !!(vh->options & LWS_SERVER_OPTION_STS)) ||
+	    lws_json_dump_conn_stats(j, &vh->conn_stats))
+		return 1;
+
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	if (vh->http.mount_list) {
 		const struct lws_http_mount *m = vh->http.mount_list;
 
-		buf += lws_snprintf(buf, end - buf, ",\n \"mounts\":[");
+		if (lws_json_out_arr(j, "mounts"))
+			return 1;
 		while (m) {
-			if (!first)
-				buf += lws_snprintf(buf, end - buf, ",");
-			buf += lws_snprintf(buf, end - buf,
-					"\n  {\n   \"mountpoint\":\"%s\",\n"
-					"  \"origin\":\"%s%s\",\n"
-					"  \"cache_max_age\":\"%d\",\n"
-					"  \"cache_reuse\":\"%d\",\n"
-					"  \"cache_revalidate\":\"%d\",\n"
-					"  \"cache_intermediaries\":\"%d\"\n"
-					,
-					m->mountpoint,
-					prots[m->origin_protocol],
-					m->origin,
-					m->cache_max_age,
-					m->cache_reusable,
-					m->cache_revalidate,
-					m->cache_intermediaries);
-			if (m->def)
-				buf += lws_snprintf(buf, end - buf,
-						",\n  \"default\":\"%s\"",
-						m->def);
-			buf += lws_snprintf(buf, end - buf, "\n  }");
-			first = 0;
+			if (lws_json_out_obj(j, NULL) ||
+			    lws_json_out_str(j, "mountpoint", m->mountpoint) ||
+			    lws_json_dump_strf(j, "origin", "%s%s",
+					       prots[m->origin_protocol],
+					       m->origin) ||
+			    lws_json_out_qint(j, "cache_max_age",
+					      m->cache_max_age) ||
+			    lws_json_out_qint(j, "cache_reuse",
+					      m->cache_reusable) ||
+			    lws_json_out_qint(j, "cache_revalidate",
+					      m->cache_revalidate) ||
+			    lws_json_out_qint(j, "cache_intermediaries",
+					      m->cache_intermediaries) ||
+			    (m->def && lws_json_out_str(j, "default", m->def)) ||
+			    lws_json_out_end(j))
+				return 1;
 			m = m->mount_next;
 		}
-		buf += lws_snprintf(buf, end - buf, "\n ]");
+		if (lws_json_out_end(j))
+			return 1;
 	}
 #endif
-	if (vh->protocols) {
-		n = 0;
-		first = 1;
-
-		buf += lws_snprintf(buf, end - buf, ",\n \"ws-protocols\":[");
-		while (n < vh->count_protocols) {
-			if (!first)
-				buf += lws_snprintf(buf, end - buf, ",");
-			buf += lws_snprintf(buf, end - buf,
-					"\n  {\n   \"%s\":{\n"
-					"    \"status\":\"ok\"\n   }\n  }"
-					,
-					vh->protocols[n].name);
-			first = 0;
-			n++;
+#if defined(LWS_WITH_HTTP_PROXY)
+	if (vh->http.proxy_upstream_list) {
+		const struct lws_proxy_upstream *up;
+		unsigned long tot;
+
+		lws_vhost_lock((struct lws_vhost *)vh);
+		if (lws_json_out_arr(j, "proxy_upstreams"))
+			goto bail_vh;
+		for (up = vh->http.proxy_upstream_list; up; up = up->next) {
+			tot = up->hits + up->misses;
+			if (lws_json_out_obj(j, NULL) ||
+			    lws_json_dump_strf(j, "upstream", "%s:%u",
+					       (const char *)(up + 1),
+					       up->port) ||
+			    lws_json_out_qint(j, "tls", up->tls) ||
+			    lws_json_out_quint(j, "conns", up->conns) ||
+			    lws_json_out_quint(j, "idle", up->idle) ||
+			    lws_json_out_quint(j, "hits", up->hits) ||
+			    lws_json_out_quint(j, "misses", up->misses) ||
+			    lws_json_out_quint(j, "refused", up->refused) ||
+			    lws_json_out_quint(j, "hit_pct",
+					tot ? (up->hits * 100) / tot : 0) ||
+			    lws_json_out_end(j))
+				goto bail_vh;
 		}
-		buf += lws_snprintf(buf, end - buf, "\n ]");
+		if (lws_json_out_end(j))
+			goto bail_vh;
+		lws_vhost_unlock((struct lws_vhost *)vh);
+	}
+#endif
+#if defined(LWS_ROLE_FCGI)
+	if (vh->http.fcgi_upstream_list) {
+		const struct lws_fcgi_upstream *up;
+		unsigned long tot;
+
+		lws_vhost_lock((struct lws_vhost *)vh);
+		if (lws_json_out_arr(j, "fcgi_upstreams"))
+			goto bail_vh;
+		for (up = vh->http.fcgi_upstream_list; up; up = up->next) {
+			tot = up->hits + up->misses;
+			if (lws_json_out_obj(j, NULL) ||
+			    lws_json_out_str(j, "upstream",
+					     (const char *)(up + 1)) ||
+			    lws_json_out_quint(j, "conns", up->conns) ||
+			    lws_json_out_quint(j, "idle", up->idle) ||
+			    lws_json_out_quint(j, "hits", up->hits) ||
+			    lws_json_out_quint(j, "misses", up->misses) ||
+			    lws_json_out_quint(j, "hit_pct",
+					tot ? (up->hits * 100) / tot : 0) ||
+			    lws_json_out_end(j))
+				goto bail_vh;
+		}
+		if (lws_json_out_end(j))
+			goto bail_vh;
+		lws_vhost_unlock((struct lws_vhost *)vh);
+	}
+#endif
+#if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
+	if (vh->http.compr_cache.max) {
+		const struct lws_compr_cache *cc = &vh->http.compr_cache;
+
+		lws_vhost_lock((struct lws_vhost *)vh);
+		if (lws_json_out_obj(j, "compressed_cache") ||
+		    lws_json_out_quint(j, "max", cc->max) ||
+		    lws_json_out_quint(j, "size", cc->size) ||
+		    lws_json_out_quint(j, "hits", cc->hits) ||
+		    lws_json_out_quint(j, "misses", cc->misses) ||
+		    lws_json_out_end(j))
+			goto bail_vh;
+		lws_vhost_unlock((struct lws_vhost *)vh);
+	}
+#endif
+#if defined(LWS_WITH_PROFILER)
+	if (lws_prof_json_dump(vh->context, vh, j))
+		return 1;
+#endif
+	if (vh->protocols) {
+		if (lws_json_out_arr(j, "ws-protocols"))
+			return 1;
+		for (n = 0; n < vh->count_protocols; n++)
+			if (lws_json_out_obj(j, NULL) ||
+			    lws_json_out_obj(j, vh->protocols[n].name) ||
+			    lws_json_out_str(j, "status", "ok") ||
+			    lws_json_out_end(j) ||
+			    lws_json_out_end(j))
+				return 1;
+		if (lws_json_out_end(j))
+			return 1;
 	}
 
-	buf += lws_snprintf(buf, end - buf, "\n}");
+	return !!lws_json_out_end(j);
 
-	return buf - orig;
-}
+#if defined(LWS_WITH_HTTP_PROXY) || defined(LWS_ROLE_FCGI) || \
+    defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
+bail_vh:
+	lws_vhost_unlock((struct lws_vhost *)vh);
 
+	return 1;
+#endif
+}
 
-LWS_EXTERN LWS_VISIBLE int
-lws_json_dump_context(const struct lws_context *context, char *buf, int len,
-		int hide_vhosts)
+static int
+lws_json_dump_ctx(struct lws_json_out *j, const struct lws_context *context,
+		  int hide_vhosts)
 {
-	char *orig = buf, *end = buf + len - 1, first = 1;
 	const struct lws_vhost *vh = context->vhost_list;
 	const struct lws_context_per_thread *pt;
-	time_t t = time(NULL);
 	int n, listening = 0, cgi_count = 0;
+	time_t t = time(NULL);
 	struct lws_conn_stats cs;
 	double d = 0;
 #ifdef LWS_WITH_CGI
@@ -3683,102 +3856,84 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 	uv_uptime(&d);
 #endif
 
-	buf += lws_snprintf(buf, end - buf, "{ "
-			    "\"version\":\"%s\",\n"
-			    "\"uptime\":\"%ld\",\n",
-			    lws_get_library_version(),
-			    (long)d);
+	if (lws_json_out_obj(j, NULL) ||
+	    lws_json_out_str(j, "version", lws_get_library_version()) ||
+	    lws_json_out_qint(j, "uptime", (long)d))
+		return 1;
 
 #ifdef LWS_HAVE_GETLOADAVG
 	{
+		char key[4];
 		double d[3];
 		int m;
 
 		m = getloadavg(d, 3);
 		for (n = 0; n < m; n++) {
-			buf += lws_snprintf(buf, end - buf,
-				"\"l%d\":\"%.2f\",\n",
-				n + 1, d[n]);
+			lws_snprintf(key, sizeof(key), "l%d", n + 1);
+			if (lws_json_dump_strf(j, key, "%.2f", d[n]))
+				return 1;
 		}
 	}
 #endif
 
-	buf += lws_snprintf(buf, end - buf, "\"contexts\":[\n");
-
-	buf += lws_snprintf(buf, end - buf, "{ "
-				"\"context_uptime\":\"%ld\",\n"
-				"\"cgi_spawned\":\"%d\",\n"
-				"\"pt_fd_max\":\"%d\",\n"
-				"\"ah_pool_max\":\"%d\",\n"
-				"\"deprecated\":\"%d\",\n"
-				"\"wsi_alive\":\"%d\",\n",
-				(unsigned long)(t - context->time_up),
-				context->count_cgi_spawned,
-				context->fd_limit_per_thread,
-				context->max_http_header_pool,
-				context->deprecated,
-				context->count_wsi_allocated);
+	if (lws_json_out_arr(j, "contexts") ||
+	    lws_json_out_obj(j, NULL) ||
+	    lws_json_out_quint(j, "context_uptime",
+			       (unsigned long)(t - context->time_up)) ||
+	    lws_json_out_qint(j, "cgi_spawned", context->count_cgi_spawned) ||
+	    lws_json_out_qint(j, "pt_fd_max", context->fd_limit_per_thread) ||
+	    lws_json_out_qint(j, "ah_pool_max",
+			      context->max_http_header_pool) ||
+	    lws_json_out_qint(j, "deprecated", context->deprecated) ||
+	    lws_json_out_qint(j, "wsi_alive", context->count_wsi_allocated) ||
+	    lws_json_out_arr(j, "pt"))
+		return 1;
 
-	buf += lws_snprintf(buf, end - buf, "\"pt\":[\n ");
 	for (n = 0; n < context->count_threads; n++) {
 		pt = &context->pt[n];
-		if (n)
-			buf += lws_snprintf(buf, end - buf, ",");
-		buf += lws_snprintf(buf, end - buf,
-				"\n  {\n"
-				"    \"fds_count\":\"%d\",\n"
-				"    \"ah_pool_inuse\":\"%d\",\n"
-				"    \"ah_wait_list\":\"%d\"\n"
-				"    }",
-				pt->fds_count,
-				pt->http.ah_count_in_use,
-				pt->http.ah_wait_list_length);
+		if (lws_json_out_obj(j, NULL) ||
+		    lws_json_out_qint(j, "fds_count", pt->fds_count) ||
+		    lws_json_out_qint(j, "ah_pool_inuse",
+				      pt->http.ah_count_in_use) ||
+		    lws_json_out_qint(j, "ah_large",
+				      pt->http.ah_count_large) ||
+		    lws_json_out_qint(j, "ah_wait_list",
+				      pt->http.ah_wait_list_length) ||
+		    lws_json_out_quint(j, "ah_waits",
+				       pt->http.ah_count_waits) ||
+		    lws_json_out_quint(j, "ah_promotions",
+				       pt->http.ah_count_promotions) ||
+#if defined(LWS_WITH_PROFILER)
+		    lws_prof_json_dump_pt(pt, j) ||
+#endif
+		    lws_json_out_end(j))
+			return 1;
 	}
 
-	buf += lws_snprintf(buf, end - buf, "]");
-
-	buf += lws_snprintf(buf, end - buf, ", \"vhosts\":[\n ");
+	if (lws_json_out_end(j) ||
+	    lws_json_out_arr(j, "vhosts"))
+		return 1;
 
-	first = 1;
-	vh = context->vhost_list;
-	listening = 0;
 	cs = context->conn_stats;
 	lws_sum_stats(context, &cs);
 	while (vh) {
-
-		if (!hide_vhosts) {
-			if (!first)
-				if(buf != end)
-					*buf++ = ',';
-			buf += lws_json_dump_vhost(vh, buf, end - buf);
-			first = 0;
-		}
+		if (!hide_vhosts && lws_json_dump_vh(j, vh))
+			return 1;
 		if (vh->lserv_wsi)
 			listening++;
 		vh = vh->vhost_next;
 	}
 
-	buf += lws_snprintf(buf, end - buf,
-			"],\n\"listen_wsi\":\"%d\",\n"
-			" \"rx\":\"%llu\",\n"
-			" \"tx\":\"%llu\",\n"
-			" \"h1_conn\":\"%lu\",\n"
-			" \"h1_trans\":\"%lu\",\n"
-			" \"h2_trans\":\"%lu\",\n"
-			" \"ws_upg\":\"%lu\",\n"
-			" \"rejected\":\"%lu\",\n"
-			" \"h2_alpn\":\"%lu\",\n"
-			" \"h2_subs\":\"%lu\",\n"
-			" \"h2_upg\":\"%lu\"",
-			listening, cs.rx, cs.tx,
-			cs.h1_conn,
-			cs.h1_trans,
-			cs.h2_trans,
-			cs.ws_upg,
-			cs.rejected,
-			cs.h2_alpn,
-			cs.h2_subs,
-			cs.h2_upg);
+	if (lws_json_out_end(j) ||
+	    lws_json_out_qint(j, "listen_wsi", listening) ||
+	    lws_json_dump_conn_stats(j, &cs))
+		return 1;
+
+#if defined(LWS_WITH_PROFILER)
+	/* callbacks and role handlers not bound to any vhost */
+	if (lws_prof_json_dump(context, NULL, j))
+		return 1;
+#endif
 
 #ifdef LWS_WITH_CGI
 	for (n = 0; n < context->count_threads; n++) {
@@ -3792,15 +3947,54 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 		}
 	}
 #endif
-	buf += lws_snprintf(buf, end - buf, ",\n \"cgi_alive\":\"%d\"\n ",
-			cgi_count);
 
-	buf += lws_snprintf(buf, end - buf, "}");
+	return lws_json_out_qint(j, "cgi_alive", cgi_count) ||
+	       lws_json_out_end(j) || /* the context */
+	       lws_json_out_end(j) || /* "contexts" */
+	       lws_json_out_end(j);
+}
+
+LWS_EXTERN int
+lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
+{
+	struct lws_json_out j;
 
+	if (len < 1)
+		return -1;
 
-	buf += lws_snprintf(buf, end - buf, "]}\n ");
+	/* leave room for the terminating NUL */
+	lws_json_out_init(&j, buf, (size_t)len - 1);
+	if (lws_json_dump_vh(&j, vh)) {
+		lwsl_info("%s: %d too small for vhost %s\n", __func__, len,
+			  vh->name);
+		*buf = '\0';
 
-	return buf - orig;
+		return -1;
+	}
+	*j.p = '\0';
+
+	return lws_ptr_diff(j.p, buf);
+}
+
+LWS_EXTERN LWS_VISIBLE int
+lws_json_dump_context(const struct lws_context *context, char *buf, int len,
+		int hide_vhosts)
+{
+	struct lws_json_out j;
+
+	if (len < 1)
+		return -1;
+
+	lws_json_out_init(&j, buf, (size_t)len - 1);
+	if (lws_json_dump_ctx(&j, context, hide_vhosts)) {
+		lwsl_info("%s: %d too small\n", __func__, len);
+		*buf = '\0';
+
+		return -1;
+	}
+	*j.p = '\0';
+
+	return lws_ptr_diff(j.p, buf);
 }
 
 #endif
@@ -3810,10 +4004,82 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len,
 LWS_VISIBLE LWS_EXTERN uint64_t
 lws_stats_get(struct lws_context *context, int index)
 {
-	if (index >= LWSSTATS_SIZE)
+	uint64_t v = 0, u;
+	int n;
+
+	if (index < 0 || index >= LWSSTATS_SIZE)
+		return 0;
+
+	for (n = 0; n < context->count_threads; n++) {
+		u = context->pt[n].stats.s[index];
+		if (index != LWSSTATS_MS_WORST_WRITABLE_DELAY)
+			v += u;
+		else
+			if (u > v)
+				v = u;
+	}
+
+	return v;
+}
+
+/* the histogram of one latency stat summed over all the pts */
+
+uint64_t
+lws_stats_hist_sum(struct lws_context *context, int index, uint64_t *hist)
+{
+	uint64_t count = 0;
+	int n, b;
+
+	memset(hist, 0, sizeof(*hist) * LWS_HIST_BUCKETS);
+
+	for (n = 0; n < context->count_threads; n++)
+		for (b = 0; b < LWS_HIST_BUCKETS; b++) {
+			hist[b] += context->pt[n].stats.hist[index][b];
+			count += context->pt[n].stats.hist[index][b];
+		}
+
+	return count;
+}
+
+uint64_t
+lws_stats_hist_percentile(const uint64_t *hist, uint64_t count, int per_mille)
+{
+	uint64_t want = (count * (unsigned int)per_mille + 999) / 1000,
+		 seen = 0;
+	int b;
+
+	if (!count)
 		return 0;
 
-	return context->lws_stats[index];
+	for (b = 0; b < LWS_HIST_BUCKETS - 1; b++) {
+		seen += hist[b];
+		if (seen >= want)
+			break;
+	}
+
+	/* report the top of the bucket the percentile fell in */
+
+	return lws_hist_bucket_floor(b + 1) - 1;
+}
+
+LWS_VISIBLE LWS_EXTERN uint64_t
+lws_stats_hist_get(struct lws_context *context, int index, int per_mille)
+{
+	uint64_t hist[LWS_HIST_BUCKETS], count, v;
+
+	if (index < 0 || index >= LWSSTATS_H_SIZE)
+		return 0;
+
+	count = lws_stats_hist_sum(context, index, hist);
+	v = lws_stats_hist_percentile(hist, count, per_mille);
+
+	/* we know the real worst writable delay, don't report more */
+
+	if (index == LWSSTATS_H_WRITABLE_DELAY &&
+	    v > lws_stats_get(context, LWSSTATS_MS_WORST_WRITABLE_DELAY))
+		v = lws_stats_get(context, LWSSTATS_MS_WORST_WRITABLE_DELAY);
+
+	return v;
 }
 
 LWS_VISIBLE LWS_EXTERN void
@@ -3825,6 +4091,12 @@ lws_stats_log_dump(struct lws_context *context)
 	int m;
 #endif
 
+	for (n = 0; n < context->count_threads; n++)
+		if (context->pt[n].stats.updated) {
+			context->pt[n].stats.updated = 0;
+			context->updated = 1;
+		}
+
 	if (!context->updated)
 		return;
 
@@ -3877,6 +4149,21 @@ lws_stats_log_dump(struct lws_context *context)
 	lwsl_notice("LWSSTATS_C_PEER_LIMIT_WSI_DENIED:           %8llu\n",
 		(unsigned long long)lws_stats_get(context,
 					LWSSTATS_C_PEER_LIMIT_WSI_DENIED));
+	lwsl_notice("LWSSTATS_C_HTTP_TXN_ALLOCS:                 %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_HTTP_TXN_ALLOCS));
+	lwsl_notice("LWSSTATS_C_HTTP_TXN_HEAP_ALLOCS:            %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_HTTP_TXN_HEAP_ALLOCS));
+	lwsl_notice("LWSSTATS_C_AH_POOL_WAITS:                   %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_AH_POOL_WAITS));
+	lwsl_notice("LWSSTATS_C_AH_PROMOTIONS:                   %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_AH_PROMOTIONS));
+	lwsl_notice("LWSSTATS_C_ACCESS_LOG_DROPPED:              %8llu\n",
+		(unsigned long long)lws_stats_get(context,
+					LWSSTATS_C_ACCESS_LOG_DROPPED));
 
 	lwsl_notice("LWSSTATS_C_TIMEOUTS:                        %8llu\n",
 		(unsigned long long)lws_stats_get(context,
@@ -3921,6 +4208,19 @@ lws_stats_log_dump(struct lws_context *context)
 			(unsigned long long)(lws_stats_get(context,
 					LWSSTATS_MS_WRITABLE_DELAY) /
 			lws_stats_get(context, LWSSTATS_C_WRITEABLE_CB)));
+	for (n = 0; n < LWSSTATS_H_SIZE; n++) {
+		static const char * const hn[] = {
+			"Writable delay", "SSL accept delay", "SSL RX delay"
+		};
+
+		lwsl_notice("  %-18s p50 / p99 / p999:    %llu / %llu / %lluus\n",
+			    hn[n], (unsigned long long)
+				lws_stats_hist_get(context, n, 500),
+			    (unsigned long long)
+				lws_stats_hist_get(context, n, 990),
+			    (unsigned long long)
+				lws_stats_hist_get(context, n, 999));
+	}
 	lwsl_notice("Simultaneous SSL restriction:               %8d/%d\n",
 			context->simultaneous_ssl,
 			context->simultaneous_ssl_restriction);
@@ -3960,6 +4260,10 @@ lws_stats_log_dump(struct lws_context *context)
 		lwsl_notice("  AH in use / max:                  %d / %d\n",
 				pt->http.ah_count_in_use,
 				context->max_http_header_pool);
+		lwsl_notice("  AH large / promotions / waits:    %d / %u / %u\n",
+				pt->http.ah_count_large,
+				pt->http.ah_count_promotions,
+				pt->http.ah_count_waits);
 
 		wl = pt->http.ah_wait_list;
 		while (wl) {
@@ -3975,12 +4279,8 @@ lws_stats_log_dump(struct lws_context *context)
 
 #if defined(LWS_WITH_PEER_LIMITS)
 	m = 0;
-	for (n = 0; n < (int)context->pl_hash_elements; n++) {
-		lws_start_foreach_llp(struct lws_peer **, peer,
-				      context->pl_hash_table[n]) {
-			m++;
-		} lws_end_foreach_llp(peer, next);
-	}
+	for (n = 0; n < LWS_PEER_SHARDS; n++)
+		m += context->pl_shard[n].count;
 
 	lwsl_notice(" Peers: total active %d\n", m);
 	if (m > 10) {
@@ -3988,12 +4288,15 @@ lws_stats_log_dump(struct lws_context *context)
 		lwsl_notice("  (showing 10 peers only)\n");
 	}
 
-	if (m) {
-		for (n = 0; n < (int)context->pl_hash_elements; n++) {
+	for (n = 0; m && n < LWS_PEER_SHARDS; n++) {
+		struct lws_peer_shard *s = &context->pl_shard[n];
+		uint32_t nu;
+
+		for (nu = 0; m && nu < s->elements; nu++) {
 			char buf[72];
 
 			lws_start_foreach_llp(struct lws_peer **, peer,
-					      context->pl_hash_table[n]) {
+					      s->table[nu]) {
 				struct lws_peer *df = *peer;
 
 				if (!lws_plat_inet_ntop(df->af, df->addr, buf,
@@ -4018,28 +4321,5 @@ lws_stats_log_dump(struct lws_context *context)
 	lwsl_notice("\n");
 }
 
-void
-lws_stats_atomic_bump(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t bump)
-{
-	lws_pt_stats_lock(pt);
-	context->lws_stats[index] += bump;
-	if (index != LWSSTATS_C_SERVICE_ENTRY)
-		context->updated = 1;
-	lws_pt_stats_unlock(pt);
-}
-
-void
-lws_stats_atomic_max(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t val)
-{
-	lws_pt_stats_lock(pt);
-	if (val > context->lws_stats[index]) {
-		context->lws_stats[index] = val;
-		context->updated = 1;
-	}
-	lws_pt_stats_unlock(pt);
-}
-
 #endif
 
@@ -70,7 +70,7 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 		 * the buflist...
 		 */
 
-		if (lws_buflist_append_segment(&wsi->buflist_out, buf, len))
+		if (lws_wsi_buflist_append(wsi, &wsi->buflist_out, buf, len))
 			return -1;
 
 		buf = NULL;
@@ -129,6 +129,11 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 		break;
 	}
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	if (m)
+		lws_peer_ratelimit_charge(wsi, 0, m);
+#endif
+
 	/*
 	 * we were sending this from buflist_out?  Then not sending everything
 	 * is a small matter of advancing ourselves only by the amount we did
@@ -138,7 +143,7 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 		if (m) {
 			lwsl_info("%p partial adv %d (vs %ld)\n", wsi, m,
 					(long)real_len);
-			lws_buflist_use_segment(&wsi->buflist_out, m);
+			lws_wsi_buflist_use(wsi, &wsi->buflist_out, m);
 		}
 
 		if (!lws_has_buffered_out(wsi)) {
@@ -193,7 +198,7 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 	lwsl_debug("%p new partial sent %d from %lu total\n", wsi, m,
 		    (unsigned long)real_len);
 
-	lws_buflist_append_segment(&wsi->buflist_out, buf + m, real_len - m);
+	lws_wsi_buflist_append(wsi, &wsi->buflist_out, buf + m, real_len - m);
 
 	lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_C_WRITE_PARTIALS, 1);
 	lws_stats_atomic_bump(wsi->context, pt,
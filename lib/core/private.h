@@ -53,7 +53,8 @@
  #include <sys/stat.h>
 #endif
 
-#if LWS_MAX_SMP > 1
+#if LWS_MAX_SMP > 1 || defined(LWS_WITH_ACCESS_LOG_THREAD) || \
+    defined(LWS_WITH_PROFILER_WATCHDOG)
  #include <pthread.h>
 #endif
 
@@ -349,6 +350,73 @@ lws_mutex_refcount_unlock(struct lws_mutex_refcount *mr);
 
 #define LWS_HRTIMER_NOWAIT (0x7fffffffffffffffll)
 
+#if defined(LWS_WITH_STATS) || defined(LWS_WITH_PROFILER)
+/*
+ * log-linear histogram buckets, four per power of two, so a percentile read
+ * from them is within 25% of the real one, from 1us up to several minutes
+ */
+#define LWS_HIST_BUCKETS 112
+
+static LWS_INLINE int
+lws_hist_bucket(uint64_t us)
+{
+	int msb = 0, b;
+
+	if (us < 4)
+		return (int)us;
+	if (us >> 32)
+		return LWS_HIST_BUCKETS - 1;
+
+#if defined(__GNUC__)
+	msb = 31 - __builtin_clz((uint32_t)us);
+#else
+	while (us >> (msb + 1))
+		msb++;
+#endif
+	b = ((msb - 1) * 4) + (int)((us >> (msb - 2)) & 3);
+	if (b >= LWS_HIST_BUCKETS)
+		b = LWS_HIST_BUCKETS - 1;
+
+	return b;
+}
+
+/* the smallest us that lands in bucket b */
+
+static LWS_INLINE uint64_t
+lws_hist_bucket_floor(int b)
+{
+	if (b < 4)
+		return (uint64_t)b;
+
+	return (uint64_t)(4 + (b & 3)) << ((b / 4) - 1);
+}
+#endif
+
+#if defined(LWS_WITH_METRICS)
+/* time the service thread spent busy between waits for events */
+struct lws_pt_loop_metrics {
+	lws_usec_t woke;
+	uint64_t iterations;
+	uint64_t busy_us;
+	uint64_t busy_max_us;
+};
+#endif
+
+#if defined(LWS_WITH_STATS)
+/*
+ * Each pt updates only its own stats, so no lock is needed.  They are padded
+ * so the counters bumped by one service thread don't share a cache line with
+ * anything another service thread writes.
+ */
+struct lws_pt_stats {
+	char pad_head[64];
+	uint64_t s[LWSSTATS_SIZE];
+	uint64_t hist[LWSSTATS_H_SIZE][LWS_HIST_BUCKETS];
+	char updated;
+	char pad_tail[64];
+};
+#endif
+
 /*
  * so we can have n connections being serviced simultaneously,
  * these things need to be isolated per-thread.
@@ -356,7 +424,6 @@ lws_mutex_refcount_unlock(struct lws_mutex_refcount *mr);
 
 struct lws_context_per_thread {
 #if LWS_MAX_SMP > 1
-	pthread_mutex_t lock_stats;
 	struct lws_mutex_refcount mr;
 	pthread_t self;
 #endif
@@ -373,6 +440,21 @@ struct lws_context_per_thread {
 	struct lws_dll_lws dll_head_timeout;
 	struct lws_dll_lws dll_head_hrtimer;
 	struct lws_dll_lws dll_head_buflist; /* guys with pending rxflow */
+#if defined(LWS_WITH_PEER_LIMITS)
+	struct lws_dll_lws dll_head_ratelimited; /* guys over a rate limit */
+#endif
+#if defined(LWS_WITH_PROFILER)
+	struct lws_prof *prof; /* callback and role handler timings */
+#endif
+#if defined(LWS_WITH_STATS)
+	struct lws_pt_stats stats;
+#endif
+#if defined(LWS_WITH_METRICS)
+	struct lws_pt_loop_metrics loop;
+	uint64_t buflist_rx_bytes; /* held in our wsi rx buflists */
+	uint64_t buflist_tx_bytes; /* ... and in their tx buflists */
+	int h2_streams;		/* open h2 streams on our connections */
+#endif
 
 #if defined(LWS_WITH_TLS)
 	struct lws_pt_tls tls;
@@ -433,6 +515,7 @@ struct lws_context_per_thread {
 	volatile unsigned char foreign_spinlock;
 
 	unsigned char tid;
+	int cpu; /* -1, or the cpu the service thread is pinned to */
 
 	unsigned char inside_service:1;
 	unsigned char event_loop_foreign:1;
@@ -442,12 +525,19 @@ struct lws_context_per_thread {
 struct lws_conn_stats {
 	unsigned long long rx, tx;
 	unsigned long h1_conn, h1_trans, h2_trans, ws_upg, h2_alpn, h2_subs,
-		      h2_upg, rejected;
+		      h2_upg, rejected, tls_hs, tls_hs_failed, timeouts;
 };
 
 void
 lws_sum_stats(const struct lws_context *ctx, struct lws_conn_stats *cs);
 
+/* the status dumps give their numbers as strings, as they always have */
+
+int
+lws_json_out_qint(struct lws_json_out *j, const char *key, int64_t v);
+int
+lws_json_out_quint(struct lws_json_out *j, const char *key, uint64_t v);
+
 struct lws_timed_vh_protocol {
 	struct lws_timed_vh_protocol *next;
 	const struct lws_protocols *protocol;
@@ -475,6 +565,20 @@ struct lws_timed_vh_protocol {
  *    SSL SNI -> wsi -> bind after SSL negotiation
  */
 
+#if defined(LWS_WITH_PEER_LIMITS)
+/*
+ * Token bucket for rate limiting.  Credit is kept in token-microseconds so
+ * refilling at rate tokens/s is just elapsed us * rate.  It holds at most one
+ * second's worth, and consumption may take it negative, which is a debt that
+ * has to be paid back by refilling before the limited connections continue.
+ */
+
+struct lws_tokenbucket {
+	int64_t credit;		/* tokens * 1000000 */
+	lws_usec_t last;	/* us time of last refill */
+	uint32_t rate;		/* tokens / s, 0 = unlimited */
+};
+#endif
 
 struct lws_vhost {
 #if !defined(LWS_WITHOUT_CLIENT)
@@ -504,6 +608,10 @@ struct lws_vhost {
 	struct lws_io_watcher w_accept;
 #endif
 	struct lws_conn_stats conn_stats;
+#if defined(LWS_WITH_PEER_LIMITS)
+	struct lws_tokenbucket tb_req;
+	struct lws_tokenbucket tb_bytes;
+#endif
 	struct lws_context *context;
 	struct lws_vhost *vhost_next;
 
@@ -548,11 +656,15 @@ struct lws_vhost {
 	int ka_interval;
 	int keepalive_timeout;
 	int timeout_secs_ah_idle;
+	unsigned int listen_accept_budget;
+	unsigned int tcp_defer_accept;
 
 	int count_bound_wsi;
 
 #ifdef LWS_WITH_ACCESS_LOG
+	struct lws_access_log_buf *log_buf[LWS_MAX_SMP]; /* per pt */
 	int log_fd;
+	unsigned char log_format;
 #endif
 
 	unsigned int created_vhost_protocols:1;
@@ -600,9 +712,31 @@ struct lws_peer {
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	struct lws_peer_role_http http;
 #endif
+	struct lws_tokenbucket tb_req;
+	struct lws_tokenbucket tb_bytes;
 
 	uint8_t af;
 };
+
+/*
+ * The peer table is split into shards with their own lock, chosen by the top
+ * bits of the peer address hash, so connections from different peers arriving
+ * on different service threads don't serialize on one lock.  Each shard's
+ * bucket array grows when it holds more peers than buckets.
+ */
+
+#define LWS_PEER_SHARDS_LOG2	4
+#define LWS_PEER_SHARDS		(1 << LWS_PEER_SHARDS_LOG2)
+
+struct lws_peer_shard {
+#if LWS_MAX_SMP > 1
+	pthread_mutex_t lock;
+#endif
+	struct lws_peer **table;
+	struct lws_peer *peer_wait_list;
+	uint32_t elements;	/* power of 2, 0 until initialized */
+	uint32_t count;		/* peers in this shard */
+};
 #endif
 
 /*
@@ -650,10 +784,13 @@ struct lws_context {
 #if defined(LWS_WITH_THREADPOOL)
 	struct lws_threadpool *tp_list_head;
 #endif
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	struct lws_access_log_writer alog;
+#endif
 
 #if defined(LWS_WITH_PEER_LIMITS)
-	struct lws_peer **pl_hash_table;
-	struct lws_peer *peer_wait_list;
+	struct lws_peer_shard pl_shard[LWS_PEER_SHARDS];
+	uint8_t pl_hash_key[16];	/* random key for peer address hash */
 	time_t next_cull;
 #endif
 
@@ -694,9 +831,8 @@ struct lws_context {
 #endif
 
 #if defined(LWS_WITH_STATS)
-	uint64_t lws_stats[LWSSTATS_SIZE];
 	uint64_t last_dump;
-	int updated;
+	int updated; /* context-wide state like ssl restriction changed */
 #endif
 #if defined(LWS_WITH_ESP32)
 	unsigned long time_last_state_dump;
@@ -717,14 +853,22 @@ struct lws_context {
 	unsigned int timeout_secs;
 	unsigned int pt_serv_buf_size;
 	int max_http_header_data;
+	int max_http_header_data_small;
 	int max_http_header_pool;
 	int simultaneous_ssl_restriction;
 	int simultaneous_ssl;
 #if defined(LWS_WITH_PEER_LIMITS)
-	uint32_t pl_hash_elements;	/* protected by context->lock */
-	uint32_t count_peers;		/* protected by context->lock */
+	uint32_t pl_hash_elements;	/* initial buckets over all shards */
+	uint32_t ip_limit_req_rate;
+	uint32_t ip_limit_byte_rate;
 	unsigned short ip_limit_ah;
 	unsigned short ip_limit_wsi;
+#endif
+#if defined(LWS_WITH_PROFILER)
+	unsigned int prof_stall_us;
+#endif
+#if defined(LWS_WITH_PROFILER_WATCHDOG)
+	struct lws_prof_watchdog *prof_wd;
 #endif
 	unsigned int deprecated:1;
 	unsigned int being_destroyed:1;
@@ -868,6 +1012,12 @@ struct lws {
 #if defined(LWS_ROLE_DBUS)
 	struct _lws_dbus_mode_related dbus;
 #endif
+#if defined(LWS_ROLE_RAW_PROXY) && defined(LWS_HAVE_SPLICE)
+	struct lws_raw_splice *splice; /* allocated if relaying by splice */
+#endif
+#if defined(LWS_ROLE_FCGI)
+	struct lws_fcgi *fcgi; /* allocated if we are a conn to an fcgi worker */
+#endif
 
 	const struct lws_role_ops *role_ops;
 	lws_wsi_state_t	wsistate;
@@ -904,6 +1054,8 @@ struct lws {
 
 #if defined(LWS_WITH_PEER_LIMITS)
 	struct lws_peer *peer;
+	struct lws_dll_lws dll_ratelimited;
+	lws_usec_t ratelimit_until; /* when we expect buckets to be paid */
 #endif
 
 	struct lws_udp *udp;
@@ -989,6 +1141,10 @@ struct lws {
 #ifdef LWS_WITH_ACCESS_LOG
 	unsigned int access_log_pending:1;
 #endif
+#if defined(LWS_WITH_PEER_LIMITS)
+	unsigned int ratelimited:1; /* rx and tx held until buckets refill */
+	unsigned int ratelimit_pollout:1; /* POLLOUT was held back */
+#endif
 #ifndef LWS_NO_CLIENT
 	unsigned int do_ws:1; /* whether we are doing http or ws flow */
 	unsigned int chunked:1; /* if the clientside connection is chunked */
@@ -998,6 +1154,7 @@ struct lws {
 	unsigned int keepalive_active:1;
 	unsigned int keepalive_rejected:1;
 	unsigned int client_pipeline:1;
+	unsigned int client_keepalive:1;
 	unsigned int client_h2_alpn:1;
 	unsigned int client_h2_substream:1;
 #endif
@@ -1010,6 +1167,7 @@ struct lws {
 	unsigned short c_port;
 #endif
 	unsigned short pending_timeout_limit;
+	unsigned short rxflow_bitmap;
 
 	/* chars */
 
@@ -1019,7 +1177,6 @@ struct lws {
 	char tsi; /* thread service index we belong to */
 	char protocol_interpret_idx;
 	char redirects;
-	uint8_t rxflow_bitmap;
 #ifdef LWS_WITH_CGI
 	char cgi_channel; /* which of stdin/out/err */
 	char hdr_state;
@@ -1094,6 +1251,66 @@ lws_latency(struct lws_context *context, struct lws *wsi, const char *action,
 	    int ret, int completion);
 #endif
 
+/*
+ * The profiler times protocol callbacks and role handlers, keyed by vhost,
+ * protocol callback or role, and callback reason or role handler.  Protocol
+ * callbacks made by lws are made through lws_protocol_cb() so they can be
+ * timed; role handlers are bracketed with lws_prof_enter() / lws_prof_exit().
+ */
+
+enum lws_prof_role_handler {
+	LWS_PROF_POLLIN			= -1,
+	LWS_PROF_POLLOUT		= -2,
+	LWS_PROF_PERIODIC		= -3,
+};
+
+#if defined(LWS_WITH_PROFILER)
+#define lws_protocol_cb(_cb, _wsi, _reason, _user, _in, _len) \
+		lws_prof_callback(_cb, _wsi, _reason, _user, _in, _len)
+
+int
+lws_prof_init(struct lws_context *context);
+void
+lws_prof_destroy(struct lws_context *context);
+void
+lws_prof_vhost_destroy(struct lws_vhost *vh);
+void
+lws_prof_watchdog_stop(struct lws_context *context);
+lws_usec_t
+lws_prof_enter(struct lws_context_per_thread *pt,
+	       const struct lws_role_ops *rops, int what);
+void
+lws_prof_exit(struct lws_context_per_thread *pt, lws_usec_t start,
+	      const struct lws_vhost *vh, const struct lws_role_ops *rops,
+	      int what);
+int
+lws_prof_callback(lws_callback_function *cb, struct lws *wsi,
+		  enum lws_callback_reasons reason, void *user, void *in,
+		  size_t len);
+int
+lws_prof_json_dump(const struct lws_context *context,
+		   const struct lws_vhost *vh, struct lws_json_out *j);
+int
+lws_prof_json_dump_pt(const struct lws_context_per_thread *pt,
+		      struct lws_json_out *j);
+#else
+#define lws_protocol_cb(_cb, _wsi, _reason, _user, _in, _len) \
+		(_cb)(_wsi, _reason, _user, _in, _len)
+
+static LWS_INLINE lws_usec_t
+lws_prof_enter(struct lws_context_per_thread *pt,
+	       const struct lws_role_ops *rops, int what) {
+	(void)pt; (void)rops; (void)what; return 0;
+}
+static LWS_INLINE void
+lws_prof_exit(struct lws_context_per_thread *pt, lws_usec_t start,
+	      const struct lws_vhost *vh, const struct lws_role_ops *rops,
+	      int what) {
+	do { (void)pt; (void)start; (void)vh; (void)rops; (void)what;
+	} while (0);
+}
+#endif
+
 static LWS_INLINE int
 lws_has_buffered_out(struct lws *wsi) { return !!wsi->buflist_out; }
 
@@ -1137,6 +1354,12 @@ lws_client_reset(struct lws **wsi, int ssl, const char *address, int port,
 LWS_EXTERN struct lws * LWS_WARN_UNUSED_RESULT
 lws_create_new_server_wsi(struct lws_vhost *vhost, int fixed_tsi);
 
+struct lws *
+lws_adopt_descriptor_vhost_tsi(struct lws_vhost *vh, lws_adoption_type type,
+			       lws_sock_file_fd_type fd,
+			       const char *vh_prot_name, struct lws *parent,
+			       int fixed_tsi, const struct sockaddr *sa);
+
 LWS_EXTERN char * LWS_WARN_UNUSED_RESULT
 lws_generate_client_handshake(struct lws *wsi, char *pkt);
 
@@ -1270,31 +1493,17 @@ static LWS_INLINE void
 lws_pt_mutex_init(struct lws_context_per_thread *pt)
 {
 	lws_mutex_refcount_init(&pt->mr);
-	pthread_mutex_init(&pt->lock_stats, NULL);
 }
 
 static LWS_INLINE void
 lws_pt_mutex_destroy(struct lws_context_per_thread *pt)
 {
-	pthread_mutex_destroy(&pt->lock_stats);
 	lws_mutex_refcount_destroy(&pt->mr);
 }
 
 #define lws_pt_lock(pt, reason) lws_mutex_refcount_lock(&pt->mr, reason)
 #define lws_pt_unlock(pt) lws_mutex_refcount_unlock(&pt->mr)
 
-static LWS_INLINE void
-lws_pt_stats_lock(struct lws_context_per_thread *pt)
-{
-	pthread_mutex_lock(&pt->lock_stats);
-}
-
-static LWS_INLINE void
-lws_pt_stats_unlock(struct lws_context_per_thread *pt)
-{
-	pthread_mutex_unlock(&pt->lock_stats);
-}
-
 #define lws_context_lock(c, reason) lws_mutex_refcount_lock(&c->mr, reason)
 #define lws_context_unlock(c) lws_mutex_refcount_unlock(&c->mr)
 
@@ -1320,8 +1529,6 @@ lws_vhost_unlock(struct lws_vhost *vhost)
 #define lws_context_unlock(_a) (void)(_a)
 #define lws_vhost_lock(_a) (void)(_a)
 #define lws_vhost_unlock(_a) (void)(_a)
-#define lws_pt_stats_lock(_a) (void)(_a)
-#define lws_pt_stats_unlock(_a) (void)(_a)
 #endif
 
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
@@ -1375,8 +1582,20 @@ LWS_EXTERN int
 lws_access_log(struct lws *wsi);
 LWS_EXTERN void
 lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int len, int meth);
+void
+lws_access_log_init(struct lws_context *context);
+void
+lws_access_log_service(struct lws_context *context, int tsi, time_t now);
+void
+lws_access_log_vhost_destroy(struct lws_vhost *vh);
+void
+lws_access_log_destroy(struct lws_context *context);
 #else
 #define lws_access_log(_a)
+#define lws_access_log_init(_a)
+#define lws_access_log_service(_a, _b, _c)
+#define lws_access_log_vhost_destroy(_a)
+#define lws_access_log_destroy(_a)
 #endif
 
 LWS_EXTERN int
@@ -1495,19 +1714,135 @@ LWS_EXTERN int
 lws_broadcast(struct lws_context *context, int reason, void *in, size_t len);
 
 #if defined(LWS_WITH_STATS)
- void
- lws_stats_atomic_bump(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t bump);
- void
- lws_stats_atomic_max(struct lws_context * context,
-		struct lws_context_per_thread *pt, int index, uint64_t val);
+/*
+ * The stats are per-pt and normally only touched by the pt's own service
+ * thread.  With SMP, other threads may still bump a pt's stats, eg, when
+ * asking for a writable callback, so the updates are relaxed atomics there.
+ */
+#if LWS_MAX_SMP > 1 && defined(__GNUC__)
+#define lws_stats_add(_p, _v) __atomic_fetch_add(_p, _v, __ATOMIC_RELAXED)
 #else
- static LWS_INLINE uint64_t lws_stats_atomic_bump(struct lws_context * context,
+#define lws_stats_add(_p, _v) (*(_p) += (_v))
+#endif
+
+static LWS_INLINE void
+lws_stats_atomic_bump(struct lws_context * context,
+		struct lws_context_per_thread *pt, int index, uint64_t bump)
+{
+	(void)context;
+	lws_stats_add(&pt->stats.s[index], bump);
+	if (index != LWSSTATS_C_SERVICE_ENTRY)
+		pt->stats.updated = 1;
+}
+
+static LWS_INLINE void
+lws_stats_atomic_max(struct lws_context * context,
+		struct lws_context_per_thread *pt, int index, uint64_t val)
+{
+#if LWS_MAX_SMP > 1 && defined(__GNUC__)
+	uint64_t cur = __atomic_load_n(&pt->stats.s[index], __ATOMIC_RELAXED);
+
+	(void)context;
+	while (val > cur)
+		if (__atomic_compare_exchange_n(&pt->stats.s[index], &cur, val,
+						1, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			pt->stats.updated = 1;
+			break;
+		}
+#else
+	(void)context;
+	if (val > pt->stats.s[index]) {
+		pt->stats.s[index] = val;
+		pt->stats.updated = 1;
+	}
+#endif
+}
+
+uint64_t
+lws_stats_hist_sum(struct lws_context *context, int index, uint64_t *hist);
+uint64_t
+lws_stats_hist_percentile(const uint64_t *hist, uint64_t count, int per_mille);
+
+/* record a latency sample in us in one of the LWSSTATS_H_ histograms */
+
+static LWS_INLINE void
+lws_stats_hist_add(struct lws_context_per_thread *pt, int index, uint64_t us)
+{
+	lws_stats_add(&pt->stats.hist[index][lws_hist_bucket(us)], 1);
+}
+#else
+ static LWS_INLINE void lws_stats_atomic_bump(struct lws_context * context,
 		struct lws_context_per_thread *pt, int index, uint64_t bump) {
-	(void)context; (void)pt; (void)index; (void)bump; return 0; }
- static LWS_INLINE uint64_t lws_stats_atomic_max(struct lws_context * context,
+	(void)context; (void)pt; (void)index; (void)bump; }
+ static LWS_INLINE void lws_stats_atomic_max(struct lws_context * context,
 		struct lws_context_per_thread *pt, int index, uint64_t val) {
-	(void)context; (void)pt; (void)index; (void)val; return 0; }
+	(void)context; (void)pt; (void)index; (void)val; }
+ static LWS_INLINE void lws_stats_hist_add(struct lws_context_per_thread *pt,
+		int index, uint64_t us) {
+	(void)pt; (void)index; (void)us; }
+#endif
+
+#if defined(LWS_WITH_METRICS)
+/*
+ * Call these as the service thread goes back to wait for events, and as it
+ * wakes from the wait, to measure how long each event loop iteration kept it
+ * busy.  Event libs have no hook before they wait, so there each dispatch
+ * to lws is measured as an iteration.
+ */
+static LWS_INLINE void
+lws_metrics_loop_woke(struct lws_context_per_thread *pt)
+{
+	pt->loop.woke = lws_now_usecs();
+}
+
+static LWS_INLINE void
+lws_metrics_loop_idle(struct lws_context_per_thread *pt)
+{
+	lws_usec_t us;
+
+	if (!pt->loop.woke)
+		return;
+
+	us = lws_now_usecs() - pt->loop.woke;
+	pt->loop.woke = 0;
+	if (us < 0) /* the wallclock was set back */
+		return;
+
+	pt->loop.iterations++;
+	pt->loop.busy_us += (uint64_t)us;
+	if ((uint64_t)us > pt->loop.busy_max_us)
+		pt->loop.busy_max_us = (uint64_t)us;
+}
+
+/*
+ * The pt keeps running totals of what its wsi rx and tx buflists are holding
+ * and how many h2 streams it has open, so the metrics don't have to walk
+ * every wsi to find out.  Changes to wsi->buflist and wsi->buflist_out go
+ * through the wrappers below, and h2 child_count changes are matched here.
+ */
+
+static LWS_INLINE void
+lws_metrics_h2_streams(struct lws *parent_wsi, int delta)
+{
+	parent_wsi->context->pt[(int)parent_wsi->tsi].h2_streams += delta;
+}
+
+int
+lws_wsi_buflist_append(struct lws *wsi, struct lws_buflist **head,
+		       const uint8_t *buf, size_t len);
+int
+lws_wsi_buflist_use(struct lws *wsi, struct lws_buflist **head, size_t len);
+void
+lws_wsi_buflist_destroy(struct lws *wsi, struct lws_buflist **head);
+#else
+#define lws_metrics_loop_woke(_pt)
+#define lws_metrics_loop_idle(_pt)
+#define lws_metrics_h2_streams(_w, _d)
+#define lws_wsi_buflist_append(_w, _h, _b, _l) \
+		lws_buflist_append_segment(_h, _b, _l)
+#define lws_wsi_buflist_use(_w, _h, _l) lws_buflist_use_segment(_h, _l)
+#define lws_wsi_buflist_destroy(_w, _h) lws_buflist_destroy_all_segments(_h)
 #endif
 
 /* socks */
@@ -1525,12 +1860,27 @@ lws_peer_track_ah_detach(struct lws_context *context, struct lws_peer *peer);
 void
 lws_peer_cull_peer_wait_list(struct lws_context *context);
 struct lws_peer *
-lws_get_or_create_peer(struct lws_vhost *vhost, lws_sockfd_type sockfd);
+lws_get_or_create_peer(struct lws_vhost *vhost, lws_sockfd_type sockfd,
+		       const struct sockaddr *sa);
+void
+lws_peer_track_ah_attach(struct lws_context *context, struct lws_peer *peer);
+int
+lws_peer_limits_init(struct lws_context *context);
+void
+lws_peer_limits_destroy(struct lws_context *context);
 void
 lws_peer_add_wsi(struct lws_context *context, struct lws_peer *peer,
 		 struct lws *wsi);
 void
 lws_peer_dump_from_wsi(struct lws *wsi);
+void
+lws_tokenbucket_init(struct lws_tokenbucket *tb, uint32_t rate);
+void
+lws_peer_ratelimit_charge(struct lws *wsi, int reqs, size_t bytes);
+lws_usec_t
+__lws_peer_ratelimit_service(struct lws_context_per_thread *pt);
+void
+__lws_peer_ratelimit_remove(struct lws *wsi);
 #endif
 
 #ifdef LWS_WITH_HUBBUB
@@ -1540,6 +1890,8 @@ html_parser_cb(const hubbub_token *token, void *pw);
 
 int
 lws_threadpool_tsi_context(struct lws_context *context, int tsi);
+void
+lws_threadpool_service_periodic(struct lws_context *context);
 
 void
 __lws_remove_from_timeout_list(struct lws *wsi);
@@ -37,6 +37,7 @@ lws_callback_as_writeable(struct lws *wsi)
 				      LWSSTATS_MS_WRITABLE_DELAY, ul);
 		lws_stats_atomic_max(wsi->context, pt,
 				     LWSSTATS_MS_WORST_WRITABLE_DELAY, ul);
+		lws_stats_hist_add(pt, LWSSTATS_H_WRITABLE_DELAY, ul);
 		wsi->active_writable_req_us = 0;
 	}
 #endif
@@ -53,7 +54,10 @@ lws_callback_as_writeable(struct lws *wsi)
 LWS_VISIBLE int
 lws_handle_POLLOUT_event(struct lws *wsi, struct lws_pollfd *pollfd)
 {
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
 	volatile struct lws *vwsi = (volatile struct lws *)wsi;
+	const struct lws_role_ops *rops;
+	lws_usec_t us;
 	int n;
 
 	// lwsl_notice("%s: %p\n", __func__, wsi);
@@ -67,6 +71,19 @@ lws_handle_POLLOUT_event(struct lws *wsi, struct lws_pollfd *pollfd)
 	 */
 	wsi->could_have_pending = 0; /* clear back-to-back write detection */
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	if (wsi->ratelimited) {
+		/*
+		 * we're held for rate limiting... stop POLLOUT until we are
+		 * released, and have it restored then
+		 */
+		wsi->ratelimit_pollout = 1;
+		vwsi->handling_pollout = 0;
+
+		return lws_change_pollfd(wsi, LWS_POLLOUT, 0);
+	}
+#endif
+
 	/*
 	 * user callback is lowest priority to get these notifications
 	 * actually, since other pending things cannot be disordered
@@ -136,7 +153,12 @@ lws_handle_POLLOUT_event(struct lws *wsi, struct lws_pollfd *pollfd)
 	if (!wsi->role_ops->handle_POLLOUT)
 		goto bail_ok;
 
-	switch ((wsi->role_ops->handle_POLLOUT)(wsi)) {
+	rops = wsi->role_ops;
+	us = lws_prof_enter(pt, rops, LWS_PROF_POLLOUT);
+	n = (wsi->role_ops->handle_POLLOUT)(wsi);
+	lws_prof_exit(pt, us, wsi->vhost, rops, LWS_PROF_POLLOUT);
+
+	switch (n) {
 	case LWS_HP_RET_BAIL_OK:
 		goto bail_ok;
 	case LWS_HP_RET_BAIL_DIE:
@@ -251,6 +273,8 @@ __lws_service_timeout_check(struct lws *wsi, time_t sec)
 #endif
 
 		lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_C_TIMEOUTS, 1);
+		if (wsi->vhost)
+			wsi->vhost->conn_stats.timeouts++;
 
 		/* no need to log normal idle keepalive timeout */
 		if (wsi->pending_timeout != PENDING_TIMEOUT_HTTP_KEEPALIVE_IDLE)
@@ -281,7 +305,7 @@ __lws_service_timeout_check(struct lws *wsi, time_t sec)
 		 */
 		wsi->socket_is_permanently_unusable = 1;
 		if (lwsi_state(wsi) == LRS_WAITING_SSL && wsi->protocol)
-			wsi->protocol->callback(wsi,
+			lws_protocol_cb(wsi->protocol->callback, wsi,
 				LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 				wsi->user_space,
 				(void *)"Timed out waiting SSL", 21);
@@ -315,7 +339,7 @@ int lws_rxflow_cache(struct lws *wsi, unsigned char *buf, int n, int len)
 
 	/* a new rxflow, buffer it and warn caller */
 
-	m = lws_buflist_append_segment(&wsi->buflist, buf + n, len - n);
+	m = lws_wsi_buflist_append(wsi, &wsi->buflist, buf + n, len - n);
 
 	if (m < 0)
 		return -1;
@@ -357,14 +381,17 @@ lws_service_adjust_timeout(struct lws_context *context, int timeout_ms, int tsi)
 
 	/*
 	 * 3) If there is any wsi with rxflow buffered and in a state to process
-	 *    it, we should not wait in poll
+	 *    it, we should not wait in poll.  Flow controlled guys, including
+	 *    those held for rate limiting, won't be serviced until that is
+	 *    lifted, so they mustn't stop us waiting.
 	 */
 
 	lws_start_foreach_dll(struct lws_dll_lws *, d,
 			      pt->dll_head_buflist.next) {
 		struct lws *wsi = lws_container_of(d, struct lws, dll_buflist);
 
-		if (lwsi_state(wsi) != LRS_DEFERRING_ACTION)
+		if (!lws_is_flowcontrolled(wsi) &&
+		    lwsi_state(wsi) != LRS_DEFERRING_ACTION)
 			return 0;
 
 	/*
@@ -398,6 +425,10 @@ lws_buflist_aware_read(struct lws_context_per_thread *pt, struct lws *wsi,
 	if (ebuf->len <= 0)
 		return 0;
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	lws_peer_ratelimit_charge(wsi, 0, (size_t)ebuf->len);
+#endif
+
 	/* nothing in buflist already?  Then just use what we read */
 
 	if (!prior)
@@ -405,8 +436,8 @@ lws_buflist_aware_read(struct lws_context_per_thread *pt, struct lws *wsi,
 
 	/* stash what we read */
 
-	n = lws_buflist_append_segment(&wsi->buflist, (uint8_t *)ebuf->token,
-				       ebuf->len);
+	n = lws_wsi_buflist_append(wsi, &wsi->buflist, (uint8_t *)ebuf->token,
+				   ebuf->len);
 	if (n < 0)
 		return -1;
 	if (n) {
@@ -437,7 +468,7 @@ lws_buflist_aware_consume(struct lws *wsi, struct lws_tokens *ebuf, int used,
 		return 0;
 
 	if (used && buffered) {
-		m = lws_buflist_use_segment(&wsi->buflist, used);
+		m = lws_wsi_buflist_use(wsi, &wsi->buflist, used);
 		lwsl_info("%s: draining rxflow: used %d, next %d\n",
 			    __func__, used, m);
 		if (m)
@@ -452,9 +483,9 @@ lws_buflist_aware_consume(struct lws *wsi, struct lws_tokens *ebuf, int used,
 	/* any remainder goes on the buflist */
 
 	if (used != ebuf->len) {
-		m = lws_buflist_append_segment(&wsi->buflist,
-					       (uint8_t *)ebuf->token + used,
-					       ebuf->len - used);
+		m = lws_wsi_buflist_append(wsi, &wsi->buflist,
+					   (uint8_t *)ebuf->token + used,
+					   ebuf->len - used);
 		if (m < 0)
 			return 1; /* OOM */
 		if (m) {
@@ -471,7 +502,11 @@ lws_buflist_aware_consume(struct lws *wsi, struct lws_tokens *ebuf, int used,
 void
 lws_service_do_ripe_rxflow(struct lws_context_per_thread *pt)
 {
+	const struct lws_role_ops *rops;
 	struct lws_pollfd pfd;
+	struct lws_vhost *vh;
+	lws_usec_t us;
+	int n;
 
 	if (!pt->dll_head_buflist.next)
 		return;
@@ -495,11 +530,18 @@ lws_service_do_ripe_rxflow(struct lws_context_per_thread *pt)
 			    wsi->wsistate);
 
 		if (!lws_is_flowcontrolled(wsi) &&
-		    lwsi_state(wsi) != LRS_DEFERRING_ACTION &&
-		    (wsi->role_ops->handle_POLLIN)(pt, wsi, &pfd) ==
-						   LWS_HPI_RET_PLEASE_CLOSE_ME)
-			lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS,
-					   "close_and_handled");
+		    lwsi_state(wsi) != LRS_DEFERRING_ACTION) {
+			vh = wsi->vhost;
+			rops = wsi->role_ops;
+			us = lws_prof_enter(pt, rops, LWS_PROF_POLLIN);
+			n = (wsi->role_ops->handle_POLLIN)(pt, wsi, &pfd);
+			lws_prof_exit(pt, us, vh, rops, LWS_PROF_POLLIN);
+
+			if (n == LWS_HPI_RET_PLEASE_CLOSE_ME)
+				lws_close_free_wsi(wsi,
+						   LWS_CLOSE_STATUS_NOSTATUS,
+						   "close_and_handled");
+		}
 
 	} lws_end_foreach_dll_safe(d, d1);
 
@@ -528,7 +570,8 @@ lws_service_flag_pending(struct lws_context *context, int tsi)
 	lws_start_foreach_dll(struct lws_dll_lws *, d, pt->dll_head_buflist.next) {
 		struct lws *wsi = lws_container_of(d, struct lws, dll_buflist);
 
-		if (lwsi_state(wsi) != LRS_DEFERRING_ACTION) {
+		if (!lws_is_flowcontrolled(wsi) &&
+		    lwsi_state(wsi) != LRS_DEFERRING_ACTION) {
 			forced = 1;
 			break;
 		}
@@ -580,6 +623,9 @@ lws_service_periodic_checks(struct lws_context *context,
 	lws_sockfd_type our_fd = 0, tmp_fd;
 	struct lws *wsi;
 	int timed_out = 0;
+#if defined(LWS_ROLE_WS) || defined(LWS_ROLE_CGI)
+	lws_usec_t us;
+#endif
 	time_t now;
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
 	struct allocated_headers *ah;
@@ -625,6 +671,10 @@ lws_service_periodic_checks(struct lws_context *context,
 		context->last_timeout_check_s = now - 1;
 	}
 
+	/* each pt sends on its access log lines once a second */
+
+	lws_access_log_service(context, tsi, now);
+
 	if (!lws_compare_time_t(context, context->last_timeout_check_s, now))
 		return 0;
 
@@ -644,6 +694,10 @@ lws_service_periodic_checks(struct lws_context *context,
 	lws_peer_cull_peer_wait_list(context);
 #endif
 
+#if defined(LWS_WITH_THREADPOOL)
+	lws_threadpool_service_periodic(context);
+#endif
+
 	/* retire unused deprecated context */
 #if !defined(LWS_PLAT_OPTEE) && !defined(LWS_WITH_ESP32)
 #if !defined(_WIN32)
@@ -883,7 +937,8 @@ lws_service_periodic_checks(struct lws_context *context,
 		lwsl_debug("%s: timed cb: vh %s, protocol %s, reason %d\n",
 			   __func__, tmr[m].vhost->name, tmr[m].protocol->name,
 			   tmr[m].reason);
-		tmr[m].protocol->callback(wsi, tmr[m].reason, NULL, NULL, 0);
+		lws_protocol_cb(tmr[m].protocol->callback, wsi,
+				tmr[m].reason, NULL, NULL, 0);
 	}
 
 	lws_free(tmr);
@@ -915,10 +970,14 @@ vh_timers_done:
 	 * Phase 5: role periodic checks
 	 */
 #if defined(LWS_ROLE_WS)
+	us = lws_prof_enter(pt, &role_ops_ws, LWS_PROF_PERIODIC);
 	role_ops_ws.periodic_checks(context, tsi, now);
+	lws_prof_exit(pt, us, NULL, &role_ops_ws, LWS_PROF_PERIODIC);
 #endif
 #if defined(LWS_ROLE_CGI)
+	us = lws_prof_enter(pt, &role_ops_cgi, LWS_PROF_PERIODIC);
 	role_ops_cgi.periodic_checks(context, tsi, now);
+	lws_prof_exit(pt, us, NULL, &role_ops_cgi, LWS_PROF_PERIODIC);
 #endif
 
 	/*
@@ -937,7 +996,11 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd,
 		   int tsi)
 {
 	struct lws_context_per_thread *pt = &context->pt[tsi];
+	const struct lws_role_ops *rops;
+	struct lws_vhost *vh;
+	lws_usec_t us;
 	struct lws *wsi;
+	int n;
 
 	if (!context || context->being_destroyed1)
 		return -1;
@@ -1007,7 +1070,13 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd,
 	// lwsl_notice("%s: %s: wsistate 0x%x\n", __func__, wsi->role_ops->name,
 	//	    wsi->wsistate);
 
-	switch ((wsi->role_ops->handle_POLLIN)(pt, wsi, pollfd)) {
+	vh = wsi->vhost;
+	rops = wsi->role_ops;
+	us = lws_prof_enter(pt, rops, LWS_PROF_POLLIN);
+	n = (wsi->role_ops->handle_POLLIN)(pt, wsi, pollfd);
+	lws_prof_exit(pt, us, vh, rops, LWS_PROF_POLLIN);
+
+	switch (n) {
 	case LWS_HPI_RET_WSI_ALREADY_DIED:
 		return 1;
 	case LWS_HPI_RET_HANDLED:
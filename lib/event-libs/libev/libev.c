@@ -101,9 +101,11 @@ lws_accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents)
 	wsi = wsi_from_fd(context, watcher->fd);
 	pt = &context->pt[(int)wsi->tsi];
 
+	lws_metrics_loop_woke(pt);
 	lws_service_fd_tsi(context, &eventfd, (int)wsi->tsi);
 
 	ev_idle_start(pt->ev.io_loop, &pt->ev.idle);
+	lws_metrics_loop_idle(pt);
 }
 
 LWS_VISIBLE void
@@ -114,6 +114,7 @@ lws_event_cb(evutil_socket_t sock_fd, short revents, void *ctx)
 	wsi = wsi_from_fd(context, sock_fd);
 	pt = &context->pt[(int)wsi->tsi];
 
+	lws_metrics_loop_woke(pt);
 	lws_service_fd_tsi(context, &eventfd, wsi->tsi);
 
 	/* set the idle timer for 1ms ahead */
@@ -121,6 +122,7 @@ lws_event_cb(evutil_socket_t sock_fd, short revents, void *ctx)
 	tv.tv_sec = 0;
 	tv.tv_usec = 1000;
 	evtimer_add(pt->event.idle_timer, &tv);
+	lws_metrics_loop_idle(pt);
 }
 
 LWS_VISIBLE void
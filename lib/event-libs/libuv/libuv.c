@@ -114,9 +114,11 @@ lws_io_cb(uv_poll_t *watcher, int status, int revents)
 			eventfd.revents |= LWS_POLLOUT;
 		}
 	}
+	lws_metrics_loop_woke(pt);
 	lws_service_fd_tsi(context, &eventfd, wsi->tsi);
 
 	uv_idle_start(&pt->uv.idle, lws_uv_idle);
+	lws_metrics_loop_idle(pt);
 }
 
 /*
@@ -37,45 +37,279 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
-struct file_entry {
-	lws_list_ptr sorted;
-	lws_list_ptr prev;
-	char name[64];
-	time_t modified;
-	size_t size;
+/*
+ * The cache keeps an index in memory of what is in the cache dir, with the
+ * size of each file, and a list of the files in order of when they were last
+ * used.  The index is built by reading one of the 256 subdirs each time
+ * lws_diskcache_trim() is called, until it has seen them all.  After that,
+ * queries and trimming are satisfied from the index, without having to open
+ * or stat the cached files.
+ *
+ * Until the index is complete, queries that miss it just look on the disk.
+ *
+ * Afterwards we keep rereading one subdir every LWS_DISKCACHE_RESCAN_SECS, so
+ * files other processes sharing the cache dir added are counted within 256
+ * of those intervals.  Only files not already in the index are stat'd.
+ */
+
+struct lws_diskcache_entry {
+	struct lws_diskcache_entry *hash_next;
+	struct lws_diskcache_entry *lru_prev;	/* more recently used */
+	struct lws_diskcache_entry *lru_next;	/* less recently used */
+	struct lws_diskcache_entry *pending_next;
+	uint64_t size;
+	time_t used;		/* last hit, or the file mtime when indexed */
+	time_t touched;		/* the mtime we last left on the file */
+	uint32_t hash;
+	char pending;		/* temp file still being created */
+
+	/* NUL-terminated filename follows */
 };
 
 struct lws_diskcache_scan {
-	struct file_entry *batch;
+	pthread_mutex_t lock;	/* protects the index */
+	struct lws_diskcache_entry **buckets;
+	struct lws_diskcache_entry *lru_head;	/* most recently used */
+	struct lws_diskcache_entry *lru_tail;	/* least recently used */
+	struct lws_diskcache_entry *pending;	/* temp files being created */
 	const char *cache_dir_base;
-	lws_list_ptr head;
-	time_t last_scan_completed;
 	uint64_t agg_size;
 	uint64_t cache_size_limit;
-	uint64_t avg_size;
 	uint64_t cache_tries;
 	uint64_t cache_hits;
-	int cache_subdir;
-	int batch_in_use;
-	int agg_file_count;
+	unsigned int count_buckets;
+	unsigned int count_entries;
+	time_t last_rescan;	/* when we last reread a subdir */
+	int cache_subdir;	/* next subdir to read into the index */
 	int secs_waiting;
+	char indexed;		/* the index has seen every subdir */
 };
 
 #define KIB (1024)
 #define MIB (KIB * KIB)
 
-#define lp_to_fe(p, _n) lws_list_ptr_container(p, struct file_entry, _n)
-
 static const char *hex = "0123456789abcdef";
 
+/* most files deleted by one trim call */
 #define BATCH_COUNT 128
+/* don't update the mtime of cache files on disk more often than this */
+#define LWS_DISKCACHE_TOUCH_SECS 600
+/* a temp file not written to for this long was abandoned */
+#define LWS_DISKCACHE_TEMP_STALE_SECS 3600
+/* once the index is complete, reread one subdir at most this often */
+#define LWS_DISKCACHE_RESCAN_SECS 2
+
+static const char *
+lde_name(struct lws_diskcache_entry *e)
+{
+	return (const char *)&e[1];
+}
 
-static int
-fe_modified_sort(lws_list_ptr a, lws_list_ptr b)
+static uint32_t
+lws_diskcache_hash(const char *name)
 {
-	struct file_entry *p1 = lp_to_fe(a, sorted), *p2 = lp_to_fe(b, sorted);
+	uint32_t h = 5381;
+
+	while (*name)
+		h = ((h << 5) + h) ^ (uint8_t)*name++;
+
+	return h;
+}
 
-	return p2->modified - p1->modified;
+/* the functions starting __ must be called with lds->lock held */
+
+static struct lws_diskcache_entry *
+__lws_diskcache_find(struct lws_diskcache_scan *lds, const char *name,
+		     uint32_t h)
+{
+	struct lws_diskcache_entry *e = lds->buckets[h & (lds->count_buckets - 1)];
+
+	while (e) {
+		if (e->hash == h && !strcmp(lde_name(e), name))
+			return e;
+		e = e->hash_next;
+	}
+
+	return NULL;
+}
+
+static void
+__lws_diskcache_lru_unlink(struct lws_diskcache_scan *lds,
+			   struct lws_diskcache_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		lds->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		lds->lru_tail = e->lru_prev;
+}
+
+static void
+__lws_diskcache_lru_add_front(struct lws_diskcache_scan *lds,
+			      struct lws_diskcache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = lds->lru_head;
+	if (lds->lru_head)
+		lds->lru_head->lru_prev = e;
+	else
+		lds->lru_tail = e;
+	lds->lru_head = e;
+}
+
+static void
+__lws_diskcache_grow(struct lws_diskcache_scan *lds)
+{
+	unsigned int n, count = lds->count_buckets * 4;
+	struct lws_diskcache_entry **b, *e, *e1;
+
+	b = lws_zalloc(sizeof(*b) * count, "diskcache buckets");
+	if (!b)
+		/* we'll just have to live with longer chains */
+		return;
+
+	for (n = 0; n < lds->count_buckets; n++) {
+		e = lds->buckets[n];
+		while (e) {
+			e1 = e->hash_next;
+			e->hash_next = b[e->hash & (count - 1)];
+			b[e->hash & (count - 1)] = e;
+			e = e1;
+		}
+	}
+
+	lws_free(lds->buckets);
+	lds->buckets = b;
+	lds->count_buckets = count;
+}
+
+static struct lws_diskcache_entry *
+__lws_diskcache_add(struct lws_diskcache_scan *lds, const char *name,
+		    uint32_t h, uint64_t size, time_t used)
+{
+	size_t len = strlen(name) + 1;
+	struct lws_diskcache_entry *e;
+
+	e = lws_malloc(sizeof(*e) + len, "diskcache entry");
+	if (!e)
+		return NULL;
+
+	memset(e, 0, sizeof(*e));
+	memcpy(&e[1], name, len);
+	e->size = size;
+	e->used = used;
+	e->touched = used;
+	e->hash = h;
+
+	e->hash_next = lds->buckets[h & (lds->count_buckets - 1)];
+	lds->buckets[h & (lds->count_buckets - 1)] = e;
+	__lws_diskcache_lru_add_front(lds, e);
+
+	lds->agg_size += size;
+	if (++lds->count_entries > lds->count_buckets * 2)
+		__lws_diskcache_grow(lds);
+
+	return e;
+}
+
+/* takes the entry out of the index, it's up to the caller to free it */
+
+static void
+__lws_diskcache_unlist(struct lws_diskcache_scan *lds,
+		       struct lws_diskcache_entry *e)
+{
+	lws_start_foreach_llp(struct lws_diskcache_entry **, pe,
+			      lds->buckets[e->hash & (lds->count_buckets - 1)]) {
+		if (*pe == e) {
+			*pe = e->hash_next;
+			break;
+		}
+	} lws_end_foreach_llp(pe, hash_next);
+
+	if (e->pending)
+		lws_start_foreach_llp(struct lws_diskcache_entry **, pe,
+				      lds->pending) {
+			if (*pe == e) {
+				*pe = e->pending_next;
+				break;
+			}
+		} lws_end_foreach_llp(pe, pending_next);
+
+	__lws_diskcache_lru_unlink(lds, e);
+	lds->agg_size -= e->size;
+	lds->count_entries--;
+}
+
+/*
+ * While the index is being built, entries go on the lru list in the order we
+ * find them... once we have seen everything, sort it once by when each was
+ * last used.  It's a merge sort on the singly-linked lru_next chain, then the
+ * prev pointers and tail are fixed up afterwards.
+ */
+
+static void
+__lws_diskcache_lru_sort(struct lws_diskcache_scan *lds)
+{
+	struct lws_diskcache_entry *list = lds->lru_head, *p, *q, *e, *tail;
+	int insize = 1, nmerges, psize, qsize, n;
+
+	if (!list)
+		return;
+
+	do {
+		p = list;
+		list = tail = NULL;
+		nmerges = 0;
+
+		while (p) {
+			nmerges++;
+			q = p;
+			psize = 0;
+			for (n = 0; n < insize && q; n++) {
+				psize++;
+				q = q->lru_next;
+			}
+			qsize = insize;
+
+			while (psize || (qsize && q)) {
+				if (!psize) {
+					e = q;
+					q = q->lru_next;
+					qsize--;
+				} else if (!qsize || !q || p->used >= q->used) {
+					e = p;
+					p = p->lru_next;
+					psize--;
+				} else {
+					e = q;
+					q = q->lru_next;
+					qsize--;
+				}
+
+				if (tail)
+					tail->lru_next = e;
+				else
+					list = e;
+				tail = e;
+			}
+
+			p = q;
+		}
+
+		tail->lru_next = NULL;
+		insize *= 2;
+	} while (nmerges > 1);
+
+	lds->lru_head = list;
+	p = NULL;
+	for (e = list; e; e = e->lru_next) {
+		e->lru_prev = p;
+		p = e;
+	}
+	lds->lru_tail = p;
 }
 
 struct lws_diskcache_scan *
@@ -88,8 +322,19 @@ lws_diskcache_create(const char *cache_dir_base, uint64_t cache_size_limit)
 
 	memset(lds, 0, sizeof(*lds));
 
+	lds->count_buckets = 1024;
+	lds->buckets = lws_zalloc(sizeof(*lds->buckets) * lds->count_buckets,
+				  "diskcache buckets");
+	if (!lds->buckets) {
+		lws_free(lds);
+
+		return NULL;
+	}
+
+	pthread_mutex_init(&lds->lock, NULL);
 	lds->cache_dir_base = cache_dir_base;
 	lds->cache_size_limit = cache_size_limit;
+	lds->secs_waiting = 1;
 
 	return lds;
 }
@@ -97,8 +342,16 @@ lws_diskcache_create(const char *cache_dir_base, uint64_t cache_size_limit)
 void
 lws_diskcache_destroy(struct lws_diskcache_scan **lds)
 {
-	if ((*lds)->batch)
-		lws_free((*lds)->batch);
+	struct lws_diskcache_entry *e = (*lds)->lru_head, *e1;
+
+	while (e) {
+		e1 = e->lru_next;
+		lws_free(e);
+		e = e1;
+	}
+
+	pthread_mutex_destroy(&(*lds)->lock);
+	lws_free((*lds)->buckets);
 	lws_free(*lds);
 	*lds = NULL;
 }
@@ -163,44 +416,96 @@ lws_diskcache_query(struct lws_diskcache_scan *lds, int is_bot,
 		    const char *hash_hex, int *_fd, char *cache, int cache_len,
 		    size_t *extant_cache_len)
 {
+	struct lws_diskcache_entry *e;
+	uint64_t size = 0;
+	time_t t = time(NULL);
+	int n, b, touch = 0;
 	struct stat s;
-	int n;
+	uint32_t h;
 
 	/* caching is disabled? */
 	if (!lds->cache_dir_base)
 		return LWS_DISKCACHE_QUERY_NO_CACHE;
 
-	if (!is_bot)
-		lds->cache_tries++;
-
 	n = lws_snprintf(cache, cache_len, "%s/%c/%c/%s", lds->cache_dir_base,
 			 hash_hex[0], hash_hex[1], hash_hex);
+	b = n - (int)strlen(hash_hex); /* offset of the filename part */
 
 	lwsl_info("%s: job cache %s\n", __func__, cache);
 
+	h = lws_diskcache_hash(hash_hex);
+
+	pthread_mutex_lock(&lds->lock); /* ======================== lds { */
+
+	if (!is_bot)
+		lds->cache_tries++;
+
+	e = __lws_diskcache_find(lds, hash_hex, h);
+	if (e) {
+		/* it's the newest thing in the lru now */
+		__lws_diskcache_lru_unlink(lds, e);
+		__lws_diskcache_lru_add_front(lds, e);
+		e->used = t;
+		size = e->size;
+
+		/*
+		 * we also update the mtime on disk from time to time, so the
+		 * index built after a restart still knows what is in use
+		 */
+		if (t - e->touched > LWS_DISKCACHE_TOUCH_SECS) {
+			e->touched = t;
+			touch = 1;
+		}
+	}
+
+	pthread_mutex_unlock(&lds->lock); /* } lds ===================== */
+
 	*_fd = open(cache, O_RDONLY);
 	if (*_fd >= 0) {
-		int fd;
 
-		if (!is_bot)
-			lds->cache_hits++;
+		if (!e) {
+			/*
+			 * Not indexed yet... either the index is still being
+			 * built, or somebody else put it in the cache dir
+			 */
+			if (fstat(*_fd, &s)) {
+				close(*_fd);
 
-		if (fstat(*_fd, &s)) {
-			close(*_fd);
+				return LWS_DISKCACHE_QUERY_NO_CACHE;
+			}
+			size = (uint64_t)s.st_size;
 
-			return LWS_DISKCACHE_QUERY_NO_CACHE;
+			pthread_mutex_lock(&lds->lock); /* =========== lds { */
+			if (!__lws_diskcache_find(lds, hash_hex, h))
+				__lws_diskcache_add(lds, hash_hex, h, size, t);
+			pthread_mutex_unlock(&lds->lock); /* } lds ======== */
 		}
 
-		*extant_cache_len = (size_t)s.st_size;
+		if (touch && futimens(*_fd, NULL))
+			lwsl_notice("%s: unable to touch %s\n", __func__,
+				    cache);
 
-		/* "touch" the hit cache file so it's last for LRU now */
-		fd = open(cache, O_RDWR);
-		if (fd >= 0)
-			close(fd);
+		pthread_mutex_lock(&lds->lock); /* =================== lds { */
+		if (!is_bot)
+			lds->cache_hits++;
+		pthread_mutex_unlock(&lds->lock); /* } lds ================ */
+
+		*extant_cache_len = (size_t)size;
 
 		return LWS_DISKCACHE_QUERY_EXISTS;
 	}
 
+	if (e) {
+		/* the index was wrong, it's gone from the disk */
+		pthread_mutex_lock(&lds->lock); /* =================== lds { */
+		e = __lws_diskcache_find(lds, hash_hex, h);
+		if (e && !e->pending) {
+			__lws_diskcache_unlist(lds, e);
+			lws_free(e);
+		}
+		pthread_mutex_unlock(&lds->lock); /* } lds ================ */
+	}
+
 	/* bots are too random to pollute the cache with their antics */
 	if (is_bot)
 		return LWS_DISKCACHE_QUERY_NO_CACHE;
@@ -218,6 +523,23 @@ lws_diskcache_query(struct lws_diskcache_scan *lds, int is_bot,
 		return LWS_DISKCACHE_QUERY_NO_CACHE;
 	}
 
+	/*
+	 * Index the temp file as pending, trim will look for it being
+	 * renamed to the final name by lws_diskcache_finalize_name()
+	 */
+
+	pthread_mutex_lock(&lds->lock); /* ======================== lds { */
+	h = lws_diskcache_hash(cache + b);
+	if (!__lws_diskcache_find(lds, cache + b, h)) {
+		e = __lws_diskcache_add(lds, cache + b, h, 0, t);
+		if (e) {
+			e->pending = 1;
+			e->pending_next = lds->pending;
+			lds->pending = e;
+		}
+	}
+	pthread_mutex_unlock(&lds->lock); /* } lds ===================== */
+
 	return LWS_DISKCACHE_QUERY_CREATING;
 }
 
@@ -228,64 +550,25 @@ lws_diskcache_secs_to_idle(struct lws_diskcache_scan *lds)
 }
 
 /*
- * The goal is to collect the oldest BATCH_COUNT filepaths and filesizes from
- * the dirs under the cache dir.  Since we don't need or want a full list of
- * files in there in memory at once, we restrict the linked-list size to
- * BATCH_COUNT entries, and once it is full, simply ignore any further files
- * that are newer than the newest one on that list.  Files older than the
- * newest guy already on the list evict the newest guy already on the list
- * and are sorted into the correct order.  In this way no matter the number
- * of files to be processed the memory requirement is fixed at BATCH_COUNT
- * struct file_entry-s.
- *
- * The oldest subset of BATCH_COUNT files are sorted into the cd->batch
- * allocation in more recent -> least recent order.
- *
- * We want to track the total size of all files we saw as well, so we know if
- * we need to actually do anything yet to restrict how much space it's taking
- * up.
+ * Read one subdir of the cache into the index.  We only need the size and
+ * mtime, which we can get with fstatat() on the dir without opening each
+ * file.  When every subdir has been read, the lru list is sorted by mtime and
+ * the index is ready to drive trimming.
  *
- * And we want to do those things statefully and incrementally instead of one
- * big atomic operation, since the user may want a huge cache, so we look in
- * one cache dir at a time and track state in the repodir struct.
- *
- * When we have seen everything, we add the doubly-linked prev pointers and then
- * if we are over the limit, start deleting up to BATCH_COUNT files working back
- * from the end.
+ * Temp files somebody else is creating are indexed as pending, the same as
+ * our own, so trim won't delete them while they are being written.
  */
 
-int
-lws_diskcache_trim(struct lws_diskcache_scan *lds)
+static int
+lws_diskcache_index_subdir(struct lws_diskcache_scan *lds)
 {
-	size_t cache_size_limit = lds->cache_size_limit;
-	char dirpath[132], filepath[132 + 32];
-	lws_list_ptr lp, op = NULL;
-	int files_trimmed = 0;
-	struct file_entry *p;
-	int fd, n, ret = -1;
-	size_t trimmed = 0;
+	struct lws_diskcache_entry *e;
+	char dirpath[132];
 	struct dirent *de;
 	struct stat s;
+	uint32_t h;
 	DIR *dir;
 
-	if (!lds->cache_subdir) {
-
-		if (lds->last_scan_completed + lds->secs_waiting > time(NULL))
-			return 0;
-
-		lds->batch = lws_malloc(sizeof(struct file_entry) *
-				BATCH_COUNT, "cache_trim");
-		if (!lds->batch) {
-			lwsl_err("%s: OOM\n", __func__);
-
-			return 1;
-		}
-		lds->agg_size = 0;
-		lds->head = NULL;
-		lds->batch_in_use = 0;
-		lds->agg_file_count = 0;
-	}
-
 	lws_snprintf(dirpath, sizeof(dirpath), "%s/%c/%c",
 		     lds->cache_dir_base, hex[(lds->cache_subdir >> 4) & 15],
 		     hex[lds->cache_subdir & 15]);
@@ -302,175 +585,219 @@ lws_diskcache_trim(struct lws_diskcache_scan *lds)
 		if (!de)
 			break;
 
-		if (de->d_type != DT_REG)
+		if (de->d_type != DT_REG && de->d_type != DT_UNKNOWN)
 			continue;
 
-		lds->agg_file_count++;
+		/*
+		 * queries, or the last pass, may have indexed it already...
+		 * if so there's no need to stat it again
+		 */
 
-		lws_snprintf(filepath, sizeof(filepath), "%s/%s", dirpath,
-			     de->d_name);
+		h = lws_diskcache_hash(de->d_name);
 
-		fd = open(filepath, O_RDONLY);
-		if (fd < 0) {
-			lwsl_err("%s: cannot open %s\n", __func__, filepath);
+		pthread_mutex_lock(&lds->lock); /* =================== lds { */
+		e = __lws_diskcache_find(lds, de->d_name, h);
+		pthread_mutex_unlock(&lds->lock); /* } lds ================ */
+		if (e)
+			continue;
 
+		if (fstatat(dirfd(dir), de->d_name, &s, AT_SYMLINK_NOFOLLOW)) {
+			if (errno != ENOENT) /* else deleted since readdir */
+				lwsl_notice("%s: cannot stat %s/%s\n",
+					    __func__, dirpath, de->d_name);
 			continue;
 		}
-
-		n = fstat(fd, &s);
-		close(fd);
-		if (n) {
-			lwsl_notice("%s: cannot stat %s\n", __func__, filepath);
+		if (!S_ISREG(s.st_mode))
 			continue;
+
+		pthread_mutex_lock(&lds->lock); /* =================== lds { */
+		if (!__lws_diskcache_find(lds, de->d_name, h)) {
+			e = __lws_diskcache_add(lds, de->d_name, h,
+						(uint64_t)s.st_size, s.st_mtime);
+			if (e && strchr(de->d_name, '~')) {
+				e->pending = 1;
+				e->pending_next = lds->pending;
+				lds->pending = e;
+			}
 		}
+		pthread_mutex_unlock(&lds->lock); /* } lds ================ */
 
-		lds->agg_size += s.st_size;
+	} while (de);
 
-		if (lds->batch_in_use == BATCH_COUNT) {
-			/*
-			 * once we filled up the batch with candidates, we don't
-			 * need to consider any files newer than the newest guy
-			 * on the list...
-			 */
-			if (lp_to_fe(lds->head, sorted)->modified < s.st_mtime)
-				continue;
+	closedir(dir);
 
-			/*
-			 * ... and if we find an older file later, we know it
-			 * will be replacing the newest guy on the list, so use
-			 * that directly...
-			 */
-			p = lds->head;
-			lds->head = p->sorted;
-		} else
-			/* we are still accepting anything to fill the batch */
+	if (++lds->cache_subdir != 0x100)
+		return 0;
+
+	lds->cache_subdir = 0;
+	if (lds->indexed)
+		/* that was just a rescan */
+		return 0;
 
-			p = &lds->batch[lds->batch_in_use++];
+	pthread_mutex_lock(&lds->lock); /* ======================== lds { */
+	__lws_diskcache_lru_sort(lds);
+	lds->indexed = 1;
+	pthread_mutex_unlock(&lds->lock); /* } lds ===================== */
 
-		p->sorted = NULL;
-		strncpy(p->name, de->d_name, sizeof(p->name) - 1);
-		p->name[sizeof(p->name) - 1] = '\0';
-		p->modified = s.st_mtime;
-		p->size = s.st_size;
+	lwsl_notice("%s: %s: indexed %u files, %lluMiB\n", __func__,
+		    lds->cache_dir_base, lds->count_entries,
+		    (unsigned long long)lds->agg_size / MIB);
 
-		lws_list_ptr_insert(&lds->head, &p->sorted, fe_modified_sort);
-	} while (de);
+	return 0;
+}
 
-	ret = 0;
+/*
+ * Each call before the index is complete reads one more subdir into it.
+ *
+ * Once it's complete, a call every LWS_DISKCACHE_RESCAN_SECS rescans one subdir
+ * for files added by others.  Each call looks for pending temp files having been renamed to their final name, so
+ * we learn their size, and if the cache is over its size limit, we delete the
+ * least recently used files until it's back under it, or we deleted
+ * BATCH_COUNT files this time.  Temp files still being written are skipped.
+ */
+
+int
+lws_diskcache_trim(struct lws_diskcache_scan *lds)
+{
+	struct lws_diskcache_entry *e, *e1, *victims = NULL;
+	uint64_t cache_size_limit = lds->cache_size_limit;
+	int files_trimmed = 0, stale = 0, n;
+	char filepath[256], *p;
+	time_t t = time(NULL);
+	uint64_t trimmed = 0;
+	struct stat s;
+	uint32_t h;
 
-	lds->cache_subdir++;
-	if (lds->cache_subdir != 0x100)
-		goto done;
+	if (!lds->indexed)
+		return lws_diskcache_index_subdir(lds);
 
-	/* we completed the whole scan... */
+	/*
+	 * pick up anything others added to the next subdir since our last
+	 * pass... it's not urgent, so not every call
+	 */
+	if (t - lds->last_rescan >= LWS_DISKCACHE_RESCAN_SECS) {
+		lds->last_rescan = t;
+		lws_diskcache_index_subdir(lds);
+	}
 
 	/* if really no guidence, then 256MiB */
 	if (!cache_size_limit)
 		cache_size_limit = 256 * 1024 * 1024;
 
-	if (lds->agg_size > cache_size_limit) {
+	pthread_mutex_lock(&lds->lock); /* ======================== lds { */
 
-		/* apply prev pointers to make the list doubly-linked */
+	e = lds->pending;
+	while (e) {
+		e1 = e->pending_next;
 
-		lp = lds->head;
-		while (lp) {
-			p = lp_to_fe(lp, sorted);
+		lws_snprintf(filepath, sizeof(filepath), "%s/%c/%c/%s",
+			     lds->cache_dir_base, lde_name(e)[0],
+			     lde_name(e)[1], lde_name(e));
 
-			p->prev = op;
-			op = &p->prev;
-			lp = p->sorted;
+		n = stat(filepath, &s);
+		if (!n && t - s.st_mtime < LWS_DISKCACHE_TEMP_STALE_SECS) {
+			/* still being created... track how big it is */
+			lds->agg_size = lds->agg_size - e->size +
+					(uint64_t)s.st_size;
+			e->size = (uint64_t)s.st_size;
+			e = e1;
+			continue;
 		}
 
-		/*
-		 * reverse the list (start from tail, now traverse using
-		 * .prev)... it's oldest-first now...
-		 */
-
-		lp = op;
-
-		while (lp && lds->agg_size > cache_size_limit) {
-			p = lp_to_fe(lp, prev);
-
-			lws_snprintf(filepath, sizeof(filepath), "%s/%c/%c/%s",
-				     lds->cache_dir_base, p->name[0],
-				     p->name[1], p->name);
+		__lws_diskcache_unlist(lds, e);
 
-			if (!unlink(filepath)) {
-				lds->agg_size -= p->size;
-				trimmed += p->size;
-				files_trimmed++;
-			} else
-				lwsl_notice("%s: Failed to unlink %s\n",
-					    __func__, filepath);
-
-			lp = p->prev;
+		if (!n) {
+			/* nobody finished it, delete it with the lru victims */
+			trimmed += e->size;
+			files_trimmed++;
+			e->hash_next = victims;
+			victims = e;
+			e = e1;
+			continue;
 		}
 
-		if (files_trimmed)
-			lwsl_notice("%s: %s: trimmed %d files totalling "
-				    "%lldKib, leaving %lldMiB\n", __func__,
-				    lds->cache_dir_base, files_trimmed,
-				    ((unsigned long long)trimmed) / KIB,
-				    ((unsigned long long)lds->agg_size) / MIB);
+		/* the temp file is gone... did it get its final name? */
+		p = strchr(filepath, '~');
+		if (p) {
+			*p = '\0';
+			if (!stat(filepath, &s)) {
+				p = strrchr(filepath, '/') + 1;
+				h = lws_diskcache_hash(p);
+				e1 = __lws_diskcache_find(lds, p, h);
+				if (e1) {
+					lds->agg_size = lds->agg_size -
+						e1->size + (uint64_t)s.st_size;
+					e1->size = (uint64_t)s.st_size;
+				} else
+					__lws_diskcache_add(lds, p, h,
+						(uint64_t)s.st_size, e->used);
+			}
+		}
+		e1 = e->pending_next;
+		lws_free(e);
+		e = e1;
 	}
 
-	if (lds->agg_size && lds->agg_file_count)
-		lds->avg_size = lds->agg_size / lds->agg_file_count;
-
 	/*
-	 * estimate how long we can go before scanning again... default we need
-	 * to start again immediately
+	 * take the least recently used out of the index while oversize, but
+	 * leave temp files that are still being written
 	 */
 
-	lds->last_scan_completed = time(NULL);
-	lds->secs_waiting = 1;
-
-	if (lds->agg_size < cache_size_limit) {
-		uint64_t avg = 4096, capacity, projected;
-
-		/* let's use 80% of the real average for margin */
-		if (lds->agg_size && lds->agg_file_count)
-			avg = ((lds->agg_size * 8) / lds->agg_file_count) / 10;
-
-		/*
-		 * if we collected BATCH_COUNT files of the average size,
-		 * how much can we clean up in 256s?
-		 */
-
-		capacity = avg * BATCH_COUNT;
-
-		/*
-		 * if the cache grew by 10%, would we hit the limit even then?
-		 */
-		projected = (lds->agg_size * 11) / 10;
-		if (projected < cache_size_limit)
-			/* no... */
-			lds->secs_waiting  = (256 / 2) * ((cache_size_limit -
-						    projected) / capacity);
-
-		/*
-		 * large waits imply we may not have enough info yet, so
-		 * check once an hour at least.
-		 */
-
-		if (lds->secs_waiting > 3600)
-			lds->secs_waiting = 3600;
-	} else
-		lds->secs_waiting = 0;
-
-	lwsl_info("%s: cache %s: %lldKiB / %lldKiB, next scan %ds\n", __func__,
-		  lds->cache_dir_base,
-		  (unsigned long long)lds->agg_size / KIB,
-		  (unsigned long long)cache_size_limit / KIB,
-		  lds->secs_waiting);
-
-	lws_free(lds->batch);
-	lds->batch = NULL;
+	e = lds->lru_tail;
+	while (lds->agg_size > cache_size_limit && e &&
+	       files_trimmed < BATCH_COUNT) {
+		e1 = e->lru_prev;
+		if (!e->pending) {
+			__lws_diskcache_unlist(lds, e);
+			trimmed += e->size;
+			files_trimmed++;
+			e->hash_next = victims;
+			victims = e;
+		}
+		e = e1;
+	}
 
-	lds->cache_subdir = 0;
+	lds->secs_waiting = lds->agg_size > cache_size_limit ? 0 : 1;
+
+	pthread_mutex_unlock(&lds->lock); /* } lds ===================== */
+
+	/* we can do the deletions without holding up queries */
+
+	e = victims;
+	while (e) {
+		e1 = e->hash_next;
+
+		lws_snprintf(filepath, sizeof(filepath), "%s/%c/%c/%s",
+			     lds->cache_dir_base, lde_name(e)[0],
+			     lde_name(e)[1], lde_name(e));
+		if (unlink(filepath)) {
+			if (errno == ENOENT) {
+				/*
+				 * somebody sharing the cache dir deleted it
+				 * already... it was only in our index.  Taking
+				 * it out of there already removed its size
+				 * from agg_size, but we didn't free anything.
+				 */
+				trimmed -= e->size;
+				files_trimmed--;
+				stale++;
+			} else
+				lwsl_notice("%s: Failed to unlink %s\n",
+					    __func__, filepath);
+		}
+		lws_free(e);
+		e = e1;
+	}
 
-done:
-	closedir(dir);
+	if (files_trimmed)
+		lwsl_notice("%s: %s: trimmed %d files totalling "
+			    "%lldKib, leaving %lldMiB\n", __func__,
+			    lds->cache_dir_base, files_trimmed,
+			    ((unsigned long long)trimmed) / KIB,
+			    ((unsigned long long)lds->agg_size) / MIB);
+	if (stale)
+		lwsl_info("%s: %s: dropped %d index entries already deleted\n",
+			  __func__, lds->cache_dir_base, stale);
 
-	return ret;
+	return 0;
 }
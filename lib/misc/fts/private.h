@@ -4,12 +4,32 @@
 //typedef off_t jg2_file_offset;
 typedef uint32_t jg2_file_offset;
 
+/*
+ * A filepath that is removed from the given segment and any older ones, either
+ * by lws_fts_tombstone() or because a newer delta segment indexed it again
+ */
+
+struct lws_fts_tombstone {
+	struct lws_fts_tombstone *next;
+	int segment;
+
+	/* - filepath (NUL-terminated) follows */
+};
+
 struct lws_fts_file {
+	struct lws_fts_file *segment_next; /* next newer delta segment */
+
+	/* base index only: everything removed from the set of segments */
+	struct lwsac *lwsac_tombstones;
+	struct lws_fts_tombstone *tombstone_list;
+
+	unsigned char *map; /* whole index mapped read-only, or NULL */
 	int fd;
 	jg2_file_offset root, flen, filepath_table;
 	int max_direct_hits;
 	int max_completion_hits;
 	int filepaths;
+	int segment; /* 0 for the base index, else delta segment ordinal */
 };
 
 
@@ -21,3 +41,14 @@ struct lws_fts_file {
 
 int
 rq32(unsigned char *b, uint32_t *d);
+
+int
+lws_fts_filepath(struct lws_fts_file *jtf, int filepath_index, char *result,
+		 size_t len, uint32_t *ofs_linetable, uint32_t *lines);
+
+int
+lws_fts_segments_open(struct lws_fts_file *jtf, const char *filepath,
+		      int flags);
+
+int
+lws_fts_filepath_live(struct lws_fts_file *set, int segment, const char *path);
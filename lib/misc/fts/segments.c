@@ -0,0 +1,449 @@
+/*
+ * libwebsockets - fulltext search delta segments
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * An index file is immutable once serialized.  To add input files without
+ * recreating it, they are indexed into small "delta segment" index files
+ * alongside it, "path.1", "path.2" etc, which are searched together with the
+ * base index.  Filepaths removed since are listed in "path.tomb", one per line
+ * as "<newest segment ordinal when removed> <filepath>".
+ *
+ * Compaction creates a new base index from the live filepaths and drops the
+ * segments and removed list.
+ *
+ * Adding a segment, removing a filepath and compacting all hold an exclusive
+ * flock() on "path.lock" while they work, so they see a consistent set of
+ * segments and removals.  It can't be on the base index itself, since
+ * compaction renames a new one over it.  Searches don't take it.
+ */
+
+#include "core/private.h"
+#include "misc/fts/private.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/*
+ * returns an fd holding the exclusive update lock for the index, or -1; close
+ * the fd to release it
+ */
+
+static int
+lws_fts_update_lock(const char *index_path)
+{
+	char path[256];
+	int fd;
+
+	lws_snprintf(path, sizeof(path), "%s.lock", index_path);
+	fd = open(path, O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		lwsl_err("%s: can't open %s\n", __func__, path);
+
+		return -1;
+	}
+
+	while (flock(fd, LOCK_EX))
+		if (errno != EINTR) {
+			lwsl_err("%s: flock %s failed (%d)\n", __func__, path,
+				 errno);
+			close(fd);
+
+			return -1;
+		}
+
+	return fd;
+}
+
+static int
+lws_fts_tombstone_add(struct lws_fts_file *jtf, int segment, const char *path)
+{
+	struct lws_fts_tombstone *ts;
+	size_t len = strlen(path);
+
+	ts = lwsac_use(&jtf->lwsac_tombstones, sizeof(*ts) + len + 1, 0);
+	if (!ts)
+		return 1;
+
+	ts->next = jtf->tombstone_list;
+	ts->segment = segment;
+	memcpy(ts + 1, path, len + 1);
+	jtf->tombstone_list = ts;
+
+	return 0;
+}
+
+/*
+ * returns how many delta segments follow the index, segment ordinals are
+ * contiguous from 1
+ */
+
+static int
+lws_fts_segments_count(const char *index_path)
+{
+	char path[256];
+	struct stat s;
+	int n = 0;
+
+	do {
+		lws_snprintf(path, sizeof(path), "%s.%d", index_path, n + 1);
+		if (stat(path, &s))
+			return n;
+		n++;
+	} while (1);
+}
+
+static int
+lws_fts_tombstones_load(struct lws_fts_file *jtf, const char *index_path)
+{
+	char path[256], *buf, *p, *end, *sp;
+	int fd, ret = 1;
+	struct stat s;
+
+	lws_snprintf(path, sizeof(path), "%s.tomb", index_path);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		/* nothing was removed */
+		return 0;
+
+	if (fstat(fd, &s))
+		goto bail;
+
+	buf = lws_malloc(s.st_size + 1, "fts tomb");
+	if (!buf)
+		goto bail;
+
+	if (read(fd, buf, s.st_size) != s.st_size) {
+		lwsl_err("%s: unable to read %s\n", __func__, path);
+		goto bail1;
+	}
+	buf[s.st_size] = '\0';
+
+	p = buf;
+	while ((end = strchr(p, '\n'))) {
+		*end = '\0';
+		sp = strchr(p, ' ');
+		if (sp && lws_fts_tombstone_add(jtf, atoi(p), sp + 1))
+			goto bail1;
+		p = end + 1;
+	}
+
+	ret = 0;
+
+bail1:
+	lws_free(buf);
+bail:
+	close(fd);
+
+	return ret;
+}
+
+int
+lws_fts_segments_open(struct lws_fts_file *jtf, const char *filepath,
+		      int flags)
+{
+	struct lws_fts_file *seg, **pseg = &jtf->segment_next;
+	int n, m, count = lws_fts_segments_count(filepath);
+	char path[256], fp[256];
+
+	for (n = 1; n <= count; n++) {
+		lws_snprintf(path, sizeof(path), "%s.%d", filepath, n);
+		seg = lws_fts_open_flags(path, flags & ~LWSFTS_F_OPEN_SEGMENTS);
+		if (!seg)
+			/* compaction removed it since we looked */
+			break;
+
+		seg->segment = n;
+		*pseg = seg;
+		pseg = &seg->segment_next;
+
+		/* filepaths indexed again here supersede the older copies */
+
+		for (m = 0; m < seg->filepaths; m++)
+			if (lws_fts_filepath(seg, m, fp, sizeof(fp), NULL, NULL) ||
+			    lws_fts_tombstone_add(jtf, n - 1, fp))
+				return 1;
+	}
+
+	return lws_fts_tombstones_load(jtf, filepath);
+}
+
+int
+lws_fts_filepath_live(struct lws_fts_file *set, int segment, const char *path)
+{
+	struct lws_fts_tombstone *ts = set->tombstone_list;
+
+	while (ts) {
+		if (ts->segment >= segment &&
+		    !strcmp((const char *)(ts + 1), path))
+			return 0;
+
+		ts = ts->next;
+	}
+
+	return 1;
+}
+
+static int
+lws_fts_index_path(struct lws_fts *t, const char *path)
+{
+	int fi, fd, n, ret = 0;
+	char buf[8192];
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		lwsl_err("%s: unable to open %s\n", __func__, path);
+
+		return 1;
+	}
+
+	fi = lws_fts_file_index(t, path, (int)strlen(path), 0);
+	if (fi < 0) {
+		close(fd);
+
+		return 1;
+	}
+
+	while ((n = (int)read(fd, buf, sizeof(buf))) > 0)
+		if (lws_fts_fill(t, fi, buf, n)) {
+			ret = 1;
+			break;
+		}
+
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Create a complete index at path from the input filepaths.  It's written to a
+ * temp file and renamed into place, so it's never seen partially written.
+ */
+
+static int
+lws_fts_build(const char *path, const char * const *filepaths, int count)
+{
+	struct lws_fts *t;
+	int fd, n, ret = 1;
+	char temp[256];
+
+	lws_snprintf(temp, sizeof(temp), "%s.new", path);
+	fd = open(temp, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd < 0) {
+		lwsl_err("%s: can't open %s\n", __func__, temp);
+
+		return 1;
+	}
+
+	t = lws_fts_create(fd);
+	if (!t)
+		goto bail;
+
+	for (n = 0; n < count; n++)
+		if (lws_fts_index_path(t, filepaths[n]))
+			goto bail1;
+
+	if (lws_fts_serialize(t))
+		goto bail1;
+
+	ret = 0;
+
+bail1:
+	lws_fts_destroy(&t);
+bail:
+	close(fd);
+
+	if (!ret && rename(temp, path)) {
+		lwsl_err("%s: rename to %s failed (%d)\n", __func__, path,
+			 errno);
+		ret = 1;
+	}
+	if (ret)
+		unlink(temp);
+
+	return ret;
+}
+
+int
+lws_fts_segment_add(const char *index_path, const char * const *filepaths,
+		    int count)
+{
+	int n, lfd = lws_fts_update_lock(index_path);
+	char path[256];
+	struct stat s;
+
+	if (lfd < 0)
+		return -1;
+
+	if (stat(index_path, &s)) {
+		/* there's no base index yet, this becomes it */
+		n = lws_fts_build(index_path, filepaths, count) ? -1 : 0;
+		goto bail;
+	}
+
+	n = lws_fts_segments_count(index_path) + 1;
+	lws_snprintf(path, sizeof(path), "%s.%d", index_path, n);
+	if (lws_fts_build(path, filepaths, count)) {
+		n = -1;
+		goto bail;
+	}
+
+	lwsl_info("%s: %s: added segment %d with %d files\n", __func__,
+		  index_path, n, count);
+
+bail:
+	close(lfd);
+
+	return n;
+}
+
+int
+lws_fts_tombstone(const char *index_path, const char *filepath)
+{
+	char path[256], line[300];
+	int fd, lfd, n, ret = 1;
+
+	if (strlen(filepath) > 255)
+		return 1;
+
+	lfd = lws_fts_update_lock(index_path);
+	if (lfd < 0)
+		return 1;
+
+	lws_snprintf(path, sizeof(path), "%s.tomb", index_path);
+	n = lws_snprintf(line, sizeof(line), "%d %s\n",
+			 lws_fts_segments_count(index_path), filepath);
+
+	/* a single small O_APPEND write can't interleave with another */
+
+	fd = open(path, O_CREAT | O_WRONLY | O_APPEND, 0600);
+	if (fd < 0) {
+		lwsl_err("%s: can't open %s\n", __func__, path);
+		goto bail;
+	}
+
+	if (write(fd, line, n) == n)
+		ret = 0;
+
+	close(fd);
+
+bail:
+	close(lfd);
+
+	return ret;
+}
+
+int
+lws_fts_compact(const char *index_path, int min_segments)
+{
+	struct lws_fts_file *jtf, *seg;
+	int n, count, total = 0, lives = 0, ret = 1;
+	char path[256], fp[256], *p;
+	struct lwsac *lac = NULL;
+	const char **live;
+	struct stat s;
+	int lfd;
+
+	/*
+	 * Hold off segment adds and removals until we're done, otherwise an
+	 * add could take a segment ordinal we are about to delete, or a
+	 * removal could go in the removed list after we read it
+	 */
+
+	lfd = lws_fts_update_lock(index_path);
+	if (lfd < 0)
+		return 1;
+
+	count = lws_fts_segments_count(index_path);
+	lws_snprintf(path, sizeof(path), "%s.tomb", index_path);
+	if (count < min_segments || (!count && stat(path, &s))) {
+		close(lfd);
+
+		return 0;
+	}
+
+	jtf = lws_fts_open_flags(index_path, LWSFTS_F_OPEN_SEGMENTS);
+	if (!jtf)
+		goto bail;
+
+	for (seg = jtf; seg; seg = seg->segment_next)
+		total += seg->filepaths;
+
+	live = lwsac_use(&lac, (total + 1) * sizeof(*live), 0);
+	if (!live)
+		goto bail;
+
+	/* collect the live filepaths, base index first */
+
+	for (seg = jtf; seg; seg = seg->segment_next)
+		for (n = 0; n < seg->filepaths; n++) {
+			if (lws_fts_filepath(seg, n, fp, sizeof(fp), NULL, NULL))
+				goto bail;
+
+			if (!lws_fts_filepath_live(jtf, seg->segment, fp))
+				continue;
+
+			if (stat(fp, &s)) {
+				lwsl_notice("%s: dropping missing %s\n",
+					    __func__, fp);
+				continue;
+			}
+
+			p = lwsac_use(&lac, strlen(fp) + 1, 0);
+			if (!p)
+				goto bail;
+			strcpy(p, fp);
+			live[lives++] = p;
+		}
+
+	lws_fts_close(jtf);
+	jtf = NULL;
+
+	if (lws_fts_build(index_path, live, lives))
+		goto bail;
+
+	/*
+	 * Everything live is in the new base index: remove the removed list,
+	 * then the segments newest first, so anything opening the index while
+	 * we do this sees at worst some redundant copies of the same files
+	 */
+
+	unlink(path);
+	for (n = count; n > 0; n--) {
+		lws_snprintf(path, sizeof(path), "%s.%d", index_path, n);
+		unlink(path);
+	}
+
+	lwsl_info("%s: %s: compacted %d segments, %d files live\n", __func__,
+		  index_path, count, lives);
+
+	ret = 0;
+
+bail:
+	if (jtf)
+		lws_fts_close(jtf);
+	lwsac_free(&lac);
+	close(lfd);
+
+	return ret;
+}
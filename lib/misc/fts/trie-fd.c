@@ -28,6 +28,9 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#if defined(LWS_HAVE_MMAP)
+#include <sys/mman.h>
+#endif
 
 #define AC_COUNT_STASHED_CHILDREN 8
 
@@ -78,11 +81,91 @@ b16(unsigned char *b)
 	return (b[0] << 8) | b[1];
 }
 
+/*
+ * Make the index content at file offset pos available at *pbuf.
+ *
+ * If the index is mapped, that is just a pointer into the mapping without any
+ * syscall or copy.  Otherwise up to len bytes are read into the caller's
+ * scratch buffer.  Either way no more than len bytes are reported available,
+ * and fewer near the end of the file.  Callers must check what they read
+ * against that, the index may be truncated or corrupt.
+ *
+ * Returns the number of bytes available at *pbuf, or -1 on error.
+ */
+
+static int
+lws_fts_grab(struct lws_fts_file *jtf, off_t pos, unsigned char *scratch,
+	     size_t len, unsigned char **pbuf)
+{
+#if defined(LWS_HAVE_MMAP)
+	if (jtf->map) {
+		if (pos < 0 || pos >= (off_t)jtf->flen)
+			return -1;
+
+		*pbuf = jtf->map + pos;
+		if ((off_t)len > (off_t)jtf->flen - pos)
+			len = (size_t)((off_t)jtf->flen - pos);
+
+		return (int)len;
+	}
+#endif
+
+	if (lseek(jtf->fd, pos, SEEK_SET) < 0) {
+		lwsl_err("%s: unable to seek\n", __func__);
+
+		return -1;
+	}
+
+	*pbuf = scratch;
+
+	return read(jtf->fd, scratch, len);
+}
+
+/*
+ * rq32() that fails rather than read past the ra bytes available at buf.
+ * Returns the new bp, or -1.
+ */
+
 static int
+lws_fts_rq32(unsigned char *buf, int bp, int ra, uint32_t *d)
+{
+	int n;
+
+	if (ra - bp >= 5)
+		return bp + rq32(&buf[bp], d);
+
+	for (n = bp; n < ra; n++)
+		if (!(buf[n] & 0x80))
+			return bp + rq32(&buf[bp], d);
+
+	return -1;
+}
+
+#define grab(_pos, _size) { \
+		bp = 0; \
+		ra = lws_fts_grab(jtf, _pos, sbuf, _size, &buf); \
+		if (ra < 0) \
+			goto bail; \
+}
+
+#define get32(_d) { \
+		bp = lws_fts_rq32(buf, bp, ra, _d); \
+		if (bp < 0) \
+			goto bail; \
+}
+
+/* fail unless _len bytes are available at bp */
+
+#define need(_len) { \
+		if (bp > ra || (size_t)(ra - bp) < (size_t)(_len)) \
+			goto bail; \
+}
+
+int
 lws_fts_filepath(struct lws_fts_file *jtf, int filepath_index, char *result,
 		 size_t len, uint32_t *ofs_linetable, uint32_t *lines)
 {
-	unsigned char buf[256 + 15];
+	unsigned char sbuf[256 + 15], *buf;
 	uint32_t flen;
 	int ra, bp = 0;
 	size_t m;
@@ -91,47 +174,36 @@ lws_fts_filepath(struct lws_fts_file *jtf, int filepath_index, char *result,
 	if (filepath_index > jtf->filepaths)
 		return 1;
 
-	if (lseek(jtf->fd, jtf->filepath_table + (4 * filepath_index),
-			SEEK_SET) < 0) {
-		lwsl_err("%s: unable to seek\n", __func__);
-
-		return 1;
-	}
-
-	ra = read(jtf->fd, buf, 4);
-	if (ra < 0)
-		return 1;
+	grab(jtf->filepath_table + (4 * filepath_index), 4);
+	need(4);
 
 	o = (unsigned int)b32(buf);
-	if (lseek(jtf->fd, o, SEEK_SET) < 0) {
-		lwsl_err("%s: unable to seek\n", __func__);
 
-		return 1;
-	}
-
-	ra = read(jtf->fd, buf, sizeof(buf));
-	if (ra < 0)
-		return 1;
+	grab(o, sizeof(sbuf));
 
 	if (ofs_linetable)
-		bp += rq32(&buf[bp], ofs_linetable);
+		get32(ofs_linetable)
 	else
-		bp += rq32(&buf[bp], &flen);
+		get32(&flen)
 	if (lines)
-		bp += rq32(&buf[bp], lines);
+		get32(lines)
 	else
-		bp += rq32(&buf[bp], &flen);
-	bp += rq32(&buf[bp], &flen);
+		get32(&flen)
+	get32(&flen);
 
 	m = flen;
 	if (len - 1 < m)
-		m = flen - 1;
+		m = len - 1;
+	need(m);
 
 	strncpy(result, (char *)&buf[bp], m);
 	result[m] = '\0';
 	result[len - 1] = '\0';
 
 	return 0;
+
+bail:
+	return 1;
 }
 
 /*
@@ -185,7 +257,7 @@ bail:
 }
 
 struct lws_fts_file *
-lws_fts_open(const char *filepath)
+lws_fts_open_flags(const char *filepath, int flags)
 {
 	struct lws_fts_file *jtf;
 
@@ -193,6 +265,12 @@ lws_fts_open(const char *filepath)
 	if (!jtf)
 		goto bail1;
 
+	jtf->segment_next = NULL;
+	jtf->lwsac_tombstones = NULL;
+	jtf->tombstone_list = NULL;
+	jtf->map = NULL;
+	jtf->segment = 0;
+
 	jtf->fd = open(filepath, O_RDONLY);
 	if (jtf->fd < 0) {
 		lwsl_err("%s: unable to open %s\n", __func__, filepath);
@@ -202,6 +280,26 @@ lws_fts_open(const char *filepath)
 	if (lws_fts_adopt(jtf) < 0)
 		goto bail3;
 
+#if defined(LWS_HAVE_MMAP)
+	if (!(flags & LWSFTS_F_OPEN_NO_MMAP)) {
+		void *p = mmap(NULL, jtf->flen, PROT_READ, MAP_SHARED,
+			       jtf->fd, 0);
+
+		if (p == MAP_FAILED)
+			lwsl_info("%s: unable to map %s, using reads\n",
+				  __func__, filepath);
+		else
+			jtf->map = p;
+	}
+#endif
+
+	if ((flags & LWSFTS_F_OPEN_SEGMENTS) &&
+	    lws_fts_segments_open(jtf, filepath, flags)) {
+		lws_fts_close(jtf);
+
+		return NULL;
+	}
+
 	return jtf;
 
 bail3:
@@ -212,39 +310,41 @@ bail1:
 	return NULL;
 }
 
+struct lws_fts_file *
+lws_fts_open(const char *filepath)
+{
+	return lws_fts_open_flags(filepath, 0);
+}
+
 void
 lws_fts_close(struct lws_fts_file *jtf)
 {
+	if (jtf->segment_next)
+		lws_fts_close(jtf->segment_next);
+	lwsac_free(&jtf->lwsac_tombstones);
+
+#if defined(LWS_HAVE_MMAP)
+	if (jtf->map)
+		munmap(jtf->map, jtf->flen);
+#endif
 	close(jtf->fd);
 	lws_free(jtf);
 }
 
-#define grab(_pos, _size) { \
-		bp = 0; \
-		if (lseek(jtf->fd, _pos, SEEK_SET) < 0) { \
-			lwsl_err("%s: unable to seek\n", __func__); \
-\
-			goto bail; \
-		} \
-\
-		ra = read(jtf->fd, buf, _size); \
-		if (ra < 0) \
-			goto bail; \
-}
-
 static struct linetable *
 lws_fts_cache_chunktable(struct lws_fts_file *jtf, uint32_t ofs_linetable,
 			 struct lwsac **linetable_head)
 {
 	struct linetable *lt, *first = NULL, **prev = NULL;
-	unsigned char buf[8];
+	unsigned char sbuf[8], *buf;
 	int line = 1, bp, ra;
 	off_t cfs = 0;
 
 	*linetable_head = NULL;
 
 	do {
-		grab(ofs_linetable, sizeof(buf));
+		grab(ofs_linetable, sizeof(sbuf));
+		need(8);
 
 		lt = lwsac_use(linetable_head, sizeof(*lt), 0);
 		if (!lt)
@@ -282,7 +382,7 @@ lws_fts_getfileoffset(struct lws_fts_file *jtf, struct linetable *ltstart,
 		      int line, off_t *_ofs)
 {
 	struct linetable *lt = ltstart;
-	unsigned char buf[LWS_FTS_LINES_PER_CHUNK * 5];
+	unsigned char sbuf[LWS_FTS_LINES_PER_CHUNK * 5], *buf;
 	uint32_t ll;
 	off_t ofs;
 	int bp, ra;
@@ -306,11 +406,11 @@ lws_fts_getfileoffset(struct lws_fts_file *jtf, struct linetable *ltstart,
 	ofs = lt->chunk_filepos_start;
 	line -= lt->chunk_line_number_start;
 
-	grab(lt->vli_ofs_in_index, sizeof(buf));
+	grab(lt->vli_ofs_in_index, sizeof(sbuf));
 
 	bp = 0;
 	while (line) {
-		bp += rq32(&buf[bp], &ll);
+		get32(&ll);
 		ofs += ll;
 		line--;
 	}
@@ -384,60 +484,44 @@ ac_record(struct lws_fts_file *jtf, struct lwsac **results_head,
 	return 0;
 }
 
-struct lws_fts_result *
-lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
+/*
+ * Search one index file of set, which may be the base index or one of its
+ * delta segments, adding any results to the ones already in result
+ */
+
+static int
+lws_fts_search_segment(struct lws_fts_file *set, struct lws_fts_file *jtf,
+		       struct lws_fts_search_params *ftsp, const char *needle,
+		       int nl, struct lws_fts_result *result)
 {
 	uint32_t children, instances, co, sl, agg, slt, chunk,
 		 fileofs_tif_start, desc, agg_instances;
-	int pos = 0, n, m, nl, bp, base = 0, ra, palm, budget, sp, ofd = -1;
-	unsigned long long tf = lws_time_in_microseconds();
-	struct lws_fts_result_autocomplete **pac = NULL;
-	char stasis, nac = 0, credible, needle[32];
+	int pos = 0, n, m, bp, base = 0, ra, palm, budget, sp, ofd = -1;
+	struct lws_fts_result_autocomplete **pac;
 	struct lws_fts_result_filepath *fp;
-	struct lws_fts_result *result;
-	unsigned char buf[4096];
+	unsigned char sbuf[4096], *buf;
 	off_t o, child_ofs;
 	struct wac s[128];
+	char nac = 0, credible;
 
-	ftsp->results_head = NULL;
-
-	if (!ftsp->needle)
-		return NULL;
-
-	nl = (int)strlen(ftsp->needle);
-	if ((size_t)nl > sizeof(needle) - 2)
-		return NULL;
-
-	result = lwsac_use(&ftsp->results_head, sizeof(*result), 0);
-	if (!result)
-		return NULL;
-
-	/* start with no results... */
-
-	result->autocomplete_head = NULL;
 	pac = &result->autocomplete_head;
-	result->filepath_head = NULL;
-	result->duration_ms = 0;
-	result->effective_flags = ftsp->flags;
+	while (*pac)
+		pac = &(*pac)->next;
 
 	palm = 0;
 
-	for (n = 0; n < nl; n++)
-		needle[n] = tolower(ftsp->needle[n]);
-	needle[nl] = '\0';
-
 	o = jtf->root;
 	do {
 		bp = 0;
 		base = 0;
 
-		grab(o, sizeof(buf));
+		grab(o, sizeof(sbuf));
 
 		child_ofs = o + bp;
-		bp += rq32(&buf[bp], &fileofs_tif_start);
-		bp += rq32(&buf[bp], &children);
-		bp += rq32(&buf[bp], &instances);
-		bp += rq32(&buf[bp], &agg_instances);
+		get32(&fileofs_tif_start);
+		get32(&children);
+		get32(&instances);
+		get32(&agg_instances);
 		palm = pos;
 
 		/* the children follow here */
@@ -456,7 +540,7 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 			/* we leave with bp positioned at the instance list */
 
 			o = fileofs_tif_start;
-			grab(o, sizeof(buf));
+			grab(o, sizeof(sbuf));
 			break;
 		}
 
@@ -468,7 +552,7 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 			 */
 
 			base += bp;
-			grab(o + base, sizeof(buf));
+			grab(o + base, sizeof(sbuf));
 		}
 
 		/* gets set if any child COULD match needle if it went on */
@@ -477,11 +561,18 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 		for (n = 0; (uint32_t)n < children; n++) {
 			uint32_t inst;
 
-			bp += rq32(&buf[bp], &co);
-			bp += rq32(&buf[bp], &inst);
-			bp += rq32(&buf[bp], &agg);
-			bp += rq32(&buf[bp], &desc);
-			bp += rq32(&buf[bp], &sl);
+			/* room for the child's five VLIs and the needle? */
+
+			if (ra - bp < 25 + nl - pos) {
+				base += bp;
+				grab(o + base, sizeof(sbuf));
+			}
+
+			get32(&co);
+			get32(&inst);
+			get32(&agg);
+			get32(&desc);
+			get32(&sl);
 
 			if (sl > (uint32_t)(nl - pos)) {
 
@@ -492,6 +583,8 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 				 */
 				size_t g = nl - pos;
 
+				need(g);
+
 				/*
 				 * "credible" means at least one child matches
 				 * all the chars in needle up to as many as it
@@ -520,6 +613,10 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 			slt = sl;
 			while (slt) {
 
+				/* nothing left in the file to compare */
+				if (bp >= ra)
+					goto bail;
+
 				/*
 				 * the strategy is to compare whatever we have
 				 * lying around, then bring in more if it didn't
@@ -556,7 +653,8 @@ lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
 					/* we matched the whole thing */
 					o = co;
 					if (!co)
-						goto bail;
+						/* nothing below it, no match */
+						return 0;
 					n = (int)children;
 					credible = 1;
 				}
@@ -566,9 +664,9 @@ ensure:
 				 * do we have at least buf more to match, or the
 				 * remainder of the string, whichever is less?
 				 *
-				 * bp may exceed sizeof(buf) on no match path
+				 * bp may exceed sizeof(sbuf) on no match path
 				 */
-				chunk = sizeof(buf);
+				chunk = sizeof(sbuf);
 				if (slt < chunk)
 					chunk = slt;
 
@@ -580,7 +678,7 @@ ensure:
 				 * at where we got to.
 				 */
 				base += bp;
-				grab(o + base, sizeof(buf));
+				grab(o + base, sizeof(sbuf));
 
 			} /* while we are still comparing */
 
@@ -588,17 +686,16 @@ ensure:
 
 		if ((uint32_t)n == children) {
 			if (!credible)
-				goto bail;
+				/* no match, that's not an error */
+				return 0;
 
 			nac = 0;
 			goto autocomp;
 		}
 	} while(1);
 
-	result->duration_ms = (int)((lws_time_in_microseconds() - tf) / 1000);
-
 	if (!instances && !children)
-		return result;
+		return 0;
 
 	/* the match list may easily exceed one read buffer load ... */
 
@@ -621,16 +718,17 @@ ensure:
 		off_t fo;
 
 		ofd = -1;
-		grab(o, sizeof(buf));
+		grab(o, sizeof(sbuf));
+		base = 0;
 
 		ro = o;
-		bp += rq32(&buf[bp], &_o);
+		get32(&_o);
 		o = _o;
 
 		assert(!o || o > TRIE_FILE_HDR_SIZE);
 
-		bp += rq32(&buf[bp], &fi);
-		bp += rq32(&buf[bp], &tot);
+		get32(&fi);
+		get32(&tot);
 
 		if (lws_fts_filepath(jtf, fi, path, sizeof(path) - 1,
 				     &ofs_linetable, &lines)) {
@@ -641,6 +739,11 @@ ensure:
 		if (ftsp->only_filepath && strcmp(path, ftsp->only_filepath))
 			continue;
 
+		/* removed, or superseded by a newer delta segment? */
+
+		if (!lws_fts_filepath_live(set, jtf->segment, path))
+			continue;
+
 		ltst = lws_fts_cache_chunktable(jtf, ofs_linetable, &lt_head);
 		if (!ltst)
 			goto bail;
@@ -694,10 +797,10 @@ ensure:
 
 				if ((ra - bp) < 8) {
 					base += bp;
-					grab(ro + base, sizeof(buf));
+					grab(ro + base, sizeof(sbuf));
 				}
 
-				bp += rq32(&buf[bp], &line);
+				get32(&line);
 				*u++ = line;
 
 				if (lws_fts_getfileoffset(jtf, ltst, line, &fo))
@@ -759,40 +862,10 @@ ensure:
 
 	} while (o);
 
-	/* sort the instance file list by results density */
-
-	do {
-		struct lws_fts_result_filepath **prf, *rf1, *rf2;
-
-		stasis = 1;
-
-		/* bubble sort keeps going until nothing changed */
-
-		prf = &result->filepath_head;
-		while (*prf) {
-
-			rf1 = *prf;
-			rf2 = rf1->next;
-
-			if (rf2 && rf1->lines_in_file && rf2->lines_in_file &&
-			    ((rf1->matches * 1000) / rf1->lines_in_file) <
-			    ((rf2->matches * 1000) / rf2->lines_in_file)) {
-				stasis = 0;
-
-				*prf = rf2;
-				rf1->next = rf2->next;
-				rf2->next = rf1;
-			}
-
-			prf = &(*prf)->next;
-		}
-
-	} while (!stasis);
-
 autocomp:
 
 	if (!(ftsp->flags & LWSFTS_F_QUERY_AUTOCOMPLETE) || nac)
-		return result;
+		return 0;
 
 	/*
 	 * autocomplete (ie, the descendent paths that yield the most hits)
@@ -818,7 +891,6 @@ autocomp:
 	budget = ftsp->max_autocomplete;
 	base = 0;
 	bp = 0;
-	pac = &result->autocomplete_head;
 	sp = 0;
 	if (pos > (int)sizeof(s[sp].ch[0].name) - 1)
 		pos = (int)sizeof(s[sp].ch[0].name) - 1;
@@ -838,12 +910,13 @@ autocomp:
 		int nobump = 0;
 		struct ch *tch = &s[sp].ch[s[sp].child - 1];
 
-		grab(child_ofs, sizeof(buf));
+		grab(child_ofs, sizeof(sbuf));
+		base = 0;
 
-		bp += rq32(&buf[bp], &fileofs_tif_start);
-		bp += rq32(&buf[bp], &children);
-		bp += rq32(&buf[bp], &instances);
-		bp += rq32(&buf[bp], &agg_instances);
+		get32(&fileofs_tif_start);
+		get32(&children);
+		get32(&instances);
+		get32(&agg_instances);
 
 		if (sp > 0 && s[sp - 1].done_children &&
 		    tch->effpos + tch->name_length >= nl &&
@@ -872,16 +945,27 @@ autocomp:
 				struct ch *ch = &s[sp].ch[i];
 				size_t max;
 
-				bp += rq32(&buf[bp], &cho);
-				bp += rq32(&buf[bp], &inst);
-				bp += rq32(&buf[bp], &agg);
-				bp += rq32(&buf[bp], &desc);
-				bp += rq32(&buf[bp], &slen);
+				if (ra - bp < 25) {
+					base += bp;
+					grab(child_ofs + base, sizeof(sbuf));
+				}
+
+				get32(&cho);
+				get32(&inst);
+				get32(&agg);
+				get32(&desc);
+				get32(&slen);
 
 				max = slen;
 				if (max > sizeof(ch->name) - 1)
 					max = sizeof(ch->name) - 1;
 
+				if (ra - bp < (int)max) {
+					base += bp;
+					grab(child_ofs + base, sizeof(sbuf));
+				}
+				need(max);
+
 				strncpy(ch->name, (char *)&buf[bp], max);
 				bp += slen;
 
@@ -961,6 +1045,135 @@ autocomp:
 		child_ofs = s[sp].ch[s[sp].child++].ofs;
 	}
 
+	return 0;
+
+bail:
+	if (ofd >= 0)
+		close(ofd);
+
+	lwsl_info("%s: search ended up at bail\n", __func__);
+
+	return 1;
+}
+
+/*
+ * The same string may be suggested by more than one segment, combine those
+ */
+
+static void
+lws_fts_ac_coalesce(struct lws_fts_result *result)
+{
+	struct lws_fts_result_autocomplete *ac, *ac1, **pac;
+
+	for (ac = result->autocomplete_head; ac; ac = ac->next) {
+		pac = &ac->next;
+		while (*pac) {
+			ac1 = *pac;
+			if (ac1->ac_length != ac->ac_length ||
+			    memcmp(ac1 + 1, ac + 1, ac->ac_length)) {
+				pac = &ac1->next;
+				continue;
+			}
+
+			ac->instances += ac1->instances;
+			ac->agg_instances += ac1->agg_instances;
+			ac->has_children |= ac1->has_children;
+			ac->elided |= ac1->elided;
+			*pac = ac1->next;
+		}
+	}
+}
+
+struct lws_fts_result *
+lws_fts_search(struct lws_fts_file *jtf, struct lws_fts_search_params *ftsp)
+{
+	unsigned long long tf = lws_time_in_microseconds();
+	struct lws_fts_result_autocomplete **pac;
+	struct lws_fts_result *result;
+	struct lws_fts_file *seg;
+	char stasis, needle[32];
+	int n, nl;
+
+	ftsp->results_head = NULL;
+
+	if (!ftsp->needle)
+		return NULL;
+
+	nl = (int)strlen(ftsp->needle);
+	if ((size_t)nl > sizeof(needle) - 2)
+		return NULL;
+
+	result = lwsac_use(&ftsp->results_head, sizeof(*result), 0);
+	if (!result)
+		return NULL;
+
+	/* start with no results... */
+
+	result->autocomplete_head = NULL;
+	result->filepath_head = NULL;
+	result->duration_ms = 0;
+	result->effective_flags = ftsp->flags;
+
+	for (n = 0; n < nl; n++)
+		needle[n] = tolower(ftsp->needle[n]);
+	needle[nl] = '\0';
+
+	/* the base index, then any delta segments, oldest first */
+
+	for (seg = jtf; seg; seg = seg->segment_next)
+		if (lws_fts_search_segment(jtf, seg, ftsp, needle, nl,
+					   result)) {
+			/* don't return results missing a segment as if whole */
+			lwsac_free(&ftsp->results_head);
+
+			return NULL;
+		}
+
+	result->duration_ms = (int)((lws_time_in_microseconds() - tf) / 1000);
+
+	/* sort the instance file list by results density */
+
+	do {
+		struct lws_fts_result_filepath **prf, *rf1, *rf2;
+
+		stasis = 1;
+
+		/* bubble sort keeps going until nothing changed */
+
+		prf = &result->filepath_head;
+		while (*prf) {
+
+			rf1 = *prf;
+			rf2 = rf1->next;
+
+			if (rf2 && rf1->lines_in_file && rf2->lines_in_file &&
+			    ((rf1->matches * 1000) / rf1->lines_in_file) <
+			    ((rf2->matches * 1000) / rf2->lines_in_file)) {
+				stasis = 0;
+
+				*prf = rf2;
+				rf1->next = rf2->next;
+				rf2->next = rf1;
+			}
+
+			prf = &(*prf)->next;
+		}
+
+	} while (!stasis);
+
+	/* keep the densest max_files of them */
+
+	{
+		struct lws_fts_result_filepath **prf = &result->filepath_head;
+
+		for (n = 0; *prf && n < ftsp->max_files; n++)
+			prf = &(*prf)->next;
+		*prf = NULL;
+	}
+
+	if (jtf->segment_next)
+		lws_fts_ac_coalesce(result);
+
 	/* let's do a final sort into agg order */
 
 	do {
@@ -989,13 +1202,14 @@ autocomp:
 
 	} while (!stasis);
 
-	return result;
-
-bail:
-	if (ofd >= 0)
-		close(ofd);
 
-	lwsl_info("%s: search ended up at bail\n", __func__);
+	if (jtf->segment_next) {
+		/* each segment may have contributed max_autocomplete */
+		pac = &result->autocomplete_head;
+		for (n = 0; *pac && n < ftsp->max_autocomplete; n++)
+			pac = &(*pac)->next;
+		*pac = NULL;
+	}
 
 	return result;
 }
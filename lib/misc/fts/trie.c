@@ -39,6 +39,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/types.h>
+#if defined(LWS_HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 struct lws_fts_entry;
 
@@ -81,6 +84,7 @@ struct lws_fts_instance_file {
 	struct lws_fts_lines *lines_list, *lines_tail;
 	uint32_t file_index;
 	uint32_t total;
+	jg2_file_offset ofs; /* in the input's output block, when written */
 
 	/*
 	 * optimization for the common case there's only 1 - ~3 matches, so we
@@ -110,6 +114,11 @@ struct lws_fts_entry {
 	struct lws_fts_instance_file *inst_file_list;
 
 	jg2_file_offset ofs_last_inst_file;
+	/*
+	 * shards only: fileoffset of the padded "prev" of the oldest instance
+	 * file in the chain, so it can be linked to another shard's chain
+	 */
+	jg2_file_offset ofs_inst_chain_tail;
 
 	char *suffix; /* suffix string or NULL if one char (in .c) */
 	jg2_file_offset ofs;
@@ -121,14 +130,29 @@ struct lws_fts_entry {
 	unsigned char c;
 };
 
-/* there's only one of these per trie file */
+/*
+ * there's one of these per trie file, plus one per shard that is later merged
+ * into it
+ */
 
 struct lws_fts {
 	struct lwsac *lwsac_head;
 	struct lwsac *lwsac_input_head;
 	struct lws_fts_entry *root;
 	struct lws_fts_filepath *filepath_list;
-	struct lws_fts_filepath *fp;
+	struct lws_fts_filepath *fp;	/* last filepath given an index */
+	struct lws_fts_filepath *fp_fill; /* filepath being filled */
+
+	struct lws_fts *parent;	/* shards: the trie we will merge into */
+
+	/*
+	 * Everything written for the input file being filled is collected
+	 * here, and written to the index file in one go when the input is
+	 * finalized
+	 */
+	unsigned char *ob;
+	size_t ob_len;
+	size_t ob_size;
 
 	struct lws_fts_entry *parser;
 	struct lws_fts_entry *root_lookup[256];
@@ -158,22 +182,36 @@ struct lws_fts {
 
 	unsigned char aggregate;
 	unsigned char agg[128];
+
+#if defined(LWS_HAVE_PTHREAD_H)
+	pthread_mutex_t lock; /* protects c and next_file_index from shards */
+#endif
 };
 
 /* since the kernel case allocates >300MB, no point keeping this too low */
 
 #define TRIE_LWSAC_BLOCK_SIZE (1024 * 1024)
 
+/* initial size of the per-input output block, it doubles as needed */
+
+#define TRIE_OB_INITIAL_SIZE (64 * 1024)
+
+/*
+ * Serialization builds entries in a local buf, which is moved on to t->ob when
+ * it is nearly full.  t->ob is written to the index when it reaches
+ * TRIE_OB_INITIAL_SIZE, or when forced.  The index file offset of buf[bp] is
+ * always t->c + t->ob_len + bp.
+ */
+
 #define spill(margin, force) \
 	if (bp && ((uint32_t)bp >= (sizeof(buf) - (margin)) || (force))) { \
-		if (write(t->fd, buf, bp) != bp) { \
-			lwsl_err("%s: write %d failed (%d)\n", __func__, \
-				 bp, errno); \
+		if (lws_fts_ob_append(t, buf, bp)) \
 			return 1; \
-		} \
-		t->c += bp; \
 		bp = 0; \
-	}
+	} \
+	if (t->ob_len && (t->ob_len >= TRIE_OB_INITIAL_SIZE || (force)) && \
+	    !lws_fts_ob_place(t)) \
+		return 1;
 
 static int
 g32(unsigned char *b, uint32_t d)
@@ -246,6 +284,113 @@ rq32(unsigned char *b, uint32_t *d)
 	return (int)(b - ob);
 }
 
+/*
+ * Write a VLI that always takes MAX_VLI bytes, so it can be overwritten later
+ * with any other value
+ */
+
+static int
+wq32_padded(unsigned char *b, uint32_t d)
+{
+	*b++ = ((d >> 28) | 0x80) & 0xff;
+	*b++ = ((d >> 21) | 0x80) & 0xff;
+	*b++ = ((d >> 14) | 0x80) & 0xff;
+	*b++ = ((d >> 7) | 0x80) & 0xff;
+	*b = d & 0x7f;
+
+	return MAX_VLI;
+}
+
+static void
+lws_fts_lock(struct lws_fts *t)
+{
+#if defined(LWS_HAVE_PTHREAD_H)
+	pthread_mutex_lock(&t->lock); /* ======================== trie lock */
+#endif
+}
+
+static void
+lws_fts_unlock(struct lws_fts *t)
+{
+#if defined(LWS_HAVE_PTHREAD_H)
+	pthread_mutex_unlock(&t->lock); /* -------------------- trie unlock */
+#endif
+}
+
+static int
+lws_fts_ob_append(struct lws_fts *t, const void *buf, size_t len)
+{
+	size_t size = t->ob_size ? t->ob_size : TRIE_OB_INITIAL_SIZE;
+	unsigned char *ob;
+
+	if (t->ob_len + len > t->ob_size) {
+		while (size < t->ob_len + len)
+			size *= 2;
+
+		ob = lws_realloc(t->ob, size, "fts ob");
+		if (!ob) {
+			lwsl_err("%s: OOM\n", __func__);
+
+			return 1;
+		}
+		t->ob = ob;
+		t->ob_size = size;
+	}
+
+	memcpy(t->ob + t->ob_len, buf, len);
+	t->ob_len += len;
+
+	return 0;
+}
+
+/*
+ * All writes to the index fd say where they go, shards share the fd and
+ * nobody may depend on the file position
+ */
+
+static int
+lws_fts_pwrite(struct lws_fts *t, const void *buf, size_t len,
+	       jg2_file_offset ofs)
+{
+	if (pwrite(t->fd, buf, len, (off_t)ofs) != (ssize_t)len) {
+		lwsl_err("%s: write %d at 0x%x failed (%d)\n", __func__,
+			 (int)len, (unsigned int)ofs, errno);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the output block collected for the input that is being finalized into
+ * the index file.  Shards share the index file with their parent, they reserve
+ * the next free space at the end of the file under the parent's lock and then
+ * write into it.
+ *
+ * Returns the fileoffset the block was written at, or 0 for failure (it can't
+ * be legitimately 0 since the file header is there).
+ */
+
+static jg2_file_offset
+lws_fts_ob_place(struct lws_fts *t)
+{
+	struct lws_fts *top = t->parent ? t->parent : t;
+	jg2_file_offset base;
+
+	lws_fts_lock(top);
+	base = top->c;
+	top->c += t->ob_len;
+	lws_fts_unlock(top);
+
+	if (lws_fts_pwrite(t, t->ob, t->ob_len, base))
+		return 0;
+
+	t->ob_len = 0;
+
+	return base;
+}
+
 struct lws_fts *
 lws_fts_create(int fd)
 {
@@ -266,6 +411,10 @@ lws_fts_create(int fd)
 	if (!t->root)
 		goto unwind;
 
+#if defined(LWS_HAVE_PTHREAD_H)
+	pthread_mutex_init(&t->lock, NULL);
+#endif
+
 	memset(t->root, 0, sizeof(*t->root));
 	t->parser = t->root;
 	t->last_file_index = -1;
@@ -292,25 +441,73 @@ lws_fts_create(int fd)
 	/* count of filepaths */
 	g32(&buf[0x10], 0);
 
-	if (write(t->fd, buf, TRIE_FILE_HDR_SIZE) != TRIE_FILE_HDR_SIZE) {
+	if (lws_fts_pwrite(t, buf, TRIE_FILE_HDR_SIZE, 0)) {
 		lwsl_err("%s: trie header write failed\n", __func__);
-		goto unwind;
+		goto unwind1;
 	}
 
 	t->c = TRIE_FILE_HDR_SIZE;
 
 	return t;
 
+unwind1:
+#if defined(LWS_HAVE_PTHREAD_H)
+	pthread_mutex_destroy(&t->lock);
+#endif
 unwind:
 	lwsac_free(&lwsac_head);
 
 	return NULL;
 }
 
+struct lws_fts *
+lws_fts_shard_create(struct lws_fts *parent)
+{
+	struct lwsac *lwsac_head = NULL;
+	struct lws_fts *t;
+
+	if (parent->parent) {
+		lwsl_err("%s: can't shard a shard\n", __func__);
+
+		return NULL;
+	}
+
+	t = lwsac_use(&lwsac_head, sizeof(*t), TRIE_LWSAC_BLOCK_SIZE);
+	if (!t)
+		return NULL;
+
+	memset(t, 0, sizeof(*t));
+
+	t->fd = parent->fd;
+	t->parent = parent;
+	t->lwsac_head = lwsac_head;
+	t->root = lwsac_use(&lwsac_head, sizeof(*t->root),
+			    TRIE_LWSAC_BLOCK_SIZE);
+	if (!t->root) {
+		lwsac_free(&lwsac_head);
+
+		return NULL;
+	}
+
+	memset(t->root, 0, sizeof(*t->root));
+	t->parser = t->root;
+	t->last_file_index = -1;
+	t->line_number = 1;
+
+	return t;
+}
+
 void
 lws_fts_destroy(struct lws_fts **trie)
 {
 	struct lwsac *lwsac_head = (*trie)->lwsac_head;
+
+#if defined(LWS_HAVE_PTHREAD_H)
+	if (!(*trie)->parent)
+		pthread_mutex_destroy(&(*trie)->lock);
+#endif
+	if ((*trie)->ob)
+		lws_free((*trie)->ob);
 	lwsac_free(&(*trie)->lwsac_input_head);
 	lwsac_free(&lwsac_head);
 	*trie = NULL;
@@ -320,6 +517,7 @@ int
 lws_fts_file_index(struct lws_fts *t, const char *filepath, int filepath_len,
 		    int priority)
 {
+	struct lws_fts *top = t->parent ? t->parent : t;
 	struct lws_fts_filepath *fp = t->filepath_list;
 #if 0
 	while (fp) {
@@ -339,8 +537,14 @@ lws_fts_file_index(struct lws_fts *t, const char *filepath, int filepath_len,
 	strncpy(fp->filepath, filepath, sizeof(fp->filepath) - 1);
 	fp->filepath[sizeof(fp->filepath) - 1] = '\0';
 	fp->filepath_len = filepath_len;
-	fp->file_index = t->next_file_index++;
-	fp->line_table_ofs = t->c;
+
+	/* shards take their file indexes from the one index they merge into */
+	lws_fts_lock(top);
+	fp->file_index = top->next_file_index++;
+	lws_fts_unlock(top);
+
+	/* the line table goes at the start of the input's output block */
+	fp->line_table_ofs = 0;
 	fp->priority = priority;
 	fp->total_lines = 0;
 	t->fp = fp;
@@ -391,19 +595,23 @@ lws_fts_entry_child_add(struct lws_fts *t, unsigned char c,
 static int
 finalize_per_input(struct lws_fts *t)
 {
+	unsigned char buf[(3 * MAX_VLI) + 8];
 	struct lws_fts_instance_file *tif;
-	unsigned char buf[8192];
 	uint64_t lwsac_input_size;
-	jg2_file_offset temp;
+	jg2_file_offset temp, base;
 	int bp = 0;
 
+	if (!t->fp_fill)
+		/* nothing was filled since the last time */
+		return 0;
+
+	/* terminate the input's line table */
+
 	bp += g16(&buf[bp], 0);
 	bp += g16(&buf[bp], 0);
 	bp += g32(&buf[bp], 0);
-	if (write(t->fd, buf, bp) != bp)
+	if (lws_fts_ob_append(t, buf, bp))
 		return 1;
-	t->c += bp;
-	bp = 0;
 
 	/*
 	 * Write the generated file index + instances (if any)
@@ -419,36 +627,43 @@ finalize_per_input(struct lws_fts *t)
 	 *
 	 * The file instances are written to disk in the order that the files
 	 * were indexed, along with their prev pointers inline.
+	 *
+	 * Until the block is written, we only know where each instance is
+	 * relative to the start of the block.
 	 */
 
 	tif = t->tif_list;
 	while (tif) {
 		struct lws_fts_lines *i;
 
-		spill((3 * MAX_VLI) + tif->count, 0);
-
+		bp = 0;
 		temp = tif->owner->ofs_last_inst_file;
-		if (tif->total)
-			tif->owner->ofs_last_inst_file = t->c + bp;
+		tif->ofs = (jg2_file_offset)t->ob_len;
 
-		assert(!temp || (temp > TRIE_FILE_HDR_SIZE && temp < t->c));
+		assert(!temp || temp > TRIE_FILE_HDR_SIZE);
 
-		/* fileoffset of prev instance file for this entry, or 0 */
-		bp += wq32(&buf[bp], temp);
+		/*
+		 * fileoffset of prev instance file for this entry, or 0.  If we
+		 * are a shard, the 0 at the end of the chain has to be able to
+		 * link to the chain from another shard when we are merged.
+		 */
+		if (t->parent && !temp)
+			bp += wq32_padded(&buf[bp], 0);
+		else
+			bp += wq32(&buf[bp], temp);
 		bp += wq32(&buf[bp], tif->file_index);
 		bp += wq32(&buf[bp], tif->total);
 
-		/* remove any pointers into this disposable lac footprint */
-		tif->owner->inst_file_list = NULL;
-
 		memcpy(&buf[bp], &tif->vli, tif->count);
 		bp += tif->count;
 
+		if (lws_fts_ob_append(t, buf, bp))
+			return 1;
+
 		i = tif->lines_list;
 		while (i) {
-			spill(i->count, 0);
-			memcpy(&buf[bp], &i->vli, i->count);
-			bp += i->count;
+			if (lws_fts_ob_append(t, &i->vli, i->count))
+				return 1;
 
 			i = i->lines_next;
 		}
@@ -456,9 +671,29 @@ finalize_per_input(struct lws_fts *t)
 		tif = tif->inst_file_next;
 	}
 
-	spill(0, 1);
+	base = lws_fts_ob_place(t);
+	if (!base)
+		return 1;
 
-	assert(lseek(t->fd, 0, SEEK_END) == (off_t)t->c);
+	t->fp_fill->line_table_ofs = base;
+	t->fp_fill = NULL;
+
+	/* now we know where the instances went, point the entries at them */
+
+	tif = t->tif_list;
+	while (tif) {
+		if (tif->total) {
+			if (t->parent && !tif->owner->ofs_last_inst_file)
+				tif->owner->ofs_inst_chain_tail =
+							base + tif->ofs;
+			tif->owner->ofs_last_inst_file = base + tif->ofs;
+		}
+
+		/* remove any pointers into this disposable lac footprint */
+		tif->owner->inst_file_list = NULL;
+
+		tif = tif->inst_file_next;
+	}
 
 	if (t->lwsac_input_head) {
 		lwsac_input_size = lwsac_total_alloc(t->lwsac_input_head);
@@ -548,11 +783,12 @@ lws_fts_fill(struct lws_fts *t, uint32_t file_index, const char *buf,
 	char *osuff, skipline = 0;
 	struct lws_fts_lines *tl;
 	unsigned int olen, n;
-	off_t lbh;
+	size_t lbh;
 
 	if ((int)file_index != t->last_file_index) {
-		if (t->last_file_index >= 0)
-			finalize_per_input(t);
+		if (finalize_per_input(t))
+			return 1;
+		t->fp_fill = t->fp;
 		t->last_file_index = file_index;
 		t->line_number = 1;
 		t->chars_in_line = 0;
@@ -564,7 +800,7 @@ lws_fts_fill(struct lws_fts *t, uint32_t file_index, const char *buf,
 resume:
 
 	chars = 0;
-	lbh = t->c;
+	lbh = t->ob_len;
 	sline = t->line_number;
 	bp += g16(&linetable[bp], 0);
 	bp += g16(&linetable[bp], 0);
@@ -582,20 +818,15 @@ resume:
 		t->chars_in_line++;
 		if (c == '\n') {
 			skipline = 0;
-			t->filepath_list->total_lines++;
+			t->fp_fill->total_lines++;
 			t->lines_in_unsealed_linetable++;
 			t->line_number++;
 
 			bp += wq32(&linetable[bp], t->chars_in_line);
 			if ((unsigned int)bp > sizeof(linetable) - 6) {
-				if (write(t->fd, linetable, bp) != bp) {
-					lwsl_err("%s: linetable write failed\n",
-							__func__);
+				if (lws_fts_ob_append(t, linetable, bp))
 					return 1;
-				}
-				t->c += bp;
 				bp = 0;
-				// assert(lseek(t->fd, 0, SEEK_END) == t->c);
 			}
 
 			chars += t->chars_in_line;
@@ -870,6 +1101,8 @@ seal:
 
 			e->ofs_last_inst_file = t->parser->ofs_last_inst_file;
 			t->parser->ofs_last_inst_file = 0;
+			e->ofs_inst_chain_tail = t->parser->ofs_inst_chain_tail;
+			t->parser->ofs_inst_chain_tail = 0;
 
 			if (t->str_match_pos != olen) {
 				/* we diverged partway */
@@ -1047,45 +1280,310 @@ after:
 	/* seal off the line length table block */
 
 	if (bp) {
-		if (write(t->fd, linetable, bp) != bp)
+		if (lws_fts_ob_append(t, linetable, bp))
 			return 1;
-		t->c += bp;
 		bp = 0;
 	}
 
-	if (lseek(t->fd, lbh, SEEK_SET) < 0) {
-		lwsl_err("%s: seek to 0x%llx failed\n", __func__,
-				(unsigned long long)lbh);
-		return 1;
+	/* it's still in the output block, so just fix up the header there */
+
+	g16(t->ob + lbh, (int)(t->ob_len - lbh));
+	g16(t->ob + lbh + 2, t->line_number - sline);
+	g32(t->ob + lbh + 4, chars);
+
+	if (len) {
+		t->lines_in_unsealed_linetable = 0;
+		goto resume;
 	}
 
-	g16(linetable, t->c - lbh);
-	g16(linetable + 2, t->line_number - sline);
-	g32(linetable + 4, chars);
-	if (write(t->fd, linetable, 8) != 8) {
-		lwsl_err("%s: write linetable header failed\n", __func__);
-		return 1;
+	/* dump the collected per-input instance and line data, and free it */
+
+	t->agg_trie_creation_us += lws_time_in_microseconds() - tf;
+
+	return 0;
+}
+
+/*
+ * Find the entry representing the token s (of length len) in trie t, creating
+ * it and splitting existing entries to make room for it as needed.  This is
+ * used to merge shard tries, the resulting trie is shaped the same way as if
+ * lws_fts_fill() had come across the token.
+ */
+
+static struct lws_fts_entry *
+lws_fts_entry_for_token(struct lws_fts *t, const unsigned char *s, int len)
+{
+	struct lws_fts_entry *e = t->root, *c, *n, *e1;
+	int pos = 0, m, olen;
+	uint32_t ochildren;
+
+	while (pos < len) {
+
+		/* look for a child starting with the next char */
+
+		if (e == t->root)
+			c = t->root_lookup[s[pos]];
+		else {
+			c = e->child_list;
+			while (c && c->c < s[pos])
+				c = c->sibling;
+			if (c && c->c != s[pos])
+				c = NULL;
+		}
+
+		if (!c) {
+			/*
+			 * nothing matches, blaze a new trail with everything
+			 * that's left as the suffix on one new child... except
+			 * off the root, which only has 1-char children
+			 */
+			c = lws_fts_entry_child_add(t, s[pos], e);
+			if (!c)
+				return NULL;
+
+			if (e == t->root) {
+				t->root_lookup[s[pos]] = c;
+				pos++;
+				e = c;
+				continue;
+			}
+
+			if (len - pos > 1) {
+				c->suffix = lwsac_use(&t->lwsac_head,
+						      len - pos + 1,
+						      TRIE_LWSAC_BLOCK_SIZE);
+				if (!c->suffix)
+					return NULL;
+				memcpy(c->suffix, &s[pos], len - pos);
+				c->suffix[len - pos] = '\0';
+				c->suffix_len = len - pos;
+			}
+
+			return c;
+		}
+
+		if (!c->suffix) {
+			e = c;
+			pos++;
+			continue;
+		}
+
+		/* how much of the child's suffix string matches? */
+
+		olen = c->suffix_len;
+		m = 1;
+		while (m < olen && pos + m < len && c->suffix[m] == s[pos + m])
+			m++;
+
+		if (m == olen) {
+			e = c;
+			pos += m;
+			continue;
+		}
+
+		/*
+		 * We have to split the child: it keeps the first m chars, and
+		 * a new child of it takes over the remainder of the suffix
+		 * together with everything that was attached to it.
+		 */
+
+		e1 = c->child_list;
+		ochildren = c->child_count;
+		c->child_list = NULL;
+		c->child_count = 0;
+
+		n = lws_fts_entry_child_add(t, c->suffix[m], c);
+		if (!n)
+			return NULL;
+
+		n->child_list = e1;
+		n->child_count = ochildren;
+		while (e1) {
+			e1->parent = n;
+			e1 = e1->sibling;
+		}
+
+		if (olen - m > 1) {
+			n->suffix = &c->suffix[m];
+			n->suffix_len = olen - m;
+		}
+
+		n->instance_count = c->instance_count;
+		n->ofs_last_inst_file = c->ofs_last_inst_file;
+		n->ofs_inst_chain_tail = c->ofs_inst_chain_tail;
+		c->instance_count = 0;
+		c->ofs_last_inst_file = 0;
+		c->ofs_inst_chain_tail = 0;
+
+		if (m == 1)
+			c->suffix = NULL;
+		else
+			c->suffix_len = m;
+
+		e = c;
+		pos += m;
 	}
 
-	assert(lseek(t->fd, 0, SEEK_END) == (off_t)t->c);
+	return e;
+}
+
+int
+lws_fts_shard_merge(struct lws_fts *t, struct lws_fts **pshard)
+{
+	struct lws_fts_entry *s[256], *e, *m;
+	struct lws_fts *shard = *pshard;
+	struct lws_fts_filepath *fp, *nfp;
+	unsigned char tok[1024], vli[MAX_VLI];
+	int sp, pl[256], n, ret = 1;
+
+	if (shard->parent != t) {
+		lwsl_err("%s: not our shard\n", __func__);
 
-	if (lseek(t->fd, t->c, SEEK_SET) < 0) {
-		lwsl_err("%s: end seek failed\n", __func__);
 		return 1;
 	}
 
-	bp = 0;
+	/*
+	 * Write out the shard's last input, and any input we were partway
+	 * through ourselves: merging may split our entries, which must not
+	 * have instances still pending on them when it does
+	 */
 
-	if (len) {
-		t->lines_in_unsealed_linetable = 0;
-		goto resume;
+	if (finalize_per_input(shard) || finalize_per_input(t))
+		goto bail;
+	t->last_file_index = -1;
+
+	/* take over the shard's filepaths */
+
+	fp = shard->filepath_list;
+	while (fp) {
+		nfp = lwsac_use(&t->lwsac_head, sizeof(*nfp),
+				TRIE_LWSAC_BLOCK_SIZE);
+		if (!nfp)
+			goto bail;
+
+		*nfp = *fp;
+		nfp->next = t->filepath_list;
+		t->filepath_list = nfp;
+
+		fp = fp->next;
 	}
 
-	/* dump the collected per-input instance and line data, and free it */
+	/*
+	 * Walk the shard trie depth-first, keeping the token each entry
+	 * represents in tok.  Every entry with instances is merged into the
+	 * equivalent entry in t: the tail of its instance file chain, which
+	 * the shard left padded, is patched to point at any existing chain on
+	 * our entry, and our entry takes the shard chain head.
+	 */
 
-	t->agg_trie_creation_us += lws_time_in_microseconds() - tf;
+	sp = 0;
+	s[0] = shard->root->child_list;
+	pl[0] = 0;
 
-	return 0;
+	while (sp >= 0) {
+		e = s[sp];
+		if (!e) {
+			if (--sp >= 0)
+				s[sp] = s[sp]->sibling;
+			continue;
+		}
+
+		n = pl[sp];
+		if (e->suffix) {
+			if (n + (int)e->suffix_len > (int)sizeof(tok)) {
+				lwsl_err("%s: token too long\n", __func__);
+				goto bail;
+			}
+			memcpy(&tok[n], e->suffix, e->suffix_len);
+			n += e->suffix_len;
+		} else {
+			if (n == (int)sizeof(tok)) {
+				lwsl_err("%s: token too long\n", __func__);
+				goto bail;
+			}
+			tok[n++] = e->c;
+		}
+
+		if (e->ofs_last_inst_file) {
+			m = lws_fts_entry_for_token(t, tok, n);
+			if (!m)
+				goto bail;
+
+			if (m->ofs_last_inst_file) {
+				wq32_padded(vli, m->ofs_last_inst_file);
+				if (lws_fts_pwrite(t, vli, MAX_VLI,
+						   e->ofs_inst_chain_tail)) {
+					lwsl_err("%s: chain link failed\n",
+						 __func__);
+					goto bail;
+				}
+			}
+
+			m->ofs_last_inst_file = e->ofs_last_inst_file;
+			m->instance_count += e->instance_count;
+		}
+
+		if (e->child_list) {
+			if (sp + 1 == LWS_ARRAY_SIZE(s)) {
+				lwsl_err("%s: Stack too deep\n", __func__);
+				goto bail;
+			}
+			s[++sp] = e->child_list;
+			pl[sp] = n;
+			continue;
+		}
+
+		s[sp] = e->sibling;
+	}
+
+	t->agg_raw_input += shard->agg_raw_input;
+	t->agg_trie_creation_us += shard->agg_trie_creation_us;
+	if (shard->worst_lwsac_input_size > t->worst_lwsac_input_size)
+		t->worst_lwsac_input_size = shard->worst_lwsac_input_size;
+
+	ret = 0;
+
+bail:
+	lws_fts_destroy(pshard);
+
+	return ret;
+}
+
+static struct lws_fts_filepath *
+lws_fts_filepath_sort(struct lws_fts_filepath *head)
+{
+	struct lws_fts_filepath *a, *b, *slow, *fast, **p;
+
+	/* merge sort into descending file index order, ie, index 0 last */
+
+	if (!head || !head->next)
+		return head;
+
+	slow = head;
+	fast = head->next;
+	while (fast && fast->next) {
+		slow = slow->next;
+		fast = fast->next->next;
+	}
+
+	b = lws_fts_filepath_sort(slow->next);
+	slow->next = NULL;
+	a = lws_fts_filepath_sort(head);
+
+	p = &head;
+	while (a && b) {
+		if (a->file_index > b->file_index) {
+			*p = a;
+			a = a->next;
+		} else {
+			*p = b;
+			b = b->next;
+		}
+		p = &(*p)->next;
+	}
+	*p = a ? a : b;
+
+	return head;
 }
 
 /* refer to ./README.md */
@@ -1093,14 +1591,31 @@ after:
 int
 lws_fts_serialize(struct lws_fts *t)
 {
-	struct lws_fts_filepath *fp = t->filepath_list, *ofp;
 	unsigned long long tf = lws_time_in_microseconds();
 	struct lws_fts_entry *e, *e1, *s[256];
+	struct lws_fts_filepath *fp, *ofp;
 	unsigned char buf[8192], stasis;
 	int n, bp, sp = 0, do_parent;
 
 	(void)tf;
-	finalize_per_input(t);
+
+	if (t->parent) {
+		lwsl_err("%s: shards must be merged, not serialized\n",
+			 __func__);
+
+		return 1;
+	}
+
+	if (finalize_per_input(t))
+		return 1;
+
+	/*
+	 * Merged shards took file indexes in whatever order they got to them,
+	 * but the filepath map below needs them in order
+	 */
+
+	t->filepath_list = lws_fts_filepath_sort(t->filepath_list);
+	fp = t->filepath_list;
 
 	/*
 	 * Compute aggregated instance counts (parents should know the total
@@ -1160,7 +1675,7 @@ lws_fts_serialize(struct lws_fts *t)
 	bp = 0;
 	while (fp) {
 
-		fp->ofs = t->c + bp;
+		fp->ofs = t->c + t->ob_len + bp;
 		n = (int)strlen(fp->filepath);
 		spill(15 + n, 0);
 
@@ -1179,17 +1694,11 @@ lws_fts_serialize(struct lws_fts *t)
 
 	/* record the fileoffset of the filepath map and filepath count */
 
-	if (lseek(t->fd, 0xc, SEEK_SET) < 0)
-		goto bail_seek;
-
-	g32(buf, t->c + bp);
+	g32(buf, t->c);
 	g32(buf + 4, t->next_file_index);
-	if (write(t->fd, buf, 8) != 8)
+	if (lws_fts_pwrite(t, buf, 8, 0xc))
 		goto bail;
 
-	if (lseek(t->fd, t->c + bp, SEEK_SET) < 0)
-		goto bail_seek;
-
 	/* dump the filepath map, starting from index 0, which is at the tail */
 
 	fp = ofp;
@@ -1232,7 +1741,7 @@ lws_fts_serialize(struct lws_fts *t)
 		/* leaf nodes with no children */
 
 		e = s[sp];
-		e->ofs = t->c + bp;
+		e->ofs = t->c + t->ob_len + bp;
 
 		/* write the trie entry header */
 
@@ -1335,15 +1844,9 @@ lws_fts_serialize(struct lws_fts *t)
 
 	/* drop the correct root trie offset + file length into the header */
 
-	if (lseek(t->fd, 4, SEEK_SET) < 0) {
-		lwsl_err("%s: unable to seek\n", __func__);
-
-		goto bail;
-	}
-
 	g32(buf, t->root->ofs);
 	g32(buf + 4, t->c);
-	if (write(t->fd, buf, 0x8) != 0x8)
+	if (lws_fts_pwrite(t, buf, 0x8, 4))
 		goto bail;
 
 	lwsl_notice("%s: index %d files (%uMiB) cpu time %dms, "
@@ -1359,9 +1862,6 @@ lws_fts_serialize(struct lws_fts *t)
 
 	return 0;
 
-bail_seek:
-	lwsl_err("%s: problem seekings\n", __func__);
-
 bail:
 	return 1;
 }
@@ -0,0 +1,389 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * Streaming JSON writer
+ *
+ * Each call is issued as a fixed sequence of pieces: the comma, the quoted
+ * and escaped key, then the value.  j->piece and j->off record how far we got
+ * into that sequence, so when the window fills the caller can repeat the same
+ * call in a fresh window and we carry on from the same byte.  Nesting state
+ * is only updated once the whole call has been issued.
+ */
+
+#include "core/private.h"
+
+enum {
+	LWSJOP_COMMA,
+	LWSJOP_KEY_OPEN,
+	LWSJOP_KEY,
+	LWSJOP_KEY_CLOSE,
+	LWSJOP_PRE,
+	LWSJOP_BODY,
+	LWSJOP_POST,
+
+	LWSJOP_DONE
+};
+
+enum {
+	LWSJOT_VALUE,
+	LWSJOT_OPEN_OBJ,
+	LWSJOT_OPEN_ARR,
+	LWSJOT_CLOSE,
+};
+
+#define LWSJO_ONES	0x0101010101010101ull
+#define LWSJO_HIGHS	0x8080808080808080ull
+
+/*
+ * Nonzero if none of the 8 bytes in w needs escaping, ie, there is no byte
+ * below 0x20, no '"' and no '\'.  A classic SWAR "has zero byte" / "has byte
+ * less than n" test, so it works a word at a time on any cpu without needing
+ * SIMD intrinsics, and is endian-neutral since we only ask "any?".
+ */
+
+static LWS_INLINE int
+lws_jo_word_clean(uint64_t w)
+{
+	uint64_t q = w ^ (LWSJO_ONES * '"'), b = w ^ (LWSJO_ONES * '\\');
+
+	return !((((w - (LWSJO_ONES * 0x20)) & ~w) |
+		  ((q - LWSJO_ONES) & ~q) |
+		  ((b - LWSJO_ONES) & ~b)) & LWSJO_HIGHS);
+}
+
+/*
+ * Copy as much of s as fits in the window, escaping it.  Escape sequences are
+ * never split over windows.  Returns the number of bytes of s consumed.
+ */
+
+static size_t
+lws_jo_escape(struct lws_json_out *j, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *o = s, *e = s + len;
+	unsigned char c;
+	uint64_t w;
+	char esc;
+
+	while (s < e) {
+
+		/* fast path: 8 bytes at a time while nothing needs escaping */
+
+		while (e - s >= 8 && j->end - j->p >= 8) {
+			memcpy(&w, s, 8);
+			if (!lws_jo_word_clean(w))
+				break;
+			memcpy(j->p, s, 8);
+			j->p += 8;
+			s += 8;
+		}
+
+		if (s == e || j->p == j->end)
+			break;
+
+		c = (unsigned char)*s;
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			*j->p++ = *s++;
+			continue;
+		}
+
+		switch (c) {
+		case '"':
+		case '\\':
+			esc = (char)c;
+			break;
+		case '\n':
+			esc = 'n';
+			break;
+		case '\r':
+			esc = 'r';
+			break;
+		case '\t':
+			esc = 't';
+			break;
+		case '\b':
+			esc = 'b';
+			break;
+		case '\f':
+			esc = 'f';
+			break;
+		default:
+			esc = 0;
+			break;
+		}
+
+		if (esc) {
+			if (j->end - j->p < 2)
+				break;
+			*j->p++ = '\\';
+			*j->p++ = esc;
+		} else {
+			if (j->end - j->p < 6)
+				break;
+			memcpy(j->p, "\\u00", 4);
+			j->p[4] = hex[c >> 4];
+			j->p[5] = hex[c & 15];
+			j->p += 6;
+		}
+		s++;
+	}
+
+	return lws_ptr_diff(s, o);
+}
+
+/* copy from offset j->off of a literal, returns nonzero if it all went */
+
+static int
+lws_jo_copy(struct lws_json_out *j, const char *s, size_t len)
+{
+	size_t n = len - j->off;
+
+	if (n > (size_t)(j->end - j->p))
+		n = j->end - j->p;
+
+	memcpy(j->p, s + j->off, n);
+	j->p += n;
+	j->off += n;
+
+	return j->off == len;
+}
+
+static int
+lws_jo_emit(struct lws_json_out *j, int type, const char *key, const char *pre,
+	    const char *body, size_t body_len, const char *post)
+{
+	uint32_t bit = 1u << j->depth;
+	size_t n;
+
+	if (!j->piece && !j->off) {
+		/* nothing issued yet for this call, check the usage */
+
+		if (type != LWSJOT_CLOSE &&
+		    !!key != !!(j->depth && (j->is_obj & bit))) {
+			lwsl_err("%s: key %s in %s\n", __func__,
+				 key ? "given" : "missing",
+				 j->depth && (j->is_obj & bit) ?
+					 "object" : "array or at top level");
+			return LWSJO_ERR;
+		}
+
+		if ((type == LWSJOT_OPEN_OBJ || type == LWSJOT_OPEN_ARR) &&
+		    j->depth >= LWS_JSON_OUT_MAX_DEPTH - 1) {
+			lwsl_err("%s: nesting too deep\n", __func__);
+			return LWSJO_ERR;
+		}
+
+		if (type == LWSJOT_CLOSE)
+			j->piece = LWSJOP_PRE;
+		else
+			if (!(j->members & bit))
+				j->piece = key ? LWSJOP_KEY_OPEN : LWSJOP_PRE;
+	}
+
+	while (j->piece != LWSJOP_DONE) {
+		switch (j->piece) {
+		case LWSJOP_COMMA:
+			if (!lws_jo_copy(j, ",", 1))
+				return LWSJO_FULL;
+			if (!key) {
+				j->piece = LWSJOP_PRE;
+				j->off = 0;
+				continue;
+			}
+			break;
+
+		case LWSJOP_KEY_OPEN:
+		case LWSJOP_POST:
+			if (j->piece == LWSJOP_POST && !post)
+				break;
+			if (!lws_jo_copy(j, j->piece == LWSJOP_POST ?
+						post : "\"", 1))
+				return LWSJO_FULL;
+			break;
+
+		case LWSJOP_KEY:
+			n = strlen(key);
+			j->off += lws_jo_escape(j, key + j->off, n - j->off);
+			if (j->off != n)
+				return LWSJO_FULL;
+			break;
+
+		case LWSJOP_BODY:
+			if (!body)
+				break;
+			j->off += lws_jo_escape(j, body + j->off,
+						body_len - j->off);
+			if (j->off != body_len)
+				return LWSJO_FULL;
+			break;
+
+		case LWSJOP_KEY_CLOSE:
+			if (!lws_jo_copy(j, "\":", 2))
+				return LWSJO_FULL;
+			break;
+
+		case LWSJOP_PRE:
+			if (!lws_jo_copy(j, pre, strlen(pre)))
+				return LWSJO_FULL;
+			break;
+		}
+
+		j->piece++;
+		j->off = 0;
+	}
+
+	j->piece = 0;
+
+	switch (type) {
+	case LWSJOT_CLOSE:
+		j->depth--;
+		break;
+	case LWSJOT_OPEN_OBJ:
+	case LWSJOT_OPEN_ARR:
+		j->members |= bit;
+		j->depth++;
+		bit <<= 1;
+		j->members &= ~bit;
+		if (type == LWSJOT_OPEN_OBJ)
+			j->is_obj |= bit;
+		else
+			j->is_obj &= ~bit;
+		break;
+	default:
+		j->members |= bit;
+		break;
+	}
+
+	return LWSJO_OK;
+}
+
+LWS_VISIBLE LWS_EXTERN void
+lws_json_out_init(struct lws_json_out *j, char *buf, size_t len)
+{
+	memset(j, 0, sizeof(*j));
+	lws_json_out_window(j, buf, len);
+}
+
+LWS_VISIBLE LWS_EXTERN void
+lws_json_out_window(struct lws_json_out *j, char *buf, size_t len)
+{
+	j->p = buf;
+	j->end = buf + len;
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_obj(struct lws_json_out *j, const char *key)
+{
+	return lws_jo_emit(j, LWSJOT_OPEN_OBJ, key, "{", NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_arr(struct lws_json_out *j, const char *key)
+{
+	return lws_jo_emit(j, LWSJOT_OPEN_ARR, key, "[", NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_end(struct lws_json_out *j)
+{
+	if (!j->depth) {
+		lwsl_err("%s: nothing open\n", __func__);
+		return LWSJO_ERR;
+	}
+
+	return lws_jo_emit(j, LWSJOT_CLOSE, NULL,
+			   j->is_obj & (1u << j->depth) ? "}" : "]",
+			   NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_strn(struct lws_json_out *j, const char *key, const char *s,
+		  size_t len)
+{
+	if (!s)
+		return lws_json_out_null(j, key);
+
+	return lws_jo_emit(j, LWSJOT_VALUE, key, "\"", s, len, "\"");
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_str(struct lws_json_out *j, const char *key, const char *s)
+{
+	return lws_json_out_strn(j, key, s, s ? strlen(s) : 0);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_int(struct lws_json_out *j, const char *key, int64_t v)
+{
+	char num[24];
+
+	lws_snprintf(num, sizeof(num), "%lld", (long long)v);
+
+	return lws_jo_emit(j, LWSJOT_VALUE, key, num, NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_uint(struct lws_json_out *j, const char *key, uint64_t v)
+{
+	char num[24];
+
+	lws_snprintf(num, sizeof(num), "%llu", (unsigned long long)v);
+
+	return lws_jo_emit(j, LWSJOT_VALUE, key, num, NULL, 0, NULL);
+}
+
+int
+lws_json_out_qint(struct lws_json_out *j, const char *key, int64_t v)
+{
+	char num[24];
+
+	lws_snprintf(num, sizeof(num), "%lld", (long long)v);
+
+	return lws_json_out_str(j, key, num);
+}
+
+int
+lws_json_out_quint(struct lws_json_out *j, const char *key, uint64_t v)
+{
+	char num[24];
+
+	lws_snprintf(num, sizeof(num), "%llu", (unsigned long long)v);
+
+	return lws_json_out_str(j, key, num);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_bool(struct lws_json_out *j, const char *key, int v)
+{
+	return lws_jo_emit(j, LWSJOT_VALUE, key, v ? "true" : "false",
+			   NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_null(struct lws_json_out *j, const char *key)
+{
+	return lws_jo_emit(j, LWSJOT_VALUE, key, "null", NULL, 0, NULL);
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_json_out_raw(struct lws_json_out *j, const char *key, const char *json)
+{
+	return lws_jo_emit(j, LWSJOT_VALUE, key, json, NULL, 0, NULL);
+}
@@ -41,6 +41,9 @@ lejp_construct(struct lejp_ctx *ctx,
 	signed char (*callback)(struct lejp_ctx *ctx, char reason), void *user,
 			const char * const *paths, unsigned char count_paths)
 {
+	const char *p, *q;
+	int n, m;
+
 	ctx->st[0].s = 0;
 	ctx->st[0].p = 0;
 	ctx->st[0].i = 0;
@@ -55,6 +58,25 @@ lejp_construct(struct lejp_ctx *ctx,
 	ctx->paths = paths;
 	ctx->count_paths = count_paths;
 	ctx->line = 1;
+	ctx->str_chunk = LEJP_STRING_CHUNK;
+
+	/*
+	 * Compile the paths into how much literal prefix each one shares
+	 * with the path before it.  lejp_check_path_match() uses it to skip
+	 * most of the comparisons, since it can know from where the last path
+	 * failed to match whether this one can match.
+	 */
+
+	for (n = 1; n < count_paths &&
+		    n < (int)LWS_ARRAY_SIZE(ctx->path_lcp); n++) {
+		p = paths[n - 1];
+		q = paths[n];
+		m = 0;
+		while (m < 255 && q[m] && q[m] == p[m] && q[m] != '*')
+			m++;
+		ctx->path_lcp[n] = m;
+	}
+
 	ctx->callback(ctx, LEJPCB_CONSTRUCTED);
 }
 
@@ -107,17 +129,64 @@ lejp_change_callback(struct lejp_ctx *ctx,
 	ctx->callback(ctx, LEJPCB_START);
 }
 
+/**
+ * lejp_set_string_chunk - set how much string value is passed per callback
+ *
+ * \param ctx:	pointer to your struct lejp_ctx
+ * \param chunk:	max bytes of string delivered per LEJPCB_VAL_STR_CHUNK
+ *
+ * By default string values are spilled to the callback in LEJP_STRING_CHUNK
+ * pieces.  Call this after lejp_construct() to deliver them in smaller
+ * pieces, for example to bound the latency of handing on a large string.
+ * Values larger than LEJP_STRING_CHUNK, or 0, are clamped to it.
+ */
+
+void
+lejp_set_string_chunk(struct lejp_ctx *ctx, unsigned int chunk)
+{
+	if (!chunk || chunk > LEJP_STRING_CHUNK)
+		chunk = LEJP_STRING_CHUNK;
+
+	ctx->str_chunk = (uint16_t)chunk;
+}
+
 void
 lejp_check_path_match(struct lejp_ctx *ctx)
 {
+	int n, k = -1, wild, l;
 	const char *p, *q;
-	int n;
+
+	/*
+	 * k is where the last path we tried failed to match, if it was
+	 * before any wildcard in it... ie, path[0..k) matched it literally
+	 * and path[k] did not.  Then comparing this path's shared prefix
+	 * length with the last one, path_lcp[n], tells us without looking at
+	 * any characters that either
+	 *
+	 *  - it is the same as the last one past k, so it fails at k too
+	 *  - it differs from the last one before k, so it fails there
+	 *  - it differs from the last one at k, and we compare from there
+	 */
 
 	/* we only need to check if a match is not active */
 	for (n = 0; !ctx->path_match && n < ctx->count_paths; n++) {
-		ctx->wildcount = 0;
 		p = ctx->path;
 		q = ctx->paths[n];
+
+		if (k >= 0 && n < (int)LWS_ARRAY_SIZE(ctx->path_lcp)) {
+			l = ctx->path_lcp[n];
+			if (l > k)
+				continue;
+			if (l < k && q[l] != '*') {
+				k = l;
+				continue;
+			}
+			p += l;
+			q += l;
+		}
+
+		ctx->wildcount = 0;
+		wild = 0;
 		while (*p && *q) {
 			if (*q != '*') {
 				if (*p != *q)
@@ -126,6 +195,7 @@ lejp_check_path_match(struct lejp_ctx *ctx)
 				q++;
 				continue;
 			}
+			wild = 1;
 			ctx->wild[ctx->wildcount++] = lws_ptr_diff(p, ctx->path);
 			q++;
 			/*
@@ -139,8 +209,10 @@ lejp_check_path_match(struct lejp_ctx *ctx)
 			while (*p && (*p != '.' || !*q))
 				p++;
 		}
-		if (*p || *q)
+		if (*p || *q) {
+			k = wild ? -1 : lws_ptr_diff(p, ctx->path);
 			continue;
+		}
 
 		ctx->path_match = n + 1;
 		ctx->path_match_len = ctx->ppos;
@@ -171,6 +243,65 @@ lejp_get_wildcard(struct lejp_ctx *ctx, int wildcard, char *dest, int len)
 	return n - ctx->wild[wildcard];
 }
 
+/*
+ * Eight bytes at a time scanning, using the usual "has a zero byte" trick.
+ * LEJP_HAS_LESS() is nonzero if any byte in x is less than n (n <= 128).
+ */
+
+#define LEJP_REP(c) (0x0101010101010101ull * (uint8_t)(c))
+#define LEJP_HAS_LESS(x, n) (((x) - LEJP_REP(n)) & ~(x) & LEJP_REP(0x80))
+#define LEJP_HAS_BYTE(x, c) LEJP_HAS_LESS((x) ^ LEJP_REP(c), 1)
+
+/* how many bytes from p can be copied into a string as they are */
+
+static int
+lejp_plain_run(const unsigned char *p, int len)
+{
+	const unsigned char *start = p;
+	uint64_t v;
+
+	while (len >= 8) {
+		memcpy(&v, p, 8);
+		if (LEJP_HAS_LESS(v, ' ') | LEJP_HAS_BYTE(v, '\"') |
+		    LEJP_HAS_BYTE(v, '\\'))
+			break;
+		p += 8;
+		len -= 8;
+	}
+
+	while (len && *p >= ' ' && *p != '\"' && *p != '\\') {
+		p++;
+		len--;
+	}
+
+	return lws_ptr_diff(p, start);
+}
+
+/* how many bytes from p are whitespace we can skip without looking at */
+
+static int
+lejp_ws_run(const unsigned char *p, int len)
+{
+	const unsigned char *start = p;
+	uint64_t v;
+
+	while (len >= 8) {
+		memcpy(&v, p, 8);
+		if (v != LEJP_REP(' '))
+			break;
+		p += 8;
+		len -= 8;
+	}
+
+	/* newlines go around the slow way so we can count them */
+	while (len && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		p++;
+		len--;
+	}
+
+	return lws_ptr_diff(p, start);
+}
+
 /**
  * lejp_parse - interpret some more incoming data incrementally
  *
@@ -191,6 +322,8 @@ int
 lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 {
 	unsigned char c, n, s, ret = LEJP_REJECT_UNKNOWN;
+	const unsigned char *q;
+	int m;
 	static const char esc_char[] = "\"\\/bfnrt";
 	static const char esc_tran[] = "\"\\/\b\f\n\r\t";
 	static const char tokens[] = "rue alse ull ";
@@ -212,12 +345,22 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				if (c == '#')
 					ctx->st[ctx->sp].s |=
 						LEJP_FLAG_WS_COMMENTLINE;
+				/* skip the rest of the run */
+				m = lejp_ws_run(json, len);
+				json += m;
+				len -= m;
 				continue;
 			}
 		}
 
-		if (ctx->st[ctx->sp].s & LEJP_FLAG_WS_COMMENTLINE)
+		if (ctx->st[ctx->sp].s & LEJP_FLAG_WS_COMMENTLINE) {
+			/* skip to the newline that ends the comment */
+			q = memchr(json, '\n', len);
+			m = q ? lws_ptr_diff(q, json) : len;
+			json += m;
+			len -= m;
 			continue;
+		}
 
 		switch (s) {
 		case LEJP_IDLE:
@@ -275,7 +418,24 @@ lejp_parse(struct lejp_ctx *ctx, const unsigned char *json, int len)
 				ret = LEJP_REJECT_MP_ILLEGAL_CTRL;
 				goto reject;
 			}
-			goto emit_string_char;
+			if (ctx->sp && ctx->st[ctx->sp - 1].s == LEJP_MP_DELIM)
+				goto emit_string_char;
+
+			/*
+			 * For a string value, copy the run of plain content
+			 * that starts here in one go, up to the chunk size
+			 */
+			ctx->buf[ctx->npos++] = c;
+			m = ctx->str_chunk > ctx->npos ?
+					ctx->str_chunk - ctx->npos : 0;
+			if (m > len)
+				m = len;
+			m = lejp_plain_run(json, m);
+			memcpy(ctx->buf + ctx->npos, json, m);
+			ctx->npos += m;
+			json += m;
+			len -= m;
+			goto string_chunk;
 
 		case LEJP_MP_STRING_ESC:
 			if (c == 'u') {
@@ -701,20 +861,22 @@ array_end:
 		continue;
 
 emit_string_char:
-		if (!ctx->sp || ctx->st[ctx->sp - 1].s != LEJP_MP_DELIM) {
-			/* assemble the string value into chunks */
-			ctx->buf[ctx->npos++] = c;
-			if (ctx->npos == sizeof(ctx->buf) - 1) {
-				if (ctx->callback(ctx, LEJPCB_VAL_STR_CHUNK)) {
-					ret = LEJP_REJECT_CALLBACK;
-					goto reject;
-				}
-				ctx->npos = 0;
-			}
+		if (ctx->sp && ctx->st[ctx->sp - 1].s == LEJP_MP_DELIM) {
+			/* name part of name:value pair */
+			ctx->path[ctx->ppos++] = c;
 			continue;
 		}
-		/* name part of name:value pair */
-		ctx->path[ctx->ppos++] = c;
+
+		/* assemble the string value into chunks */
+		ctx->buf[ctx->npos++] = c;
+string_chunk:
+		if (ctx->npos >= ctx->str_chunk) {
+			if (ctx->callback(ctx, LEJPCB_VAL_STR_CHUNK)) {
+				ret = LEJP_REJECT_CALLBACK;
+				goto reject;
+			}
+			ctx->npos = 0;
+		}
 		continue;
 
 add_stack_level:
@@ -148,6 +148,22 @@ lwsac_free(struct lwsac **head)
 	*head = NULL;
 }
 
+void
+lwsac_reset(struct lwsac **head)
+{
+	struct lwsac *h = *head;
+
+	if (!h)
+		return;
+
+	lwsac_free(&h->next);
+
+	h->curr = h;
+	h->ofs = sizeof(*h);
+	h->total_alloc_size = h->alloc_size;
+	h->total_blocks = 1;
+}
+
 void
 lwsac_info(struct lwsac *head)
 {
@@ -0,0 +1,605 @@
+/*
+ * libwebsockets - OpenMetrics / Prometheus text rendering of lws metrics
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "core/private.h"
+
+/*
+ * The metrics are described by a const table, and rendered one line at a
+ * time straight from the live context, vhost and pt members, so nothing is
+ * allocated or copied.  The render state is just where in the table we got
+ * to, so the caller can stream the text out in chunks of whatever size.
+ *
+ * A family's samples must all follow its header, so each family is rendered
+ * for every vhost or pt before moving on to the next family.  The vhosts are
+ * followed with a cursor in the render state.  Since vhosts may come and go
+ * between calls, each call finds the cursor again from the item index once.
+ *
+ * Anything per-pt is a running total the pt keeps, so rendering never needs
+ * to look at the connections or take a pt lock.
+ */
+
+enum lws_metric_scope {
+	LWSMS_CONTEXT,
+	LWSMS_VHOST,
+	LWSMS_PT,
+};
+
+enum lws_metric_type {
+	LWSMT_COUNTER,
+	LWSMT_GAUGE,
+	LWSMT_SUMMARY,
+};
+
+enum lws_metric_id {
+	LWSMI_VH_RX,
+	LWSMI_VH_TX,
+	LWSMI_VH_H1_CONN,
+	LWSMI_VH_H1_TRANS,
+	LWSMI_VH_H2_ALPN,
+	LWSMI_VH_H2_UPG,
+	LWSMI_VH_H2_STREAMS,
+	LWSMI_VH_H2_TRANS,
+	LWSMI_VH_WS_UPG,
+	LWSMI_VH_REJECTED,
+	LWSMI_VH_TLS_HS,
+	LWSMI_VH_TLS_HS_FAILED,
+	LWSMI_VH_TIMEOUTS,
+
+	LWSMI_PT_CONNS,
+	LWSMI_PT_AH_IN_USE,
+	LWSMI_PT_AH_LARGE,
+	LWSMI_PT_AH_WAITING,
+	LWSMI_PT_AH_WAITS,
+	LWSMI_PT_AH_PROMOTIONS,
+	LWSMI_PT_RX_BUFLIST,
+	LWSMI_PT_TX_BUFLIST,
+	LWSMI_PT_H2_STREAMS,
+	LWSMI_PT_LOOP,
+	LWSMI_PT_LOOP_MAX,
+
+	LWSMI_WSI_LIVE,
+	LWSMI_AH_POOL,
+	LWSMI_SSL_SIMULTANEOUS,
+	LWSMI_STATS,
+	LWSMI_STATS_HIST,
+	LWSMI_STATS_WORST,
+};
+
+struct lws_metric {
+	const char *name;
+	const char *help;
+	uint8_t scope;
+	uint8_t type;
+	uint8_t id;
+	uint8_t us;	/* value is in us, render it as seconds */
+	uint8_t arg;	/* LWSSTATS_ or LWSSTATS_H_ index */
+};
+
+static const struct lws_metric metrics[] = {
+	{ "lws_vhost_received_bytes", "Bytes received",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_RX, 0, 0 },
+	{ "lws_vhost_sent_bytes", "Bytes sent",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_TX, 0, 0 },
+	{ "lws_vhost_h1_connections", "http/1 connections",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H1_CONN, 0, 0 },
+	{ "lws_vhost_h1_transactions", "http/1 transactions",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H1_TRANS, 0, 0 },
+	{ "lws_vhost_h2_alpn_connections", "h2 connections made by ALPN",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H2_ALPN, 0, 0 },
+	{ "lws_vhost_h2_upgrades", "http/1 connections upgraded to h2",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H2_UPG, 0, 0 },
+	{ "lws_vhost_h2_streams", "h2 streams",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H2_STREAMS, 0, 0 },
+	{ "lws_vhost_h2_transactions", "h2 transactions",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_H2_TRANS, 0, 0 },
+	{ "lws_vhost_ws_upgrades", "Upgrades to ws",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_WS_UPG, 0, 0 },
+	{ "lws_vhost_rejected", "http transactions rejected",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_REJECTED, 0, 0 },
+	{ "lws_vhost_tls_handshakes", "TLS handshakes accepted",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_TLS_HS, 0, 0 },
+	{ "lws_vhost_tls_handshake_failures", "TLS handshakes that failed",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_TLS_HS_FAILED, 0, 0 },
+	{ "lws_vhost_timeouts", "Connections closed by a timeout",
+	  LWSMS_VHOST, LWSMT_COUNTER, LWSMI_VH_TIMEOUTS, 0, 0 },
+
+	{ "lws_pt_connections", "Sockets in use by the service thread",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_CONNS, 0, 0 },
+#if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
+	{ "lws_pt_ah_in_use", "ah in use from the pool",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_AH_IN_USE, 0, 0 },
+	{ "lws_pt_ah_large", "ah in use grown to max_http_header_data",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_AH_LARGE, 0, 0 },
+	{ "lws_pt_ah_waiting", "wsi waiting for an ah",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_AH_WAITING, 0, 0 },
+	{ "lws_pt_ah_waits", "Times a wsi had to wait for an ah",
+	  LWSMS_PT, LWSMT_COUNTER, LWSMI_PT_AH_WAITS, 0, 0 },
+	{ "lws_pt_ah_promotions", "Small ah grown to max_http_header_data",
+	  LWSMS_PT, LWSMT_COUNTER, LWSMI_PT_AH_PROMOTIONS, 0, 0 },
+#endif
+	{ "lws_pt_rx_buflist_bytes", "Bytes read and waiting to be used",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_RX_BUFLIST, 0, 0 },
+	{ "lws_pt_tx_buflist_bytes", "Bytes accepted and waiting to be sent",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_TX_BUFLIST, 0, 0 },
+#if defined(LWS_ROLE_H2)
+	{ "lws_pt_h2_streams", "Open h2 streams",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_H2_STREAMS, 0, 0 },
+#endif
+	{ "lws_pt_loop_busy_seconds",
+	  "Time each event loop iteration kept the service thread busy",
+	  LWSMS_PT, LWSMT_SUMMARY, LWSMI_PT_LOOP, 1, 0 },
+	{ "lws_pt_loop_busy_max_seconds",
+	  "Longest an event loop iteration kept the service thread busy",
+	  LWSMS_PT, LWSMT_GAUGE, LWSMI_PT_LOOP_MAX, 1, 0 },
+
+	{ "lws_wsi_live", "Live wsi",
+	  LWSMS_CONTEXT, LWSMT_GAUGE, LWSMI_WSI_LIVE, 0, 0 },
+#if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
+	{ "lws_ah_pool_size", "Max ah in the pool per service thread",
+	  LWSMS_CONTEXT, LWSMT_GAUGE, LWSMI_AH_POOL, 0, 0 },
+#endif
+#if defined(LWS_WITH_TLS)
+	{ "lws_ssl_simultaneous", "Connections using SSL",
+	  LWSMS_CONTEXT, LWSMT_GAUGE, LWSMI_SSL_SIMULTANEOUS, 0, 0 },
+#endif
+
+#if defined(LWS_WITH_STATS)
+	{ "lws_connections", "Incoming connections",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_CONNECTIONS },
+	{ "lws_api_close", "Calls to close api",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_API_CLOSE },
+	{ "lws_api_read", "Calls to read from socket api",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_API_READ },
+	{ "lws_api_lws_write", "Calls to lws_write api",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_API_LWS_WRITE },
+	{ "lws_api_write", "Calls to write api",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_API_WRITE },
+	{ "lws_write_partials", "Partial writes",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_WRITE_PARTIALS },
+	{ "lws_writeable_cb_requests", "Writable callback requests",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_WRITEABLE_CB_REQ },
+	{ "lws_writeable_cb_effective_requests",
+	  "Effective writable callback requests",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_WRITEABLE_CB_EFF_REQ },
+	{ "lws_writeable_cb", "Writable callbacks",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_WRITEABLE_CB },
+	{ "lws_ssl_connections_failed", "Failed SSL connections",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_SSL_CONNECTIONS_FAILED },
+	{ "lws_ssl_connections_accepted", "Accepted SSL connections",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_SSL_CONNECTIONS_ACCEPTED },
+	{ "lws_ssl_accept_spins", "SSL_accept() attempts",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_SSL_CONNECTIONS_ACCEPT_SPIN },
+	{ "lws_ssl_connections_had_rx",
+	  "Accepted SSL connections that have had some RX",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_SSL_CONNS_HAD_RX },
+	{ "lws_timeouts", "Timed-out connections",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_TIMEOUTS },
+	{ "lws_service_entries", "Entries to the service loop",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_SERVICE_ENTRY },
+	{ "lws_read_bytes", "Bytes read",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_B_READ },
+	{ "lws_written_bytes", "Bytes written",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_B_WRITE },
+	{ "lws_partials_accepted_bytes",
+	  "Bytes of write data accepted into new partials",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_B_PARTIALS_ACCEPTED_PARTS },
+	{ "lws_peer_limit_ah_denied", "Ah denied because of the peer limit",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_PEER_LIMIT_AH_DENIED },
+	{ "lws_peer_limit_wsi_denied", "Wsi denied because of the peer limit",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_PEER_LIMIT_WSI_DENIED },
+	{ "lws_http_txn_allocs", "Allocations from http transaction lwsacs",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_HTTP_TXN_ALLOCS },
+	{ "lws_http_txn_heap_allocs",
+	  "Heap chunks the http transaction lwsacs needed",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_HTTP_TXN_HEAP_ALLOCS },
+	{ "lws_ah_pool_waits", "Times a wsi had to wait for an ah",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_AH_POOL_WAITS },
+	{ "lws_ah_promotions", "Small ah grown to max_http_header_data",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_AH_PROMOTIONS },
+	{ "lws_access_log_dropped",
+	  "Access log lines lost because the log writes were behind",
+	  LWSMS_CONTEXT, LWSMT_COUNTER, LWSMI_STATS, 0,
+	  LWSSTATS_C_ACCESS_LOG_DROPPED },
+	{ "lws_writable_delay_seconds",
+	  "Delay between asking for writable and getting the callback",
+	  LWSMS_CONTEXT, LWSMT_SUMMARY, LWSMI_STATS_HIST, 1,
+	  LWSSTATS_H_WRITABLE_DELAY },
+	{ "lws_ssl_accept_delay_seconds", "Delay in accepting SSL connections",
+	  LWSMS_CONTEXT, LWSMT_SUMMARY, LWSMI_STATS_HIST, 1,
+	  LWSSTATS_H_SSL_ACCEPT_DELAY },
+	{ "lws_ssl_rx_delay_seconds",
+	  "Delay between SSL accept completing and the first RX",
+	  LWSMS_CONTEXT, LWSMT_SUMMARY, LWSMI_STATS_HIST, 1,
+	  LWSSTATS_H_SSL_RX_DELAY },
+	{ "lws_writable_delay_worst_seconds",
+	  "Worst delay between asking for writable and getting the callback",
+	  LWSMS_CONTEXT, LWSMT_GAUGE, LWSMI_STATS_WORST, 1, 0 },
+#endif
+};
+
+#if defined(LWS_WITH_STATS)
+static const struct lws_metric_quantile {
+	int per_mille;
+	const char *q;
+} quantiles[] = {
+	{ 500, "0.5" }, { 900, "0.9" }, { 990, "0.99" }, { 999, "0.999" }
+};
+
+/* the aggregate us each LWSSTATS_H_ histogram is the distribution of */
+
+static const int hist_sum_index[] = {
+	LWSSTATS_MS_WRITABLE_DELAY,
+	LWSSTATS_MS_SSL_CONNECTIONS_ACCEPTED_DELAY,
+	LWSSTATS_MS_SSL_RX_DELAY,
+};
+#endif
+
+static const char * const type_names[] = { "counter", "gauge", "summary" };
+
+static int
+lws_metric_samples(const struct lws_metric *m)
+{
+	if (m->type != LWSMT_SUMMARY)
+		return 1;
+
+#if defined(LWS_WITH_STATS)
+	if (m->id == LWSMI_STATS_HIST) /* quantiles, sum, count */
+		return (int)LWS_ARRAY_SIZE(quantiles) + 2;
+#endif
+
+	return 2; /* sum, count */
+}
+
+static struct lws_vhost *
+lws_metric_vhost(struct lws_context *context, int item)
+{
+	struct lws_vhost *vh = context->vhost_list;
+
+	while (vh && item--)
+		vh = vh->vhost_next;
+
+	return vh;
+}
+
+static uint64_t
+lws_metric_value(struct lws_context *context, const struct lws_metric *m,
+		 struct lws_vhost *vh, int item, int sample)
+{
+	struct lws_context_per_thread *pt = NULL;
+#if defined(LWS_WITH_STATS)
+	uint64_t hist[LWS_HIST_BUCKETS], count, v, worst;
+#endif
+
+	if (m->scope == LWSMS_PT)
+		pt = &context->pt[item];
+
+	switch (m->id) {
+	case LWSMI_VH_RX:
+		return vh->conn_stats.rx;
+	case LWSMI_VH_TX:
+		return vh->conn_stats.tx;
+	case LWSMI_VH_H1_CONN:
+		return vh->conn_stats.h1_conn;
+	case LWSMI_VH_H1_TRANS:
+		return vh->conn_stats.h1_trans;
+	case LWSMI_VH_H2_ALPN:
+		return vh->conn_stats.h2_alpn;
+	case LWSMI_VH_H2_UPG:
+		return vh->conn_stats.h2_upg;
+	case LWSMI_VH_H2_STREAMS:
+		return vh->conn_stats.h2_subs;
+	case LWSMI_VH_H2_TRANS:
+		return vh->conn_stats.h2_trans;
+	case LWSMI_VH_WS_UPG:
+		return vh->conn_stats.ws_upg;
+	case LWSMI_VH_REJECTED:
+		return vh->conn_stats.rejected;
+	case LWSMI_VH_TLS_HS:
+		return vh->conn_stats.tls_hs;
+	case LWSMI_VH_TLS_HS_FAILED:
+		return vh->conn_stats.tls_hs_failed;
+	case LWSMI_VH_TIMEOUTS:
+		return vh->conn_stats.timeouts;
+
+	case LWSMI_PT_CONNS:
+		return pt->count_conns;
+#if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
+	case LWSMI_PT_AH_IN_USE:
+		return (uint64_t)pt->http.ah_count_in_use;
+	case LWSMI_PT_AH_LARGE:
+		return (uint64_t)pt->http.ah_count_large;
+	case LWSMI_PT_AH_WAITING:
+		return (uint64_t)pt->http.ah_wait_list_length;
+	case LWSMI_PT_AH_WAITS:
+		return pt->http.ah_count_waits;
+	case LWSMI_PT_AH_PROMOTIONS:
+		return pt->http.ah_count_promotions;
+	case LWSMI_AH_POOL:
+		return (uint64_t)context->max_http_header_pool;
+#endif
+	case LWSMI_PT_RX_BUFLIST:
+		return pt->buflist_rx_bytes;
+	case LWSMI_PT_TX_BUFLIST:
+		return pt->buflist_tx_bytes;
+#if defined(LWS_ROLE_H2)
+	case LWSMI_PT_H2_STREAMS:
+		return (uint64_t)pt->h2_streams;
+#endif
+	case LWSMI_PT_LOOP:
+		return sample ? pt->loop.iterations : pt->loop.busy_us;
+	case LWSMI_PT_LOOP_MAX:
+		return pt->loop.busy_max_us;
+
+	case LWSMI_WSI_LIVE:
+		return (uint64_t)context->count_wsi_allocated;
+#if defined(LWS_WITH_TLS)
+	case LWSMI_SSL_SIMULTANEOUS:
+		return (uint64_t)context->simultaneous_ssl;
+#endif
+
+#if defined(LWS_WITH_STATS)
+	case LWSMI_STATS:
+		return lws_stats_get(context, m->arg);
+	case LWSMI_STATS_WORST:
+		return lws_stats_get(context, LWSSTATS_MS_WORST_WRITABLE_DELAY);
+	case LWSMI_STATS_HIST:
+		if (sample == (int)LWS_ARRAY_SIZE(quantiles))
+			return lws_stats_get(context, hist_sum_index[m->arg]);
+
+		count = lws_stats_hist_sum(context, m->arg, hist);
+		if (sample > (int)LWS_ARRAY_SIZE(quantiles))
+			return count;
+
+		v = lws_stats_hist_percentile(hist, count,
+					      quantiles[sample].per_mille);
+
+		/* we know the real worst writable delay, don't report more */
+		worst = lws_stats_get(context,
+				      LWSSTATS_MS_WORST_WRITABLE_DELAY);
+		if (m->arg == LWSSTATS_H_WRITABLE_DELAY && v > worst)
+			v = worst;
+
+		return v;
+#endif
+	}
+
+	return 0;
+}
+
+/* label values escape backslash, double-quote and line feed */
+
+static int
+lws_metric_label(char *dest, const char *s, int len)
+{
+	char *p = dest, *end = dest + len - 3;
+
+	while (*s && p < end) {
+		if (*s == '\\' || *s == '\"' || *s == '\n') {
+			*p++ = '\\';
+			*p++ = *s == '\n' ? 'n' : *s;
+			s++;
+			continue;
+		}
+		*p++ = *s++;
+	}
+	*p = '\0';
+
+	return lws_ptr_diff(p, dest);
+}
+
+static int
+lws_metric_line(struct lws_context *context, struct lws_metrics_render *r,
+		char *line, int len)
+{
+	const struct lws_metric *m = &metrics[r->family];
+	const char *suffix = "", *q = NULL;
+	char labels[128], *lp = labels, *lend = labels + sizeof(labels);
+	int item = r->item - 1;
+	uint64_t v;
+
+	labels[0] = '\0';
+
+	if (!r->item) {
+		/*
+		 * OpenMetrics names the counter family without the _total
+		 * that's on its sample, Prometheus text names the sample
+		 */
+		suffix = m->type == LWSMT_COUNTER && !r->openmetrics ?
+								"_total" : "";
+
+		return lws_snprintf(line, len, "# HELP %s%s %s\n"
+					       "# TYPE %s%s %s\n",
+					       m->name, suffix, m->help,
+					       m->name, suffix,
+					       type_names[m->type]);
+	}
+
+	switch (m->scope) {
+	case LWSMS_VHOST:
+		lp += lws_snprintf(lp, lws_ptr_diff(lend, lp), "vhost=\"");
+		lp += lws_metric_label(lp, r->vh->name,
+				       lws_ptr_diff(lend, lp) - 2);
+		lp += lws_snprintf(lp, lws_ptr_diff(lend, lp), "\"");
+		break;
+	case LWSMS_PT:
+		if (item >= context->count_threads)
+			return 0;
+		lp += lws_snprintf(lp, lws_ptr_diff(lend, lp), "pt=\"%d\"",
+				   item);
+		break;
+	default:
+		item = 0;
+		break;
+	}
+
+	if (m->type == LWSMT_COUNTER)
+		suffix = "_total";
+
+	if (m->type == LWSMT_SUMMARY) {
+		if (r->sample == lws_metric_samples(m) - 2)
+			suffix = "_sum";
+		else
+			if (r->sample == lws_metric_samples(m) - 1)
+				suffix = "_count";
+#if defined(LWS_WITH_STATS)
+			else
+				q = quantiles[r->sample].q;
+#endif
+	}
+
+	if (q)
+		lp += lws_snprintf(lp, lws_ptr_diff(lend, lp),
+				   "%squantile=\"%s\"", lp == labels ? "" : ",",
+				   q);
+
+	v = lws_metric_value(context, m, r->vh, item, r->sample);
+
+	if (m->us && strcmp(suffix, "_count"))
+		return lws_snprintf(line, len, "%s%s%s%s%s %llu.%06llu\n",
+				    m->name, suffix, lp == labels ? "" : "{",
+				    labels, lp == labels ? "" : "}",
+				    (unsigned long long)v / 1000000,
+				    (unsigned long long)v % 1000000);
+
+	return lws_snprintf(line, len, "%s%s%s%s%s %llu\n", m->name, suffix,
+			    lp == labels ? "" : "{", labels,
+			    lp == labels ? "" : "}", (unsigned long long)v);
+}
+
+static void
+lws_metrics_next(struct lws_context *context, struct lws_metrics_render *r)
+{
+	const struct lws_metric *m;
+
+	if (r->family == (int)LWS_ARRAY_SIZE(metrics)) {
+		r->done = 1;
+		return;
+	}
+
+	m = &metrics[r->family];
+	if (r->item && ++r->sample < lws_metric_samples(m))
+		return;
+
+	r->sample = 0;
+
+	switch (m->scope) {
+	case LWSMS_VHOST:
+		r->vh = r->item ? r->vh->vhost_next : context->vhost_list;
+		if (r->vh) {
+			r->item++;
+			return;
+		}
+		break;
+	case LWSMS_PT:
+		if (++r->item <= context->count_threads)
+			return;
+		break;
+	default:
+		if (!r->item++)
+			return;
+		break;
+	}
+
+	r->item = 0;
+	r->family++;
+}
+
+LWS_VISIBLE LWS_EXTERN int
+lws_metrics_render(struct lws_context *context, struct lws_metrics_render *r,
+		   char *buf, int len)
+{
+	char line[384], *p = buf, *end = buf + len;
+	int n;
+
+	/* the vhosts may have changed since the last call, find ours again */
+
+	if (!r->done && r->item && r->family < (int)LWS_ARRAY_SIZE(metrics) &&
+	    metrics[r->family].scope == LWSMS_VHOST) {
+		r->vh = lws_metric_vhost(context, r->item - 1);
+		if (!r->vh) {
+			/* we were at the end of the list, move on */
+			r->item = 0;
+			r->sample = 0;
+			r->family++;
+		}
+	}
+
+	while (!r->done) {
+		if (r->family == (int)LWS_ARRAY_SIZE(metrics))
+			n = r->openmetrics ? lws_snprintf(line, sizeof(line),
+							  "# EOF\n") : 0;
+		else
+			n = lws_metric_line(context, r, line, sizeof(line));
+
+		/* only whole lines, the rest goes in the next call */
+		if (n >= lws_ptr_diff(end, p))
+			break;
+
+		memcpy(p, line, n);
+		p += n;
+
+		lws_metrics_next(context, r);
+	}
+
+	return lws_ptr_diff(p, buf);
+}
+
+#if defined(LWS_WITH_STATS)
+LWS_VISIBLE LWS_EXTERN int
+lws_stats_prometheus(struct lws_context *context, char *buf, int len)
+{
+	struct lws_metrics_render r;
+	int n;
+
+	memset(&r, 0, sizeof(r));
+	n = lws_metrics_render(context, &r, buf, len);
+	if (!r.done)
+		return -1;
+
+	buf[n] = '\0';
+
+	return n;
+}
+#endif
@@ -21,14 +21,160 @@
 
 #include "core/private.h"
 
-/* requires context->lock */
+#if LWS_MAX_SMP > 1
+#define lws_peer_shard_lock(_s) pthread_mutex_lock(&(_s)->lock)
+#define lws_peer_shard_unlock(_s) pthread_mutex_unlock(&(_s)->lock)
+#else
+#define lws_peer_shard_lock(_s) (void)(_s)
+#define lws_peer_shard_unlock(_s) (void)(_s)
+#endif
+
+/* the most buckets a shard grows to */
+#define LWS_PEER_SHARD_MAX_ELEMENTS (1 << 20)
+
+/*
+ * SipHash-2-4 of the peer address, keyed with a random per-context key so
+ * remote peers can't choose addresses that all land in one bucket
+ */
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+static uint64_t
+lws_peer_u8to64_le(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+	       ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+	       ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+	       ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t
+lws_peer_hash(const uint8_t *key, const uint8_t *in, size_t len)
+{
+	uint64_t k0 = lws_peer_u8to64_le(key), k1 = lws_peer_u8to64_le(key + 8),
+		 v0 = 0x736f6d6570736575ull ^ k0,
+		 v1 = 0x646f72616e646f6dull ^ k1,
+		 v2 = 0x6c7967656e657261ull ^ k0,
+		 v3 = 0x7465646279746573ull ^ k1,
+		 b = ((uint64_t)len) << 56, m;
+	size_t n;
+
+	for (; len >= 8; len -= 8, in += 8) {
+		m = lws_peer_u8to64_le(in);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	for (n = 0; n < len; n++)
+		b |= ((uint64_t)in[n]) << (8 * n);
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	b = v0 ^ v1 ^ v2 ^ v3;
+
+	return (uint32_t)(b ^ (b >> 32));
+}
+
+static struct lws_peer_shard *
+lws_peer_shard(struct lws_context *context, struct lws_peer *peer)
+{
+	return &context->pl_shard[peer->hash >> (32 - LWS_PEER_SHARDS_LOG2)];
+}
+
+int
+lws_peer_limits_init(struct lws_context *context)
+{
+	uint32_t n, e = 4;
+
+	/*
+	 * scale the peer hash table according to the max fds for the process,
+	 * so that the max list depth averages 16.  Eg, 1024 fd -> 64,
+	 * 102400 fd -> 6400.  It's split over the shards, each starting with
+	 * a power of 2 buckets and growing when it has more peers than that.
+	 */
+
+	context->pl_hash_elements =
+		(context->count_threads * context->fd_limit_per_thread) / 16;
+	while (e * LWS_PEER_SHARDS < context->pl_hash_elements &&
+	       e < LWS_PEER_SHARD_MAX_ELEMENTS)
+		e <<= 1;
+
+	if (lws_get_random(context, context->pl_hash_key,
+			   sizeof(context->pl_hash_key)) !=
+					sizeof(context->pl_hash_key)) {
+		lwsl_err("%s: unable to get random hash key\n", __func__);
+
+		return 1;
+	}
+
+	for (n = 0; n < LWS_PEER_SHARDS; n++) {
+		struct lws_peer_shard *s = &context->pl_shard[n];
+
+		s->table = lws_zalloc(sizeof(struct lws_peer *) * e,
+				      "peer limits hash table");
+		if (!s->table)
+			return 1;
+#if LWS_MAX_SMP > 1
+		pthread_mutex_init(&s->lock, NULL);
+#endif
+		s->elements = e;
+	}
+
+	return 0;
+}
+
+void
+lws_peer_limits_destroy(struct lws_context *context)
+{
+	uint32_t n, nu;
+
+	for (n = 0; n < LWS_PEER_SHARDS; n++) {
+		struct lws_peer_shard *s = &context->pl_shard[n];
+
+		for (nu = 0; nu < s->elements; nu++)
+			lws_start_foreach_llp(struct lws_peer **, peer,
+					      s->table[nu]) {
+				struct lws_peer *df = *peer;
+				*peer = df->next;
+				lws_free(df);
+				continue;
+			} lws_end_foreach_llp(peer, next);
+
+		if (s->elements) {
+#if LWS_MAX_SMP > 1
+			pthread_mutex_destroy(&s->lock);
+#endif
+			s->elements = 0;
+		}
+		lws_free_set_NULL(s->table);
+	}
+}
+
+/* requires shard lock */
 static void
-__lws_peer_remove_from_peer_wait_list(struct lws_context *context,
+__lws_peer_remove_from_peer_wait_list(struct lws_peer_shard *s,
 				      struct lws_peer *peer)
 {
 	struct lws_peer *df;
 
-	lws_start_foreach_llp(struct lws_peer **, p, context->peer_wait_list) {
+	lws_start_foreach_llp(struct lws_peer **, p, s->peer_wait_list) {
 		if (*p == peer) {
 			df = *p;
 
@@ -40,70 +186,100 @@ __lws_peer_remove_from_peer_wait_list(struct lws_context *context,
 	} lws_end_foreach_llp(p, peer_wait_list);
 }
 
-/* requires context->lock */
+/* requires shard lock */
 static void
-__lws_peer_add_to_peer_wait_list(struct lws_context *context,
+__lws_peer_add_to_peer_wait_list(struct lws_peer_shard *s,
 				 struct lws_peer *peer)
 {
-	__lws_peer_remove_from_peer_wait_list(context, peer);
+	__lws_peer_remove_from_peer_wait_list(s, peer);
 
-	peer->peer_wait_list = context->peer_wait_list;
-	context->peer_wait_list = peer;
+	peer->peer_wait_list = s->peer_wait_list;
+	s->peer_wait_list = peer;
 }
 
+/*
+ * requires shard lock... double the buckets, if we can't get the memory we
+ * just carry on with longer chains
+ */
+static void
+__lws_peer_shard_grow(struct lws_peer_shard *s)
+{
+	uint32_t e = s->elements * 2, n;
+	struct lws_peer **t, *peer;
+
+	t = lws_zalloc(sizeof(struct lws_peer *) * e, "peer limits hash table");
+	if (!t)
+		return;
+
+	for (n = 0; n < s->elements; n++)
+		while (s->table[n]) {
+			peer = s->table[n];
+			s->table[n] = peer->next;
+			peer->next = t[peer->hash & (e - 1)];
+			t[peer->hash & (e - 1)] = peer;
+		}
+
+	lws_free(s->table);
+	s->table = t;
+	s->elements = e;
+
+	lwsl_info("%s: shard grown to %u\n", __func__, e);
+}
+
+/*
+ * sa is NULL, or the peer address if we already know it from accept()
+ */
 
 struct lws_peer *
-lws_get_or_create_peer(struct lws_vhost *vhost, lws_sockfd_type sockfd)
+lws_get_or_create_peer(struct lws_vhost *vhost, lws_sockfd_type sockfd,
+		       const struct sockaddr *sa)
 {
 	struct lws_context *context = vhost->context;
-	socklen_t rlen = 0;
-	void *q;
-	uint8_t *q8;
-	struct lws_peer *peer;
-	uint32_t hash = 0;
-	int n, af = AF_INET;
 	struct sockaddr_storage addr;
+	struct lws_peer_shard *s;
+	struct lws_peer *peer;
+	uint8_t k[17];
+	socklen_t rlen;
+	uint32_t hash;
+	void *q;
 
 	if (vhost->options & LWS_SERVER_OPTION_UNIX_SOCK)
 		return NULL;
 
-#ifdef LWS_WITH_IPV6
-	if (LWS_IPV6_ENABLED(vhost)) {
-		af = AF_INET6;
+	if (!sa) {
+		rlen = sizeof(addr);
+		if (getpeername(sockfd, (struct sockaddr *)&addr, &rlen))
+			/* eg, udp doesn't have to have a peer */
+			return NULL;
+		sa = (struct sockaddr *)&addr;
 	}
-#endif
-	rlen = sizeof(addr);
-	if (getpeername(sockfd, (struct sockaddr*)&addr, &rlen))
-		/* eg, udp doesn't have to have a peer */
-		return NULL;
 
-	if (af == AF_INET) {
-		struct sockaddr_in *s = (struct sockaddr_in *)&addr;
-		q = &s->sin_addr;
-		rlen = sizeof(s->sin_addr);
+	if (sa->sa_family == AF_INET) {
+		const struct sockaddr_in *s4 = (const struct sockaddr_in *)sa;
+		q = (void *)&s4->sin_addr;
+		rlen = sizeof(s4->sin_addr);
 	} else
 #ifdef LWS_WITH_IPV6
-	{
-		struct sockaddr_in6 *s = (struct sockaddr_in6 *)&addr;
-		q = &s->sin6_addr;
-		rlen = sizeof(s->sin6_addr);
-	}
-#else
-		return NULL;
+	if (sa->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *s6 = (const struct sockaddr_in6 *)sa;
+		q = (void *)&s6->sin6_addr;
+		rlen = sizeof(s6->sin6_addr);
+	} else
 #endif
+		return NULL;
 
-	q8 = q;
-	for (n = 0; n < (int)rlen; n++)
-		hash = (((hash << 4) | (hash >> 28)) * n) ^ q8[n];
-
-	hash = hash % context->pl_hash_elements;
+	k[0] = (uint8_t)sa->sa_family;
+	memcpy(&k[1], q, rlen);
+	hash = lws_peer_hash(context->pl_hash_key, k, rlen + 1);
+	s = &context->pl_shard[hash >> (32 - LWS_PEER_SHARDS_LOG2)];
 
-	lws_context_lock(context, "peer search"); /* <======================= */
+	lws_peer_shard_lock(s); /* <======================================== */
 
 	lws_start_foreach_ll(struct lws_peer *, peerx,
-			     context->pl_hash_table[hash]) {
-		if (peerx->af == af && !memcmp(q, peerx->addr, rlen)) {
-			lws_context_unlock(context); /* === */
+			     s->table[hash & (s->elements - 1)]) {
+		if (peerx->hash == hash && peerx->af == sa->sa_family &&
+		    !memcmp(q, peerx->addr, rlen)) {
+			lws_peer_shard_unlock(s); /* === */
 			return peerx;
 		}
 	} lws_end_foreach_ll(peerx, next);
@@ -112,41 +288,46 @@ lws_get_or_create_peer(struct lws_vhost *vhost, lws_sockfd_type sockfd)
 
 	peer = lws_zalloc(sizeof(*peer), "peer");
 	if (!peer) {
-		lws_context_unlock(context); /* === */
+		lws_peer_shard_unlock(s); /* === */
 		lwsl_err("%s: OOM for new peer\n", __func__);
 		return NULL;
 	}
 
-	context->count_peers++;
-	peer->next = context->pl_hash_table[hash];
+	if (++s->count > s->elements &&
+	    s->elements < LWS_PEER_SHARD_MAX_ELEMENTS)
+		__lws_peer_shard_grow(s);
+
+	peer->next = s->table[hash & (s->elements - 1)];
 	peer->hash = hash;
-	peer->af = af;
-	context->pl_hash_table[hash] = peer;
+	peer->af = (uint8_t)sa->sa_family;
+	s->table[hash & (s->elements - 1)] = peer;
 	memcpy(peer->addr, q, rlen);
+	lws_tokenbucket_init(&peer->tb_req, context->ip_limit_req_rate);
+	lws_tokenbucket_init(&peer->tb_bytes, context->ip_limit_byte_rate);
 	time(&peer->time_created);
 	/*
 	 * On creation, the peer has no wsi attached, so is created on the
 	 * wait list.  When a wsi is added it is removed from the wait list.
 	 */
 	time(&peer->time_closed_all);
-	__lws_peer_add_to_peer_wait_list(context, peer);
+	__lws_peer_add_to_peer_wait_list(s, peer);
 
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_shard_unlock(s); /* =======================================> */
 
 	return peer;
 }
 
-/* requires context->lock */
+/* requires shard lock */
 static int
-__lws_peer_destroy(struct lws_context *context, struct lws_peer *peer)
+__lws_peer_destroy(struct lws_peer_shard *s, struct lws_peer *peer)
 {
 	lws_start_foreach_llp(struct lws_peer **, p,
-			      context->pl_hash_table[peer->hash]) {
+			      s->table[peer->hash & (s->elements - 1)]) {
 		if (*p == peer) {
 			struct lws_peer *df = *p;
 			*p = df->next;
 			lws_free(df);
-			context->count_peers--;
+			s->count--;
 
 			return 0;
 		}
@@ -158,48 +339,59 @@ __lws_peer_destroy(struct lws_context *context, struct lws_peer *peer)
 void
 lws_peer_cull_peer_wait_list(struct lws_context *context)
 {
+	struct lws_peer_shard *s;
 	struct lws_peer *df;
 	time_t t;
+	int n;
 
 	time(&t);
 
 	if (context->next_cull && t < context->next_cull)
 		return;
 
-	lws_context_lock(context, "peer cull"); /* <========================= */
-
 	context->next_cull = t + 5;
 
-	lws_start_foreach_llp(struct lws_peer **, p, context->peer_wait_list) {
-		if (t - (*p)->time_closed_all > 10) {
-			df = *p;
+	for (n = 0; n < LWS_PEER_SHARDS; n++) {
+		s = &context->pl_shard[n];
 
-			/* remove us from the peer wait list */
-			*p = df->peer_wait_list;
-			df->peer_wait_list = NULL;
+		lws_peer_shard_lock(s); /* <================================ */
 
-			__lws_peer_destroy(context, df);
-			continue; /* we already point to next, if any */
-		}
-	} lws_end_foreach_llp(p, peer_wait_list);
+		lws_start_foreach_llp(struct lws_peer **, p,
+				      s->peer_wait_list) {
+			if (t - (*p)->time_closed_all > 10) {
+				df = *p;
+
+				/* remove us from the peer wait list */
+				*p = df->peer_wait_list;
+				df->peer_wait_list = NULL;
+
+				__lws_peer_destroy(s, df);
+				continue; /* we already point to next, if any */
+			}
+		} lws_end_foreach_llp(p, peer_wait_list);
 
-	lws_context_unlock(context); /* ====================================> */
+		lws_peer_shard_unlock(s); /* ===============================> */
+	}
 }
 
 void
 lws_peer_add_wsi(struct lws_context *context, struct lws_peer *peer,
 		 struct lws *wsi)
 {
+	struct lws_peer_shard *s;
+
 	if (!peer)
 		return;
 
-	lws_context_lock(context, "peer add"); /* <========================== */
+	s = lws_peer_shard(context, peer);
+
+	lws_peer_shard_lock(s); /* <======================================== */
 
 	peer->count_wsi++;
 	wsi->peer = peer;
-	__lws_peer_remove_from_peer_wait_list(context, peer);
+	__lws_peer_remove_from_peer_wait_list(s, peer);
 
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_shard_unlock(s); /* =======================================> */
 }
 
 void
@@ -228,10 +420,14 @@ lws_peer_dump_from_wsi(struct lws *wsi)
 void
 lws_peer_track_wsi_close(struct lws_context *context, struct lws_peer *peer)
 {
+	struct lws_peer_shard *s;
+
 	if (!peer)
 		return;
 
-	lws_context_lock(context, "peer wsi close"); /* <==================== */
+	s = lws_peer_shard(context, peer);
+
+	lws_peer_shard_lock(s); /* <======================================== */
 
 	assert(peer->count_wsi);
 	peer->count_wsi--;
@@ -250,10 +446,10 @@ lws_peer_track_wsi_close(struct lws_context *context, struct lws_peer *peer)
 		 * later if no further activity is coming.
 		 */
 		time(&peer->time_closed_all);
-		__lws_peer_add_to_peer_wait_list(context, peer);
+		__lws_peer_add_to_peer_wait_list(s, peer);
 	}
 
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_shard_unlock(s); /* =======================================> */
 }
 
 #if defined(LWS_ROLE_H1) || defined(LWS_ROLE_H2)
@@ -275,15 +471,229 @@ lws_peer_confirm_ah_attach_ok(struct lws_context *context,
 	return 0;
 }
 
+void
+lws_peer_track_ah_attach(struct lws_context *context, struct lws_peer *peer)
+{
+	struct lws_peer_shard *s;
+
+	if (!peer)
+		return;
+
+	s = lws_peer_shard(context, peer);
+
+	lws_peer_shard_lock(s); /* <======================================== */
+	peer->http.count_ah++;
+	lws_peer_shard_unlock(s); /* =======================================> */
+}
+
 void
 lws_peer_track_ah_detach(struct lws_context *context, struct lws_peer *peer)
 {
+	struct lws_peer_shard *s;
+
 	if (!peer)
 		return;
 
-	lws_context_lock(context, "peer ah detach"); /* <==================== */
+	s = lws_peer_shard(context, peer);
+
+	lws_peer_shard_lock(s); /* <======================================== */
 	assert(peer->http.count_ah);
 	peer->http.count_ah--;
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_shard_unlock(s); /* =======================================> */
 }
 #endif
+
+/*
+ * Request and byte rate limiting
+ *
+ * Peers and vhosts may have token buckets for requests/s and bytes/s.
+ * Connections from a peer are charged against both the peer's and the
+ * vhost's buckets for each request they start and each byte they read or
+ * write on the network.  When a charge leaves any bucket in debt, the network
+ * connection is not dropped, but held: rx is flow controlled and POLLOUT is
+ * not serviced until the debt has been paid back by the buckets refilling.
+ */
+
+#define LWS_TB_SCALE 1000000ll /* credit per token, ie, us per s */
+
+void
+lws_tokenbucket_init(struct lws_tokenbucket *tb, uint32_t rate)
+{
+	tb->rate = rate;
+	tb->credit = (int64_t)rate * LWS_TB_SCALE;
+	tb->last = lws_time_in_microseconds();
+}
+
+/*
+ * requires the lock protecting the bucket.  Refills the bucket for the time
+ * since it was last looked at, takes n tokens, and returns 0 if it is still
+ * in credit, else how many us until it will be.
+ */
+
+static lws_usec_t
+__lws_tokenbucket_charge(struct lws_tokenbucket *tb, lws_usec_t now, size_t n)
+{
+	int64_t full = (int64_t)tb->rate * LWS_TB_SCALE;
+	lws_usec_t el = now - tb->last;
+
+	if (!tb->rate)
+		return 0;
+
+	tb->last = now;
+
+	if (el > 0) {
+		/* any debt plus a whole second must have been refilled */
+		if (el >= LWS_TB_SCALE + (tb->credit < 0 ?
+					  -tb->credit / tb->rate : 0))
+			tb->credit = full;
+		else {
+			tb->credit += el * tb->rate;
+			if (tb->credit > full)
+				tb->credit = full;
+		}
+	}
+
+	tb->credit -= (int64_t)n * LWS_TB_SCALE;
+	if (tb->credit >= 0)
+		return 0;
+
+	return (-tb->credit + tb->rate - 1) / tb->rate;
+}
+
+/*
+ * Charge reqs requests and bytes network bytes on wsi to its peer and vhost,
+ * and hold its network connection if that takes any of them into debt
+ */
+
+void
+lws_peer_ratelimit_charge(struct lws *wsi, int reqs, size_t bytes)
+{
+	struct lws *nwsi = lws_get_network_wsi(wsi);
+	struct lws_context_per_thread *pt;
+	struct lws_peer *peer = nwsi->peer;
+	struct lws_vhost *vh = wsi->vhost;
+	lws_usec_t now, w, wait = 0;
+	struct lws_peer_shard *s;
+
+	/* only accepted network connections are tracked as peers */
+
+	if (!peer || (!peer->tb_req.rate && !peer->tb_bytes.rate &&
+		      (!vh || (!vh->tb_req.rate && !vh->tb_bytes.rate))))
+		return;
+
+	now = lws_time_in_microseconds();
+
+	if (peer->tb_req.rate || peer->tb_bytes.rate) {
+		s = lws_peer_shard(wsi->context, peer);
+
+		lws_peer_shard_lock(s); /* <================================ */
+		w = __lws_tokenbucket_charge(&peer->tb_req, now, (size_t)reqs);
+		if (w > wait)
+			wait = w;
+		w = __lws_tokenbucket_charge(&peer->tb_bytes, now, bytes);
+		if (w > wait)
+			wait = w;
+		lws_peer_shard_unlock(s); /* ===============================> */
+	}
+
+	if (vh && (vh->tb_req.rate || vh->tb_bytes.rate)) {
+		lws_vhost_lock(vh); /* <==================================== */
+		w = __lws_tokenbucket_charge(&vh->tb_req, now, (size_t)reqs);
+		if (w > wait)
+			wait = w;
+		w = __lws_tokenbucket_charge(&vh->tb_bytes, now, bytes);
+		if (w > wait)
+			wait = w;
+		lws_vhost_unlock(vh); /* ===================================> */
+	}
+
+	if (!wait)
+		return;
+
+	pt = &wsi->context->pt[(int)nwsi->tsi];
+
+	lws_pt_lock(pt, __func__); /* <===================================== */
+
+	if (nwsi->ratelimit_until < now + wait)
+		nwsi->ratelimit_until = now + wait;
+
+	if (!nwsi->ratelimited) {
+		lwsl_info("%s: wsi %p: over rate limit, holding for %lldus\n",
+			  __func__, nwsi, (long long)wait);
+
+		nwsi->ratelimited = 1;
+		lws_dll_lws_add_front(&nwsi->dll_ratelimited,
+				      &pt->dll_head_ratelimited);
+
+		/*
+		 * we change the pollfd directly rather than go through
+		 * lws_rx_flow_control(), since that waits for any buflist to
+		 * drain before disabling rx, and ignores h2 network wsi.  The
+		 * bitmap reason still stops the buflist being serviced.
+		 */
+		nwsi->rxflow_bitmap |= LWS_RXFLOW_REASON_RATELIMIT;
+		nwsi->rxflow_change_to &= ~LWS_RXFLOW_ALLOW;
+		__lws_change_pollfd(nwsi, LWS_POLLIN, 0);
+	}
+
+	lws_pt_unlock(pt); /* =============================================> */
+}
+
+/* requires pt lock */
+
+void
+__lws_peer_ratelimit_remove(struct lws *wsi)
+{
+	if (!wsi->ratelimited)
+		return;
+
+	lws_dll_lws_remove(&wsi->dll_ratelimited);
+	wsi->ratelimited = 0;
+	wsi->ratelimit_pollout = 0;
+	wsi->rxflow_bitmap &= ~LWS_RXFLOW_REASON_RATELIMIT;
+}
+
+/*
+ * requires pt lock.  Releases held connections whose debt should have been
+ * paid back by now, and returns how many us until the next one is due, or
+ * LWS_HRTIMER_NOWAIT if none are held.  If other connections from the same
+ * peer put it back in debt meanwhile, the released connection is held again
+ * by its own next charge.
+ */
+
+lws_usec_t
+__lws_peer_ratelimit_service(struct lws_context_per_thread *pt)
+{
+	lws_usec_t now, soonest = LWS_HRTIMER_NOWAIT;
+	int pollout;
+
+	if (!pt->dll_head_ratelimited.next)
+		return soonest;
+
+	now = lws_time_in_microseconds();
+
+	lws_start_foreach_dll_safe(struct lws_dll_lws *, d, d1,
+				   pt->dll_head_ratelimited.next) {
+		struct lws *wsi = lws_container_of(d, struct lws,
+						   dll_ratelimited);
+
+		if (wsi->ratelimit_until > now) {
+			if (wsi->ratelimit_until - now < soonest)
+				soonest = wsi->ratelimit_until - now;
+		} else {
+			lwsl_info("%s: wsi %p: releasing\n", __func__, wsi);
+
+			pollout = wsi->ratelimit_pollout;
+			__lws_peer_ratelimit_remove(wsi);
+
+			if (!wsi->rxflow_bitmap) {
+				wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
+				__lws_change_pollfd(wsi, 0, LWS_POLLIN);
+			}
+			if (pollout)
+				__lws_change_pollfd(wsi, 0, LWS_POLLOUT);
+		}
+	} lws_end_foreach_dll_safe(d, d1);
+
+	return soonest;
+}
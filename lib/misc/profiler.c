@@ -0,0 +1,829 @@
+/*
+ * libwebsockets - protocol callback and role handler profiler
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "core/private.h"
+
+#include <time.h>
+
+#if defined(LWS_HAVE_EXECINFO_H)
+#include <execinfo.h>
+#endif
+
+/*
+ * Each service thread has its own table of timings.  The table is open
+ * addressed on the key
+ *
+ *   (vhost, protocol, protocol callback, role, reason or role handler)
+ *
+ * and has a fixed number of entries: once it is full, new keys are counted
+ * in "dropped" and not recorded.
+ *
+ * Only the owning service thread adds keys or counts into the table, so
+ * recording against a key already in it takes no lock.  Adding a key, vhost
+ * destroy marking keys gone and other threads reading the table take the
+ * table's own lock, so readers always see whole keys.  The counts they read
+ * may be a little behind.
+ *
+ * The histograms use the same log-linear buckets as the stats.
+ */
+
+#define LWS_PROF_ENTRIES	256	/* power of 2 */
+#define LWS_PROF_JSON_TOP	16	/* keys with most total time dumped */
+#define LWS_PROF_LOG_INTERVAL	(10 * 1000000ll) /* per key */
+#define LWS_PROF_BT_DEPTH	16
+
+struct lws_prof_key {
+	const struct lws_vhost *vh;
+	const struct lws_protocols *pr;
+	lws_callback_function *cb;
+	const struct lws_role_ops *rops;
+	int what;	/* callback reason, or enum lws_prof_role_handler */
+};
+
+struct lws_prof_entry {
+	struct lws_prof_key k;
+
+	uint64_t total_us;
+	lws_usec_t last_log;
+	uint32_t count;
+	uint32_t max_us;
+	uint32_t stalls;
+	uint32_t stalls_logged;
+	uint32_t hist[LWS_HIST_BUCKETS];
+
+	char used;
+	char gone;	/* the vhost was destroyed, slot may be reused */
+};
+
+struct lws_prof {
+	struct lws_prof_entry e[LWS_PROF_ENTRIES];
+#if LWS_MAX_SMP > 1
+	pthread_mutex_t lock;	/* for changing keys, or reading from outside */
+#endif
+
+	/* the watchdog thread reads these while we are inside a handler */
+
+	volatile lws_usec_t entered; /* start of outermost handler, or 0 */
+	const char * volatile cur_name;	/* innermost protocol or role name */
+	volatile int cur_what;	/* ... and its reason or role handler */
+
+	/* only the watchdog thread uses these */
+
+	lws_usec_t wd_entered;	/* the outermost handler we last logged */
+	lws_usec_t wd_last_log;
+
+	uint32_t dropped;
+	uint32_t stalls;
+	int depth;
+	char stall_seen; /* a nested handler already reported this stall */
+};
+
+#if defined(LWS_WITH_PROFILER_WATCHDOG)
+struct lws_prof_watchdog {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char exiting;
+};
+#endif
+
+struct lws_prof_sum {
+	struct lws_prof_key k;
+	uint64_t total_us;
+};
+
+static lws_usec_t
+lws_prof_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return ((lws_usec_t)ts.tv_sec * 1000000ll) +
+			(ts.tv_nsec / 1000);
+#endif
+
+	return lws_now_usecs();
+}
+
+static void
+lws_prof_lock(struct lws_prof *prof)
+{
+#if LWS_MAX_SMP > 1
+	pthread_mutex_lock(&prof->lock);
+#else
+	(void)prof;
+#endif
+}
+
+static void
+lws_prof_unlock(struct lws_prof *prof)
+{
+#if LWS_MAX_SMP > 1
+	pthread_mutex_unlock(&prof->lock);
+#else
+	(void)prof;
+#endif
+}
+
+static int
+lws_prof_key_eq(const struct lws_prof_key *a, const struct lws_prof_key *b)
+{
+	return a->vh == b->vh && a->pr == b->pr && a->cb == b->cb &&
+	       a->rops == b->rops && a->what == b->what;
+}
+
+static unsigned int
+lws_prof_hash(const struct lws_prof_key *k)
+{
+	uint64_t h = (uint64_t)(lws_intptr_t)k->vh;
+
+	h = (h * 31) ^ (uint64_t)(lws_intptr_t)k->pr;
+	h = (h * 31) ^ (uint64_t)(lws_intptr_t)k->cb;
+	h = (h * 31) ^ (uint64_t)(lws_intptr_t)k->rops;
+	h = (h * 31) ^ (uint64_t)(unsigned int)k->what;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 32;
+
+	return (unsigned int)h & (LWS_PROF_ENTRIES - 1);
+}
+
+/* the entry for k, else NULL and the slot it could go in (NULL if full) */
+
+static struct lws_prof_entry *
+lws_prof_probe(struct lws_prof *prof, const struct lws_prof_key *k,
+	       struct lws_prof_entry **slot)
+{
+	struct lws_prof_entry *e, *reuse = NULL;
+	unsigned int h = lws_prof_hash(k), n;
+
+	for (n = 0; n < LWS_PROF_ENTRIES; n++) {
+		e = &prof->e[(h + n) & (LWS_PROF_ENTRIES - 1)];
+		if (!e->used)
+			break;
+		if (e->gone) {
+			if (!reuse)
+				reuse = e;
+			continue;
+		}
+		if (lws_prof_key_eq(&e->k, k))
+			return e;
+	}
+
+	*slot = reuse ? reuse : (n == LWS_PROF_ENTRIES ? NULL : e);
+
+	return NULL;
+}
+
+/*
+ * Only the owning service thread may create, other threads must hold the
+ * table lock to look up
+ */
+
+static struct lws_prof_entry *
+lws_prof_find(struct lws_prof *prof, const struct lws_prof_key *k, int create)
+{
+	struct lws_prof_entry *e, *slot;
+
+	e = lws_prof_probe(prof, k, &slot);
+	if (e || !create)
+		return e;
+
+	/* probe again under the lock, vhost destroy may have freed a slot */
+
+	lws_prof_lock(prof);
+
+	e = lws_prof_probe(prof, k, &slot);
+	if (!e) {
+		if (slot) {
+			memset(slot, 0, sizeof(*slot));
+			slot->k = *k;
+			slot->used = 1;
+			e = slot;
+		} else
+			prof->dropped++;
+	}
+
+	lws_prof_unlock(prof);
+
+	return e;
+}
+
+static uint32_t
+lws_prof_percentile(const struct lws_prof_entry *e, int per_mille)
+{
+	uint64_t want = ((uint64_t)e->count * (unsigned int)per_mille + 999) /
+									1000,
+		 seen = 0, v;
+	int b;
+
+	for (b = 0; b < LWS_HIST_BUCKETS - 1; b++) {
+		seen += e->hist[b];
+		if (seen >= want)
+			break;
+	}
+
+	/* report the top of the bucket, but never more than the max seen */
+
+	v = b == LWS_HIST_BUCKETS - 1 ? e->max_us :
+					lws_hist_bucket_floor(b + 1) - 1;
+	if (v > e->max_us)
+		v = e->max_us;
+
+	return (uint32_t)v;
+}
+
+static const char *
+lws_prof_name(const struct lws_prof_key *k)
+{
+	int n;
+
+	if (k->rops)
+		return k->rops->name;
+	if (k->pr)
+		return k->pr->name;
+	if (k->vh)
+		for (n = 0; n < k->vh->count_protocols; n++)
+			if (k->vh->protocols[n].callback == k->cb)
+				return k->vh->protocols[n].name;
+
+	return "unknown";
+}
+
+static const char *
+lws_prof_handler_name(int what)
+{
+	switch (what) {
+	case LWS_PROF_POLLIN:
+		return "POLLIN";
+	case LWS_PROF_POLLOUT:
+		return "POLLOUT";
+	case LWS_PROF_PERIODIC:
+		return "periodic";
+	}
+
+	return "?";
+}
+
+static void
+lws_prof_log_stall(struct lws_context_per_thread *pt,
+		   struct lws_prof_entry *e, lws_usec_t us)
+{
+#if defined(LWS_HAVE_EXECINFO_H)
+	void *bt[LWS_PROF_BT_DEPTH];
+	char **syms;
+	int n, m;
+#endif
+
+	if (e->k.rops)
+		lwsl_warn("%s: tsi %d stalled %lldus in %s %s role %s "
+			  "(%u stalls, %u not logged)\n", __func__, pt->tid,
+			  (long long)us, e->k.vh ? e->k.vh->name : "(no vhost)",
+			  lws_prof_name(&e->k),
+			  lws_prof_handler_name(e->k.what), e->stalls,
+			  e->stalls - e->stalls_logged - 1);
+	else
+		lwsl_warn("%s: tsi %d stalled %lldus in %s protocol %s "
+			  "reason %d (%u stalls, %u not logged)\n", __func__,
+			  pt->tid, (long long)us,
+			  e->k.vh ? e->k.vh->name : "(no vhost)",
+			  lws_prof_name(&e->k), e->k.what, e->stalls,
+			  e->stalls - e->stalls_logged - 1);
+
+	e->stalls_logged = e->stalls;
+
+#if defined(LWS_HAVE_EXECINFO_H)
+	/* where lws called the slow callback or handler from */
+
+	m = backtrace(bt, LWS_ARRAY_SIZE(bt));
+	syms = backtrace_symbols(bt, m);
+	if (!syms)
+		return;
+
+	/* skip ourselves */
+	for (n = 1; n < m; n++)
+		lwsl_warn("    %s\n", syms[n]);
+
+	free(syms);
+#endif
+}
+
+static void
+lws_prof_record(struct lws_context_per_thread *pt, lws_usec_t start,
+		const struct lws_prof_key *k)
+{
+	struct lws_prof *prof = pt->prof;
+	struct lws_prof_entry *e;
+	lws_usec_t now, us;
+	uint32_t u;
+
+	now = lws_prof_now();
+	us = now - start;
+	if (us < 0)
+		us = 0;
+	u = us > 0xffffffffll ? 0xffffffff : (uint32_t)us;
+
+	if (!--prof->depth)
+		/* the watchdog has nothing to look at until the next one */
+		prof->entered = 0;
+
+	e = lws_prof_find(prof, k, 1);
+	if (e) {
+		e->count++;
+		e->total_us += (uint64_t)us;
+		if (u > e->max_us)
+			e->max_us = u;
+		e->hist[lws_hist_bucket(u)]++;
+
+		if (u >= pt->context->prof_stall_us) {
+			e->stalls++;
+
+			/*
+			 * The handlers we were called inside of stalled for
+			 * at least as long, only count and log the innermost
+			 * one for the thread
+			 */
+
+			if (!prof->stall_seen) {
+				prof->stalls++;
+				if (!e->last_log ||
+				    now - e->last_log >= LWS_PROF_LOG_INTERVAL) {
+					e->last_log = now;
+					lws_prof_log_stall(pt, e, us);
+				}
+			}
+			prof->stall_seen = 1;
+		}
+	}
+
+	if (!prof->depth)
+		prof->stall_seen = 0;
+}
+
+static lws_usec_t
+lws_prof_start(struct lws_prof *prof, const char *name, int what)
+{
+	lws_usec_t now = lws_prof_now();
+
+	prof->cur_name = name;
+	prof->cur_what = what;
+	if (!prof->depth++)
+		prof->entered = now;
+
+	return now;
+}
+
+lws_usec_t
+lws_prof_enter(struct lws_context_per_thread *pt,
+	       const struct lws_role_ops *rops, int what)
+{
+	if (!pt->prof)
+		return 0;
+
+	return lws_prof_start(pt->prof, rops->name, what);
+}
+
+void
+lws_prof_exit(struct lws_context_per_thread *pt, lws_usec_t start,
+	      const struct lws_vhost *vh, const struct lws_role_ops *rops,
+	      int what)
+{
+	struct lws_prof_key k;
+
+	if (!pt->prof)
+		return;
+
+	memset(&k, 0, sizeof(k));
+	k.vh = vh;
+	k.rops = rops;
+	k.what = what;
+
+	lws_prof_record(pt, start, &k);
+}
+
+int
+lws_prof_callback(lws_callback_function *cb, struct lws *wsi,
+		  enum lws_callback_reasons reason, void *user, void *in,
+		  size_t len)
+{
+	struct lws_context_per_thread *pt;
+	const char *name;
+	struct lws_prof_key k;
+	lws_usec_t start;
+	int n, what;
+
+	if (!wsi || !wsi->context)
+		return cb(wsi, reason, user, in, len);
+
+	pt = &wsi->context->pt[(int)wsi->tsi];
+	if (!pt->prof)
+		return cb(wsi, reason, user, in, len);
+
+#if LWS_MAX_SMP > 1
+	/* only the service thread may touch the pt's table */
+	if (pt->inside_service && !pthread_equal(pt->self, pthread_self()))
+		return cb(wsi, reason, user, in, len);
+#endif
+
+	/* the callback may destroy the wsi, take what we need now */
+
+	memset(&k, 0, sizeof(k));
+	k.vh = wsi->vhost;
+	k.pr = wsi->protocol && wsi->protocol->callback == cb ?
+							wsi->protocol : NULL;
+	k.cb = cb;
+	k.what = (int)reason;
+
+	/* what we were inside of before, for the watchdog */
+	name = pt->prof->cur_name;
+	what = pt->prof->cur_what;
+
+	start = lws_prof_start(pt->prof, k.pr ? k.pr->name : NULL, k.what);
+	n = cb(wsi, reason, user, in, len);
+	lws_prof_record(pt, start, &k);
+
+	pt->prof->cur_name = name;
+	pt->prof->cur_what = what;
+
+	return n;
+}
+
+void
+lws_prof_vhost_destroy(struct lws_vhost *vh)
+{
+	struct lws_context *context = vh->context;
+	struct lws_prof *prof;
+	int n, m;
+
+	for (n = 0; n < context->count_threads; n++) {
+		prof = context->pt[n].prof;
+		if (!prof)
+			continue;
+
+		/*
+		 * We can't empty the slots without breaking the probe chains
+		 * of keys inserted after them, mark them as reusable instead.
+		 * The key is left alone, since the owning service thread may
+		 * be comparing against it without the lock.
+		 */
+
+		lws_prof_lock(prof);
+		for (m = 0; m < LWS_PROF_ENTRIES; m++)
+			if (prof->e[m].used && prof->e[m].k.vh == vh)
+				prof->e[m].gone = 1;
+		lws_prof_unlock(prof);
+	}
+}
+
+#if defined(LWS_WITH_PROFILER_WATCHDOG)
+
+/*
+ * A stall is otherwise only seen once the handler returns, which a wedged
+ * one never does.  The watchdog thread looks at when each service thread
+ * entered its outermost handler, and logs the ones still inside one after
+ * the stall time, with what they are innermost in.  It can't tell where
+ * inside that the thread is blocked, a debugger attached at that point can.
+ */
+
+static void
+lws_prof_watchdog_check(struct lws_context *context, int tsi, lws_usec_t now)
+{
+	struct lws_prof *prof = context->pt[tsi].prof;
+	lws_usec_t entered = prof->entered;
+	const char *name;
+	int what;
+
+	if (!entered || now - entered < context->prof_stall_us)
+		return;
+
+	/* log each stall once, then every so often while it goes on */
+
+	if (entered == prof->wd_entered &&
+	    now - prof->wd_last_log < LWS_PROF_LOG_INTERVAL)
+		return;
+
+	prof->wd_entered = entered;
+	prof->wd_last_log = now;
+
+	/* if he's moving on meanwhile, these may not match */
+
+	name = prof->cur_name;
+	what = prof->cur_what;
+
+	if (what < 0)
+		lwsl_warn("%s: tsi %d stalled for %lldus so far, in role %s "
+			  "%s\n", __func__, tsi, (long long)(now - entered),
+			  name ? name : "unknown",
+			  lws_prof_handler_name(what));
+	else
+		lwsl_warn("%s: tsi %d stalled for %lldus so far, in protocol "
+			  "%s reason %d\n", __func__, tsi,
+			  (long long)(now - entered), name ? name : "unknown",
+			  what);
+}
+
+static void *
+lws_prof_watchdog(void *d)
+{
+	struct lws_context *context = (struct lws_context *)d;
+	struct lws_prof_watchdog *wd = context->prof_wd;
+	lws_usec_t interval = context->prof_stall_us / 2, t;
+	struct timespec ts;
+	int n;
+
+	/* look often enough to see stalls around the stall time */
+
+	if (interval < 10000)
+		interval = 10000;
+	if (interval > 1000000)
+		interval = 1000000;
+
+	pthread_mutex_lock(&wd->lock); /* ===================== watchdog { */
+
+	while (!wd->exiting) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		t = ((lws_usec_t)ts.tv_sec * 1000000ll) +
+		    (ts.tv_nsec / 1000) + interval;
+		ts.tv_sec = (time_t)(t / 1000000ll);
+		ts.tv_nsec = (long)(t % 1000000ll) * 1000;
+
+		pthread_cond_timedwait(&wd->cond, &wd->lock, &ts);
+		if (wd->exiting)
+			break;
+
+		t = lws_prof_now();
+		for (n = 0; n < context->count_threads; n++)
+			lws_prof_watchdog_check(context, n, t);
+	}
+
+	pthread_mutex_unlock(&wd->lock); /* } watchdog ================ */
+
+	return NULL;
+}
+
+static int
+lws_prof_watchdog_start(struct lws_context *context)
+{
+	struct lws_prof_watchdog *wd;
+
+	wd = lws_zalloc(sizeof(*wd), "prof watchdog");
+	if (!wd)
+		return 1;
+
+	pthread_mutex_init(&wd->lock, NULL);
+	pthread_cond_init(&wd->cond, NULL);
+	context->prof_wd = wd;
+
+	if (pthread_create(&wd->thread, NULL, lws_prof_watchdog, context)) {
+		lwsl_err("%s: unable to start watchdog thread\n", __func__);
+		context->prof_wd = NULL;
+		pthread_cond_destroy(&wd->cond);
+		pthread_mutex_destroy(&wd->lock);
+		lws_free(wd);
+
+		return 1;
+	}
+
+#if defined(LWS_HAS_PTHREAD_SETNAME_NP)
+	pthread_setname_np(wd->thread, "lws-prof-wd");
+#endif
+
+	return 0;
+}
+#endif
+
+/* stop looking at the service threads, before they start going away */
+
+void
+lws_prof_watchdog_stop(struct lws_context *context)
+{
+#if defined(LWS_WITH_PROFILER_WATCHDOG)
+	struct lws_prof_watchdog *wd = context->prof_wd;
+
+	if (!wd)
+		return;
+
+	pthread_mutex_lock(&wd->lock); /* ===================== watchdog { */
+	wd->exiting = 1;
+	pthread_cond_signal(&wd->cond);
+	pthread_mutex_unlock(&wd->lock); /* } watchdog ================ */
+
+	pthread_join(wd->thread, NULL);
+
+	pthread_cond_destroy(&wd->cond);
+	pthread_mutex_destroy(&wd->lock);
+	lws_free_set_NULL(context->prof_wd);
+#else
+	(void)context;
+#endif
+}
+
+int
+lws_prof_init(struct lws_context *context)
+{
+	int n;
+
+	for (n = 0; n < context->count_threads; n++) {
+		context->pt[n].prof = lws_zalloc(sizeof(struct lws_prof),
+						 "prof");
+		if (!context->pt[n].prof) {
+			lwsl_err("%s: OOM\n", __func__);
+
+			return 1;
+		}
+#if LWS_MAX_SMP > 1
+		pthread_mutex_init(&context->pt[n].prof->lock, NULL);
+#endif
+	}
+
+#if defined(LWS_WITH_PROFILER_WATCHDOG)
+	if (lws_prof_watchdog_start(context))
+		return 1;
+#endif
+
+	lwsl_notice("   Profiling callbacks, stalls logged from %uus\n",
+		    context->prof_stall_us);
+
+	return 0;
+}
+
+void
+lws_prof_destroy(struct lws_context *context)
+{
+	int n;
+
+	lws_prof_watchdog_stop(context);
+
+	for (n = 0; n < context->count_threads; n++) {
+		if (!context->pt[n].prof)
+			continue;
+#if LWS_MAX_SMP > 1
+		pthread_mutex_destroy(&context->pt[n].prof->lock);
+#endif
+		lws_free_set_NULL(context->pt[n].prof);
+	}
+}
+
+/*
+ * Dump the keys of one vhost, or with vh NULL the keys with no vhost, with
+ * the most total time, as a "callback_profile" member of the object the
+ * writer is in.  Each table is read under its lock, but the numbers from
+ * other service threads may be a little behind.
+ *
+ * Returns nonzero if the writer ran out of room.
+ */
+
+int
+lws_prof_json_dump(const struct lws_context *context,
+		   const struct lws_vhost *vh, struct lws_json_out *j)
+{
+	int n, m, b, count = 0, top, ret = 1;
+	struct lws_prof_entry *e, acc;
+	struct lws_prof_sum *sums, t;
+	struct lws_prof *prof;
+
+	sums = lws_malloc(sizeof(*sums) * LWS_PROF_ENTRIES *
+			  (unsigned int)context->count_threads, "prof dump");
+	if (!sums)
+		return 0;
+
+	/* add up the total time of each key over all the threads */
+
+	for (n = 0; n < context->count_threads; n++) {
+		prof = context->pt[n].prof;
+		if (!prof)
+			continue;
+		lws_prof_lock(prof);
+		for (m = 0; m < LWS_PROF_ENTRIES; m++) {
+			e = &prof->e[m];
+			if (!e->used || e->gone || e->k.vh != vh)
+				continue;
+			for (b = 0; b < count; b++)
+				if (lws_prof_key_eq(&sums[b].k, &e->k))
+					break;
+			if (b == count) {
+				sums[count].k = e->k;
+				sums[count++].total_us = 0;
+			}
+			sums[b].total_us += e->total_us;
+		}
+		lws_prof_unlock(prof);
+	}
+
+	if (!count) {
+		ret = 0;
+		goto bail;
+	}
+
+	/* just bring the top few to the front */
+
+	top = count < LWS_PROF_JSON_TOP ? count : LWS_PROF_JSON_TOP;
+	for (n = 0; n < top; n++) {
+		b = n;
+		for (m = n + 1; m < count; m++)
+			if (sums[m].total_us > sums[b].total_us)
+				b = m;
+		t = sums[n];
+		sums[n] = sums[b];
+		sums[b] = t;
+	}
+
+	if (lws_json_out_arr(j, "callback_profile"))
+		goto bail;
+
+	for (n = 0; n < top; n++) {
+		memset(&acc, 0, sizeof(acc));
+		acc.k = sums[n].k;
+
+		for (m = 0; m < context->count_threads; m++) {
+			prof = context->pt[m].prof;
+			if (!prof)
+				continue;
+			lws_prof_lock(prof);
+			e = lws_prof_find(prof, &acc.k, 0);
+			if (e) {
+				acc.count += e->count;
+				acc.total_us += e->total_us;
+				acc.stalls += e->stalls;
+				if (e->max_us > acc.max_us)
+					acc.max_us = e->max_us;
+				for (b = 0; b < LWS_HIST_BUCKETS; b++)
+					acc.hist[b] += e->hist[b];
+			}
+			lws_prof_unlock(prof);
+		}
+
+		if (!acc.count)
+			continue;
+
+		if (lws_json_out_obj(j, NULL))
+			goto bail;
+
+		if (acc.k.rops) {
+			if (lws_json_out_str(j, "role", lws_prof_name(&acc.k)) ||
+			    lws_json_out_str(j, "handler",
+					lws_prof_handler_name(acc.k.what)))
+				goto bail;
+		} else
+			if (lws_json_out_str(j, "protocol",
+					     lws_prof_name(&acc.k)) ||
+			    lws_json_out_qint(j, "reason", acc.k.what))
+				goto bail;
+
+		if (lws_json_out_quint(j, "count", acc.count) ||
+		    lws_json_out_quint(j, "total_us", acc.total_us) ||
+		    lws_json_out_quint(j, "mean_us",
+				       acc.total_us / acc.count) ||
+		    lws_json_out_quint(j, "p50_us",
+				       lws_prof_percentile(&acc, 500)) ||
+		    lws_json_out_quint(j, "p90_us",
+				       lws_prof_percentile(&acc, 900)) ||
+		    lws_json_out_quint(j, "p99_us",
+				       lws_prof_percentile(&acc, 990)) ||
+		    lws_json_out_quint(j, "p999_us",
+				       lws_prof_percentile(&acc, 999)) ||
+		    lws_json_out_quint(j, "max_us", acc.max_us) ||
+		    lws_json_out_quint(j, "stalls", acc.stalls) ||
+		    lws_json_out_end(j))
+			goto bail;
+	}
+
+	ret = !!lws_json_out_end(j);
+
+bail:
+	lws_free(sums);
+
+	return ret;
+}
+
+/* stall and table overflow totals for one service thread */
+
+int
+lws_prof_json_dump_pt(const struct lws_context_per_thread *pt,
+		      struct lws_json_out *j)
+{
+	if (!pt->prof)
+		return 0;
+
+	return lws_json_out_quint(j, "stalls", pt->prof->stalls) ||
+	       lws_json_out_quint(j, "prof_dropped", pt->prof->dropped);
+}
@@ -37,6 +37,7 @@ struct lws_threadpool_task {
 	struct lws_threadpool_task_args args;
 
 	lws_usec_t created;
+	lws_usec_t deadline; /* absolute, or 0 if none */
 	lws_usec_t acquired;
 	lws_usec_t done;
 	lws_usec_t entered_state;
@@ -49,6 +50,7 @@ struct lws_threadpool_task {
 	enum lws_threadpool_task_status status;
 
 	int late_sync_retries;
+	unsigned int seq; /* order of enqueue, unaffected by clock changes */
 
 	char wanted_writeable_cb;
 	char outlive;
@@ -74,6 +76,8 @@ struct lws_threadpool {
 	struct lws_threadpool_task *task_queue_head;
 	struct lws_threadpool_task *task_done_head;
 
+	struct lws_threadpool_class_stats cs[LWS_THREADPOOL_PRIORITIES];
+
 	char name[32];
 
 	int threads_in_pool;
@@ -81,6 +85,7 @@ struct lws_threadpool {
 	int done_queue_depth;
 	int max_queue_depth;
 	int running_tasks;
+	unsigned int enqueue_seq;
 
 	unsigned int destroying:1;
 };
@@ -116,8 +121,9 @@ __lws_threadpool_task_dump(struct lws_threadpool_task *task, char *buf, int len)
 
 	if (!task->acquired) {
 		buf += lws_snprintf(buf, end - buf,
-				    "task: %s, QUEUED queued: %dms",
-				    task->name, ms_delta(now, task->created));
+				    "task: %s, QUEUED queued: %dms (prio %d)",
+				    task->name, ms_delta(now, task->created),
+				    task->args.priority);
 
 		return;
 	}
@@ -214,6 +220,23 @@ lws_threadpool_dump(struct lws_threadpool *tp)
 		lwsl_err("%s: tp says done_queue_depth %d, but actually %d\n",
 			 __func__, tp->done_queue_depth, count);
 
+	for (n = 0; n < LWS_THREADPOOL_PRIORITIES; n++) {
+		struct lws_threadpool_class_stats *cs = &tp->cs[n];
+
+		if (!cs->enqueued)
+			continue;
+
+		lwsl_thread("  prio %d: queued %d (peak %d), enq %llu, "
+			    "started %llu, expired %llu, wait avg %dms max %dms\n",
+			    n, cs->queue_depth, cs->queue_depth_peak,
+			    (unsigned long long)cs->enqueued,
+			    (unsigned long long)cs->started,
+			    (unsigned long long)cs->expired,
+			    cs->started ? (int)(cs->wait_us_total /
+					  (lws_usec_t)cs->started / 1000) : 0,
+			    (int)(cs->wait_us_max / 1000));
+	}
+
 	pthread_mutex_unlock(&tp->lock); /* --------------- tp unlock */
 #endif
 }
@@ -274,6 +297,107 @@ __lws_threadpool_reap(struct lws_threadpool_task *task)
 	lws_threadpool_task_cleanup_destroy(task);
 }
 
+/*
+ * Queued task *c missed its deadline without ever getting a worker.  Unlink it
+ * from the pending queue and treat it like a task stopped before it could run:
+ * if it still has a wsi, that will reap it (and call the cleanup) when it
+ * comes to look at the task status, otherwise we must reap it ourselves.
+ *
+ * Call with tp lock held.
+ */
+
+static void
+__lws_threadpool_task_expire(struct lws_threadpool_task **c)
+{
+	struct lws_threadpool_task *task = *c;
+	struct lws_threadpool *tp = task->tp;
+
+	*c = task->task_queue_next;
+	tp->queue_depth--;
+	tp->cs[task->args.priority].queue_depth--;
+	tp->cs[task->args.priority].expired++;
+
+	task->task_queue_next = tp->task_done_head;
+	tp->task_done_head = task;
+	tp->done_queue_depth++;
+	state_transition(task, LWS_TP_STATUS_STOPPED);
+	task->done = lws_now_usecs();
+
+	lwsl_info("%s: tp %s: task %s missed deadline by %dms\n", __func__,
+		  tp->name, task->name, ms_delta(task->done, task->deadline));
+
+	if (!task->args.wsi) {
+		__lws_threadpool_reap(task);
+
+		return;
+	}
+
+	task->wanted_writeable_cb = 1;
+	lws_cancel_service(lws_get_context(task->args.wsi));
+}
+
+static void
+__lws_threadpool_expire_sweep(struct lws_threadpool *tp)
+{
+	struct lws_threadpool_task **c = &tp->task_queue_head;
+	lws_usec_t now = lws_now_usecs();
+
+	while (*c)
+		if ((*c)->deadline && now > (*c)->deadline)
+			__lws_threadpool_task_expire(c);
+		else
+			c = &(*c)->task_queue_next;
+}
+
+/*
+ * Queued tasks are checked for their deadline when a task is enqueued or a
+ * worker picks one up.  If all the workers are busy and nothing new is queued,
+ * neither happens, so the service thread also sweeps every pool once a second.
+ */
+
+void
+lws_threadpool_service_periodic(struct lws_context *context)
+{
+	struct lws_threadpool *tp;
+
+	lws_context_lock(context, __func__); /* ------------------ context { */
+
+	tp = context->tp_list_head;
+	while (tp) {
+		pthread_mutex_lock(&tp->lock); /* ================ tpool lock */
+		__lws_threadpool_expire_sweep(tp);
+		pthread_mutex_unlock(&tp->lock); /* ------------ tpool unlock */
+		tp = tp->tp_list;
+	}
+
+	lws_context_unlock(context); /* } context ------------------------- */
+}
+
+/*
+ * Should queued task a be started before queued task b?  Higher priority class
+ * wins, then earliest deadline (tasks with no deadline come after any with
+ * one), then whichever was queued first.  That's decided by the enqueue
+ * sequence number, not the created time, so a step in the wall clock can't
+ * reorder tasks users rely on being run FIFO.
+ */
+
+static int
+lws_threadpool_task_precedes(const struct lws_threadpool_task *a,
+			     const struct lws_threadpool_task *b)
+{
+	if (a->args.priority != b->args.priority)
+		return a->args.priority > b->args.priority;
+
+	if (a->deadline != b->deadline) {
+		if (!a->deadline || !b->deadline)
+			return !!a->deadline;
+
+		return a->deadline < b->deadline;
+	}
+
+	return (int)(a->seq - b->seq) <= 0;
+}
+
 /*
  * this gets called from each tsi service context after the service was
  * cancelled... we need to ask for the writable callback from the matching
@@ -473,25 +597,39 @@ lws_threadpool_worker(void *d)
 			continue;
 		}
 
+		/* drop anything that already missed its deadline */
+		__lws_threadpool_expire_sweep(tp);
+
 		c = &tp->task_queue_head;
 		c2 = NULL;
 		task = NULL;
 		pool->task = NULL;
 
-		/* look at the queue tail */
+		/* find the queued task that should run next */
 		while (*c) {
-			c2 = c;
+			if (!c2 || lws_threadpool_task_precedes(*c, *c2))
+				c2 = c;
 			c = &(*c)->task_queue_next;
 		}
 
-		/* is there a task at the queue tail? */
+		/* is there a task we can take? */
 		if (c2 && *c2) {
+			struct lws_threadpool_class_stats *cs;
+
 			pool->task = task = *c2;
 			task->acquired = pool->acquired = lws_now_usecs();
 			/* remove it from the queue */
 			*c2 = task->task_queue_next;
 			task->task_queue_next = NULL;
 			tp->queue_depth--;
+
+			cs = &tp->cs[task->args.priority];
+			cs->queue_depth--;
+			cs->started++;
+			cs->wait_us_total += task->acquired - task->created;
+			if (task->acquired - task->created > cs->wait_us_max)
+				cs->wait_us_max = task->acquired - task->created;
+
 			/* mark it as running */
 			state_transition(task, LWS_TP_STATUS_RUNNING);
 		}
@@ -541,7 +679,8 @@ lws_threadpool_worker(void *d)
 			lws_usec_t then;
 			int n;
 
-			if (tp->destroying || !task->args.wsi) {
+			if (tp->destroying ||
+			    (!task->args.wsi && !task->args.async_task)) {
 				lwsl_info("%s: stopping on wsi gone\n", __func__);
 				state_transition(task, LWS_TP_STATUS_STOPPING);
 			}
@@ -712,10 +851,9 @@ lws_threadpool_finish(struct lws_threadpool *tp)
 		tp->task_done_head = task;
 		state_transition(task, LWS_TP_STATUS_STOPPED);
 		tp->queue_depth--;
+		tp->cs[task->args.priority].queue_depth--;
 		tp->done_queue_depth++;
 		task->done = lws_now_usecs();
-
-		c = &task->task_queue_next;
 	}
 
 	pthread_mutex_unlock(&tp->lock); /* -------------------- tpool unlock */
@@ -823,6 +961,7 @@ lws_threadpool_dequeue(struct lws *wsi)
 			tp->task_done_head = task;
 			state_transition(task, LWS_TP_STATUS_STOPPED);
 			tp->queue_depth--;
+			tp->cs[task->args.priority].queue_depth--;
 			tp->done_queue_depth++;
 			task->done = lws_now_usecs();
 
@@ -900,13 +1039,34 @@ lws_threadpool_enqueue(struct lws_threadpool *tp,
 		       const char *format, ...)
 {
 	struct lws_threadpool_task *task = NULL;
+	struct lws_threadpool_class_stats *cs;
 	va_list ap;
 
 	if (tp->destroying)
 		return NULL;
 
+	if (args->priority >= LWS_THREADPOOL_PRIORITIES) {
+		lwsl_err("%s: priority %d out of range\n", __func__,
+			 args->priority);
+
+		return NULL;
+	}
+
+	if (!args->wsi && !args->async_task) {
+		lwsl_err("%s: task without wsi must be async_task\n", __func__);
+
+		return NULL;
+	}
+
 	pthread_mutex_lock(&tp->lock); /* ======================== tpool lock */
 
+	/*
+	 * tasks that missed their deadline shouldn't keep new ones from
+	 * getting on the queue
+	 */
+
+	__lws_threadpool_expire_sweep(tp);
+
 	/*
 	 * if there's room on the queue, the job always goes on the queue
 	 * first, then any free thread may pick it up after the wake_idle
@@ -932,6 +1092,9 @@ lws_threadpool_enqueue(struct lws_threadpool *tp,
 	task->args = *args;
 	task->tp = tp;
 	task->created = lws_now_usecs();
+	task->seq = tp->enqueue_seq++;
+	if (args->deadline_us)
+		task->deadline = task->created + args->deadline_us;
 
 	va_start(ap, format);
 	vsnprintf(task->name, sizeof(task->name) - 1, format, ap);
@@ -946,16 +1109,22 @@ lws_threadpool_enqueue(struct lws_threadpool *tp,
 	tp->task_queue_head = task;
 	tp->queue_depth++;
 
+	cs = &tp->cs[args->priority];
+	cs->enqueued++;
+	if (++cs->queue_depth > cs->queue_depth_peak)
+		cs->queue_depth_peak = cs->queue_depth;
+
 	/*
 	 * mark the wsi itself as depending on this tp (so wsi close for
 	 * whatever reason can clean up)
 	 */
 
-	args->wsi->tp_task = task;
+	if (args->wsi)
+		args->wsi->tp_task = task;
 
-	lwsl_thread("%s: tp %s: enqueued task %p (%s) for wsi %p, depth %d\n",
-		    __func__, tp->name, task, task->name, args->wsi,
-		    tp->queue_depth);
+	lwsl_thread("%s: tp %s: enqueued task %p (%s) for wsi %p, depth %d, "
+		    "prio %d\n", __func__, tp->name, task, task->name,
+		    args->wsi, tp->queue_depth, args->priority);
 
 	/* alert any idle thread there's something new on the task list */
 
@@ -985,6 +1154,15 @@ lws_threadpool_task_status_wsi(struct lws *wsi,
 	*user = (*task)->args.user;
 	status = (*task)->status;
 
+	if (status == LWS_TP_STATUS_QUEUED && (*task)->deadline &&
+	    lws_now_usecs() > (*task)->deadline) {
+		/* don't wait for the periodic sweep to notice */
+		pthread_mutex_lock(&tp->lock); /* ================ tpool lock */
+		__lws_threadpool_expire_sweep(tp);
+		pthread_mutex_unlock(&tp->lock); /* ------------ tpool unlock */
+		status = (*task)->status;
+	}
+
 	if (status == LWS_TP_STATUS_FINISHED ||
 	    status == LWS_TP_STATUS_STOPPED) {
 		char buf[160];
@@ -1011,3 +1189,17 @@ lws_threadpool_task_sync(struct lws_threadpool_task *task, int stop)
 
 	pthread_cond_signal(&task->wake_idle);
 }
+
+int
+lws_threadpool_class_stats(struct lws_threadpool *tp, int priority,
+			   struct lws_threadpool_class_stats *stats)
+{
+	if (priority < 0 || priority >= LWS_THREADPOOL_PRIORITIES)
+		return -1;
+
+	pthread_mutex_lock(&tp->lock); /* ======================== tpool lock */
+	*stats = tp->cs[priority];
+	pthread_mutex_unlock(&tp->lock); /* -------------------- tpool unlock */
+
+	return 0;
+}
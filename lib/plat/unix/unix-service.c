@@ -22,12 +22,39 @@
 #define _GNU_SOURCE
 #include "core/private.h"
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 int
 lws_poll_listen_fd(struct lws_pollfd *fd)
 {
 	return poll(fd, 1, 0);
 }
 
+/* pin the calling thread, which is the service thread for pt, to its cpu */
+
+static void
+lws_plat_pin_service_thread(struct lws_context_per_thread *pt)
+{
+#if defined(__linux__) && defined(CPU_SET)
+	cpu_set_t set;
+
+	if (pt->cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(pt->cpu, &set);
+
+	if (sched_setaffinity(0, sizeof(set), &set))
+		lwsl_warn("%s: unable to pin tsi %d to cpu %d (%d)\n", __func__,
+			  pt->tid, pt->cpu, LWS_ERRNO);
+	else
+		lwsl_info("%s: tsi %d pinned to cpu %d\n", __func__, pt->tid,
+			  pt->cpu);
+#endif
+}
+
 LWS_EXTERN int
 _lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 {
@@ -49,8 +76,14 @@ _lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 	if (timeout_ms < 0)
 		goto faked_service;
 
-	if (context->event_loop_ops->run_pt)
+	if (context->event_loop_ops->run_pt) {
+		/*
+		 * The event lib loop runs on this thread from here until it is
+		 * stopped, so this is the service thread to pin
+		 */
+		lws_plat_pin_service_thread(pt);
 		context->event_loop_ops->run_pt(context, tsi);
+	}
 
 	if (!pt->service_tid_detected) {
 		struct lws _lws;
@@ -62,6 +95,8 @@ _lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 			context->vhost_list->protocols[0].callback(
 			&_lws, LWS_CALLBACK_GET_THREAD_ID, NULL, NULL, 0);
 		pt->service_tid_detected = 1;
+
+		lws_plat_pin_service_thread(pt);
 	}
 
 	/*
@@ -85,11 +120,13 @@ _lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 		lws_pt_unlock(pt);
 	}
 
+	lws_metrics_loop_idle(pt);
 	vpt->inside_poll = 1;
 	lws_memory_barrier();
 	n = poll(pt->fds, pt->fds_count, timeout_ms);
 	vpt->inside_poll = 0;
 	lws_memory_barrier();
+	lws_metrics_loop_woke(pt);
 
 	/* Collision will be rare and brief.  Just spin until it completes */
 	while (vpt->foreign_spinlock)
@@ -138,7 +138,9 @@ _lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 			       FD_ADDRESS_LIST_CHANGE);
 	}
 
+	lws_metrics_loop_idle(pt);
 	ev = WSAWaitForMultipleEvents(1, &pt->events, FALSE, timeout_ms, FALSE);
+	lws_metrics_loop_woke(pt);
 	if (ev == WSA_WAIT_EVENT_0) {
 		unsigned int eIdx;
 
@@ -16,11 +16,17 @@ lws_send_pipe_choked(struct lws *wsi)
 	/* the fact we checked implies we avoided back-to-back writes */
 	wsi_eff->could_have_pending = 0;
 
-	/* treat the fact we got a truncated send pending as if we're choked */
+	/*
+	 * treat the fact we got a truncated send pending, or are held for
+	 * rate limiting, as if we're choked
+	 */
 	if (lws_has_buffered_out(wsi_eff)
 #if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
 	    ||wsi->http.comp_ctx.buflist_comp ||
 	      wsi->http.comp_ctx.may_have_more
+#endif
+#if defined(LWS_WITH_PEER_LIMITS)
+	    || wsi_eff->ratelimited
 #endif
 	)
 		return 1;
@@ -0,0 +1,1215 @@
+/*
+ * libwebsockets - FastCGI gateway to persistent local workers
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * fcgi:// mounts pass the request to an already-running FastCGI worker, eg,
+ * php-fpm, over a unix domain or tcp socket, instead of spawning a process
+ * for each request like cgi:// mounts.
+ *
+ * The request's CGI environment goes as FCGI_PARAMS, the request body as
+ * FCGI_STDIN and FCGI_STDOUT comes back as a CGI-style response, headers then
+ * body, exactly as a cgi:// mount script would write it.
+ *
+ * The connection to the worker is made with FCGI_KEEP_CONN, and once the
+ * worker has ended the request it's parked idle on the vhost, in a list for
+ * the worker address.  The next request to the same worker from the same
+ * service thread takes it, skipping the connect and the worker's accept.
+ */
+
+#include "core/private.h"
+
+/* call with the vhost lock held */
+
+static struct lws_fcgi_upstream *
+__lws_fcgi_upstream(struct lws_vhost *vh, const char *address)
+{
+	struct lws_fcgi_upstream *up;
+	size_t len = strlen(address);
+
+	lws_start_foreach_ll(struct lws_fcgi_upstream *, u,
+			     vh->http.fcgi_upstream_list) {
+		if (!strcmp((const char *)(u + 1), address))
+			return u;
+	} lws_end_foreach_ll(u, next);
+
+	up = lws_zalloc(sizeof(*up) + len + 1, "fcgi upstream");
+	if (!up)
+		return NULL;
+
+	memcpy(up + 1, address, len + 1);
+
+	up->next = vh->http.fcgi_upstream_list;
+	vh->http.fcgi_upstream_list = up;
+
+	return up;
+}
+
+/*
+ * The worker address is either an absolute path to a unix domain socket, or a
+ * numeric ipv4 or [ipv6] address and port.  We don't resolve names here, since
+ * we're in the middle of serving the request.
+ */
+
+static struct lws *
+lws_fcgi_conn_create(struct lws *txn, const char *address)
+{
+	struct lws_context *context = txn->context;
+	struct lws_context_per_thread *pt = &context->pt[(int)txn->tsi];
+#if defined(LWS_WITH_UNIX_SOCK)
+	struct sockaddr_un sau;
+#endif
+	const struct sockaddr *psa = NULL;
+	char ads[64], *q, unix_skt = 0;
+	socklen_t salen = 0;
+	sockaddr46 sa46;
+	struct lws *wsi;
+	int n;
+
+	if ((unsigned int)pt->fds_count == context->fd_limit_per_thread - 1) {
+		lwsl_err("%s: no space for new conn\n", __func__);
+		return NULL;
+	}
+
+	memset(&sa46, 0, sizeof(sa46));
+
+	if (address[0] == '/') {
+#if defined(LWS_WITH_UNIX_SOCK)
+		memset(&sau, 0, sizeof(sau));
+		sau.sun_family = AF_UNIX;
+		lws_strncpy(sau.sun_path, address, sizeof(sau.sun_path));
+		psa = (const struct sockaddr *)&sau;
+		salen = sizeof(sau);
+		unix_skt = 1;
+#else
+		lwsl_err("%s: %s: lws built without LWS_UNIX_SOCK\n", __func__,
+			 address);
+
+		return NULL;
+#endif
+	} else {
+		lws_strncpy(ads, address + (address[0] == '['), sizeof(ads));
+		q = strrchr(ads, ':');
+		if (!q)
+			goto bad_address;
+		n = atoi(q + 1);
+		if (q > ads && q[-1] == ']')
+			q--;
+		*q = '\0';
+
+		if (inet_pton(AF_INET, ads, &sa46.sa4.sin_addr) == 1) {
+			sa46.sa4.sin_family = AF_INET;
+			sa46.sa4.sin_port = htons(n);
+			salen = sizeof(sa46.sa4);
+		}
+#if defined(LWS_WITH_IPV6)
+		else if (inet_pton(AF_INET6, ads, &sa46.sa6.sin6_addr) == 1) {
+			sa46.sa6.sin6_family = AF_INET6;
+			sa46.sa6.sin6_port = htons(n);
+			salen = sizeof(sa46.sa6);
+		}
+#endif
+		else
+			goto bad_address;
+
+		psa = (const struct sockaddr *)&sa46;
+	}
+
+	wsi = lws_zalloc(sizeof(*wsi), "fcgi conn");
+	if (!wsi)
+		return NULL;
+
+	wsi->fcgi = lws_zalloc(sizeof(*wsi->fcgi), "fcgi");
+	if (!wsi->fcgi) {
+		lws_free(wsi);
+		return NULL;
+	}
+
+	wsi->fcgi->wsi = wsi;
+	wsi->tsi = txn->tsi;
+	wsi->context = context;
+	wsi->pending_timeout = NO_PENDING_TIMEOUT;
+	wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
+	wsi->position_in_fds_table = LWS_NO_FDS_POS;
+	wsi->protocol = txn->vhost->protocols;
+	wsi->unix_skt = unix_skt;
+	lws_role_transition(wsi, LWSIFR_CLIENT, LRS_ESTABLISHED,
+			    &role_ops_fcgi);
+	context->count_wsi_allocated++;
+	lws_vhost_bind_wsi(txn->vhost, wsi);
+
+	wsi->desc.sockfd = socket(psa->sa_family, SOCK_STREAM, 0);
+	if (!lws_socket_is_valid(wsi->desc.sockfd)) {
+		lwsl_err("%s: unable to create socket\n", __func__);
+		goto bail;
+	}
+
+	if (lws_plat_set_socket_options(txn->vhost, wsi->desc.sockfd,
+					unix_skt)) {
+		lwsl_err("%s: failed to set socket options\n", __func__);
+		goto bail;
+	}
+
+	if (connect(wsi->desc.sockfd, psa, salen) == -1) {
+		if (LWS_ERRNO != LWS_EINPROGRESS &&
+		    LWS_ERRNO != LWS_EWOULDBLOCK) {
+			lwsl_notice("%s: connect to %s failed: %d\n", __func__,
+				    address, LWS_ERRNO);
+			goto bail;
+		}
+		wsi->fcgi->connecting = 1;
+	}
+
+	if (context->event_loop_ops->accept &&
+	    context->event_loop_ops->accept(wsi))
+		goto bail;
+
+	if (__insert_wsi_socket_into_fds(context, wsi))
+		goto bail;
+
+	/* we find out how the connect went when it becomes writeable */
+	if (wsi->fcgi->connecting &&
+	    lws_change_pollfd(wsi, 0, LWS_POLLOUT)) {
+		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS, __func__);
+
+		return NULL;
+	}
+
+	return wsi;
+
+bail:
+	if (lws_socket_is_valid(wsi->desc.sockfd))
+		compatible_close(wsi->desc.sockfd);
+	__lws_free_wsi(wsi);
+
+	return NULL;
+
+bad_address:
+	lwsl_err("%s: fcgi origin %s should be /unix/skt/path, "
+		 "ipv4:port or [ipv6]:port\n", __func__, address);
+
+	return NULL;
+}
+
+/* writes whole FastCGI records to the worker, buffering what won't go yet */
+
+static int
+lws_fcgi_send(struct lws *conn, const uint8_t *buf, size_t len)
+{
+	struct lws_fcgi *f = conn->fcgi;
+
+	if (f->connecting || lws_has_buffered_out(conn)) {
+		if (lws_buflist_append_segment(&conn->buflist_out, buf, len) < 0)
+			return -1;
+		if (!f->connecting)
+			lws_callback_on_writable(conn);
+
+		return 0;
+	}
+
+	return lws_issue_raw(conn, (unsigned char *)buf, len) < 0;
+}
+
+static uint8_t *
+lws_fcgi_record_hdr(uint8_t *p, int type, size_t len)
+{
+	*p++ = LWS_FCGI_VERSION_1;
+	*p++ = (uint8_t)type;
+	*p++ = 0;
+	*p++ = LWS_FCGI_REQUEST_ID;
+	*p++ = (uint8_t)(len >> 8);
+	*p++ = (uint8_t)len;
+	*p++ = 0; /* padding length */
+	*p++ = 0;
+
+	return p;
+}
+
+static uint8_t *
+lws_fcgi_nv_len(uint8_t *p, size_t len)
+{
+	if (len < 128) {
+		*p++ = (uint8_t)len;
+
+		return p;
+	}
+
+	*p++ = (uint8_t)(0x80 | (len >> 24));
+	*p++ = (uint8_t)(len >> 16);
+	*p++ = (uint8_t)(len >> 8);
+	*p++ = (uint8_t)len;
+
+	return p;
+}
+
+/*
+ * The FCGI_PARAMS stream is cut into records wherever our buffer fills, so a
+ * name-value pair may be split across records, as the spec allows.  That way
+ * nothing is dropped however long the params get.
+ */
+
+struct lws_fcgi_ps {
+	struct lws *conn;
+	uint8_t *p;
+	int err;
+	uint8_t buf[LWS_FCGI_HDR_SIZE + 4096];
+};
+
+static void
+lws_fcgi_ps_flush(struct lws_fcgi_ps *ps)
+{
+	size_t len = lws_ptr_diff(ps->p, ps->buf + LWS_FCGI_HDR_SIZE);
+
+	if (!len || ps->err)
+		return;
+
+	lws_fcgi_record_hdr(ps->buf, LWS_FCGI_PARAMS, len);
+	if (lws_fcgi_send(ps->conn, ps->buf, lws_ptr_diff(ps->p, ps->buf)))
+		ps->err = 1;
+
+	ps->p = ps->buf + LWS_FCGI_HDR_SIZE;
+}
+
+static void
+lws_fcgi_ps_out(struct lws_fcgi_ps *ps, const void *d, size_t len)
+{
+	const uint8_t *s = (const uint8_t *)d;
+	size_t n;
+
+	while (len && !ps->err) {
+		n = lws_ptr_diff(ps->buf + sizeof(ps->buf), ps->p);
+		if (!n) {
+			lws_fcgi_ps_flush(ps);
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy(ps->p, s, n);
+		ps->p += n;
+		s += n;
+		len -= n;
+	}
+}
+
+/* the lengths and name of a pair, the caller follows it with vlen of value */
+
+static void
+lws_fcgi_param_start(struct lws_fcgi_ps *ps, const char *name, size_t vlen)
+{
+	size_t nlen = strlen(name);
+	uint8_t l[8], *p = l;
+
+	p = lws_fcgi_nv_len(p, nlen);
+	p = lws_fcgi_nv_len(p, vlen);
+	lws_fcgi_ps_out(ps, l, lws_ptr_diff(p, l));
+	lws_fcgi_ps_out(ps, name, nlen);
+}
+
+static void
+lws_fcgi_param(struct lws_fcgi_ps *ps, const char *name, const char *value,
+	       int vlen)
+{
+	if (vlen < 0)
+		vlen = (int)strlen(value);
+
+	lws_fcgi_param_start(ps, name, vlen);
+	lws_fcgi_ps_out(ps, value, vlen);
+}
+
+/*
+ * The urlargs were urldecoded into fragments, put them back together.  Returns
+ * a heap copy, or NULL with *len 0 if there were none, or NULL with *len -1 on
+ * OOM.
+ */
+
+static char *
+lws_fcgi_query_string(struct lws *wsi, int *len)
+{
+	int total = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_URI_ARGS), n, m;
+	char *qs, *tok, *q, *eq;
+	size_t size;
+
+	*len = 0;
+	if (total <= 0)
+		return NULL;
+
+	/* each char might become %xx, plus some slack for lws_urlencode */
+	size = (size_t)total * 3 + 8;
+	qs = lws_malloc(size + total + 1, "fcgi qs");
+	if (!qs) {
+		*len = -1;
+		return NULL;
+	}
+	tok = qs + size;
+	q = qs;
+
+	m = 0;
+	while (lws_hdr_copy_fragment(wsi, tok, total + 1,
+				     WSI_TOKEN_HTTP_URI_ARGS, m) >= 0) {
+		if (m)
+			*q++ = '&';
+		eq = strchr(tok, '=');
+		if (eq)
+			*eq = '\0';
+		lws_urlencode(q, tok, lws_ptr_diff(qs + size, q));
+		q += strlen(q);
+		if (eq) {
+			*q++ = '=';
+			lws_urlencode(q, eq + 1, lws_ptr_diff(qs + size, q));
+			q += strlen(q);
+		}
+		m++;
+	}
+
+	n = lws_ptr_diff(q, qs);
+	*len = n;
+
+	return qs;
+}
+
+static const struct {
+	unsigned char token;
+	const char *name;
+} fcgi_hdr_params[] = {
+	{ WSI_TOKEN_HTTP_CONTENT_TYPE,		"CONTENT_TYPE" },
+	{ WSI_TOKEN_HTTP_CONTENT_LENGTH,	"CONTENT_LENGTH" },
+	{ WSI_TOKEN_HOST,			"HTTP_HOST" },
+	{ WSI_TOKEN_HTTP_COOKIE,		"HTTP_COOKIE" },
+	{ WSI_TOKEN_HTTP_USER_AGENT,		"HTTP_USER_AGENT" },
+	{ WSI_TOKEN_HTTP_REFERER,		"HTTP_REFERER" },
+	{ WSI_TOKEN_HTTP_ACCEPT,		"HTTP_ACCEPT" },
+	{ WSI_TOKEN_HTTP_ACCEPT_ENCODING,	"HTTP_ACCEPT_ENCODING" },
+	{ WSI_TOKEN_HTTP_ACCEPT_LANGUAGE,	"HTTP_ACCEPT_LANGUAGE" },
+	{ WSI_TOKEN_HTTP_CONTENT_ENCODING,	"HTTP_CONTENT_ENCODING" },
+	{ WSI_TOKEN_HTTP_AUTHORIZATION,		"HTTP_AUTHORIZATION" },
+	{ WSI_TOKEN_HTTP_IF_MODIFIED_SINCE,	"HTTP_IF_MODIFIED_SINCE" },
+	{ WSI_TOKEN_HTTP_IF_NONE_MATCH,		"HTTP_IF_NONE_MATCH" },
+};
+
+/*
+ * Produce the same CGI/1.1 environment a cgi:// mount gives its script, as
+ * FCGI_PARAMS name-value pairs
+ */
+
+static void
+lws_fcgi_params(struct lws *wsi, const struct lws_http_mount *hit,
+		const char *method, const char *uri_ptr, int uri_len,
+		struct lws_fcgi_ps *ps)
+{
+	const struct lws_protocol_vhost_options *pvo = hit->cgienv;
+	char tok[256], *qs, *v;
+	int n, m, qs_len;
+
+	lws_fcgi_param(ps, "GATEWAY_INTERFACE", "CGI/1.1", -1);
+	lws_fcgi_param(ps, "SERVER_SOFTWARE", "libwebsockets", -1);
+	lws_fcgi_param(ps, "SERVER_PROTOCOL", wsi->http2_substream ?
+		       "HTTP/2" : (wsi->http.request_version ==
+			       HTTP_VERSION_1_0 ? "HTTP/1.0" : "HTTP/1.1"), -1);
+	lws_fcgi_param(ps, "SERVER_NAME", wsi->vhost->name, -1);
+	n = lws_snprintf(tok, sizeof(tok), "%d", wsi->vhost->listen_port);
+	lws_fcgi_param(ps, "SERVER_PORT", tok, n);
+	if (lws_is_ssl(wsi))
+		lws_fcgi_param(ps, "HTTPS", "on", 2);
+	lws_get_peer_simple(wsi, tok, sizeof(tok));
+	lws_fcgi_param(ps, "REMOTE_ADDR", tok, -1);
+
+	qs = lws_fcgi_query_string(wsi, &qs_len);
+	if (qs_len < 0) {
+		ps->err = 1;
+		return;
+	}
+
+	lws_fcgi_param(ps, "REQUEST_METHOD", method, -1);
+
+	/* REQUEST_URI is the original uri, including any query string */
+	lws_fcgi_param_start(ps, "REQUEST_URI",
+			     uri_len + (qs_len ? qs_len + 1 : 0));
+	lws_fcgi_ps_out(ps, uri_ptr, uri_len);
+	if (qs_len) {
+		lws_fcgi_ps_out(ps, "?", 1);
+		lws_fcgi_ps_out(ps, qs, qs_len);
+	}
+
+	lws_fcgi_param(ps, "SCRIPT_NAME", hit->mountpoint,
+		       hit->mountpoint_len);
+	lws_fcgi_param(ps, "PATH_INFO", uri_ptr + hit->mountpoint_len,
+		       uri_len - hit->mountpoint_len);
+	lws_fcgi_param(ps, "QUERY_STRING", qs ? qs : "", qs_len);
+	lws_free(qs);
+
+	for (n = 0; n < (int)LWS_ARRAY_SIZE(fcgi_hdr_params); n++) {
+		m = lws_hdr_total_length(wsi, fcgi_hdr_params[n].token);
+		if (m <= 0)
+			continue;
+
+		/* eg, cookies can be far bigger than anything on the stack */
+		v = lws_malloc(m + 1, "fcgi hdr");
+		if (!v) {
+			ps->err = 1;
+			return;
+		}
+		m = lws_hdr_copy(wsi, v, m + 1, fcgi_hdr_params[n].token);
+		if (m > 0)
+			lws_fcgi_param(ps, fcgi_hdr_params[n].name, v, m);
+		lws_free(v);
+	}
+
+	/* the mount's cgi-env, eg, SCRIPT_FILENAME for php-fpm */
+
+	while (pvo) {
+		lws_fcgi_param(ps, pvo->name, pvo->value, -1);
+		pvo = pvo->next;
+	}
+}
+
+static int
+lws_fcgi_begin_request(struct lws *wsi, struct lws *conn,
+		       const struct lws_http_mount *hit, const char *method,
+		       const char *uri_ptr, int uri_len)
+{
+	struct lws_fcgi_ps ps;
+	uint8_t *p = ps.buf;
+
+	ps.conn = conn;
+	ps.err = 0;
+
+	p = lws_fcgi_record_hdr(p, LWS_FCGI_BEGIN_REQUEST, 8);
+	*p++ = 0;
+	*p++ = LWS_FCGI_RESPONDER;
+	*p++ = LWS_FCGI_KEEP_CONN;
+	memset(p, 0, 5);
+	p += 5;
+
+	if (lws_fcgi_send(conn, ps.buf, lws_ptr_diff(p, ps.buf)))
+		return 1;
+
+	ps.p = ps.buf + LWS_FCGI_HDR_SIZE;
+	lws_fcgi_params(wsi, hit, method, uri_ptr, uri_len, &ps);
+	lws_fcgi_ps_flush(&ps);
+	if (ps.err) {
+		lwsl_notice("%s: failed to send params\n", __func__);
+		return 1;
+	}
+
+	/* an empty record ends the params stream */
+	p = lws_fcgi_record_hdr(ps.buf, LWS_FCGI_PARAMS, 0);
+
+	/* ... and if there's no body, the stdin stream too */
+	if (!wsi->http.rx_content_length) {
+		p = lws_fcgi_record_hdr(p, LWS_FCGI_STDIN, 0);
+		conn->fcgi->stdin_ended = 1;
+	}
+
+	return lws_fcgi_send(conn, ps.buf, lws_ptr_diff(p, ps.buf));
+}
+
+int
+lws_fcgi(struct lws *wsi, const struct lws_http_mount *hit,
+	 const char *method, const char *uri_ptr, int uri_len)
+{
+	struct lws_vhost *vh = wsi->vhost;
+	struct lws_fcgi_upstream *up;
+	struct lws_fcgi_txn *t;
+	struct lws *conn = NULL;
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+
+	up = __lws_fcgi_upstream(vh, hit->origin);
+	if (!up) {
+		lws_vhost_unlock(vh); /* } vh ---------------------------- */
+
+		return 1;
+	}
+
+	/* is there an idle connection we can use from this service thread? */
+
+	lws_start_foreach_dll(struct lws_dll_lws *, d, up->idle_head.next) {
+		struct lws_fcgi *f = lws_container_of(d, struct lws_fcgi,
+						      dll_idle);
+		if (f->wsi->tsi == wsi->tsi) {
+			conn = f->wsi;
+			break;
+		}
+	} lws_end_foreach_dll(d);
+
+	if (conn) {
+		lws_dll_lws_remove(&conn->fcgi->dll_idle);
+		up->idle--;
+		up->hits++;
+	} else {
+		/* reserve our place while we connect */
+		up->conns++;
+		up->misses++;
+	}
+
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	if (conn) {
+		lwsl_info("%s: reusing %p to %s\n", __func__, conn,
+			  hit->origin);
+		lws_set_timeout(conn, NO_PENDING_TIMEOUT, 0);
+	} else {
+		conn = lws_fcgi_conn_create(wsi, hit->origin);
+
+		lws_vhost_lock(vh); /* -------------------------------- vh { */
+		if (conn)
+			conn->fcgi->upstream = up;
+		else
+			up->conns--;
+		lws_vhost_unlock(vh); /* } vh ------------------------------ */
+
+		if (!conn)
+			return 1;
+	}
+
+	t = lws_http_txn_malloc(wsi, sizeof(*t) + LWS_FCGI_MAX_RESPONSE_HDRS,
+				"fcgi txn");
+	if (!t)
+		goto bail;
+
+	memset(t, 0, sizeof(*t));
+	t->conn = conn;
+	t->response_code = HTTP_STATUS_OK;
+	t->timeout_secs = hit->cgi_timeout ? hit->cgi_timeout : 5;
+	t->no_body = !strcmp(method, "HEAD");
+	wsi->http.fcgi_txn = t;
+
+	conn->fcgi->txn = wsi;
+	conn->fcgi->stdin_ended = 0;
+	conn->fcgi->rh_pos = 0;
+
+	if (lws_fcgi_begin_request(wsi, conn, hit, method, uri_ptr, uri_len))
+		goto bail;
+
+	lws_set_timeout(wsi, PENDING_TIMEOUT_CGI, t->timeout_secs);
+
+	return 0;
+
+bail:
+	/* the caller returns the error on the server wsi, not us */
+	conn->fcgi->txn = NULL;
+	lws_fcgi_txn_destroy(wsi);
+	lws_close_free_wsi(conn, LWS_CLOSE_STATUS_NOSTATUS, "fcgi begin");
+
+	return 1;
+}
+
+/*
+ * Pass some of the request body on to the worker as FCGI_STDIN, or with a NULL
+ * buf, tell it there's no more
+ */
+
+int
+lws_fcgi_stdin(struct lws *wsi, const uint8_t *buf, size_t len)
+{
+	struct lws_fcgi_txn *t = wsi->http.fcgi_txn;
+	uint8_t hdr[LWS_FCGI_HDR_SIZE];
+	struct lws *conn;
+	size_t chunk;
+
+	if (!t || !t->conn || t->conn->fcgi->stdin_ended)
+		/* nobody is interested in it any more */
+		return 0;
+
+	conn = t->conn;
+
+	if (!buf) {
+		conn->fcgi->stdin_ended = 1;
+		lws_fcgi_record_hdr(hdr, LWS_FCGI_STDIN, 0);
+
+		return lws_fcgi_send(conn, hdr, sizeof(hdr));
+	}
+
+	while (len) {
+		chunk = len > LWS_FCGI_MAX_CONTENT ? LWS_FCGI_MAX_CONTENT : len;
+
+		lws_fcgi_record_hdr(hdr, LWS_FCGI_STDIN, chunk);
+		if (lws_fcgi_send(conn, hdr, sizeof(hdr)) ||
+		    lws_fcgi_send(conn, buf, chunk))
+			return -1;
+
+		buf += chunk;
+		len -= chunk;
+	}
+
+	/* if the worker isn't keeping up, stop reading the body for now */
+
+	if (lws_has_buffered_out(conn) && !conn->fcgi->txn_quenched) {
+		conn->fcgi->txn_quenched = 1;
+		lws_rx_flow_control(wsi, 0);
+	}
+
+	return 0;
+}
+
+/* the connection to the worker drained what we had buffered for it */
+
+int
+lws_fcgi_conn_writeable(struct lws *conn)
+{
+	struct lws_fcgi *f = conn->fcgi;
+
+	if (f->txn_quenched) {
+		f->txn_quenched = 0;
+		if (f->txn)
+			lws_rx_flow_control(f->txn, 1);
+	}
+
+	return 0;
+}
+
+static void
+lws_fcgi_txn_writeable(struct lws *txn)
+{
+	txn->reason_bf |= LWS_CB_REASON_AUX_BF__FCGI;
+	lws_callback_on_writable(txn);
+}
+
+static int
+lws_fcgi_txn_stdout(struct lws *conn, const uint8_t *buf, size_t len)
+{
+	struct lws *txn = conn->fcgi->txn;
+	struct lws_fcgi_txn *t = txn->http.fcgi_txn;
+	char *h = (char *)(t + 1);
+
+	/* collect the CGI-style response headers up to the blank line */
+
+	while (len && !t->headers_done) {
+		if (t->hdr_len == LWS_FCGI_MAX_RESPONSE_HDRS) {
+			lwsl_notice("%s: response headers too large\n",
+				    __func__);
+			return 1;
+		}
+		h[t->hdr_len++] = (char)*buf++;
+		len--;
+
+		if (t->hdr_len >= 2 && h[t->hdr_len - 1] == '\n' &&
+		    (h[t->hdr_len - 2] == '\n' ||
+		     (t->hdr_len >= 3 && h[t->hdr_len - 2] == '\r' &&
+		      h[t->hdr_len - 3] == '\n')))
+			t->headers_done = 1;
+	}
+
+	if (len) {
+		if (lws_buflist_append_segment(&t->stdout_list, buf, len) < 0)
+			return 1;
+		t->stdout_buffered += len;
+	}
+
+	if (t->stdout_buffered > LWS_FCGI_STDOUT_HIGH_WATER && !t->quenched) {
+		/* the client isn't keeping up, stop reading the worker */
+		t->quenched = 1;
+		lws_rx_flow_control(conn, 0);
+	}
+
+	lws_set_timeout(txn, PENDING_TIMEOUT_CGI, t->timeout_secs);
+	if (t->headers_done)
+		lws_fcgi_txn_writeable(txn);
+
+	return 0;
+}
+
+/*
+ * The worker ended the request.  The server wsi finishes sending the response
+ * by itself, and if the worker is ready for another request we park the
+ * connection idle.  Returns nonzero if the connection should be closed.
+ */
+
+static int
+lws_fcgi_end_request(struct lws *conn)
+{
+	struct lws_fcgi *f = conn->fcgi;
+	struct lws *txn = f->txn;
+	struct lws_vhost *vh = conn->vhost;
+	struct lws_fcgi_txn *t = txn->http.fcgi_txn;
+	struct lws_fcgi_upstream *up = f->upstream;
+
+	if (f->end[4] != LWS_FCGI_REQUEST_COMPLETE)
+		lwsl_notice("%s: worker protocolStatus %d\n", __func__,
+			    f->end[4]);
+
+	t->ended = 1;
+	t->conn = NULL;
+	f->txn = NULL;
+
+	if (f->txn_quenched) {
+		f->txn_quenched = 0;
+		lws_rx_flow_control(txn, 1);
+	}
+	if (t->quenched) {
+		t->quenched = 0;
+		lws_rx_flow_control(conn, 1);
+	}
+
+	lws_fcgi_txn_writeable(txn);
+
+	/* the worker must have seen our whole request to be reusable */
+
+	if (f->end[4] != LWS_FCGI_REQUEST_COMPLETE || !f->stdin_ended ||
+	    lws_has_buffered_out(conn) || !up)
+		return 1;
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+
+	if (up->idle >= vh->http.fcgi_pool_max_idle) {
+		lws_vhost_unlock(vh); /* } vh ---------------------------- */
+
+		return 1;
+	}
+
+	lws_dll_lws_add_front(&f->dll_idle, &up->idle_head);
+	up->idle++;
+
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	lws_set_timeout(conn, PENDING_TIMEOUT_CLIENT_CONN_IDLE,
+			vh->http.fcgi_pool_idle_secs);
+
+	lwsl_info("%s: %p idle to %s\n", __func__, conn,
+		  (const char *)(up + 1));
+
+	return 0;
+}
+
+/*
+ * Parse the records arriving from the worker.  Returns nonzero if the
+ * connection should be closed.
+ */
+
+int
+lws_fcgi_rx(struct lws *conn, const uint8_t *buf, size_t len)
+{
+	struct lws_fcgi *f = conn->fcgi;
+	size_t n;
+
+	while (len) {
+		if (f->rh_pos < LWS_FCGI_HDR_SIZE) {
+			if (!f->txn) {
+				/* nothing should come while we are idle */
+				lwsl_info("%s: %p: unexpected rx\n", __func__,
+					  conn);
+				return 1;
+			}
+
+			f->rh[f->rh_pos++] = *buf++;
+			len--;
+			if (f->rh_pos < LWS_FCGI_HDR_SIZE)
+				continue;
+
+			if (f->rh[0] != LWS_FCGI_VERSION_1) {
+				lwsl_notice("%s: bad record version %d\n",
+					    __func__, f->rh[0]);
+				return 1;
+			}
+			f->content_remain = (uint16_t)((f->rh[4] << 8) |
+						       f->rh[5]);
+			f->padding_remain = f->rh[6];
+
+			if (f->rh[1] == LWS_FCGI_END_REQUEST) {
+				/* the body is fixed size, don't trust it */
+				if (f->content_remain != sizeof(f->end)) {
+					lwsl_notice("%s: bad END_REQUEST len %d\n",
+						    __func__, f->content_remain);
+					return 1;
+				}
+				memset(f->end, 0, sizeof(f->end));
+			}
+		}
+
+		n = f->content_remain;
+		if (n > len)
+			n = len;
+
+		switch (f->rh[1]) {
+		case LWS_FCGI_STDOUT:
+			if (n && lws_fcgi_txn_stdout(conn, buf, n))
+				return 1;
+			break;
+
+		case LWS_FCGI_STDERR:
+			if (n)
+				lwsl_notice("FCGI-stderr: %.*s\n", (int)n,
+					    (const char *)buf);
+			break;
+
+		case LWS_FCGI_END_REQUEST:
+			/* content_remain is 1 .. sizeof(f->end) here */
+			if (n)
+				memcpy(&f->end[sizeof(f->end) - f->content_remain],
+				       buf, n);
+			break;
+
+		default:
+			/* nothing else is meaningful for a responder */
+			break;
+		}
+
+		buf += n;
+		len -= n;
+		f->content_remain -= (uint16_t)n;
+		if (f->content_remain)
+			continue;
+
+		n = f->padding_remain;
+		if (n > len)
+			n = len;
+		buf += n;
+		len -= n;
+		f->padding_remain -= (uint8_t)n;
+		if (f->padding_remain)
+			continue;
+
+		/* the record is complete */
+
+		f->rh_pos = 0;
+
+		if (f->rh[1] == LWS_FCGI_END_REQUEST &&
+		    (lws_fcgi_end_request(conn) || len))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Iterate through the CGI-style response header lines, giving the name and
+ * value of each one.  Returns nonzero at the blank line or end.
+ */
+
+static int
+lws_fcgi_hdr_next(const char **pos, const char *end, char *name, size_t nlen,
+		  const char **val, int *vlen)
+{
+	const char *p = *pos, *eol, *colon;
+
+	do {
+		eol = memchr(p, '\n', lws_ptr_diff(end, p));
+		if (!eol)
+			return 1;
+		*pos = eol + 1;
+		if (eol > p && eol[-1] == '\r')
+			eol--;
+		if (eol == p)
+			return 1;
+
+		colon = memchr(p, ':', lws_ptr_diff(eol, p));
+		if (colon && (size_t)lws_ptr_diff(colon, p) + 2 <= nlen)
+			break;
+
+		p = *pos;
+	} while (1);
+
+	/* name includes the colon, as lws_add_http_header_by_name() wants */
+	memcpy(name, p, lws_ptr_diff(colon, p) + 1);
+	name[lws_ptr_diff(colon, p) + 1] = '\0';
+
+	colon++;
+	while (colon < eol && (*colon == ' ' || *colon == '\t'))
+		colon++;
+	*val = colon;
+	*vlen = lws_ptr_diff(eol, colon);
+
+	return 0;
+}
+
+static int
+lws_fcgi_write_headers(struct lws *wsi, struct lws_fcgi_txn *t,
+		       unsigned char *start, unsigned char *end)
+{
+	const char *h = (const char *)(t + 1), *pos, *val;
+	unsigned char *p = start;
+	int vlen, location = 0, status = 0, cl = 0, flags;
+	char name[64];
+
+	/* the status and framing headers decide how we send the rest */
+
+	pos = h;
+	while (!lws_fcgi_hdr_next(&pos, h + t->hdr_len, name, sizeof(name),
+				  &val, &vlen)) {
+		if (!strcasecmp(name, "status:")) {
+			t->response_code = atoi(val);
+			status = 1;
+		} else if (!strcasecmp(name, "location:"))
+			location = 1;
+		else if (!strcasecmp(name, "content-length:")) {
+			t->content_length = (lws_filepos_t)atoll(val);
+			cl = 1;
+		}
+	}
+
+	if (!status && location)
+		t->response_code = HTTP_STATUS_FOUND;
+	if (t->response_code < 200 ||
+	    t->response_code == HTTP_STATUS_NO_CONTENT ||
+	    t->response_code == HTTP_STATUS_NOT_MODIFIED)
+		t->no_body = 1;
+
+	if (lws_add_http_header_status(wsi, t->response_code, &p, end))
+		return 1;
+
+	pos = h;
+	while (!lws_fcgi_hdr_next(&pos, h + t->hdr_len, name, sizeof(name),
+				  &val, &vlen)) {
+		if (!strcasecmp(name, "status:") ||
+		    !strcasecmp(name, "content-length:") ||
+		    !strcasecmp(name, "transfer-encoding:") ||
+		    !strcasecmp(name, "connection:") ||
+		    !strcasecmp(name, "keep-alive:"))
+			continue;
+
+		if (lws_add_http_header_by_name(wsi, (unsigned char *)name,
+						(unsigned char *)val, vlen,
+						&p, end))
+			return 1;
+	}
+
+	if (cl) {
+		if (lws_add_http_header_content_length(wsi, t->content_length,
+						       &p, end))
+			return 1;
+	} else if (!t->no_body && !wsi->http2_substream) {
+		/* we can only delimit the body by closing, or chunking it */
+		if (wsi->http.request_version == HTTP_VERSION_1_0) {
+			wsi->http.conn_type = HTTP_CONNECTION_CLOSE;
+			if (lws_add_http_header_by_token(wsi,
+					WSI_TOKEN_CONNECTION,
+					(unsigned char *)"close", 5, &p, end))
+				return 1;
+		} else {
+			t->chunked = 1;
+			if (lws_add_http_header_by_token(wsi,
+					WSI_TOKEN_HTTP_TRANSFER_ENCODING,
+					(unsigned char *)"chunked", 7, &p, end))
+				return 1;
+		}
+	}
+
+	if (lws_finalize_http_header(wsi, &p, end))
+		return 1;
+
+	flags = LWS_WRITE_HTTP_HEADERS;
+	if (t->no_body && wsi->http2_substream)
+		flags |= LWS_WRITE_H2_STREAM_END;
+
+	if (lws_write(wsi, start, lws_ptr_diff(p, start), flags) < 0)
+		return 1;
+
+	t->headers_sent = 1;
+
+	return 0;
+}
+
+/*
+ * The server wsi is writeable and we have something from the worker for it.
+ * Returns -1 if the server wsi should be closed.
+ */
+
+int
+lws_fcgi_write_stdout(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_fcgi_txn *t = wsi->http.fcgi_txn;
+	unsigned char *start = pt->serv_buf + LWS_PRE, *q, *seg;
+	size_t room, n;
+	char ch[12];
+	int m, last;
+
+	if (!t)
+		return 0;
+
+	if (!t->headers_sent) {
+		if (!t->headers_done) {
+			if (!t->failed && !t->ended)
+				return 0;
+
+			/* the worker didn't give us a response */
+			lwsl_notice("%s: %p: no response from worker\n",
+				    __func__, wsi);
+			lws_fcgi_txn_destroy(wsi);
+			if (lws_return_http_status(wsi,
+					HTTP_STATUS_SERVICE_UNAVAILABLE, NULL))
+				return -1;
+
+			return lws_http_transaction_completed(wsi) ? -1 : 0;
+		}
+
+		if (lws_fcgi_write_headers(wsi, t, start, pt->serv_buf +
+					   wsi->context->pt_serv_buf_size)) {
+			lwsl_notice("%s: %p: unable to send headers\n",
+				    __func__, wsi);
+			return -1;
+		}
+
+		if (lws_has_buffered_out(wsi))
+			goto again;
+	}
+
+	if (t->failed)
+		/* the response was cut short, the client has to see it */
+		return -1;
+
+	if (t->no_body) {
+		lws_buflist_destroy_all_segments(&t->stdout_list);
+		t->stdout_buffered = 0;
+	}
+
+	n = lws_buflist_next_segment_len(&t->stdout_list, &seg);
+	if (n) {
+		/* leave room in front for the chunk size, and behind for the
+		 * chunk end and final chunk */
+		q = start + 10;
+		room = wsi->context->pt_serv_buf_size - LWS_PRE - 10 - 7;
+		if (n > room)
+			n = room;
+		memcpy(q, seg, n);
+		lws_buflist_use_segment(&t->stdout_list, n);
+		t->stdout_buffered -= n;
+
+		last = t->ended && !t->stdout_list;
+		m = (int)n;
+		if (t->chunked) {
+			int hl = lws_snprintf(ch, sizeof(ch), "%X\x0d\x0a",
+					      (int)n);
+			q -= hl;
+			memcpy(q, ch, hl);
+			m += hl;
+			memcpy(q + m, "\x0d\x0a", 2);
+			m += 2;
+			if (last) {
+				memcpy(q + m, "0\x0d\x0a\x0d\x0a", 5);
+				m += 5;
+				t->chunked = 0;
+			}
+		}
+
+		if (lws_write(wsi, q, m, last && wsi->http2_substream ?
+					 LWS_WRITE_HTTP_FINAL :
+					 LWS_WRITE_HTTP) < 0)
+			return -1;
+
+		if (last)
+			t->no_body = 1;
+
+		if (t->quenched && t->conn &&
+		    t->stdout_buffered < LWS_FCGI_STDOUT_LOW_WATER) {
+			t->quenched = 0;
+			lws_rx_flow_control(t->conn, 1);
+		}
+	}
+
+	if (!t->ended || t->stdout_list)
+		goto again;
+
+	/* the worker has finished and we passed on everything */
+
+	if (!t->no_body) {
+		if (t->chunked) {
+			memcpy(start, "0\x0d\x0a\x0d\x0a", 5);
+			if (lws_write(wsi, start, 5, LWS_WRITE_HTTP) < 0)
+				return -1;
+		} else if (wsi->http2_substream &&
+			   (!wsi->http.tx_content_length ||
+			    wsi->http.tx_content_remain))
+			lws_write(wsi, start, 0, LWS_WRITE_HTTP_FINAL);
+	}
+
+	lws_fcgi_txn_destroy(wsi);
+
+	if (wsi->http.rx_content_remain)
+		/* he's still sending a body nobody wants, don't parse it */
+		wsi->http.conn_type = HTTP_CONNECTION_CLOSE;
+
+	lws_set_timeout(wsi, NO_PENDING_TIMEOUT, 0);
+
+	return lws_http_transaction_completed(wsi) ? -1 : 0;
+
+again:
+	lws_fcgi_txn_writeable(wsi);
+
+	return 0;
+}
+
+/* the server wsi is closing, the worker can't finish the request for it */
+
+void
+__lws_fcgi_txn_close(struct lws *wsi)
+{
+	struct lws_fcgi_txn *t = wsi->http.fcgi_txn;
+	struct lws *conn;
+
+	if (!t || !t->conn)
+		return;
+
+	conn = t->conn;
+	t->conn = NULL;
+	conn->fcgi->txn = NULL;
+
+	/* it may still be answering, so we can't use the connection again */
+	conn->socket_is_permanently_unusable = 1;
+	__lws_close_free_wsi(conn, LWS_CLOSE_STATUS_NOSTATUS,
+			     "fcgi txn closing");
+}
+
+void
+lws_fcgi_txn_destroy(struct lws *wsi)
+{
+	struct lws_fcgi_txn *t = wsi->http.fcgi_txn;
+
+	if (!t)
+		return;
+
+	if (t->conn)
+		t->conn->fcgi->txn = NULL;
+
+	lws_buflist_destroy_all_segments(&t->stdout_list);
+	wsi->http.fcgi_txn = NULL;
+	lws_http_txn_free_set_NULL(t);
+}
+
+/* the connection is closing... call with the vhost lock held */
+
+void
+__lws_fcgi_pool_remove(struct lws *conn)
+{
+	struct lws_fcgi *f = conn->fcgi;
+	struct lws_fcgi_upstream *up = f->upstream;
+
+	if (!up)
+		return;
+
+	if (f->dll_idle.prev) {
+		lws_dll_lws_remove(&f->dll_idle);
+		up->idle--;
+	}
+	up->conns--;
+	f->upstream = NULL;
+}
+
+void
+lws_fcgi_pool_destroy(struct lws_vhost *vh)
+{
+	struct lws_fcgi_upstream *up = vh->http.fcgi_upstream_list, *up1;
+
+	while (up) {
+		up1 = up->next;
+		lws_free(up);
+		up = up1;
+	}
+
+	vh->http.fcgi_upstream_list = NULL;
+}
@@ -0,0 +1,164 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include <core/private.h>
+
+static int
+rops_handle_POLLIN_fcgi(struct lws_context_per_thread *pt, struct lws *wsi,
+			struct lws_pollfd *pollfd)
+{
+	struct lws_fcgi *f = wsi->fcgi;
+	socklen_t sl;
+	int n, e = 0;
+
+	if (f->connecting) {
+		if (!(pollfd->revents & (LWS_POLLOUT | LWS_POLLHUP)))
+			return LWS_HPI_RET_HANDLED;
+
+		sl = sizeof(e);
+		if (getsockopt(wsi->desc.sockfd, SOL_SOCKET, SO_ERROR,
+			       (char *)&e, &sl) || e) {
+			lwsl_notice("%s: %p: connect to worker failed: %d\n",
+				    __func__, wsi, e);
+
+			return LWS_HPI_RET_PLEASE_CLOSE_ME;
+		}
+
+		/* the request we queued while connecting goes out below */
+		f->connecting = 0;
+	}
+
+	if (pollfd->revents & pollfd->events & LWS_POLLIN) {
+		n = lws_ssl_capable_read_no_ssl(wsi, pt->serv_buf,
+					wsi->context->pt_serv_buf_size);
+		switch (n) {
+		case 0:
+		case LWS_SSL_CAPABLE_ERROR:
+			lwsl_info("%s: %p: worker closed\n", __func__, wsi);
+
+			return LWS_HPI_RET_PLEASE_CLOSE_ME;
+
+		case LWS_SSL_CAPABLE_MORE_SERVICE:
+			break;
+
+		default:
+			if (lws_fcgi_rx(wsi, pt->serv_buf, n))
+				return LWS_HPI_RET_PLEASE_CLOSE_ME;
+			break;
+		}
+	}
+
+	if ((pollfd->revents & LWS_POLLOUT) &&
+	    lws_handle_POLLOUT_event(wsi, pollfd))
+		return LWS_HPI_RET_PLEASE_CLOSE_ME;
+
+	return LWS_HPI_RET_HANDLED;
+}
+
+static int
+rops_handle_POLLOUT_fcgi(struct lws *wsi)
+{
+	/* everything we buffered for the worker has gone */
+
+	if (lws_change_pollfd(wsi, LWS_POLLOUT, 0))
+		return LWS_HP_RET_BAIL_DIE;
+
+	lws_fcgi_conn_writeable(wsi);
+
+	return LWS_HP_RET_BAIL_OK;
+}
+
+static int
+rops_close_role_fcgi(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	struct lws_fcgi *f = wsi->fcgi;
+	struct lws_fcgi_txn *t;
+	struct lws *txn;
+
+	if (!f)
+		return 0;
+
+	lws_vhost_lock(wsi->vhost);
+	__lws_fcgi_pool_remove(wsi);
+	lws_vhost_unlock(wsi->vhost);
+
+	txn = f->txn;
+	if (!txn)
+		return 0;
+
+	/*
+	 * The worker went away in the middle of the request.  Let the server
+	 * wsi find out about it in its own writeable callback.
+	 */
+
+	f->txn = NULL;
+	t = txn->http.fcgi_txn;
+	t->conn = NULL;
+	t->failed = 1;
+
+	if (f->txn_quenched)
+		lws_rx_flow_control(txn, 1);
+
+	txn->reason_bf |= LWS_CB_REASON_AUX_BF__FCGI;
+	lws_callback_on_writable(txn);
+
+	return 0;
+}
+
+static int
+rops_destroy_role_fcgi(struct lws *wsi)
+{
+	lws_free_set_NULL(wsi->fcgi);
+
+	return 0;
+}
+
+struct lws_role_ops role_ops_fcgi = {
+	/* role name */			"fcgi",
+	/* alpn id */			NULL,
+	/* check_upgrades */		NULL,
+	/* init_context */		NULL,
+	/* init_vhost */		NULL,
+	/* destroy_vhost */		NULL,
+	/* periodic_checks */		NULL,
+	/* service_flag_pending */	NULL,
+	/* handle_POLLIN */		rops_handle_POLLIN_fcgi,
+	/* handle_POLLOUT */		rops_handle_POLLOUT_fcgi,
+	/* perform_user_POLLOUT */	NULL,
+	/* callback_on_writable */	NULL,
+	/* tx_credit */			NULL,
+	/* write_role_protocol */	NULL,
+	/* encapsulation_parent */	NULL,
+	/* alpn_negotiated */		NULL,
+	/* close_via_role_protocol */	NULL,
+	/* close_role */		rops_close_role_fcgi,
+	/* close_kill_connection */	NULL,
+	/* destroy_role */		rops_destroy_role_fcgi,
+	/* adoption_bind */		NULL,
+	/* client_bind */		NULL,
+	/* adoption_cb clnt, srv */	{ 0, 0 },
+	/* rx_cb clnt, srv */		{ 0, 0 },
+	/* writeable cb clnt, srv */	{ 0, 0 },
+	/* close cb clnt, srv */	{ 0, 0 },
+	/* protocol_bind_cb c,s */	{ 0, 0 },
+	/* protocol_unbind_cb c,s */	{ 0, 0 },
+	/* file_handle */		0,
+};
@@ -0,0 +1,141 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010 - 2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ *  This is included from core/private.h if LWS_ROLE_FCGI
+ */
+
+extern struct lws_role_ops role_ops_fcgi;
+
+#define lwsi_role_fcgi(wsi) (wsi->role_ops == &role_ops_fcgi)
+
+/* FastCGI 1.0 record types and flags we use */
+
+enum {
+	LWS_FCGI_BEGIN_REQUEST		= 1,
+	LWS_FCGI_ABORT_REQUEST		= 2,
+	LWS_FCGI_END_REQUEST		= 3,
+	LWS_FCGI_PARAMS			= 4,
+	LWS_FCGI_STDIN			= 5,
+	LWS_FCGI_STDOUT			= 6,
+	LWS_FCGI_STDERR			= 7,
+};
+
+#define LWS_FCGI_VERSION_1		1
+#define LWS_FCGI_RESPONDER		1
+#define LWS_FCGI_KEEP_CONN		1
+#define LWS_FCGI_REQUEST_COMPLETE	0
+#define LWS_FCGI_HDR_SIZE		8
+#define LWS_FCGI_MAX_CONTENT		65535
+/* we only have one request at a time on each connection */
+#define LWS_FCGI_REQUEST_ID		1
+
+/* response headers from the worker must fit in this */
+#define LWS_FCGI_MAX_RESPONSE_HDRS	4096
+/* stop reading the worker when this much response is waiting for the client */
+#define LWS_FCGI_STDOUT_HIGH_WATER	(64 * 1024)
+#define LWS_FCGI_STDOUT_LOW_WATER	(16 * 1024)
+
+/*
+ * One of these per distinct worker address that fcgi mounts on the vhost
+ * connect to.  Protected by the vhost lock.
+ */
+
+struct lws_fcgi_upstream {
+	struct lws_fcgi_upstream *next;
+	struct lws_dll_lws idle_head; /* idle connections we can reuse */
+
+	unsigned long hits;	/* requests that reused an idle conn */
+	unsigned long misses;	/* requests that made a new conn */
+
+	unsigned int conns;	/* connections open, busy or idle */
+	unsigned int idle;	/* connections idle in idle_head */
+
+	/* worker address string follows */
+};
+
+/* the connection wsi to a worker has one of these */
+
+struct lws_fcgi {
+	struct lws_dll_lws dll_idle;	/* on upstream->idle_head */
+	struct lws_fcgi_upstream *upstream;
+	struct lws *wsi;	/* the connection wsi this belongs to */
+	struct lws *txn;	/* server wsi whose request we carry, or NULL */
+
+	uint8_t rh[LWS_FCGI_HDR_SIZE];	/* record header being collected */
+	uint8_t end[8];			/* END_REQUEST body being collected */
+	uint16_t content_remain;	/* of the current record */
+	uint8_t padding_remain;
+	uint8_t rh_pos;
+
+	unsigned int connecting:1;
+	unsigned int stdin_ended:1;
+	unsigned int txn_quenched:1; /* we stopped reading the txn body */
+};
+
+/* the server wsi being answered by a worker has one of these */
+
+struct lws_fcgi_txn {
+	struct lws *conn;	/* connection to worker, NULL after END_REQUEST */
+	struct lws_buflist *stdout_list; /* response body waiting to be sent */
+	size_t stdout_buffered;
+	lws_filepos_t content_length;	/* from the response headers, or 0 */
+
+	int response_code;
+	int hdr_len;
+	int timeout_secs;	/* the mount's cgi-timeout */
+
+	unsigned int headers_done:1;
+	unsigned int headers_sent:1;
+	unsigned int chunked:1;
+	unsigned int ended:1;
+	unsigned int quenched:1; /* we stopped reading the worker */
+	unsigned int failed:1; /* worker went away before END_REQUEST */
+	unsigned int no_body:1; /* HEAD, 204 or 304 */
+
+	/* response headers buffer of LWS_FCGI_MAX_RESPONSE_HDRS follows */
+};
+
+int
+lws_fcgi(struct lws *wsi, const struct lws_http_mount *hit,
+	 const char *method, const char *uri_ptr, int uri_len);
+
+int
+lws_fcgi_stdin(struct lws *wsi, const uint8_t *buf, size_t len);
+
+int
+lws_fcgi_write_stdout(struct lws *wsi);
+
+int
+lws_fcgi_rx(struct lws *wsi, const uint8_t *buf, size_t len);
+
+int
+lws_fcgi_conn_writeable(struct lws *conn);
+
+void
+__lws_fcgi_txn_close(struct lws *wsi);
+
+void
+lws_fcgi_txn_destroy(struct lws *wsi);
+
+void
+__lws_fcgi_pool_remove(struct lws *conn);
+
+void
+lws_fcgi_pool_destroy(struct lws_vhost *vh);
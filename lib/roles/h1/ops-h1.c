@@ -130,6 +130,14 @@ http_postbody:
 			body_chunk_len = min(wsi->http.rx_content_remain, len);
 			wsi->http.rx_content_remain -= body_chunk_len;
 			len -= body_chunk_len;
+#if defined(LWS_ROLE_FCGI)
+			if (wsi->http.fcgi_txn) {
+				if (lws_fcgi_stdin(wsi, buf,
+						   (size_t)body_chunk_len))
+					goto bail;
+				n = (size_t)body_chunk_len;
+			} else
+#endif
 #ifdef LWS_WITH_CGI
 			if (wsi->http.cgi) {
 				struct lws_cgi_args args;
@@ -147,17 +155,16 @@ http_postbody:
 					(void *)&args, 0);
 				if ((int)n < 0)
 					goto bail;
-			} else {
+			} else
 #endif
-				n = wsi->protocol->callback(wsi,
+			{
+				n = lws_protocol_cb(wsi->protocol->callback, wsi,
 					LWS_CALLBACK_HTTP_BODY, wsi->user_space,
 					buf, (size_t)body_chunk_len);
 				if (n)
 					goto bail;
 				n = (size_t)body_chunk_len;
-#ifdef LWS_WITH_CGI
 			}
-#endif
 			buf += n;
 
 			if (wsi->http.rx_content_remain)  {
@@ -168,6 +175,16 @@ http_postbody:
 			}
 			/* he sent all the content in time */
 postbody_completion:
+#if defined(LWS_ROLE_FCGI)
+			if (wsi->http.fcgi_txn) {
+				/* the worker still has to finish answering */
+				lws_set_timeout(wsi, PENDING_TIMEOUT_CGI,
+					wsi->http.fcgi_txn->timeout_secs);
+				if (lws_fcgi_stdin(wsi, NULL, 0))
+					goto bail;
+				break;
+			}
+#endif
 #ifdef LWS_WITH_CGI
 			/*
 			 * If we're running a cgi, we can't let him off the
@@ -185,7 +202,7 @@ postbody_completion:
 			{
 				lwsl_info("HTTP_BODY_COMPLETION: %p (%s)\n",
 					  wsi, wsi->protocol->name);
-				n = wsi->protocol->callback(wsi,
+				n = lws_protocol_cb(wsi->protocol->callback, wsi,
 					LWS_CALLBACK_HTTP_BODY_COMPLETION,
 					wsi->user_space, NULL, 0);
 				if (n)
@@ -471,6 +488,7 @@ try_pollout:
 					LWSSTATS_MS_WRITABLE_DELAY, ul);
 			lws_stats_atomic_max(wsi->context, pt,
 				  LWSSTATS_MS_WORST_WRITABLE_DELAY, ul);
+			lws_stats_hist_add(pt, LWSSTATS_H_WRITABLE_DELAY, ul);
 			wsi->active_writable_req_us = 0;
 		}
 #endif
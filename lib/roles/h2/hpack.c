@@ -219,7 +219,7 @@ static int lws_frag_start(struct lws *wsi, int hdr_token_idx)
 		return 1;
 	}
 
-	if (ah->nfrag >= LWS_ARRAY_SIZE(ah->frag_index)) {
+	if (_lws_ah_frags_room(ah, ah->nfrag ? ah->nfrag : 1)) {
 		lwsl_err("%s: frag index %d too big\n", __func__, ah->nfrag);
 		return 1;
 	}
@@ -264,6 +264,9 @@ static int lws_frag_start(struct lws *wsi, int hdr_token_idx)
 
 		/* cookie continuations need a separator token of ';' */
 		if (hdr_token_idx == WSI_TOKEN_HTTP_COOKIE) {
+			if (ah->pos >= ah->data_length &&
+			    lws_header_table_promote(wsi))
+				return 1;
 			ah->data[ah->pos++] = ';';
 			ah->frags[ah->nfrag].len++;
 		}
@@ -277,6 +280,10 @@ static int lws_frag_append(struct lws *wsi, unsigned char c)
 {
 	struct allocated_headers *ah = wsi->http.ah;
 
+	/* a small ah that filled up is grown to the large size class */
+	if (ah->pos >= ah->data_length && lws_header_table_promote(wsi))
+		return 1;
+
 	ah->data[ah->pos++] = c;
 	ah->frags[ah->nfrag].len++;
 
@@ -193,6 +193,7 @@ lws_wsi_server_new(struct lws_vhost *vh, struct lws *parent_wsi,
 	/* first child is now the new guy */
 	parent_wsi->h2.child_list = wsi;
 	parent_wsi->h2.child_count++;
+	lws_metrics_h2_streams(parent_wsi, 1);
 
 	wsi->h2.my_priority = 16;
 	wsi->h2.tx_cr = nwsi->h2.h2n->set.s[H2SET_INITIAL_WINDOW_SIZE];
@@ -219,12 +220,14 @@ bail1:
 	/* undo the insert */
 	parent_wsi->h2.child_list = wsi->h2.sibling_list;
 	parent_wsi->h2.child_count--;
+	lws_metrics_h2_streams(parent_wsi, -1);
 
 	vh->context->count_wsi_allocated--;
 
 	if (wsi->user_space)
 		lws_free_set_NULL(wsi->user_space);
-	vh->protocols[0].callback(wsi, LWS_CALLBACK_WSI_DESTROY, NULL, NULL, 0);
+	lws_protocol_cb(vh->protocols[0].callback, wsi,
+			LWS_CALLBACK_WSI_DESTROY, NULL, NULL, 0);
 	lws_vhost_unbind_wsi(wsi);
 	lws_free(wsi);
 
@@ -257,6 +260,7 @@ lws_wsi_h2_adopt(struct lws *parent_wsi, struct lws *wsi)
 	/* first child is now the new guy */
 	parent_wsi->h2.child_list = wsi;
 	parent_wsi->h2.child_count++;
+	lws_metrics_h2_streams(parent_wsi, 1);
 
 	wsi->h2.my_priority = 16;
 	wsi->h2.tx_cr = nwsi->h2.h2n->set.s[H2SET_INITIAL_WINDOW_SIZE];
@@ -279,10 +283,12 @@ bail1:
 	/* undo the insert */
 	parent_wsi->h2.child_list = wsi->h2.sibling_list;
 	parent_wsi->h2.child_count--;
+	lws_metrics_h2_streams(parent_wsi, -1);
 
 	if (wsi->user_space)
 		lws_free_set_NULL(wsi->user_space);
-	wsi->protocol->callback(wsi, LWS_CALLBACK_WSI_DESTROY, NULL, NULL, 0);
+	lws_protocol_cb(wsi->protocol->callback, wsi,
+			LWS_CALLBACK_WSI_DESTROY, NULL, NULL, 0);
 	lws_free(wsi);
 
 	return NULL;
@@ -333,6 +339,7 @@ int lws_remove_server_child_wsi(struct lws_context *context, struct lws *wsi)
 		if (*w == wsi) {
 			*w = wsi->h2.sibling_list;
 			(wsi->h2.parent_wsi)->h2.child_count--;
+			lws_metrics_h2_streams(wsi->h2.parent_wsi, -1);
 			return 0;
 		}
 	} lws_end_foreach_llp(w, h2.sibling_list);
@@ -1877,7 +1884,8 @@ lws_h2_parser(struct lws *wsi, unsigned char *in, lws_filepos_t inlen,
 
 					if (lwsi_state(h2n->swsi) == LRS_DEFERRING_ACTION) {
 						// lwsl_notice("appending because we are in LRS_DEFERRING_ACTION\n");
-						m = lws_buflist_append_segment(
+						m = lws_wsi_buflist_append(
+							h2n->swsi,
 							&h2n->swsi->buflist,
 								in - 1, n);
 						if (m < 0)
@@ -2172,7 +2180,7 @@ lws_h2_client_handshake(struct lws *wsi)
 
 	/* give userland a chance to append, eg, cookies */
 
-	if (wsi->protocol->callback(wsi,
+	if (lws_protocol_cb(wsi->protocol->callback, wsi,
 				LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER,
 				wsi->user_space, &p, (end - p) - 12))
 		goto fail_length;
@@ -2250,8 +2258,9 @@ lws_h2_ws_handshake(struct lws *wsi)
 	hit = lws_find_mount(wsi, uri_ptr, n);
 
 	if (hit && hit->cgienv &&
-	    wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP_PMO, wsi->user_space,
-				    (void *)hit->cgienv, 0))
+	    lws_protocol_cb(wsi->protocol->callback, wsi,
+			    LWS_CALLBACK_HTTP_PMO, wsi->user_space,
+			    (void *)hit->cgienv, 0))
 		return 1;
 
 	return 0;
@@ -209,6 +209,10 @@ read:
 			lwsl_info("%s: LWS_SSL_CAPABLE_ERROR\n", __func__);
 			return LWS_HPI_RET_PLEASE_CLOSE_ME;
 		}
+#if defined(LWS_WITH_PEER_LIMITS)
+		if (ebuf.len > 0)
+			lws_peer_ratelimit_charge(wsi, 0, (size_t)ebuf.len);
+#endif
 
 		// lwsl_notice("%s: Actual RX %d\n", __func__, ebuf.len);
 		// if (ebuf.len > 0)
@@ -270,7 +274,7 @@ drain:
 		}
 
 		if (buffered) {
-			m = lws_buflist_use_segment(&wsi->buflist, n);
+			m = lws_wsi_buflist_use(wsi, &wsi->buflist, n);
 			lwsl_info("%s: draining rxflow: used %d, next %d\n",
 				    __func__, n, m);
 			if (!m) {
@@ -280,7 +284,7 @@ drain:
 			}
 		} else
 			if (n != ebuf.len) {
-				m = lws_buflist_append_segment(&wsi->buflist,
+				m = lws_wsi_buflist_append(wsi, &wsi->buflist,
 						(uint8_t *)ebuf.token + n,
 						ebuf.len - n);
 				if (m < 0)
@@ -670,9 +674,10 @@ rops_close_kill_connection_h2(struct lws *wsi, enum lws_close_status reason)
 			}
 		} lws_end_foreach_llp(w, h2.sibling_list);
 		wsi->h2.parent_wsi->h2.child_count--;
+		lws_metrics_h2_streams(wsi->h2.parent_wsi, -1);
 		wsi->h2.parent_wsi = NULL;
 		if (wsi->h2.pending_status_body)
-			lws_free_set_NULL(wsi->h2.pending_status_body);
+			lws_http_txn_free_set_NULL(wsi->h2.pending_status_body);
 	}
 
 	if (wsi->h2_stream_carries_ws) {
@@ -949,7 +954,7 @@ rops_perform_user_POLLOUT_h2(struct lws *wsi)
 					 LWS_PRE,
 				         strlen(w->h2.pending_status_body +
 					        LWS_PRE), LWS_WRITE_HTTP_FINAL);
-			lws_free_set_NULL(w->h2.pending_status_body);
+			lws_http_txn_free_set_NULL(w->h2.pending_status_body);
 			lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS,
 					   "h2 end stream 1");
 			wa = &wsi->h2.child_list;
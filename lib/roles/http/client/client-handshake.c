@@ -454,8 +454,9 @@ ads_known:
 		if (!wsi->protocol)
 			wsi->protocol = &wsi->vhost->protocols[0];
 
-		wsi->protocol->callback(wsi, LWS_CALLBACK_WSI_CREATE,
-					wsi->user_space, NULL, 0);
+		lws_protocol_cb(wsi->protocol->callback, wsi,
+				LWS_CALLBACK_WSI_CREATE,
+				wsi->user_space, NULL, 0);
 
 		lws_set_timeout(wsi, PENDING_TIMEOUT_AWAITING_CONNECT_RESPONSE,
 				AWAITING_TIMEOUT);
@@ -635,6 +636,11 @@ send_hs:
 			/* clear his established timeout */
 			lws_set_timeout(wsi, NO_PENDING_TIMEOUT, 0);
 
+			/* service.c pollout processing wants this */
+			wsi->hdr_parsing_completed = 1;
+
+			lwsi_set_state(wsi, LRS_ESTABLISHED);
+
 			m = wsi->role_ops->adoption_cb[0];
 			if (m) {
 				n = user_callback_handle_rxflow(
@@ -646,11 +652,6 @@ send_hs:
 				}
 			}
 
-			/* service.c pollout processing wants this */
-			wsi->hdr_parsing_completed = 1;
-
-			lwsi_set_state(wsi, LRS_ESTABLISHED);
-
 			return wsi;
 		}
 
@@ -685,7 +686,7 @@ send_hs:
 
 oom4:
 	if (lwsi_role_client(wsi) /* && lwsi_state_est(wsi) */) {
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 			LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 			wsi->user_space, (void *)cce, strlen(cce));
 		wsi->already_did_cce = 1;
@@ -712,7 +713,7 @@ oom4:
 	return NULL;
 
 failed:
-	wsi->protocol->callback(wsi,
+	lws_protocol_cb(wsi->protocol->callback, wsi,
 		LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 		wsi->user_space, (void *)cce, strlen(cce));
 	wsi->already_did_cce = 1;
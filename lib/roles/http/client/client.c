@@ -535,13 +535,27 @@ bail3:
 		lwsl_info("closing conn at LWS_CONNMODE...SERVER_REPLY\n");
 		if (cce)
 			lwsl_info("reason: %s\n", cce);
-		wsi->protocol->callback(wsi,
+		lws_protocol_cb(wsi->protocol->callback, wsi,
 			LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 			wsi->user_space, (void *)cce, cce ? strlen(cce) : 0);
 		wsi->already_did_cce = 1;
 		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS, "cbail3");
 		return -1;
 
+	case LRS_IDLING:
+		/*
+		 * Nothing is expected from the server on an idle keepalive
+		 * connection.  If it became readable, he hung up on us (or
+		 * sent something we can't make sense of): it's finished.
+		 */
+		if (!(pollfd->revents & (LWS_POLLIN | LWS_POLLHUP)))
+			break;
+
+		lwsl_info("%s: %p: server closed idle connection\n", __func__,
+			  wsi);
+		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS, "idle hup");
+		return -1;
+
 	default:
 		break;
 	}
@@ -567,6 +581,13 @@ lws_http_transaction_completed_client(struct lws *wsi)
 		return -1;
 	}
 
+#if defined(LWS_WITH_HTTP_PROXY)
+	/* reverse proxy upstream connections go back in the vhost pool */
+
+	if (wsi->http.upstream && !lws_http_proxy_pool_park(wsi))
+		return 0;
+#endif
+
 	/*
 	 * Are we constitutionally capable of having a queue, ie, we are on
 	 * the "active client connections" list?
@@ -747,6 +768,12 @@ lws_client_interpret_server_handshake(struct lws *wsi)
 			lwsl_info("no URI\n");
 			goto bail3;
 		}
+		/* the server may still tell us he will close after this */
+		if (!wsi->do_ws &&
+		    lws_hdr_total_length(wsi, WSI_TOKEN_CONNECTION) &&
+		    !strcasecmp(lws_hdr_simple_ptr(wsi, WSI_TOKEN_CONNECTION),
+				"close"))
+			wsi->http.conn_type = HTTP_CONNECTION_CLOSE;
 	} else {
 		p = lws_hdr_simple_ptr(wsi, WSI_TOKEN_HTTP_COLON_STATUS);
 		if (!p) {
@@ -936,7 +963,7 @@ lws_client_interpret_server_handshake(struct lws *wsi)
 		 * we seem to be good to go, give client last chance to check
 		 * headers and OK it
 		 */
-		if (w->protocol->callback(w,
+		if (lws_protocol_cb(w->protocol->callback, w,
 				LWS_CALLBACK_CLIENT_FILTER_PRE_ESTABLISH,
 					    w->user_space, NULL, 0)) {
 
@@ -950,7 +977,7 @@ lws_client_interpret_server_handshake(struct lws *wsi)
 		wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
 
 		/* call him back to inform him he is up */
-		if (w->protocol->callback(w,
+		if (lws_protocol_cb(w->protocol->callback, w,
 					    LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP,
 					    w->user_space, NULL, 0)) {
 			cce = "HS: disallowed at ESTABLISHED";
@@ -999,7 +1026,7 @@ bail2:
 		n = 0;
 		if (cce)
 			n = (int)strlen(cce);
-		w->protocol->callback(w,
+		lws_protocol_cb(w->protocol->callback, w,
 				LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
 				w->user_space, (void *)cce,
 				(unsigned int)n);
@@ -1103,12 +1130,12 @@ lws_generate_client_handshake(struct lws *wsi, char *pkt)
 		p = lws_generate_client_ws_handshake(wsi, p, conn1);
 	} else
 #endif
-		if (!wsi->client_pipeline)
+		if (!wsi->client_pipeline && !wsi->client_keepalive)
 			p += sprintf(p, "connection: close\x0d\x0a");
 
 	/* give userland a chance to append, eg, cookies */
 
-	if (wsi->protocol->callback(wsi,
+	if (lws_protocol_cb(wsi->protocol->callback, wsi,
 			LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER,
 			wsi->user_space, &p,
 			(pkt + wsi->context->pt_serv_buf_size) - p - 12))
@@ -0,0 +1,355 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010 - 2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "core/private.h"
+
+/*
+ * Cache of compressed file bodies.
+ *
+ * The first time a file from a mount is served with stream compression, the
+ * compressor output is copied into a new entry as it is produced.  If the
+ * whole body was compressed, the entry is listed on the vhost cache, keyed by
+ * the file path, length and mtime, and the compression method.
+ *
+ * Later requests for the same version of the file that would choose the same
+ * compression method are served from the entry, through a fop_fd that reads
+ * from it, with a content-length and without running the compressor.
+ *
+ * Entries are evicted least recently used first to stay within the vhost's
+ * compressed_cache_max.  An entry evicted while fop_fds are still serving from
+ * it is freed when the last of them is closed.
+ */
+
+static uint32_t
+lws_compr_cache_hash(const char *path, lws_filepos_t len, uint32_t mod_time)
+{
+	uint32_t h = 5381 ^ mod_time ^ (uint32_t)len;
+
+	while (*path)
+		h = ((h << 5) + h) ^ (uint8_t)*path++;
+
+	return h;
+}
+
+static const char *
+lws_compr_cache_path(struct lws_compr_cache_entry *e)
+{
+	return (const char *)&e[1];
+}
+
+static uint8_t *
+lws_compr_cache_data(struct lws_compr_cache_entry *e)
+{
+	return (uint8_t *)&e[1] + strlen(lws_compr_cache_path(e)) + 1;
+}
+
+/* call with vhost lock held */
+
+static void
+__lws_compr_cache_unlist(struct lws_compr_cache *cc,
+			 struct lws_compr_cache_entry *e)
+{
+	lws_start_foreach_llp(struct lws_compr_cache_entry **, pe,
+			      cc->hash[e->hash % LWS_COMPR_CACHE_BUCKETS]) {
+		if (*pe == e) {
+			*pe = e->hash_next;
+			break;
+		}
+	} lws_end_foreach_llp(pe, hash_next);
+
+	lws_dll_lws_remove(&e->lru);
+	cc->size -= e->len;
+	e->listed = 0;
+
+	if (!e->refcount)
+		lws_free(e);
+}
+
+/* fops for a fop_fd reading from a cache entry */
+
+static int
+lws_compr_cache_fop_close(lws_fop_fd_t *fop_fd)
+{
+	struct lws_compr_cache_entry *e = (*fop_fd)->filesystem_priv;
+	struct lws_vhost *vh = e->vh;
+
+	lws_vhost_lock(vh);
+	if (!--e->refcount && !e->listed)
+		lws_free(e);
+	lws_vhost_unlock(vh);
+
+	lws_free_set_NULL(*fop_fd);
+
+	return 0;
+}
+
+static lws_fileofs_t
+lws_compr_cache_fop_seek_cur(lws_fop_fd_t fop_fd, lws_fileofs_t ofs)
+{
+	if ((lws_fileofs_t)fop_fd->pos + ofs < 0 ||
+	    fop_fd->pos + ofs > fop_fd->len)
+		return -1;
+
+	fop_fd->pos += ofs;
+
+	return fop_fd->pos;
+}
+
+static int
+lws_compr_cache_fop_read(lws_fop_fd_t fop_fd, lws_filepos_t *amount,
+			 uint8_t *buf, lws_filepos_t len)
+{
+	struct lws_compr_cache_entry *e = fop_fd->filesystem_priv;
+
+	if (len > fop_fd->len - fop_fd->pos)
+		len = fop_fd->len - fop_fd->pos;
+
+	memcpy(buf, lws_compr_cache_data(e) + fop_fd->pos, (size_t)len);
+	fop_fd->pos += len;
+	*amount = len;
+
+	return 0;
+}
+
+static const struct lws_plat_file_ops fops_compr_cache = {
+	NULL,				/* open */
+	lws_compr_cache_fop_close,	/* close */
+	lws_compr_cache_fop_seek_cur,	/* seek_cur */
+	lws_compr_cache_fop_read,	/* read */
+	NULL,				/* write */
+	{ { NULL, 0 } },		/* fi */
+	NULL,				/* next */
+};
+
+/*
+ * Called instead of lws_http_compression_apply() when lws_serve_http_file()
+ * decides to compress a file.  Either replaces wsi->http.fop_fd with one
+ * reading the compressed body from the cache, or applies the compression and
+ * if the file is cacheable, starts capturing the compressed body.
+ */
+
+int
+lws_compr_cache_apply(struct lws *wsi, const char *file, unsigned char **p,
+		      unsigned char *end)
+{
+	struct lws_compr_cache *cc = &wsi->vhost->http.compr_cache;
+	lws_filepos_t len = lws_vfs_get_length(wsi->http.fop_fd);
+	uint32_t mod_time = lws_vfs_get_mod_time(wsi->http.fop_fd);
+	struct lws_compression_support *lcs;
+	struct lws_compr_cache_entry *e;
+	lws_fop_fd_t fop_fd;
+	size_t n;
+	uint32_t h;
+
+	lcs = lws_http_compression_preferred(wsi);
+
+	/*
+	 * we can only trust the key if we know the file mtime, and we only
+	 * want whole, uninterpreted files
+	 */
+
+	if (!cc->max || !lcs || !mod_time || wsi->interpreting ||
+#if defined(LWS_WITH_RANGES)
+	    wsi->http.range.count_ranges ||
+#endif
+	    len > cc->max / 8)
+		return lws_http_compression_apply(wsi, NULL, p, end, 0);
+
+	h = lws_compr_cache_hash(file, len, mod_time);
+
+	lws_vhost_lock(wsi->vhost);
+	e = cc->hash[h % LWS_COMPR_CACHE_BUCKETS];
+	while (e) {
+		if (e->hash == h && e->lcs == lcs && e->orig_len == len &&
+		    e->mod_time == mod_time &&
+		    !strcmp(lws_compr_cache_path(e), file))
+			break;
+		e = e->hash_next;
+	}
+	if (e) {
+		lws_dll_lws_remove(&e->lru);
+		lws_dll_lws_add_front(&e->lru, &cc->lru_head);
+		e->refcount++;
+		cc->hits++;
+	} else
+		cc->misses++;
+	lws_vhost_unlock(wsi->vhost);
+
+	if (!e)
+		goto compress;
+
+	fop_fd = lws_zalloc(sizeof(*fop_fd), "compr cache fop_fd");
+	if (!fop_fd) {
+		lws_vhost_lock(wsi->vhost);
+		if (!--e->refcount && !e->listed)
+			lws_free(e);
+		lws_vhost_unlock(wsi->vhost);
+
+		return -1;
+	}
+
+	fop_fd->fd = LWS_INVALID_FILE;
+	fop_fd->fops = &fops_compr_cache;
+	fop_fd->filesystem_priv = e;
+	fop_fd->len = e->len;
+	fop_fd->mod_time = mod_time;
+	fop_fd->flags = LWS_FOP_FLAG_VIRTUAL;
+
+	lws_vfs_file_close(&wsi->http.fop_fd);
+	wsi->http.fop_fd = fop_fd;
+
+	lwsl_info("%s: wsi %p: %s %s from cache\n", __func__, wsi, file,
+		  lcs->encoding_name);
+
+	return lws_add_http_header_by_token(wsi,
+			WSI_TOKEN_HTTP_CONTENT_ENCODING,
+			(unsigned char *)lcs->encoding_name,
+			(int)strlen(lcs->encoding_name), p, end);
+
+compress:
+	n = lws_http_compression_apply(wsi, NULL, p, end, 0);
+	if (n || !wsi->http.lcs)
+		return (int)n;
+
+	/*
+	 * Compressible files generally shrink, but allow for some growth
+	 * before we give up on keeping it
+	 */
+
+	n = strlen(file) + 1;
+	e = lws_malloc(sizeof(*e) + n + (size_t)len + (size_t)(len / 16) + 64,
+		       "compr cache entry");
+	if (!e)
+		return 0;
+
+	memset(e, 0, sizeof(*e));
+	e->vh = wsi->vhost;
+	e->lcs = wsi->http.lcs;
+	e->orig_len = len;
+	e->alloc = (size_t)len + (size_t)(len / 16) + 64;
+	e->mod_time = mod_time;
+	e->hash = h;
+	memcpy(&e[1], file, n);
+
+	wsi->http.comp_capture = e;
+
+	return 0;
+}
+
+void
+lws_compr_cache_capture(struct lws *wsi, const uint8_t *buf, size_t len)
+{
+	struct lws_compr_cache_entry *e = wsi->http.comp_capture;
+
+	if (e->len + len > e->alloc) {
+		lwsl_info("%s: %s doesn't compress, not caching\n", __func__,
+			  lws_compr_cache_path(e));
+		lws_compr_cache_capture_drop(wsi);
+
+		return;
+	}
+
+	memcpy(lws_compr_cache_data(e) + e->len, buf, len);
+	e->len += len;
+}
+
+void
+lws_compr_cache_capture_commit(struct lws *wsi)
+{
+	struct lws_compr_cache_entry *e = wsi->http.comp_capture, *e1;
+	struct lws_compr_cache *cc = &wsi->vhost->http.compr_cache;
+	struct lws_dll_lws *d;
+
+	wsi->http.comp_capture = NULL;
+
+	/* give back the unused allowance for growth */
+
+	e1 = lws_realloc(e, lws_ptr_diff(lws_compr_cache_data(e), e) + e->len,
+			 "compr cache entry");
+	if (e1)
+		e = e1;
+
+	lws_vhost_lock(wsi->vhost);
+
+	/* somebody else may have compressed the same thing meanwhile */
+
+	e1 = cc->hash[e->hash % LWS_COMPR_CACHE_BUCKETS];
+	while (e1) {
+		if (e1->hash == e->hash && e1->lcs == e->lcs &&
+		    e1->orig_len == e->orig_len &&
+		    e1->mod_time == e->mod_time &&
+		    !strcmp(lws_compr_cache_path(e1), lws_compr_cache_path(e)))
+			break;
+		e1 = e1->hash_next;
+	}
+	if (e1 || e->len > cc->max) {
+		lws_vhost_unlock(wsi->vhost);
+		lws_free(e);
+
+		return;
+	}
+
+	/*
+	 * make space by evicting the least recently used... the list has no
+	 * tail pointer, but this only happens once per new file version
+	 */
+
+	while (cc->size + e->len > cc->max && cc->lru_head.next) {
+		d = cc->lru_head.next;
+		while (d->next)
+			d = d->next;
+		e1 = lws_container_of(d, struct lws_compr_cache_entry, lru);
+		lwsl_info("%s: evicting %s\n", __func__,
+			  lws_compr_cache_path(e1));
+		__lws_compr_cache_unlist(cc, e1);
+	}
+
+	e->hash_next = cc->hash[e->hash % LWS_COMPR_CACHE_BUCKETS];
+	cc->hash[e->hash % LWS_COMPR_CACHE_BUCKETS] = e;
+	lws_dll_lws_add_front(&e->lru, &cc->lru_head);
+	cc->size += e->len;
+	e->listed = 1;
+
+	lws_vhost_unlock(wsi->vhost);
+
+	lwsl_info("%s: cached %s %s: %llu -> %lu\n", __func__,
+		  lws_compr_cache_path(e), e->lcs->encoding_name,
+		  (unsigned long long)e->orig_len, (unsigned long)e->len);
+}
+
+void
+lws_compr_cache_capture_drop(struct lws *wsi)
+{
+	lws_free_set_NULL(wsi->http.comp_capture);
+}
+
+void
+lws_compr_cache_destroy(struct lws_vhost *vh)
+{
+	struct lws_compr_cache *cc = &vh->http.compr_cache;
+	struct lws_compr_cache_entry *e;
+
+	while (cc->lru_head.next) {
+		e = lws_container_of(cc->lru_head.next,
+				     struct lws_compr_cache_entry, lru);
+		__lws_compr_cache_unlist(cc, e);
+	}
+}
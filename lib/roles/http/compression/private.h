@@ -78,3 +78,54 @@ lws_http_compression_transform(struct lws *wsi, unsigned char *buf,
 
 void
 lws_http_compression_destroy(struct lws *wsi);
+
+struct lws_compression_support *
+lws_http_compression_preferred(struct lws *wsi);
+
+/*
+ * Compressed file bodies kept for reuse, keyed by file path, length and mtime
+ * and the compression method.  One per vhost, protected by the vhost lock.
+ */
+
+#define LWS_COMPR_CACHE_BUCKETS 32
+
+struct lws_compr_cache_entry {
+	struct lws_dll_lws lru;	/* on cache->lru_head, most recently used first */
+	struct lws_compr_cache_entry *hash_next;
+	struct lws_vhost *vh;
+	struct lws_compression_support *lcs;
+	lws_filepos_t orig_len;	/* length of the uncompressed file */
+	size_t len;		/* compressed length so far */
+	size_t alloc;		/* room for compressed data while capturing */
+	uint32_t mod_time;
+	uint32_t hash;
+	int refcount;		/* fop_fds currently serving from us */
+	unsigned int listed:1;	/* in the hash table and lru list */
+
+	/* file path string, then compressed data follow */
+};
+
+struct lws_compr_cache {
+	struct lws_compr_cache_entry *hash[LWS_COMPR_CACHE_BUCKETS];
+	struct lws_dll_lws lru_head;
+	size_t max;		/* 0 means disabled */
+	size_t size;		/* compressed bytes currently listed */
+	unsigned long hits;
+	unsigned long misses;
+};
+
+int
+lws_compr_cache_apply(struct lws *wsi, const char *file, unsigned char **p,
+		      unsigned char *end);
+
+void
+lws_compr_cache_capture(struct lws *wsi, const uint8_t *buf, size_t len);
+
+void
+lws_compr_cache_capture_commit(struct lws *wsi);
+
+void
+lws_compr_cache_capture_drop(struct lws *wsi);
+
+void
+lws_compr_cache_destroy(struct lws_vhost *vh);
@@ -54,6 +54,20 @@ lws_http_compression_validate(struct lws *wsi)
 	return 0;
 }
 
+/* the method lws_http_compression_apply() would choose for this client */
+
+struct lws_compression_support *
+lws_http_compression_preferred(struct lws *wsi)
+{
+	size_t n;
+
+	for (n = 0; n < LWS_ARRAY_SIZE(lcs_available); n++)
+		if (wsi->http.comp_accept_mask & (1 << n))
+			return lcs_available[n];
+
+	return NULL;
+}
+
 LWS_VISIBLE int
 lws_http_compression_apply(struct lws *wsi, const char *name,
 			   unsigned char **p, unsigned char *end, char decomp)
@@ -104,6 +118,9 @@ lws_http_compression_apply(struct lws *wsi, const char *name,
 void
 lws_http_compression_destroy(struct lws *wsi)
 {
+	if (wsi->http.comp_capture)
+		lws_compr_cache_capture_drop(wsi);
+
 	if (!wsi->http.lcs || !wsi->http.comp_ctx.u.generic_ctx_ptr)
 		return;
 
@@ -185,8 +202,14 @@ lws_http_compression_transform(struct lws *wsi, unsigned char *buf,
 		return -1;
 	}
 
-	if (!ctx->may_have_more && ctx->final_on_input_side)
+	if (wsi->http.comp_capture && *olen_oused)
+		lws_compr_cache_capture(wsi, *outbuf, *olen_oused);
+
+	if (!ctx->may_have_more && ctx->final_on_input_side) {
 		*wp = LWS_WRITE_HTTP_FINAL | ((*wp) & ~0x1f);
+		if (wsi->http.comp_capture)
+			lws_compr_cache_capture_commit(wsi);
+	}
 
 	lwsl_debug("%s: %p: more %d, ilen_iused %d\n", __func__, wsi,
 		   ctx->may_have_more, (int)ilen_iused);
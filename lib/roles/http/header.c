@@ -452,8 +452,8 @@ lws_return_http_status(struct lws *wsi, unsigned int code,
 		wsi->http.tx_content_length = len;
 		wsi->http.tx_content_remain = len;
 
-		wsi->h2.pending_status_body = lws_malloc(len + LWS_PRE + 1,
-							"pending status body");
+		wsi->h2.pending_status_body = lws_http_txn_malloc(wsi,
+					len + LWS_PRE + 1, "pending status body");
 		if (!wsi->h2.pending_status_body)
 			return -1;
 
@@ -527,3 +527,44 @@ lws_http_compression_apply(struct lws *wsi, const char *name,
 #endif
 
 
+
+#if defined(LWS_WITH_LWSAC)
+
+/* what a typical transaction needs, eg, access log strings and proxy headers */
+#define LWS_HTTP_TXN_AC_CHUNK 2048
+
+void *
+lws_http_transaction_alloc(struct lws *wsi, size_t size)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	uint64_t before = wsi->http.txn_ac ?
+				lwsac_total_alloc(wsi->http.txn_ac) : 0;
+	void *p;
+
+	p = lwsac_use(&wsi->http.txn_ac, size, LWS_HTTP_TXN_AC_CHUNK);
+	if (!p)
+		return NULL;
+
+	lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_C_HTTP_TXN_ALLOCS, 1);
+	if (lwsac_total_alloc(wsi->http.txn_ac) != before)
+		lws_stats_atomic_bump(wsi->context, pt,
+				      LWSSTATS_C_HTTP_TXN_HEAP_ALLOCS, 1);
+
+	return p;
+}
+
+#endif
+
+/*
+ * The transaction is over: drop everything it allocated in one go.  We keep
+ * the first chunk for the next transaction on the connection, it's freed when
+ * the wsi is.
+ */
+
+void
+lws_http_transaction_reset_alloc(struct lws *wsi)
+{
+#if defined(LWS_WITH_LWSAC)
+	lwsac_reset(&wsi->http.txn_ac);
+#endif
+}
@@ -96,17 +96,39 @@ lws_ranges_reset(struct lws_range_parsing *rp);
  * Both client and server mode uses them for http header analysis
  */
 
+/*
+ * A typical request only has a handful of headers, so the ah keeps room for
+ * this many fragments itself, and only moves them to a heap allocation of up
+ * to WSI_TOKEN_COUNT if a request needs more.
+ */
+#define LWS_AH_FRAGS_INLINE 24
+
 struct allocated_headers {
 	struct allocated_headers *next; /* linked list */
 	struct lws *wsi; /* owner */
 	char *data; /* prepared by context init to point to dedicated storage */
 	ah_data_idx_t data_length;
+
+	/* the members used for every character parsed come first */
+
+	uint32_t pos;
+	uint32_t current_token_limit;
+	int16_t lextable_pos;
+	uint8_t /* enum lws_token_indexes */ parser_state;
+	uint8_t nfrag;
+	uint8_t frags_count; /* frags[] we have room for */
+	char /*enum uri_path_states */ ups;
+	char /*enum uri_esc_states */ ues;
+	char esc_stash;
+	char post_literal_equal;
+	uint8_t in_use;
+
 	/*
 	 * the randomly ordered fragments, indexed by frag_index and
-	 * lws_fragments->nfrag for continuation.
+	 * lws_fragments->nfrag for continuation.  Points to frags_inline
+	 * unless the request needed more than that.
 	 */
-	struct lws_fragments frags[WSI_TOKEN_COUNT];
-	time_t assigned;
+	struct lws_fragments *frags;
 	/*
 	 * for each recognized token, frag_index says which frag[] his data
 	 * starts in (0 means the token did not appear)
@@ -114,25 +136,15 @@ struct allocated_headers {
 	 */
 	uint8_t frag_index[WSI_TOKEN_COUNT];
 
-#ifndef LWS_NO_CLIENT
-	char initial_handshake_hash_base64[30];
-#endif
-
-	uint32_t pos;
 	uint32_t http_response;
-	uint32_t current_token_limit;
 	int hdr_token_idx;
+	time_t assigned;
 
-	int16_t lextable_pos;
-
-	uint8_t in_use;
-	uint8_t nfrag;
-	char /*enum uri_path_states */ ups;
-	char /*enum uri_esc_states */ ues;
+#ifndef LWS_NO_CLIENT
+	char initial_handshake_hash_base64[30];
+#endif
 
-	char esc_stash;
-	char post_literal_equal;
-	uint8_t /* enum lws_token_indexes */ parser_state;
+	struct lws_fragments frags_inline[LWS_AH_FRAGS_INLINE];
 };
 
 
@@ -170,8 +182,17 @@ struct lws_pt_role_http {
 #endif
 	int ah_wait_list_length;
 	uint32_t ah_pool_length;
+	uint32_t ah_count_waits;	/* times a wsi joined the wait list */
+	uint32_t ah_count_promotions;	/* times a small ah was grown */
 
 	int ah_count_in_use;
+	int ah_count_large;		/* ah currently grown to the max */
+
+#ifdef LWS_WITH_ACCESS_LOG
+	time_t access_log_flush_s;	/* last time our log lines were sent */
+	time_t access_log_date_s;	/* time access_log_date is for */
+	char access_log_date[32];	/* formatted once a second */
+#endif
 };
 
 struct lws_peer_role_http {
@@ -179,11 +200,49 @@ struct lws_peer_role_http {
 	uint32_t total_ah;
 };
 
+#if defined(LWS_WITH_HTTP_PROXY)
+/*
+ * One of these per distinct host:port:tls that reverse proxy mounts on the
+ * vhost connect to.  Protected by the vhost lock.
+ */
+
+struct lws_proxy_upstream {
+	struct lws_proxy_upstream *next;
+	struct lws_dll_lws idle_head; /* idle connections we can reuse */
+
+	unsigned long hits;	/* transactions that reused an idle conn */
+	unsigned long misses;	/* transactions that made a new conn */
+	unsigned long refused;	/* transactions refused at max_conns */
+
+	unsigned int conns;	/* connections open, busy or idle */
+	unsigned int idle;	/* connections idle in idle_head */
+
+	unsigned short port;
+	char tls;
+
+	/* address string follows */
+};
+#endif
+
 struct lws_vhost_role_http {
 	char http_proxy_address[128];
 	const struct lws_http_mount *mount_list;
 	const char *error_document_404;
 	unsigned int http_proxy_port;
+#if defined(LWS_WITH_HTTP_PROXY)
+	struct lws_proxy_upstream *proxy_upstream_list;
+	unsigned int proxy_pool_max_idle;
+	unsigned int proxy_pool_max_conns;
+	unsigned int proxy_pool_idle_secs;
+#endif
+#if defined(LWS_ROLE_FCGI)
+	struct lws_fcgi_upstream *fcgi_upstream_list;
+	unsigned int fcgi_pool_max_idle;
+	unsigned int fcgi_pool_idle_secs;
+#endif
+#if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
+	struct lws_compr_cache compr_cache;
+#endif
 };
 
 #ifdef LWS_WITH_ACCESS_LOG
@@ -191,9 +250,53 @@ struct lws_access_log {
 	char *header_log;
 	char *user_agent;
 	char *referrer;
+	lws_usec_t us_start;
 	unsigned long sent;
 	int response;
 };
+
+/*
+ * Formatted access log lines are collected in a buffer per vhost per service
+ * thread, under the pt lock since vhost destroy may take it from another
+ * thread.  Full buffers, and partial ones once a second, are taken off the
+ * vhost with their own dup() of the log fd, and handed to the writer after
+ * the lock is dropped.
+ */
+
+#if !defined(LWS_ACCESS_LOG_BUF_SIZE)
+#define LWS_ACCESS_LOG_BUF_SIZE 16384
+#endif
+#if !defined(LWS_ACCESS_LOG_QUEUE_MAX)
+/* bytes waiting for the writer thread before we start dropping lines */
+#define LWS_ACCESS_LOG_QUEUE_MAX (64 * LWS_ACCESS_LOG_BUF_SIZE)
+#endif
+/* the longest line we produce, including json escaping */
+#define LWS_ACCESS_LOG_LINE_MAX 1024
+
+struct lws_access_log_buf {
+	struct lws_access_log_buf *next;
+	int fd; /* our own dup of the vhost log fd once detached */
+	unsigned int len;
+	unsigned int lines;
+
+	/* LWS_ACCESS_LOG_BUF_SIZE of line data follows */
+};
+
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+struct lws_access_log_writer {
+	pthread_t thread;
+	pthread_mutex_t lock; /* protects everything below */
+	pthread_cond_t cond;
+	struct lws_access_log_buf *head;
+	struct lws_access_log_buf *tail;
+	size_t queued;
+	uint64_t dropped;
+	uint64_t dropped_reported;
+
+	unsigned int started:1;
+	unsigned int exiting:1;
+};
+#endif
 #endif
 
 #define LWS_HTTP_CHUNK_HDR_MAX_SIZE (6 + 2) /* 6 hex digits and then CRLF */
@@ -202,11 +305,17 @@ struct lws_access_log {
 struct _lws_http_mode_related {
 	struct lws *new_wsi_list;
 
+#if defined(LWS_WITH_LWSAC)
+	struct lwsac *txn_ac; /* allocations freed when transaction completes */
+#endif
+
 	unsigned char *pending_return_headers;
 	size_t pending_return_headers_len;
 
 #if defined(LWS_WITH_HTTP_PROXY)
 	struct lws_rewrite *rw;
+	struct lws_proxy_upstream *upstream; /* pooled proxy client conn */
+	struct lws_dll_lws dll_proxy_idle; /* on upstream->idle_head */
 #endif
 	struct allocated_headers *ah;
 	struct lws *ah_wait_list;
@@ -226,11 +335,16 @@ struct _lws_http_mode_related {
 #ifdef LWS_WITH_CGI
 	struct lws_cgi *cgi; /* wsi being cgi master have one of these */
 #endif
+#if defined(LWS_ROLE_FCGI)
+	struct lws_fcgi_txn *fcgi_txn; /* answered by an fcgi worker */
+#endif
 #if defined(LWS_WITH_HTTP_STREAM_COMPRESSION)
 	struct lws_compression_support *lcs;
 	lws_comp_ctx_t comp_ctx;
+	struct lws_compr_cache_entry *comp_capture; /* body going in the cache */
 	unsigned char comp_accept_mask;
 #endif
+	const char *sidecar_encoding; /* fop_fd is a precompressed sidecar */
 
 	enum http_version request_version;
 	enum http_conn_type conn_type;
@@ -279,6 +393,24 @@ lws_check_basic_auth(struct lws *wsi, const char *basic_auth_login_file);
 int
 lws_unauthorised_basic_auth(struct lws *wsi);
 
+/*
+ * Internal allocations that only live as long as the http transaction come from
+ * the wsi's transaction lwsac if we have it, so they are freed all together,
+ * and usually from a chunk kept from the last transaction on the connection
+ */
+
+#if defined(LWS_WITH_LWSAC)
+#define lws_http_txn_malloc(_wsi, _size, _reason) \
+		lws_http_transaction_alloc(_wsi, _size)
+#define lws_http_txn_free_set_NULL(_p) (_p) = NULL
+#else
+#define lws_http_txn_malloc(_wsi, _size, _reason) lws_malloc(_size, _reason)
+#define lws_http_txn_free_set_NULL(_p) lws_free_set_NULL(_p)
+#endif
+
+void
+lws_http_transaction_reset_alloc(struct lws *wsi);
+
 int
 lws_read_h1(struct lws *wsi, unsigned char *buf, lws_filepos_t len);
 
@@ -287,3 +419,23 @@ _lws_header_table_reset(struct allocated_headers *ah);
 
 LWS_EXTERN int
 _lws_destroy_ah(struct lws_context_per_thread *pt, struct allocated_headers *ah);
+
+int
+lws_header_table_promote(struct lws *wsi);
+
+int
+_lws_ah_frags_room(struct allocated_headers *ah, unsigned int n);
+
+#if defined(LWS_WITH_HTTP_PROXY)
+struct lws *
+lws_http_proxy_connect(struct lws_client_connect_info *i);
+
+int
+lws_http_proxy_pool_park(struct lws *wsi);
+
+void
+__lws_http_proxy_pool_remove(struct lws *wsi);
+
+void
+lws_http_proxy_pool_destroy(struct lws_vhost *vh);
+#endif
@@ -19,6 +19,7 @@
  *  MA  02110-1301  USA
  */
 
+#define _GNU_SOURCE
 #include "core/private.h"
 
 /*
@@ -29,6 +30,21 @@
  * 200 152987 "https://libwebsockets.org/index.html"
  * "Mozilla/5.0 (Macint... Chrome/49.0.2623.87 Safari/537.36"
  *
+ * or with LWS_ACCESS_LOG_FORMAT_JSON, the same information and the latency
+ * from the request headers being complete to the transaction completing:
+ *
+ * {"peer":"2.31.234.19","time":"27/Mar/2016:03:22:44 +0800",
+ * "method":"GET","uri":"/aep-screen.png","proto":"HTTP/1.1","status":200,
+ * "sent":152987,"latency_us":1843,"referrer":"https://libwebsockets.org/",
+ * "ua":"Mozilla/5.0 (Macint... Chrome/49.0.2623.87 Safari/537.36"}
+ *
+ * Lines are not written as each transaction completes, they're collected in
+ * a buffer per vhost per service thread and written a buffer at a time, when
+ * the buffer fills or at least once a second.  With
+ * LWS_WITH_ACCESS_LOG_THREAD, the buffers are written by a dedicated thread,
+ * so a slow log device doesn't stall the service threads.  If the writer gets
+ * more than LWS_ACCESS_LOG_QUEUE_MAX behind, further buffers are dropped, and
+ * counted, until it catches up.
  */
 
 extern const char * const method_names[];
@@ -40,8 +56,9 @@ static const char * const hver[] = {
 void
 lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int uri_len, int meth)
 {
-	char da[64], uri[256];
-	const char *pa, *me;
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	char uri[256], euri[256], eme[32];
+	const char *pa, *me, *da;
 	time_t t = time(NULL);
 	int l = 256, m;
 #ifdef LWS_WITH_IPV6
@@ -61,15 +78,29 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int uri_len, int met
 	if (wsi->access_log_pending)
 		lws_access_log(wsi);
 
-	wsi->http.access_log.header_log = lws_malloc(l, "access log");
+	if (wsi->vhost->log_format == LWS_ACCESS_LOG_FORMAT_JSON)
+		l = 512;
+
+	wsi->http.access_log.header_log = lws_http_txn_malloc(wsi, l,
+							      "access log");
 	if (!wsi->http.access_log.header_log)
 		return;
 
-	tmp = localtime(&t);
-	if (tmp)
-		strftime(da, sizeof(da), "%d/%b/%Y:%H:%M:%S %z", tmp);
-	else
-		strcpy(da, "01/Jan/1970:00:00:00 +0000");
+	wsi->http.access_log.us_start = lws_now_usecs();
+
+	/* the date only changes once a second, only format it then */
+
+	if (pt->http.access_log_date_s != t) {
+		tmp = localtime(&t);
+		if (!tmp ||
+		    !strftime(pt->http.access_log_date,
+			      sizeof(pt->http.access_log_date),
+			      "%d/%b/%Y:%H:%M:%S %z", tmp))
+			strcpy(pt->http.access_log_date,
+			       "01/Jan/1970:00:00:00 +0000");
+		pt->http.access_log_date_s = t;
+	}
+	da = pt->http.access_log_date;
 
 	pa = lws_get_peer_simple(wsi, ads, sizeof(ads));
 	if (!pa)
@@ -89,19 +120,28 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int uri_len, int met
 	strncpy(uri, uri_ptr, m);
 	uri[m] = '\0';
 
-	lws_snprintf(wsi->http.access_log.header_log, l,
-		     "%s - - [%s] \"%s %s %s\"",
-		     pa, da, me, uri, hver[wsi->http.request_version]);
+	if (wsi->vhost->log_format == LWS_ACCESS_LOG_FORMAT_JSON)
+		lws_snprintf(wsi->http.access_log.header_log, l,
+			     "{\"peer\":\"%s\",\"time\":\"%s\",\"method\":\"%s\","
+			     "\"uri\":\"%s\",\"proto\":\"%s\"",
+			     pa, da, lws_json_purify(eme, me, sizeof(eme)),
+			     lws_json_purify(euri, uri, sizeof(euri)),
+			     hver[wsi->http.request_version]);
+	else
+		lws_snprintf(wsi->http.access_log.header_log, l,
+			     "%s - - [%s] \"%s %s %s\"",
+			     pa, da, me, uri, hver[wsi->http.request_version]);
 
 	//lwsl_notice("%s\n", wsi->http.access_log.header_log);
 
 	l = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_USER_AGENT);
 	if (l) {
 		wsi->http.access_log.user_agent =
-				lws_malloc(l + 5, "access log");
+			lws_http_txn_malloc(wsi, l + 5, "access log");
 		if (!wsi->http.access_log.user_agent) {
 			lwsl_err("OOM getting user agent\n");
-			lws_free_set_NULL(wsi->http.access_log.header_log);
+			lws_http_txn_free_set_NULL(
+					wsi->http.access_log.header_log);
 			return;
 		}
 		wsi->http.access_log.user_agent[0] = '\0';
@@ -114,11 +154,14 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int uri_len, int met
 	}
 	l = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_REFERER);
 	if (l) {
-		wsi->http.access_log.referrer = lws_malloc(l + 5, "referrer");
+		wsi->http.access_log.referrer = lws_http_txn_malloc(wsi, l + 5,
+								 "referrer");
 		if (!wsi->http.access_log.referrer) {
 			lwsl_err("OOM getting referrer\n");
-			lws_free_set_NULL(wsi->http.access_log.user_agent);
-			lws_free_set_NULL(wsi->http.access_log.header_log);
+			lws_http_txn_free_set_NULL(
+					wsi->http.access_log.user_agent);
+			lws_http_txn_free_set_NULL(
+					wsi->http.access_log.header_log);
 			return;
 		}
 		wsi->http.access_log.referrer[0] = '\0';
@@ -133,12 +176,194 @@ lws_prepare_access_log_info(struct lws *wsi, char *uri_ptr, int uri_len, int met
 }
 
 
+static void
+lws_access_log_write(struct lws_access_log_buf *b)
+{
+	const char *p = (const char *)&b[1];
+	unsigned int len = b->len;
+	ssize_t n;
+
+	while (len) {
+		n = write(b->fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			lwsl_err("Failed to write log\n");
+			break;
+		}
+		p += n;
+		len -= (unsigned int)n;
+	}
+
+	close(b->fd);
+	lws_free(b);
+}
+
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+static void *
+lws_access_log_writer(void *d)
+{
+	struct lws_access_log_writer *w = (struct lws_access_log_writer *)d;
+	struct lws_access_log_buf *b;
+
+	pthread_mutex_lock(&w->lock); /* ======================= writer { */
+
+	while (1) {
+		while (!w->head && !w->exiting)
+			pthread_cond_wait(&w->cond, &w->lock);
+
+		b = w->head;
+		if (!b)
+			/* we were asked to exit and there's nothing left */
+			break;
+
+		w->head = b->next;
+		if (!w->head)
+			w->tail = NULL;
+		w->queued -= b->len;
+
+		pthread_mutex_unlock(&w->lock); /* } writer */
+		lws_access_log_write(b);
+		pthread_mutex_lock(&w->lock); /* writer { */
+	}
+
+	pthread_mutex_unlock(&w->lock); /* } writer ==================== */
+
+	return NULL;
+}
+#endif
+
+/*
+ * Pass a buffer of lines on to be written.  The buffer is freed by the time
+ * it has been written, or dropped.
+ */
+
+static void
+lws_access_log_submit(struct lws_context *context, int tsi,
+		      struct lws_access_log_buf *b)
+{
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	struct lws_access_log_writer *w = &context->alog;
+
+	pthread_mutex_lock(&w->lock); /* ======================= writer { */
+
+	if (!w->started && !w->exiting) {
+		if (pthread_create(&w->thread, NULL, lws_access_log_writer, w))
+			lwsl_err("%s: unable to start writer thread\n",
+				 __func__);
+		else {
+			w->started = 1;
+#if defined(LWS_HAS_PTHREAD_SETNAME_NP)
+			pthread_setname_np(w->thread, "lws-access-log");
+#endif
+		}
+	}
+
+	if (w->started) {
+		if (w->queued + b->len > LWS_ACCESS_LOG_QUEUE_MAX) {
+			/*
+			 * The log device can't keep up... lose the lines
+			 * rather than block the service thread or grow
+			 * without limit
+			 */
+			w->dropped += b->lines;
+			pthread_mutex_unlock(&w->lock); /* } writer */
+			lws_stats_atomic_bump(context, &context->pt[tsi],
+					      LWSSTATS_C_ACCESS_LOG_DROPPED,
+					      b->lines);
+			close(b->fd);
+			lws_free(b);
+
+			return;
+		}
+
+		b->next = NULL;
+		if (w->tail)
+			w->tail->next = b;
+		else
+			w->head = b;
+		w->tail = b;
+		w->queued += b->len;
+
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock); /* } writer */
+
+		return;
+	}
+
+	pthread_mutex_unlock(&w->lock); /* } writer ==================== */
+#endif
+
+	/* there's no writer thread, write it ourselves */
+
+	lws_access_log_write(b);
+}
+
+/*
+ * Requires nothing else can add to the pt's buffer meanwhile.  Takes the pt's
+ * buffer off the vhost to be submitted after the lock is dropped.  It gets its
+ * own dup of the log fd, so it can still be written if the vhost closes its fd
+ * meanwhile.
+ */
+
+static struct lws_access_log_buf *
+lws_access_log_detach(struct lws_vhost *vh, int tsi)
+{
+	struct lws_access_log_buf *b = vh->log_buf[tsi];
+
+	if (!b)
+		return NULL;
+
+	vh->log_buf[tsi] = NULL;
+
+	b->fd = dup(vh->log_fd);
+	if (b->fd < 0) {
+		lwsl_err("%s: unable to dup log fd, dropping %u lines\n",
+			 __func__, b->lines);
+		lws_free(b);
+
+		return NULL;
+	}
+
+	return b;
+}
+
+/*
+ * Requires the pt lock for tsi.  Return our pt's buffer for the vhost, if it
+ * has space for another line, otherwise detach it into *full to be sent on
+ * and start a new one
+ */
+
+static struct lws_access_log_buf *
+lws_access_log_buf(struct lws_vhost *vh, int tsi,
+		   struct lws_access_log_buf **full)
+{
+	struct lws_access_log_buf *b = vh->log_buf[tsi];
+
+	if (b && b->len + LWS_ACCESS_LOG_LINE_MAX <= LWS_ACCESS_LOG_BUF_SIZE)
+		return b;
+
+	*full = lws_access_log_detach(vh, tsi);
+
+	b = lws_malloc(sizeof(*b) + LWS_ACCESS_LOG_BUF_SIZE, "access log buf");
+	if (!b)
+		return NULL;
+
+	memset(b, 0, sizeof(*b));
+	b->fd = -1;
+	vh->log_buf[tsi] = b;
+
+	return b;
+}
+
 int
 lws_access_log(struct lws *wsi)
 {
-	char *p = wsi->http.access_log.user_agent, ass[512],
-	     *p1 = wsi->http.access_log.referrer;
-	int l;
+	char *p = wsi->http.access_log.user_agent, *ass,
+	     *p1 = wsi->http.access_log.referrer, eua[224], eref[192];
+	struct lws_access_log_buf *b, *full = NULL;
+	struct lws_context_per_thread *pt;
+	int l, lock;
 
 	if (!wsi->vhost)
 		return 0;
@@ -152,42 +377,220 @@ lws_access_log(struct lws *wsi)
 	if (!wsi->http.access_log.header_log)
 		return 0;
 
+	/*
+	 * vhost destroy may take our pt's buffer from another thread.  Once
+	 * the context is being destroyed the service threads are finished and
+	 * the pt locks are already gone.
+	 */
+
+	pt = &wsi->context->pt[(int)wsi->tsi];
+	lock = !wsi->context->being_destroyed1;
+	if (lock)
+		lws_pt_lock(pt, __func__); /* -------------------------- pt { */
+
+	b = lws_access_log_buf(wsi->vhost, (int)wsi->tsi, &full);
+	if (!b) {
+		lwsl_err("OOM for access log\n");
+		goto unlock;
+	}
+	ass = (char *)&b[1] + b->len;
+
 	if (!p)
 		p = "";
 
 	if (!p1)
 		p1 = "";
 
+	if (wsi->vhost->log_format == LWS_ACCESS_LOG_FORMAT_JSON) {
+		l = lws_snprintf(ass, LWS_ACCESS_LOG_LINE_MAX,
+				 "%s,\"status\":%d,\"sent\":%lu,"
+				 "\"latency_us\":%llu,\"referrer\":\"%s\","
+				 "\"ua\":\"%s\"}\n",
+				 wsi->http.access_log.header_log,
+				 wsi->http.access_log.response,
+				 wsi->http.access_log.sent,
+				 (unsigned long long)(lws_now_usecs() -
+					 wsi->http.access_log.us_start),
+				 lws_json_purify(eref, p1, sizeof(eref)),
+				 lws_json_purify(eua, p, sizeof(eua)));
+		goto done;
+	}
+
 	/*
 	 * We do this in two parts to restrict an oversize referrer such that
 	 * we will always have space left to append an empty useragent, while
 	 * maintaining the structure of the log text
 	 */
-	l = lws_snprintf(ass, sizeof(ass) - 7, "%s %d %lu \"%s",
+	l = lws_snprintf(ass, 512 - 7, "%s %d %lu \"%s",
 			 wsi->http.access_log.header_log,
 			 wsi->http.access_log.response,
 			 wsi->http.access_log.sent, p1);
-	if (strlen(p) > sizeof(ass) - 6 - l)
-		p[sizeof(ass) - 6 - l] = '\0';
-	l += lws_snprintf(ass + l, sizeof(ass) - 1 - l, "\" \"%s\"\n", p);
+	if ((int)strlen(p) > 512 - 6 - l)
+		p[512 - 6 - l] = '\0';
+	l += lws_snprintf(ass + l, 512 - 1 - l, "\" \"%s\"\n", p);
+
+done:
+	b->len += l;
+	b->lines++;
+
+unlock:
+	if (lock)
+		lws_pt_unlock(pt); /* } pt ------------------------------------ */
+
+	/* without the writer thread this write()s, so not under the lock */
+
+	if (full)
+		lws_access_log_submit(wsi->context, (int)wsi->tsi, full);
+
+	if (wsi->http.access_log.header_log)
+		lws_http_txn_free_set_NULL(wsi->http.access_log.header_log);
+	if (wsi->http.access_log.user_agent)
+		lws_http_txn_free_set_NULL(wsi->http.access_log.user_agent);
+	if (wsi->http.access_log.referrer)
+		lws_http_txn_free_set_NULL(wsi->http.access_log.referrer);
+	wsi->access_log_pending = 0;
+
+	return 0;
+}
+
+void
+lws_access_log_init(struct lws_context *context)
+{
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	pthread_mutex_init(&context->alog.lock, NULL);
+	pthread_cond_init(&context->alog.cond, NULL);
+#else
+	(void)context;
+#endif
+}
+
+/*
+ * Called from the service thread for tsi about once a second: send on what
+ * it has collected since last time, so lines don't wait in the buffer
+ * indefinitely when it is quiet
+ */
+
+void
+lws_access_log_service(struct lws_context *context, int tsi, time_t now)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct lws_access_log_buf *b, *list = NULL;
+	struct lws_vhost *vh;
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	uint64_t dropped = 0;
+#endif
+
+	if (pt->http.access_log_flush_s == now)
+		return;
+	pt->http.access_log_flush_s = now;
+
+	/*
+	 * Only we add lines to our pt's buffers, and vhosts are only destroyed
+	 * once they're off the list, so the context lock is enough here.
+	 * Collect them under it, submit them after.
+	 */
 
-	if (write(wsi->vhost->log_fd, ass, l) != l)
-		lwsl_err("Failed to write log\n");
+	lws_context_lock(context, __func__); /* ------------ context { */
 
-	if (wsi->http.access_log.header_log) {
-		lws_free(wsi->http.access_log.header_log);
-		wsi->http.access_log.header_log = NULL;
+	vh = context->vhost_list;
+	while (vh) {
+		b = lws_access_log_detach(vh, tsi);
+		if (b) {
+			b->next = list;
+			list = b;
+		}
+		vh = vh->vhost_next;
 	}
-	if (wsi->http.access_log.user_agent) {
-		lws_free(wsi->http.access_log.user_agent);
-		wsi->http.access_log.user_agent = NULL;
+
+	lws_context_unlock(context); /* } context ------------------- */
+
+	while (list) {
+		b = list;
+		list = b->next;
+		lws_access_log_submit(context, tsi, b);
 	}
-	if (wsi->http.access_log.referrer) {
-		lws_free(wsi->http.access_log.referrer);
-		wsi->http.access_log.referrer = NULL;
+
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	if (tsi)
+		return;
+
+	pthread_mutex_lock(&context->alog.lock); /* ============ writer { */
+	if (context->alog.dropped != context->alog.dropped_reported) {
+		dropped = context->alog.dropped -
+			  context->alog.dropped_reported;
+		context->alog.dropped_reported = context->alog.dropped;
 	}
-	wsi->access_log_pending = 0;
+	pthread_mutex_unlock(&context->alog.lock); /* } writer ========= */
 
-	return 0;
+	if (dropped)
+		lwsl_warn("%s: access log writes behind, dropped %llu lines\n",
+			  __func__, (unsigned long long)dropped);
+#endif
 }
 
+/*
+ * Send on anything the vhost still has buffered, and close its log fd
+ */
+
+void
+lws_access_log_vhost_destroy(struct lws_vhost *vh)
+{
+	struct lws_context_per_thread *pt;
+	struct lws_access_log_buf *b;
+	int n, lock = !vh->context->being_destroyed1;
+
+	if (vh->log_fd == (int)LWS_INVALID_FILE)
+		return;
+
+	/* the other pts' service threads may be adding lines meanwhile */
+
+	for (n = 0; n < vh->context->count_threads; n++) {
+		pt = &vh->context->pt[n];
+		if (lock)
+			lws_pt_lock(pt, __func__); /* ------------------ pt { */
+		b = lws_access_log_detach(vh, n);
+		if (lock)
+			lws_pt_unlock(pt); /* } pt ---------------------------- */
+
+		if (b)
+			lws_access_log_submit(vh->context, n, b);
+	}
+
+	/* anything still to be written has its own dup of the fd */
+
+	close(vh->log_fd);
+	vh->log_fd = (int)LWS_INVALID_FILE;
+}
+
+/* called after all the vhosts are destroyed */
+
+void
+lws_access_log_destroy(struct lws_context *context)
+{
+#if defined(LWS_WITH_ACCESS_LOG_THREAD)
+	struct lws_access_log_writer *w = &context->alog;
+	int started;
+
+	pthread_mutex_lock(&w->lock); /* ======================= writer { */
+	w->exiting = 1;
+	started = w->started;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock); /* } writer ==================== */
+
+	/* he writes everything still queued before exiting */
+
+	if (started)
+		pthread_join(w->thread, NULL);
+	w->started = 0;
+
+	if (w->dropped != w->dropped_reported)
+		lwsl_warn("%s: access log writes behind, dropped %llu lines\n",
+			  __func__, (unsigned long long)(w->dropped -
+							 w->dropped_reported));
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+#else
+	(void)context;
+#endif
+}
@@ -40,6 +40,10 @@ static const char * const paths_global[] = {
 	"global.reject-service-keywords[].*",
 	"global.reject-service-keywords[]",
 	"global.default-alpn",
+	"global.pt-cpus[]",
+	"global.ip-limit-req-rate",
+	"global.ip-limit-byte-rate",
+	"global.profiler-stall-us",
 };
 
 enum lejp_global_paths {
@@ -54,6 +58,10 @@ enum lejp_global_paths {
 	LWJPGP_REJECT_SERVICE_KEYWORDS_NAME,
 	LWJPGP_REJECT_SERVICE_KEYWORDS,
 	LWJPGP_DEFAULT_ALPN,
+	LWJPGP_PT_CPUS,
+	LWJPGP_IP_LIMIT_REQ_RATE,
+	LWJPGP_IP_LIMIT_BYTE_RATE,
+	LWJPGP_PROFILER_STALL_US,
 };
 
 static const char * const paths_vhosts[] = {
@@ -118,6 +126,18 @@ static const char * const paths_vhosts[] = {
 	"vhosts[].allow-non-tls",
 	"vhosts[].redirect-http",
 	"vhosts[].allow-http-on-https",
+	"vhosts[].proxy-pool-max-idle",
+	"vhosts[].proxy-pool-max-conns",
+	"vhosts[].proxy-pool-idle-secs",
+	"vhosts[].listen-accept-budget",
+	"vhosts[].tcp-defer-accept",
+	"vhosts[].fcgi-pool-max-idle",
+	"vhosts[].fcgi-pool-idle-secs",
+	"vhosts[].precompressed",
+	"vhosts[].compressed-cache-max",
+	"vhosts[].limit-req-rate",
+	"vhosts[].limit-byte-rate",
+	"vhosts[].access-log-format",
 };
 
 enum lejp_vhost_paths {
@@ -182,6 +202,18 @@ enum lejp_vhost_paths {
 	LEJPVP_FLAG_ALLOW_NON_TLS,
 	LEJPVP_FLAG_REDIRECT_HTTP,
 	LEJPVP_FLAG_ALLOW_HTTP_ON_HTTPS,
+	LEJPVP_PROXY_POOL_MAX_IDLE,
+	LEJPVP_PROXY_POOL_MAX_CONNS,
+	LEJPVP_PROXY_POOL_IDLE_SECS,
+	LEJPVP_LISTEN_ACCEPT_BUDGET,
+	LEJPVP_TCP_DEFER_ACCEPT,
+	LEJPVP_FCGI_POOL_MAX_IDLE,
+	LEJPVP_FCGI_POOL_IDLE_SECS,
+	LEJPVP_FLAG_PRECOMPRESSED,
+	LEJPVP_COMPRESSED_CACHE_MAX,
+	LEJPVP_LIMIT_REQ_RATE,
+	LEJPVP_LIMIT_BYTE_RATE,
+	LEJPVP_ACCESS_LOG_FORMAT,
 };
 
 static const char * const parser_errs[] = {
@@ -275,7 +307,7 @@ lejp_globals_cb(struct lejp_ctx *ctx, char reason)
 {
 	struct jpargs *a = (struct jpargs *)ctx->user;
 	struct lws_protocol_vhost_options *rej;
-	int n;
+	int n, *cpus;
 
 	/* we only match on the prepared path strings */
 	if (!(reason & LEJP_FLAG_CB_IS_VALUE) || !ctx->path_match)
@@ -336,6 +368,33 @@ lejp_globals_cb(struct lejp_ctx *ctx, char reason)
 		a->info->alpn = a->p;
 		break;
 
+	case LWJPGP_PT_CPUS:
+		n = ctx->i[ctx->ipos - 1];
+		if (!n) {
+			/* first one... make space for all of them */
+			cpus = lwsws_align(a);
+			a->p += sizeof(*cpus) * LWS_MAX_SMP;
+			for (n = 0; n < LWS_MAX_SMP; n++)
+				cpus[n] = -1;
+			a->info->pt_cpus = cpus;
+			n = 0;
+		}
+		if (n < LWS_MAX_SMP)
+			((int *)a->info->pt_cpus)[n] = atoi(ctx->buf);
+		return 0;
+
+	case LWJPGP_IP_LIMIT_REQ_RATE:
+		a->info->ip_limit_req_rate = atoi(ctx->buf);
+		return 0;
+
+	case LWJPGP_IP_LIMIT_BYTE_RATE:
+		a->info->ip_limit_byte_rate = atoi(ctx->buf);
+		return 0;
+
+	case LWJPGP_PROFILER_STALL_US:
+		a->info->prof_stall_us = atoi(ctx->buf);
+		return 0;
+
 	default:
 		return 0;
 	}
@@ -537,6 +596,7 @@ lejp_vhosts_cb(struct lejp_ctx *ctx, char reason)
 			">http://",
 			">https://",
 			"callback://",
+			"fcgi://",
 			"gzip://",
 		};
 
@@ -835,6 +895,51 @@ lejp_vhosts_cb(struct lejp_ctx *ctx, char reason)
 			       LWS_SERVER_OPTION_ALLOW_HTTP_ON_HTTPS_LISTENER);
 		return 0;
 
+	case LEJPVP_PROXY_POOL_MAX_IDLE:
+		a->info->proxy_pool_max_idle = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_PROXY_POOL_MAX_CONNS:
+		a->info->proxy_pool_max_conns = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_PROXY_POOL_IDLE_SECS:
+		a->info->proxy_pool_idle_secs = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_LISTEN_ACCEPT_BUDGET:
+		a->info->listen_accept_budget = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_TCP_DEFER_ACCEPT:
+		a->info->tcp_defer_accept = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_FCGI_POOL_MAX_IDLE:
+		a->info->fcgi_pool_max_idle = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_FCGI_POOL_IDLE_SECS:
+		a->info->fcgi_pool_idle_secs = atoi(ctx->buf);
+		return 0;
+	case LEJPVP_FLAG_PRECOMPRESSED:
+		set_reset_flag(&a->info->options, ctx->buf,
+			       LWS_SERVER_OPTION_HTTP_PRECOMPRESSED);
+		return 0;
+	case LEJPVP_COMPRESSED_CACHE_MAX:
+		a->info->compressed_cache_max = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_LIMIT_REQ_RATE:
+		a->info->vh_limit_req_rate = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_LIMIT_BYTE_RATE:
+		a->info->vh_limit_byte_rate = atoi(ctx->buf);
+		return 0;
+
+	case LEJPVP_ACCESS_LOG_FORMAT:
+		if (!strcmp(ctx->buf, "json"))
+			a->info->access_log_format = LWS_ACCESS_LOG_FORMAT_JSON;
+		else
+			a->info->access_log_format =
+					LWS_ACCESS_LOG_FORMAT_COMBINED;
+		return 0;
+
 	default:
 		return 0;
 	}
@@ -58,6 +58,8 @@ struct lws_urldecode_stateful {
 	char content_disp[32];
 	char content_disp_filename[256];
 	char mime_boundary[128];
+	uint8_t mb_skip[256];
+	int mb_len;
 	int out_len;
 	int pos;
 	int hdr_idx;
@@ -68,6 +70,7 @@ struct lws_urldecode_stateful {
 	unsigned int inside_quote:1;
 	unsigned int subname:1;
 	unsigned int boundary_real_crlf:1;
+	unsigned int part_output:1;
 
 	enum urldecode_stateful state;
 
@@ -81,7 +84,7 @@ lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 	struct lws_urldecode_stateful *s = lws_zalloc(sizeof(*s),
 						"stateful urldecode");
 	char buf[205], *p;
-	int m = 0;
+	int m = 0, n;
 
 	if (!s)
 		return NULL;
@@ -118,6 +121,17 @@ lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 					s->mime_boundary[m++] = *p++;
 
 				s->mime_boundary[m] = '\0';
+				s->mb_len = m;
+
+				/*
+				 * Horspool skip table, for how far we can move
+				 * on when the last byte under the boundary is
+				 * a particular value
+				 */
+				memset(s->mb_skip, m, sizeof(s->mb_skip));
+				for (n = 0; n < m - 1; n++)
+					s->mb_skip[(uint8_t)s->mime_boundary[n]] =
+								(uint8_t)(m - 1 - n);
 
 				lwsl_info("boundary '%s'\n", s->mime_boundary);
 			}
@@ -127,19 +141,80 @@ lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 	return s;
 }
 
+/*
+ * Returns how many bytes at in are content that can't be part of the mime
+ * boundary: either the offset of the first whole boundary, or if there
+ * isn't one, everything except the last bytes that might be the start of a
+ * boundary we didn't see the rest of yet.
+ */
+
+static int
+lws_urldecode_s_content_span(struct lws_urldecode_stateful *s,
+			     const uint8_t *in, int len)
+{
+	const uint8_t *b = (const uint8_t *)s->mime_boundary;
+	int n = 0, l = s->mb_len;
+
+	while (n + l <= len) {
+		if (in[n + l - 1] == b[l - 1] && !memcmp(in + n, b, l - 1))
+			return n;
+		n += s->mb_skip[in[n + l - 1]];
+	}
+
+	return len - l + 1 > 0 ? len - l + 1 : 0;
+}
+
+/*
+ * Deal with a span of multipart content in one go.  File content is passed
+ * to the callback from where it is in the input, other content is copied to
+ * the output buffer, as much as there is room for.  Returns how much was
+ * used, or -1 for fatal error.
+ */
+
+static int
+lws_urldecode_s_content(struct lws_urldecode_stateful *s, const char *in,
+			int len)
+{
+	char *p = (char *)in;
+	int room;
+
+	if (s->content_disp_filename[0]) {
+		if (s->pos && s->output(s->data, s->name, &s->out, s->pos, 0))
+			return -1;
+		s->pos = 0;
+
+		if (s->output(s->data, s->name, &p, len, 0))
+			return -1;
+		s->part_output = 1;
+
+		return len;
+	}
+
+	room = s->out_len - s->pos - 1;
+	if (len > room)
+		len = room;
+	if (len <= 0)
+		return 0;
+
+	memcpy(s->out + s->pos, in, len);
+	s->pos += len;
+
+	return len;
+}
+
 static int
 lws_urldecode_s_process(struct lws_urldecode_stateful *s, const char *in,
 			int len)
 {
 	int n, m, hit = 0;
-	char c, was_end = 0;
+	char c;
 
 	while (len--) {
 		if (s->pos == s->out_len - s->mp - 1) {
 			if (s->output(s->data, s->name, &s->out, s->pos, 0))
 				return -1;
 
-			was_end = s->pos;
+			s->part_output = 1;
 			s->pos = 0;
 		}
 		switch (s->state) {
@@ -218,6 +293,20 @@ lws_urldecode_s_process(struct lws_urldecode_stateful *s, const char *in,
 		/* states for multipart / mime style */
 
 		case MT_LOOK_BOUND_IN:
+			if (!s->mp && s->mb_len) {
+				/* take the content up to any boundary at once */
+				m = lws_urldecode_s_content_span(s,
+						(const uint8_t *)in, len + 1);
+				if (m)
+					m = lws_urldecode_s_content(s, in, m);
+				if (m < 0)
+					return -1;
+				if (m) {
+					in += m;
+					len -= m - 1;
+					continue;
+				}
+			}
 retry_as_first:
 			if (*in == s->mime_boundary[s->mp] &&
 			    s->mime_boundary[s->mp]) {
@@ -227,12 +316,13 @@ retry_as_first:
 					s->mp = 0;
 					s->state = MT_IGNORE1;
 
-					if (s->pos || was_end)
+					if (s->pos || s->part_output)
 						if (s->output(s->data, s->name,
 						      &s->out, s->pos, 1))
 							return -1;
 
 					s->pos = 0;
+					s->part_output = 0;
 
 					s->content_disp[0] = '\0';
 					s->name[0] = '\0';
@@ -422,6 +512,9 @@ struct lws_spa {
 	const char * const *param_names;
 	void *opt_data;
 	lws_spa_fileupload_cb opt_cb;
+	char *upload_dir;
+	lws_fop_fd_t fop_fd;
+	char upload_path[384]; /* of the file fop_fd is writing */
 	int *param_length;
 	int count_params;
 	int max_storage;
@@ -444,6 +537,109 @@ lws_urldecode_spa_lookup(struct lws_spa *spa,
 	return -1;
 }
 
+/* the client's filename for the part, without any path elements */
+
+static const char *
+lws_spa_upload_filename(struct lws_spa *spa)
+{
+	const char *fn = spa->s->content_disp_filename, *p;
+
+	for (p = fn; *p; p++)
+		if (*p == '/' || *p == '\\')
+			fn = p + 1;
+
+	return fn;
+}
+
+/*
+ * Close and delete an upload file we didn't finish writing.  Since the files
+ * are created exclusively, leaving it there would make any retry of the
+ * upload fail.
+ */
+
+static void
+lws_spa_upload_abandon(struct lws_spa *spa)
+{
+	if (!spa->fop_fd)
+		return;
+
+	lws_vfs_file_close(&spa->fop_fd);
+
+	lwsl_notice("%s: removing incomplete %s\n", __func__,
+		    spa->upload_path);
+	if (unlink(spa->upload_path))
+		lwsl_err("%s: unable to remove %s (errno %d)\n", __func__,
+			 spa->upload_path, errno);
+}
+
+static int
+lws_spa_upload_file(struct lws_spa *spa, const char *name, char *buf,
+		    int len, int state)
+{
+	lws_fop_flags_t flags = LWS_O_CREAT | LWS_O_EXCL | LWS_O_WRONLY;
+	const char *fn = lws_spa_upload_filename(spa);
+	lws_filepos_t amount;
+
+	if (state == LWS_UFS_OPEN) {
+		if (!*fn || *fn == '.') {
+			lwsl_notice("%s: refusing filename '%s'\n", __func__,
+				    spa->s->content_disp_filename);
+			return -1;
+		}
+
+		/* the user callback can still veto it */
+
+		if (spa->opt_cb && spa->opt_cb(spa->opt_data, name, fn, NULL, 0,
+					       LWS_UFS_OPEN))
+			return -1;
+
+		/*
+		 * Never replace, or write through, something that's already
+		 * there... a client reusing a filename fails the upload
+		 */
+
+		if (lws_snprintf(spa->upload_path, sizeof(spa->upload_path),
+				 "%s/%s", spa->upload_dir, fn) >=
+					 (int)sizeof(spa->upload_path)) {
+			lwsl_notice("%s: path too long for '%s'\n", __func__,
+				    fn);
+			return -1;
+		}
+
+		spa->fop_fd = lws_vfs_file_open(spa->s->wsi->context->fops,
+						spa->upload_path, &flags);
+		if (!spa->fop_fd) {
+			lwsl_notice("%s: unable to create %s (errno %d)\n",
+				    __func__, spa->upload_path, errno);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (!spa->fop_fd)
+		return -1;
+
+	if (len && (lws_vfs_file_write(spa->fop_fd, &amount, (uint8_t *)buf,
+				       len) < 0 || amount != (lws_filepos_t)len)) {
+		lwsl_notice("%s: write to %s failed\n", __func__, fn);
+		lws_spa_upload_abandon(spa);
+
+		return -1;
+	}
+
+	if (state == LWS_UFS_CONTENT)
+		return 0;
+
+	lws_vfs_file_close(&spa->fop_fd);
+
+	if (spa->opt_cb && spa->opt_cb(spa->opt_data, name, fn, NULL, 0,
+				       LWS_UFS_FINAL_CONTENT))
+		return -1;
+
+	return 0;
+}
+
 static int
 lws_urldecode_spa_cb(void *data, const char *name, char **buf, int len,
 		     int final)
@@ -453,6 +649,9 @@ lws_urldecode_spa_cb(void *data, const char *name, char **buf, int len,
 	int n;
 
 	if (spa->s->content_disp_filename[0]) {
+		if (spa->upload_dir)
+			return lws_spa_upload_file(spa, name, *buf, len, final);
+
 		if (spa->opt_cb) {
 			n = spa->opt_cb(spa->opt_data, name,
 					spa->s->content_disp_filename,
@@ -538,6 +737,21 @@ bail2:
 	return NULL;
 }
 
+LWS_VISIBLE LWS_EXTERN int
+lws_spa_set_upload_dir(struct lws_spa *spa, const char *dir)
+{
+	size_t n = strlen(dir) + 1;
+
+	lws_free_set_NULL(spa->upload_dir);
+	spa->upload_dir = lws_malloc(n, "spa upload dir");
+	if (!spa->upload_dir)
+		return -1;
+
+	memcpy(spa->upload_dir, dir, n);
+
+	return 0;
+}
+
 LWS_VISIBLE LWS_EXTERN int
 lws_spa_process(struct lws_spa *ludspa, const char *in, int len)
 {
@@ -581,6 +795,9 @@ lws_spa_finalize(struct lws_spa *spa)
 		spa->s = NULL;
 	}
 
+	/* the body ended in the middle of an upload file */
+	lws_spa_upload_abandon(spa);
+
 	spa->finalized = 1;
 
 	return 0;
@@ -599,6 +816,10 @@ lws_spa_destroy(struct lws_spa *spa)
 	lwsl_debug("%s %p %p %p %p\n", __func__, spa->param_length,
 		   spa->params, spa->storage, spa);
 
+	/* an upload that didn't complete mustn't be left looking like it did */
+	lws_spa_upload_abandon(spa);
+
+	lws_free(spa->upload_dir);
 	lws_free(spa->param_length);
 	lws_free(spa->params);
 	lws_free(spa->storage);
@@ -44,6 +44,8 @@ _lws_create_ah(struct lws_context_per_thread *pt, ah_data_idx_t data_size)
 	ah->next = pt->http.ah_list;
 	pt->http.ah_list = ah;
 	ah->data_length = data_size;
+	ah->frags = ah->frags_inline;
+	ah->frags_count = LWS_AH_FRAGS_INLINE;
 	pt->http.ah_pool_length++;
 
 	lwsl_info("%s: created ah %p (size %d): pool length %d\n", __func__,
@@ -59,10 +61,15 @@ _lws_destroy_ah(struct lws_context_per_thread *pt, struct allocated_headers *ah)
 		if ((*a) == ah) {
 			*a = ah->next;
 			pt->http.ah_pool_length--;
+			if ((int)ah->data_length >
+				    pt->context->max_http_header_data_small)
+				pt->http.ah_count_large--;
 			lwsl_info("%s: freed ah %p : pool length %d\n",
 				    __func__, ah, pt->http.ah_pool_length);
 			if (ah->data)
 				lws_free(ah->data);
+			if (ah->frags != ah->frags_inline)
+				lws_free(ah->frags);
 			lws_free(ah);
 
 			return 0;
@@ -72,12 +79,105 @@ _lws_destroy_ah(struct lws_context_per_thread *pt, struct allocated_headers *ah)
 	return 1;
 }
 
+/*
+ * An ah starts out with the small size class of header data, if there is one.
+ * When the headers being parsed don't fit in that, it's grown to the large
+ * size class of max_http_header_data, and stays that way until it's reset.
+ *
+ * Returns 0 if the ah was grown, or nonzero if it is already the large size
+ * or we couldn't grow it.
+ */
+
+int
+lws_header_table_promote(struct lws *wsi)
+{
+	struct lws_context *context = wsi->context;
+	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
+	struct allocated_headers *ah = wsi->http.ah;
+	char *p;
+
+	if ((int)ah->data_length >= context->max_http_header_data)
+		return 1;
+
+	p = lws_realloc(ah->data, context->max_http_header_data, "ah data");
+	if (!p) {
+		lwsl_err("%s: OOM growing ah\n", __func__);
+
+		return 1;
+	}
+
+	ah->data = p;
+	ah->data_length = context->max_http_header_data;
+
+	lws_pt_lock(pt, __func__);
+	pt->http.ah_count_large++;
+	pt->http.ah_count_promotions++;
+	lws_pt_unlock(pt);
+
+	lws_stats_atomic_bump(context, pt, LWSSTATS_C_AH_PROMOTIONS, 1);
+
+	lwsl_info("%s: wsi %p: ah %p grown to %d\n", __func__, wsi, ah,
+		  context->max_http_header_data);
+
+	return 0;
+}
+
+/*
+ * Make sure frags[n] exists, moving the fragments from the ah to a bigger heap
+ * allocation if needed.  Returns nonzero if n is more fragments than we will
+ * deal with, or we couldn't get the memory.
+ */
+
+int
+_lws_ah_frags_room(struct allocated_headers *ah, unsigned int n)
+{
+	struct lws_fragments *f;
+	unsigned int count;
+
+	if (n < ah->frags_count)
+		return 0;
+
+	if (n >= WSI_TOKEN_COUNT)
+		return 1;
+
+	count = ah->frags_count * 2;
+	if (count > WSI_TOKEN_COUNT)
+		count = WSI_TOKEN_COUNT;
+
+	if (ah->frags == ah->frags_inline) {
+		f = lws_malloc(sizeof(*f) * count, "ah frags");
+		if (f)
+			memcpy(f, ah->frags_inline, sizeof(ah->frags_inline));
+	} else
+		f = lws_realloc(ah->frags, sizeof(*f) * count, "ah frags");
+	if (!f)
+		return 1;
+
+	memset(f + ah->frags_count, 0, sizeof(*f) * (count - ah->frags_count));
+	ah->frags = f;
+	ah->frags_count = (uint8_t)count;
+
+	return 0;
+}
+
 void
 _lws_header_table_reset(struct allocated_headers *ah)
 {
+	unsigned int n = ah->nfrag + 1u;
+
 	/* init the ah to reflect no headers or data have appeared yet */
 	memset(ah->frag_index, 0, sizeof(ah->frag_index));
-	memset(ah->frags, 0, sizeof(ah->frags));
+
+	/* only the fragments we used need clearing */
+	if (ah->frags != ah->frags_inline) {
+		lws_free(ah->frags);
+		ah->frags = ah->frags_inline;
+		ah->frags_count = LWS_AH_FRAGS_INLINE;
+		n = LWS_AH_FRAGS_INLINE;
+	}
+	if (n > ah->frags_count)
+		n = ah->frags_count;
+	memset(ah->frags, 0, sizeof(*ah->frags) * n);
 	ah->nfrag = 0;
 	ah->pos = 0;
 	ah->http_response = 0;
@@ -90,8 +190,8 @@ _lws_header_table_reset(struct allocated_headers *ah)
 void
 __lws_header_table_reset(struct lws *wsi, int autoservice)
 {
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
 	struct allocated_headers *ah = wsi->http.ah;
-	struct lws_context_per_thread *pt;
 	struct lws_pollfd *pfd;
 
 	/* if we have the idea we're resetting 'our' ah, must be bound to one */
@@ -101,6 +201,20 @@ __lws_header_table_reset(struct lws *wsi, int autoservice)
 
 	_lws_header_table_reset(ah);
 
+	/* a grown ah goes back to the small size class for the next headers */
+
+	if ((int)ah->data_length > wsi->context->max_http_header_data_small) {
+		char *p = lws_realloc(ah->data,
+				wsi->context->max_http_header_data_small,
+				"ah data");
+		if (p) {
+			ah->data = p;
+			ah->data_length =
+				wsi->context->max_http_header_data_small;
+			pt->http.ah_count_large--;
+		}
+	}
+
 	/* since we will restart the ah, our new headers are not completed */
 	wsi->hdr_parsing_completed = 0;
 
@@ -115,7 +229,6 @@ __lws_header_table_reset(struct lws *wsi, int autoservice)
 	    autoservice) {
 		lwsl_debug("%s: service on readbuf ah\n", __func__);
 
-		pt = &wsi->context->pt[(int)wsi->tsi];
 		/*
 		 * Unlike a normal connect, we have the headers already
 		 * (or the first part of them anyway)
@@ -156,6 +269,8 @@ _lws_header_ensure_we_are_on_waiting_list(struct lws *wsi)
 	wsi->http.ah_wait_list = pt->http.ah_wait_list;
 	pt->http.ah_wait_list = wsi;
 	pt->http.ah_wait_list_length++;
+	pt->http.ah_count_waits++;
+	lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_C_AH_POOL_WAITS, 1);
 
 	/* we cannot accept input then */
 
@@ -235,7 +350,7 @@ lws_header_table_attach(struct lws *wsi, int autoservice)
 
 	__lws_remove_from_ah_waiting_list(wsi);
 
-	wsi->http.ah = _lws_create_ah(pt, context->max_http_header_data);
+	wsi->http.ah = _lws_create_ah(pt, context->max_http_header_data_small);
 	if (!wsi->http.ah) { /* we could not create an ah */
 		_lws_header_ensure_we_are_on_waiting_list(wsi);
 
@@ -248,10 +363,7 @@ lws_header_table_attach(struct lws *wsi, int autoservice)
 
 #if defined(LWS_WITH_PEER_LIMITS) && (defined(LWS_ROLE_H1) || \
     defined(LWS_ROLE_H2))
-	lws_context_lock(context, "ah attach"); /* <========================= */
-	if (wsi->peer)
-		wsi->peer->http.count_ah++;
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_track_ah_attach(context, wsi->peer);
 #endif
 
 	_lws_change_pollfd(wsi, 0, LWS_POLLIN, &pa);
@@ -369,10 +481,7 @@ int __lws_header_table_detach(struct lws *wsi, int autoservice)
 	__lws_header_table_reset(wsi, autoservice);
 #if defined(LWS_WITH_PEER_LIMITS) && (defined(LWS_ROLE_H1) || \
     defined(LWS_ROLE_H2))
-	lws_context_lock(context, "ah detach"); /* <========================= */
-	if (wsi->peer)
-		wsi->peer->http.count_ah++;
-	lws_context_unlock(context); /* ====================================> */
+	lws_peer_track_ah_attach(context, wsi->peer);
 #endif
 
 	/* clients acquire the ah and then insert themselves in fds table... */
@@ -571,11 +680,13 @@ lws_pos_in_bounds(struct lws *wsi)
 	if (!wsi->http.ah)
 		return -1;
 
-	if (wsi->http.ah->pos <
-	    (unsigned int)wsi->context->max_http_header_data)
+	if (wsi->http.ah->pos < wsi->http.ah->data_length)
 		return 0;
 
-	if ((int)wsi->http.ah->pos == wsi->context->max_http_header_data) {
+	if (wsi->http.ah->pos == wsi->http.ah->data_length) {
+		if (!lws_header_table_promote(wsi))
+			return 0;
+
 		lwsl_err("Ran out of header data space\n");
 		return 1;
 	}
@@ -585,7 +696,7 @@ lws_pos_in_bounds(struct lws *wsi)
 	 * the limit, only meet it
 	 */
 	lwsl_err("%s: pos %d, limit %d\n", __func__, wsi->http.ah->pos,
-		 wsi->context->max_http_header_data);
+		 (int)wsi->http.ah->data_length);
 	assert(0);
 
 	return 1;
@@ -595,7 +706,7 @@ int LWS_WARN_UNUSED_RESULT
 lws_hdr_simple_create(struct lws *wsi, enum lws_token_indexes h, const char *s)
 {
 	wsi->http.ah->nfrag++;
-	if (wsi->http.ah->nfrag == LWS_ARRAY_SIZE(wsi->http.ah->frags)) {
+	if (_lws_ah_frags_room(wsi->http.ah, wsi->http.ah->nfrag)) {
 		lwsl_warn("More hdr frags than we can deal with, dropping\n");
 		return -1;
 	}
@@ -715,7 +826,7 @@ lws_parse_urldecode(struct lws *wsi, uint8_t *_c)
 			/* link to next fragment */
 			ah->frags[ah->nfrag].nfrag = ah->nfrag + 1;
 			ah->nfrag++;
-			if (ah->nfrag >= LWS_ARRAY_SIZE(ah->frags))
+			if (_lws_ah_frags_room(ah, ah->nfrag))
 				goto excessive;
 			/* start next fragment after the & */
 			ah->post_literal_equal = 0;
@@ -818,7 +929,7 @@ lws_parse_urldecode(struct lws *wsi, uint8_t *_c)
 
 		/* move to using WSI_TOKEN_HTTP_URI_ARGS */
 		ah->nfrag++;
-		if (ah->nfrag >= LWS_ARRAY_SIZE(ah->frags))
+		if (_lws_ah_frags_room(ah, ah->nfrag))
 			goto excessive;
 		ah->frags[ah->nfrag].offset = ++ah->pos;
 		ah->frags[ah->nfrag].len = 0;
@@ -1099,7 +1210,7 @@ nope:
 start_fragment:
 			ah->nfrag++;
 excessive:
-			if (ah->nfrag == LWS_ARRAY_SIZE(ah->frags)) {
+			if (_lws_ah_frags_room(ah, ah->nfrag)) {
 				lwsl_warn("More hdr frags than we can deal with\n");
 				return LPR_FAIL;
 			}
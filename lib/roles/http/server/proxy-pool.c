@@ -0,0 +1,291 @@
+/*
+ * libwebsockets - http reverse proxy upstream connection pool
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ *
+ * Reverse proxy mounts make a client connection to the upstream server for
+ * each proxied transaction.  Rather than close it when the transaction
+ * completes, if the upstream server allows keepalive the connection is
+ * detached from the server wsi it was proxying for and parked idle on the
+ * vhost, in a list for its host:port:tls.  The next proxied transaction to the
+ * same upstream on the same service thread takes it and sends its request on
+ * it, skipping the tcp and any tls handshake.
+ */
+
+#include "core/private.h"
+
+/* call with the vhost lock held */
+
+static struct lws_proxy_upstream *
+__lws_http_proxy_upstream(struct lws_vhost *vh, const char *address, int port,
+			  int tls)
+{
+	struct lws_proxy_upstream *up;
+	size_t len = strlen(address);
+
+	lws_start_foreach_ll(struct lws_proxy_upstream *, u,
+			     vh->http.proxy_upstream_list) {
+		if (u->port == port && u->tls == tls &&
+		    !strcmp((const char *)(u + 1), address))
+			return u;
+	} lws_end_foreach_ll(u, next);
+
+	up = lws_zalloc(sizeof(*up) + len + 1, "proxy upstream");
+	if (!up)
+		return NULL;
+
+	up->port = port;
+	up->tls = tls;
+	memcpy(up + 1, address, len + 1);
+
+	up->next = vh->http.proxy_upstream_list;
+	vh->http.proxy_upstream_list = up;
+
+	return up;
+}
+
+/*
+ * Prepare an idle pooled connection to issue the request described by i, as a
+ * child of i->parent_wsi, just like a fresh one from lws_client_connect_via_info()
+ *
+ * Returns 0 if it's ready to go, 1 if there's no ah free for it right now, or
+ * -1 if it can't be used.
+ */
+
+static int
+lws_http_proxy_rearm(struct lws *w, struct lws_client_connect_info *i)
+{
+	struct lws *parent = i->parent_wsi;
+
+	/* idle conns don't hold an ah, we need one again to issue the request */
+
+	if (lws_header_table_attach(w, 0)) {
+		/*
+		 * Don't leave the idle conn queued for one, a fresh connection
+		 * can wait for an ah the usual way
+		 */
+		lws_header_table_detach(w, 0);
+
+		return 1;
+	}
+
+	w->http.ah->ues = URIES_IDLE;
+
+	if (lws_hdr_simple_create(w, _WSI_TOKEN_CLIENT_PEER_ADDRESS,
+				  i->address) ||
+	    lws_hdr_simple_create(w, _WSI_TOKEN_CLIENT_URI, i->path) ||
+	    lws_hdr_simple_create(w, _WSI_TOKEN_CLIENT_HOST, i->host) ||
+	    lws_hdr_simple_create(w, _WSI_TOKEN_CLIENT_METHOD, i->method))
+		return -1;
+
+	w->parent = parent;
+	w->sibling_list = parent->child_list;
+	parent->child_list = w;
+
+	w->redirects = 0;
+	w->hdr_parsing_completed = 0;
+	w->http.proxy_parent_chunked = 0;
+
+	/* we are already connected, so we go straight to sending headers */
+
+	lwsi_set_state(w, LRS_H1C_ISSUE_HANDSHAKE2);
+	lws_set_timeout(w, PENDING_TIMEOUT_AWAITING_CLIENT_HS_SEND,
+			w->context->timeout_secs);
+	lws_callback_on_writable(w);
+
+	if (i->pwsi)
+		*i->pwsi = w;
+
+	return 0;
+}
+
+struct lws *
+lws_http_proxy_connect(struct lws_client_connect_info *i)
+{
+	struct lws *parent = i->parent_wsi, *w = NULL;
+	struct lws_vhost *vh = parent->vhost;
+	struct lws_proxy_upstream *up;
+	int tls = !!(i->ssl_connection & LCCSCF_USE_SSL), n;
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+
+	up = __lws_http_proxy_upstream(vh, i->address, i->port, tls);
+	if (!up) {
+		lws_vhost_unlock(vh); /* } vh ---------------------------- */
+
+		return NULL;
+	}
+
+	/* is there an idle connection we can use from this service thread? */
+
+	lws_start_foreach_dll(struct lws_dll_lws *, d, up->idle_head.next) {
+		struct lws *c = lws_container_of(d, struct lws,
+						 http.dll_proxy_idle);
+		if (c->tsi == parent->tsi) {
+			w = c;
+			break;
+		}
+	} lws_end_foreach_dll(d);
+
+	if (w) {
+		lws_dll_lws_remove(&w->http.dll_proxy_idle);
+		up->idle--;
+		up->hits++;
+	}
+
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	if (w) {
+		lwsl_info("%s: reusing %p to %s:%d\n", __func__, w,
+			  i->address, i->port);
+		n = lws_http_proxy_rearm(w, i);
+		if (!n)
+			return w;
+
+		if (n < 0) {
+			/* we can't use it after all... closing it takes it out
+			 * of the upstream accounting */
+			lws_close_free_wsi(w, LWS_CLOSE_STATUS_NOSTATUS,
+					   "proxy rearm");
+
+			return NULL;
+		}
+
+		/* no ah for it now... put it back and make a new connection */
+
+		lws_vhost_lock(vh); /* -------------------------------- vh { */
+		lws_dll_lws_add_front(&w->http.dll_proxy_idle, &up->idle_head);
+		up->idle++;
+		up->hits--;
+		lws_vhost_unlock(vh); /* } vh ------------------------------ */
+	}
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+
+	if (vh->http.proxy_pool_max_conns &&
+	    up->conns >= vh->http.proxy_pool_max_conns) {
+		up->refused++;
+		lws_vhost_unlock(vh); /* } vh ---------------------------- */
+		lwsl_notice("%s: %s:%d at limit of %d conns\n", __func__,
+			    i->address, i->port, vh->http.proxy_pool_max_conns);
+
+		return NULL;
+	}
+
+	/* reserve our place in the limit while we connect */
+	up->conns++;
+	up->misses++;
+
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	/* we want to keep it afterwards, so don't let it ask for close */
+	i->ssl_connection |= LCCSCF_KEEPALIVE;
+
+	w = lws_client_connect_via_info(i);
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+	if (w)
+		w->http.upstream = up;
+	else
+		up->conns--;
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	return w;
+}
+
+int
+lws_http_proxy_pool_park(struct lws *wsi)
+{
+	struct lws_proxy_upstream *up = wsi->http.upstream;
+	struct lws_vhost *vh = wsi->vhost;
+
+	/* the server will close it, or we can't tell where the next one is */
+
+	if (wsi->http.conn_type != HTTP_CONNECTION_KEEP_ALIVE ||
+	    wsi->client_h2_alpn || wsi->socket_is_permanently_unusable)
+		return 1;
+
+	lws_vhost_lock(vh); /* ---------------------------------------- vh { */
+
+	if (up->idle >= vh->http.proxy_pool_max_idle) {
+		lws_vhost_unlock(vh); /* } vh ---------------------------- */
+
+		return 1;
+	}
+
+	lws_dll_lws_add_front(&wsi->http.dll_proxy_idle, &up->idle_head);
+	up->idle++;
+
+	/* the pool owns it now, nobody can pipeline on it */
+	lws_dll_lws_remove(&wsi->dll_active_client_conns);
+
+	lws_vhost_unlock(vh); /* } vh -------------------------------------- */
+
+	/*
+	 * The server wsi we were proxying for gets on with finishing the
+	 * transaction without us, we must not be closed along with it
+	 */
+
+	lws_remove_child_from_any_parent(wsi);
+
+	/* an idle conn doesn't need an ah, let somebody else use it */
+	lws_header_table_detach(wsi, 0);
+	wsi->hdr_parsing_completed = 0;
+	wsi->http.rx_content_length = 0;
+	lwsi_set_state(wsi, LRS_IDLING);
+
+	lws_set_timeout(wsi, PENDING_TIMEOUT_CLIENT_CONN_IDLE,
+			vh->http.proxy_pool_idle_secs);
+
+	lwsl_info("%s: %p idle to %s:%d\n", __func__, wsi,
+		  (const char *)(up + 1), up->port);
+
+	return 0;
+}
+
+/* the wsi is closing... call with the vhost lock held */
+
+void
+__lws_http_proxy_pool_remove(struct lws *wsi)
+{
+	struct lws_proxy_upstream *up = wsi->http.upstream;
+
+	if (!up)
+		return;
+
+	if (wsi->http.dll_proxy_idle.prev) {
+		lws_dll_lws_remove(&wsi->http.dll_proxy_idle);
+		up->idle--;
+	}
+	up->conns--;
+	wsi->http.upstream = NULL;
+}
+
+void
+lws_http_proxy_pool_destroy(struct lws_vhost *vh)
+{
+	struct lws_proxy_upstream *up = vh->http.proxy_upstream_list, *up1;
+
+	while (up) {
+		up1 = up->next;
+		lws_free(up);
+		up = up1;
+	}
+
+	vh->http.proxy_upstream_list = NULL;
+}
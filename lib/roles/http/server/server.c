@@ -21,6 +21,10 @@
 
 #include "core/private.h"
 
+#if defined(__linux__) && LWS_MAX_SMP > 1
+#include <linux/filter.h>
+#endif
+
 const char * const method_names[] = {
 	"GET", "POST", "OPTIONS", "PUT", "PATCH", "DELETE", "CONNECT", "HEAD",
 #ifdef LWS_WITH_HTTP2
@@ -30,6 +34,55 @@ const char * const method_names[] = {
 
 static const char * const intermediates[] = { "private", "public" };
 
+#if defined(__linux__) && LWS_MAX_SMP > 1 && defined(SO_ATTACH_REUSEPORT_CBPF)
+/*
+ * The kernel picks which of the service threads' SO_REUSEPORT listen sockets
+ * gets a new connection by hashing, unless the group has a classic bpf program
+ * attached to choose.  Ours returns the index, in order of listen(), of the
+ * listen socket whose service thread is pinned to the cpu handling the
+ * connection's rx.  Connections arriving on other cpus return an out of range
+ * index, which makes the kernel fall back to hashing them.
+ */
+
+static void
+lws_vhost_listen_steer(struct lws_vhost *vhost, lws_sockfd_type sockfd)
+{
+	struct sock_filter code[(LWS_MAX_SMP * 2) + 2], *c = code;
+	struct lws_context *context = vhost->context;
+	struct sock_fprog prog;
+	int n;
+
+	*c++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+					    SKF_AD_OFF + SKF_AD_CPU);
+
+	for (n = 0; n < context->count_threads; n++) {
+		if (context->pt[n].cpu < 0)
+			continue;
+
+		*c++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					(unsigned int)context->pt[n].cpu, 0, 1);
+		*c++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, n);
+	}
+
+	if (c == code + 1)
+		/* nobody is pinned */
+		return;
+
+	*c++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+	prog.len = (unsigned short)lws_ptr_diff(c, code) / sizeof(code[0]);
+	prog.filter = code;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       (const void *)&prog, sizeof(prog)) < 0)
+		lwsl_warn("%s: vh %s: unable to attach steering program (%d)\n",
+			  __func__, vhost->name, LWS_ERRNO);
+	else
+		lwsl_info("%s: vh %s: steering connections by cpu\n",
+			  __func__, vhost->name);
+}
+#endif
+
 /*
  * return 0: all done
  *        1: nonfatal error
@@ -231,8 +284,36 @@ done_list:
 			}
 #endif
 #endif
+		/*
+		 * On Linux the connections accepted from this inherit the
+		 * options set here, so this is all the socket option setting
+		 * they need.
+		 */
 		lws_plat_set_socket_options(vhost, sockfd, 0);
 
+#if defined(TCP_DEFER_ACCEPT)
+		if (vhost->tcp_defer_accept &&
+#ifdef LWS_WITH_UNIX_SOCK
+		    !LWS_UNIX_SOCK_ENABLED(vhost) &&
+#endif
+		    setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			       (const void *)&vhost->tcp_defer_accept,
+			       sizeof(vhost->tcp_defer_accept)) < 0)
+			lwsl_warn("%s: TCP_DEFER_ACCEPT failed\n", __func__);
+#endif
+
+#if defined(__linux__) && LWS_MAX_SMP > 1 && defined(SO_INCOMING_CPU)
+		/*
+		 * Older kernels without reuseport bpf prefer the listen socket
+		 * whose incoming cpu matches the cpu the connection arrived on
+		 */
+		if (limit > 1 && vhost->context->pt[m].cpu >= 0 &&
+		    setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU,
+			       (const void *)&vhost->context->pt[m].cpu,
+			       sizeof(vhost->context->pt[m].cpu)) < 0)
+			lwsl_info("%s: SO_INCOMING_CPU failed\n", __func__);
+#endif
+
 		is = lws_socket_bind(vhost, sockfd, vhost->listen_port, vhost->iface);
 		if (is == LWS_ITOSA_BUSY) {
 			/* treat as fatal */
@@ -295,6 +376,12 @@ done_list:
 			__remove_wsi_socket_from_fds(wsi);
 			goto bail;
 		}
+
+#if defined(__linux__) && LWS_MAX_SMP > 1 && defined(SO_ATTACH_REUSEPORT_CBPF)
+		/* the whole group is listening, it can be steered now */
+		if (limit > 1 && m == limit - 1)
+			lws_vhost_listen_steer(vhost, sockfd);
+#endif
 	} /* for each thread able to independently listen */
 
 	if (!lws_check_opt(vhost->context->options, LWS_SERVER_OPTION_EXPLICIT_VHOSTS)) {
@@ -464,6 +551,110 @@ lws_vfs_prepare_flags(struct lws *wsi)
 	return f;
 }
 
+#if !defined(_WIN32_WCE) && !defined(WIN32) && !defined(LWS_WITH_ESP32)
+/*
+ * Does the client's accept-encoding list the content-encoding "name", without
+ * forbidding it with q=0?
+ */
+
+static int
+lws_http_accepts_encoding(struct lws *wsi, const char *name)
+{
+	const char *p = lws_hdr_simple_ptr(wsi, WSI_TOKEN_HTTP_ACCEPT_ENCODING),
+		   *q;
+	size_t n = strlen(name);
+
+	if (!p)
+		return 0;
+
+	while (*p) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		q = p;
+		while (*p && *p != ',' && *p != ';' && *p != ' ')
+			p++;
+
+		if ((size_t)(p - q) == n && !strncasecmp(q, name, n)) {
+			while (*p == ' ')
+				p++;
+			if (*p++ != ';')
+				return 1;
+			while (*p == ' ')
+				p++;
+			if ((*p != 'q' && *p != 'Q') || p[1] != '=')
+				return 1;
+
+			return atof(p + 2) > 0;
+		}
+
+		while (*p && *p != ',')
+			p++;
+	}
+
+	return 0;
+}
+
+/*
+ * If there's an up-to-date foo.br or foo.gz next to the file foo that we're
+ * about to serve, and the client accepts it, serve that instead and return the
+ * content-encoding.
+ */
+
+static const char *
+lws_http_serve_sidecar(struct lws *wsi, const char *path)
+{
+	static const char * const sidecars[][2] = {
+		{ "br",		".br" },
+		{ "gzip",	".gz" },
+	};
+	const struct lws_plat_file_ops *fops;
+	lws_fop_flags_t fflags;
+	lws_fop_fd_t fop_fd;
+	const char *vpath;
+	struct stat st;
+	char sc[256];
+	size_t n;
+
+	for (n = 0; n < LWS_ARRAY_SIZE(sidecars); n++) {
+		if (!lws_http_accepts_encoding(wsi, sidecars[n][0]))
+			continue;
+
+		if (lws_snprintf(sc, sizeof(sc), "%s%s", path,
+				 sidecars[n][1]) >= (int)sizeof(sc) - 1)
+			continue;
+
+		fflags = LWS_O_RDONLY;
+		fops = lws_vfs_select_fops(wsi->context->fops, sc, &vpath);
+		fop_fd = fops->LWS_FOP_OPEN(wsi->context->fops, sc, vpath,
+					    &fflags);
+		if (!fop_fd)
+			continue;
+
+		/* ignore it if it's older than the file, it may be stale */
+
+		if ((fflags & LWS_FOP_FLAG_VIRTUAL) ||
+		    fstat(fop_fd->fd, &st) ||
+		    (S_IFMT & st.st_mode) != S_IFREG ||
+		    (uint32_t)st.st_mtime <
+				lws_vfs_get_mod_time(wsi->http.fop_fd)) {
+			lws_vfs_file_close(&fop_fd);
+			continue;
+		}
+
+		fop_fd->mod_time = (uint32_t)st.st_mtime;
+
+		lws_vfs_file_close(&wsi->http.fop_fd);
+		wsi->http.fop_fd = fop_fd;
+
+		lwsl_info("%s: serving %s\n", __func__, sc);
+
+		return sidecars[n][0];
+	}
+
+	return NULL;
+}
+#endif
+
 static int
 lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 	       const struct lws_http_mount *m)
@@ -573,9 +764,31 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 	if (spin == 5)
 		lwsl_err("symlink loop %s \n", path);
 
+	wsi->http.sidecar_encoding = NULL;
+#if !defined(WIN32) && !defined(LWS_WITH_ESP32)
+	if ((wsi->vhost->options & LWS_SERVER_OPTION_HTTP_PRECOMPRESSED) &&
+	    !(fflags & LWS_FOP_FLAG_VIRTUAL)) {
+		/* files we interpret must be served as they are */
+		while (pvo) {
+			n = (int)strlen(path);
+			if (n > (int)strlen(pvo->name) &&
+			    !strcmp(&path[n - strlen(pvo->name)], pvo->name))
+				break;
+			pvo = pvo->next;
+		}
+		if (!pvo)
+			wsi->http.sidecar_encoding =
+					lws_http_serve_sidecar(wsi, path);
+		pvo = m->interpret;
+	}
+#endif
+
 	n = sprintf(sym, "%08llX%08lX",
 		    (unsigned long long)lws_vfs_get_length(wsi->http.fop_fd),
 		    (unsigned long)lws_vfs_get_mod_time(wsi->http.fop_fd));
+	/* the etag must be different for each encoding of the file */
+	if (wsi->http.sidecar_encoding)
+		n += sprintf(sym + n, "-%s", wsi->http.sidecar_encoding);
 
 	/* disable ranges if IF_RANGE token invalid */
 
@@ -611,6 +824,14 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 					(unsigned char *)sym, n, &p, end))
 				return -1;
 
+			if ((wsi->vhost->options &
+					LWS_SERVER_OPTION_HTTP_PRECOMPRESSED) &&
+			    lws_add_http_header_by_name(wsi,
+					(unsigned char *)"vary:",
+					(unsigned char *)"Accept-Encoding",
+					15, &p, end))
+				return -1;
+
 			/* but we still need to send cache control... */
 
 			if (m->cache_max_age && m->cache_reusable) {
@@ -658,6 +879,13 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 	if (lws_add_http_header_by_token(wsi, WSI_TOKEN_HTTP_ETAG,
 			(unsigned char *)sym, n, &p, end))
 		return -1;
+
+	/* caches must keep the encodings of the file apart */
+	if ((wsi->vhost->options & LWS_SERVER_OPTION_HTTP_PRECOMPRESSED) &&
+	    lws_add_http_header_by_name(wsi, (unsigned char *)"vary:",
+					(unsigned char *)"Accept-Encoding", 15,
+					&p, end))
+		return -1;
 #endif
 
 	mimetype = lws_get_mimetype(path, m);
@@ -708,7 +936,7 @@ lws_http_serve(struct lws *wsi, char *uri, const char *origin,
 			return -1;
 		args.p = (char *)p;
 		args.max_len = lws_ptr_diff(end, p);
-		if (pp->callback(wsi, LWS_CALLBACK_ADD_HEADERS,
+		if (lws_protocol_cb(pp->callback, wsi, LWS_CALLBACK_ADD_HEADERS,
 					  wsi->user_space, &args, 0))
 			return -1;
 		p = (unsigned char *)args.p;
@@ -745,6 +973,7 @@ lws_find_mount(struct lws *wsi, const char *uri_ptr, int uri_len)
 		    ) {
 			if (hm->origin_protocol == LWSMPRO_CALLBACK ||
 			    ((hm->origin_protocol == LWSMPRO_CGI ||
+			      hm->origin_protocol == LWSMPRO_FCGI ||
 			     lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI) ||
 			     (wsi->http2_substream &&
 				lws_hdr_total_length(wsi,
@@ -1017,6 +1246,10 @@ lws_http_action(struct lws *wsi)
 	lwsl_info("Method: '%s' (%d), request for '%s'\n", method_names[meth],
 		  meth, uri_ptr);
 
+#if defined(LWS_WITH_PEER_LIMITS)
+	lws_peer_ratelimit_charge(wsi, 1, 0);
+#endif
+
 	if (wsi->role_ops && wsi->role_ops->check_upgrades)
 		switch (wsi->role_ops->check_upgrades(wsi)) {
 		case LWS_UPG_RET_DONE:
@@ -1087,8 +1320,9 @@ lws_http_action(struct lws *wsi)
 		wsi->http.conn_type = conn_type;
 	}
 
-	n = wsi->protocol->callback(wsi, LWS_CALLBACK_FILTER_HTTP_CONNECTION,
-				    wsi->user_space, uri_ptr, uri_len);
+	n = lws_protocol_cb(wsi->protocol->callback, wsi,
+			    LWS_CALLBACK_FILTER_HTTP_CONNECTION,
+			    wsi->user_space, uri_ptr, uri_len);
 	if (n) {
 		lwsl_info("LWS_CALLBACK_HTTP closing\n");
 
@@ -1149,7 +1383,8 @@ lws_http_action(struct lws *wsi)
 
 		lwsi_set_state(wsi, LRS_DOING_TRANSACTION);
 
-		m = wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP,
+		m = lws_protocol_cb(wsi->protocol->callback, wsi,
+				    LWS_CALLBACK_HTTP,
 				    wsi->user_space, uri_ptr, uri_len);
 
 		goto after;
@@ -1179,6 +1414,7 @@ lws_http_action(struct lws *wsi)
 	     (hit->origin_protocol == LWSMPRO_REDIR_HTTP ||
 	      hit->origin_protocol == LWSMPRO_REDIR_HTTPS)) &&
 	    (hit->origin_protocol != LWSMPRO_CGI &&
+	     hit->origin_protocol != LWSMPRO_FCGI &&
 	     hit->origin_protocol != LWSMPRO_CALLBACK)) {
 		unsigned char *start = pt->serv_buf + LWS_PRE, *p = start,
 			      *end = p + wsi->context->pt_serv_buf_size -
@@ -1339,7 +1575,7 @@ lws_http_action(struct lws *wsi)
 			    i.address, i.port, i.path, i.ssl_connection,
 			    i.uri_replace_from, i.uri_replace_to);
 
-		if (!lws_client_connect_via_info(&i)) {
+		if (!lws_http_proxy_connect(&i)) {
 			lwsl_err("proxy connect fail\n");
 
 			/*
@@ -1394,7 +1630,7 @@ lws_http_action(struct lws *wsi)
 		args.final = 0; /* used to signal callback dealt with it */
 		args.chunked = 0;
 
-		n = wsi->protocol->callback(wsi,
+		n = lws_protocol_cb(wsi->protocol->callback, wsi,
 					    LWS_CALLBACK_CHECK_ACCESS_RIGHTS,
 					    wsi->user_space, &args, 0);
 		if (n) {
@@ -1405,14 +1641,14 @@ lws_http_action(struct lws *wsi)
 		if (args.final) /* callback completely handled it well */
 			return 0;
 
-		if (hit->cgienv && wsi->protocol->callback(wsi,
+		if (hit->cgienv && lws_protocol_cb(wsi->protocol->callback, wsi,
 				LWS_CALLBACK_HTTP_PMO,
 				wsi->user_space, (void *)hit->cgienv, 0))
 			return 1;
 
 		if (lws_hdr_total_length(wsi, WSI_TOKEN_POST_URI)) {
-			m = wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP,
-					    wsi->user_space,
+			m = lws_protocol_cb(wsi->protocol->callback, wsi,
+					    LWS_CALLBACK_HTTP, wsi->user_space,
 					    uri_ptr + hit->mountpoint_len,
 					    uri_len - hit->mountpoint_len);
 			goto after;
@@ -1445,6 +1681,36 @@ lws_http_action(struct lws *wsi)
 	}
 #endif
 
+#if defined(LWS_ROLE_FCGI)
+	/* did we hit something with an fcgi:// origin? */
+	if (hit->origin_protocol == LWSMPRO_FCGI) {
+		const char *mp = method_names[meth];
+		char method[16];
+
+		if (wsi->http2_substream &&
+		    lws_hdr_copy(wsi, method, sizeof(method),
+				 WSI_TOKEN_HTTP_COLON_METHOD) > 0)
+			mp = method;
+
+		lwsl_debug("%s: fcgi\n", __func__);
+
+		if (lws_fcgi(wsi, hit, mp, uri_ptr, uri_len)) {
+			lwsl_err("%s: fcgi %s failed\n", __func__, hit->origin);
+
+			lws_return_http_status(wsi,
+				HTTP_STATUS_SERVICE_UNAVAILABLE,
+				"<h1>Service Temporarily Unavailable</h1>"
+				"The server is temporarily unable to service "
+				"your request due to maintenance downtime or "
+				"capacity problems. Please try again later.");
+
+			return 1;
+		}
+
+		goto deal_body;
+	}
+#endif
+
 	n = uri_len - lws_ptr_diff(s, uri_ptr); // (int)strlen(s);
 	if (s[0] == '\0' || (n == 1 && s[n - 1] == '/'))
 		s = (char *)hit->def;
@@ -1474,13 +1740,14 @@ lws_http_action(struct lws *wsi)
 			if (lws_bind_protocol(wsi, pp, "http_action HTTP"))
 				return 1;
 
-			m = pp->callback(wsi, LWS_CALLBACK_HTTP,
-					 wsi->user_space,
-					 uri_ptr + hit->mountpoint_len,
-					 uri_len - hit->mountpoint_len);
+			m = lws_protocol_cb(pp->callback, wsi,
+					    LWS_CALLBACK_HTTP, wsi->user_space,
+					    uri_ptr + hit->mountpoint_len,
+					    uri_len - hit->mountpoint_len);
 		} else
-			m = wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP,
-				    wsi->user_space, uri_ptr, uri_len);
+			m = lws_protocol_cb(wsi->protocol->callback, wsi,
+					    LWS_CALLBACK_HTTP, wsi->user_space,
+					    uri_ptr, uri_len);
 	}
 
 after:
@@ -1490,7 +1757,7 @@ after:
 		return 1;
 	}
 
-#ifdef LWS_WITH_CGI
+#if defined(LWS_WITH_CGI) || defined(LWS_ROLE_FCGI)
 deal_body:
 #endif
 	/*
@@ -1508,6 +1775,9 @@ deal_body:
 			   wsi->upgraded_to_http2, wsi->http2_substream);
 
 		if (wsi->http.content_length_explicitly_zero &&
+#if defined(LWS_ROLE_FCGI)
+		    !wsi->http.fcgi_txn &&
+#endif
 		    lws_hdr_total_length(wsi, WSI_TOKEN_POST_URI)) {
 
 			/*
@@ -1522,11 +1792,11 @@ deal_body:
 			 * result status code and result body if any, and
 			 * do the transaction complete processing.
 			 */
-			if (wsi->protocol->callback(wsi,
+			if (lws_protocol_cb(wsi->protocol->callback, wsi,
 					LWS_CALLBACK_HTTP_BODY,
 					wsi->user_space, NULL, 0))
 				return 1;
-			if (wsi->protocol->callback(wsi,
+			if (lws_protocol_cb(wsi->protocol->callback, wsi,
 					LWS_CALLBACK_HTTP_BODY_COMPLETION,
 					wsi->user_space, NULL, 0))
 				return 1;
@@ -1694,7 +1964,8 @@ lws_http_to_fallback(struct lws *wsi, unsigned char *obuf, size_t olen)
 	n = LWS_CALLBACK_RAW_RX;
 	if (wsi->role_ops->rx_cb[lwsi_role_server(wsi)])
 		n = wsi->role_ops->rx_cb[lwsi_role_server(wsi)];
-	if (wsi->protocol->callback(wsi, n, wsi->user_space, obuf, olen))
+	if (lws_protocol_cb(wsi->protocol->callback, wsi, n, wsi->user_space,
+			    obuf, olen))
 		return 1;
 
 	return 0;
@@ -2045,6 +2316,10 @@ lws_http_transaction_completed(struct lws *wsi)
 	if (lws_bind_protocol(wsi, &wsi->vhost->protocols[0], __func__))
 		return 1;
 
+	/* nothing can still be using the transaction's allocations now */
+
+	lws_http_transaction_reset_alloc(wsi);
+
 	/*
 	 * otherwise set ourselves up ready to go again, but because we have no
 	 * idea about the wsi writability, we make put it in a holding state
@@ -2148,7 +2423,7 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 	lws_filepos_t total_content_length;
 	unsigned char *p = response;
 	unsigned char *end = p + context->pt_serv_buf_size - LWS_PRE;
-	const char *vpath;
+	const char *vpath, *sidecar = NULL;
 #if defined(LWS_WITH_RANGES)
 	int ranges;
 #endif
@@ -2156,6 +2431,11 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 	if (wsi->handling_404)
 		n = HTTP_STATUS_NOT_FOUND;
 
+	/* lws_http_serve() may have opened a precompressed sidecar for us */
+	if (wsi->http.fop_fd)
+		sidecar = wsi->http.sidecar_encoding;
+	wsi->http.sidecar_encoding = NULL;
+
 	/*
 	 * We either call the platform fops .open with first arg platform fops,
 	 * or we call fops_zip .open with first arg platform fops, and fops_zip
@@ -2209,8 +2489,16 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 	if (lws_add_http_header_status(wsi, n, &p, end))
 		return -1;
 
-	if ((wsi->http.fop_fd->flags & (LWS_FOP_FLAG_COMPR_ACCEPTABLE_GZIP |
-		       LWS_FOP_FLAG_COMPR_IS_GZIP)) ==
+	if (sidecar) {
+		if (lws_add_http_header_by_token(wsi,
+			WSI_TOKEN_HTTP_CONTENT_ENCODING,
+			(unsigned char *)sidecar, (int)strlen(sidecar), &p, end))
+			return -1;
+		lwsl_info("file is being provided precompressed in %s\n",
+			  sidecar);
+	} else if ((wsi->http.fop_fd->flags &
+		    (LWS_FOP_FLAG_COMPR_ACCEPTABLE_GZIP |
+		     LWS_FOP_FLAG_COMPR_IS_GZIP)) ==
 	    (LWS_FOP_FLAG_COMPR_ACCEPTABLE_GZIP | LWS_FOP_FLAG_COMPR_IS_GZIP)) {
 		if (lws_add_http_header_by_token(wsi,
 			WSI_TOKEN_HTTP_CONTENT_ENCODING,
@@ -2228,8 +2516,16 @@ lws_serve_http_file(struct lws *wsi, const char *file, const char *content_type,
 
 		if (!strncmp(content_type, "text/", 5) ||
 		    !strcmp(content_type, "application/javascript") ||
-		    !strcmp(content_type, "image/svg+xml"))
-			lws_http_compression_apply(wsi, NULL, &p, end, 0);
+		    !strcmp(content_type, "image/svg+xml")) {
+			/*
+			 * this may replace fop_fd with the compressed body
+			 * from the cache
+			 */
+			if (lws_compr_cache_apply(wsi, file, &p, end) < 0)
+				return -1;
+			wsi->http.filelen = lws_vfs_get_length(wsi->http.fop_fd);
+			total_content_length = wsi->http.filelen;
+		}
 	}
 #endif
 
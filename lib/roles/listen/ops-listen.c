@@ -19,8 +19,19 @@
  *  MA  02110-1301  USA
  */
 
+#define _GNU_SOURCE
 #include <core/private.h>
 
+#if defined(LWS_HAVE_ACCEPT4) && defined(__linux__)
+/*
+ * Accepted sockets inherit the socket options we set on the listen socket,
+ * only the fd flags are per-fd and accept4() can set those itself.  So there's
+ * nothing more to do to them.  And accept4() on the nonblocking listen socket
+ * tells us when there's nothing more in the queue, without another poll().
+ */
+#define LWS_ACCEPT_INHERITS 1
+#endif
+
 static int
 rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 			  struct lws_pollfd *pollfd)
@@ -28,7 +39,8 @@ rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 	struct lws_context *context = wsi->context;
 	lws_sockfd_type accept_fd = LWS_SOCK_INVALID;
 	lws_sock_file_fd_type fd;
-	int opts = LWS_ADOPT_SOCKET | LWS_ADOPT_ALLOW_SSL;
+	int opts = LWS_ADOPT_SOCKET | LWS_ADOPT_ALLOW_SSL, n;
+	unsigned int budget = wsi->vhost->listen_accept_budget;
 	struct sockaddr_storage cli_addr;
 	socklen_t clilen;
 
@@ -79,8 +91,14 @@ rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 		 * block the connect queue for other legit peers.
 		 */
 
+#if defined(LWS_ACCEPT_INHERITS)
+		accept_fd = accept4((int)pollfd->fd,
+				    (struct sockaddr *)&cli_addr, &clilen,
+				    SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
 		accept_fd = accept((int)pollfd->fd,
 				   (struct sockaddr *)&cli_addr, &clilen);
+#endif
 		lws_latency(context, wsi, "listener accept",
 			    (int)accept_fd, accept_fd != LWS_SOCK_INVALID);
 		if (accept_fd == LWS_SOCK_INVALID) {
@@ -92,7 +110,9 @@ rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 			return LWS_HPI_RET_HANDLED;
 		}
 
+#if !defined(LWS_ACCEPT_INHERITS)
 		lws_plat_set_socket_options(wsi->vhost, accept_fd, 0);
+#endif
 
 #if defined(LWS_WITH_IPV6)
 		lwsl_debug("accepted new conn port %u on fd=%d\n",
@@ -128,8 +148,20 @@ rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 			opts = LWS_ADOPT_SOCKET;
 
 		fd.sockfd = accept_fd;
-		cwsi = lws_adopt_descriptor_vhost(wsi->vhost, opts, fd,
-						  NULL, NULL);
+
+		/*
+		 * If our service thread is pinned, the kernel steered this
+		 * connection to our listen socket because its rx is on our
+		 * cpu... keep it on our pt rather than the idlest one
+		 */
+		n = -1;
+		if (pt->cpu >= 0 &&
+		    pt->fds_count < context->fd_limit_per_thread - 1)
+			n = wsi->tsi;
+
+		cwsi = lws_adopt_descriptor_vhost_tsi(wsi->vhost, opts, fd,
+						      NULL, NULL, n,
+					(const struct sockaddr *)&cli_addr);
 		if (!cwsi) {
 			lwsl_err("%s: lws_adopt_descriptor_vhost failed\n",
 					__func__);
@@ -143,12 +175,18 @@ rops_handle_POLLIN_listen(struct lws_context_per_thread *pt, struct lws *wsi,
 			return LWS_HPI_RET_WSI_ALREADY_DIED;
 		}
 
-		lwsl_info("%s: new wsi %p: wsistate 0x%x, role_ops %s\n",
-			    __func__, cwsi, cwsi->wsistate, cwsi->role_ops->name);
+		lwsl_info("%s: new wsi %p: tsi %d, wsistate 0x%x, role_ops %s\n",
+			    __func__, cwsi, cwsi->tsi, cwsi->wsistate,
+			    cwsi->role_ops->name);
 
 	} while (pt->fds_count < context->fd_limit_per_thread - 1 &&
 		 wsi->position_in_fds_table != LWS_NO_FDS_POS &&
-		 lws_poll_listen_fd(&pt->fds[wsi->position_in_fds_table]) > 0);
+		 /* leave the rest for next time if we did our share */
+		 (!budget || --budget)
+#if !defined(LWS_ACCEPT_INHERITS)
+		 && lws_poll_listen_fd(&pt->fds[wsi->position_in_fds_table]) > 0
+#endif
+		 );
 
 	return LWS_HPI_RET_HANDLED;
 }
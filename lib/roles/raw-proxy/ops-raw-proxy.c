@@ -19,8 +19,205 @@
  *  MA  02110-1301  USA
  */
 
+#define _GNU_SOURCE
 #include <core/private.h>
 
+#if defined(LWS_HAVE_SPLICE)
+
+#include <fcntl.h>
+
+#define LWS_RAW_SPLICE_CHUNK (64 * 1024)
+
+/*
+ * Pass what waits in wsi's pipe on to its peer.  Returns -1 if the peer
+ * failed, 0 if it all went, or 1 if some is still waiting.
+ */
+
+static int
+lws_raw_splice_flush(struct lws *wsi)
+{
+	struct lws_raw_splice *sp = wsi->splice;
+	struct lws *peer = sp->peer;
+	ssize_t n;
+
+	while (sp->pending) {
+		/* anything the protocol queued to him before goes first */
+		if (lws_has_buffered_out(peer))
+			return 1;
+
+		n = splice(sp->pipe_fd[0], NULL, peer->desc.sockfd, NULL,
+			   sp->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			lwsl_info("%s: %p: splice to %p failed %d\n", __func__,
+				  wsi, peer, errno);
+
+			return -1;
+		}
+		if (n <= 0)
+			return 1;
+
+		sp->pending -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Move what arrived on wsi into its pipe and on to its peer, without
+ * copying it into userspace
+ */
+
+static int
+lws_raw_splice_rx(struct lws *wsi)
+{
+	struct lws_raw_splice *sp = wsi->splice;
+	ssize_t n;
+
+	if (!sp->peer)
+		/* there's nowhere for it to go any more */
+		return -1;
+
+	n = splice(wsi->desc.sockfd, NULL, sp->pipe_fd[1], NULL,
+		   LWS_RAW_SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+
+		return -1;
+	}
+	if (!n) {
+		lwsl_info("%s: %p: remote closed\n", __func__, wsi);
+		sp->eof = 1;
+	}
+	sp->pending += n;
+
+	switch (lws_raw_splice_flush(wsi)) {
+	case -1:
+		return -1;
+	case 0:
+		/* everything we got was passed on... */
+		return sp->eof ? -1 : 0;
+	}
+
+	/* the peer can't take it all yet... stop reading until he has */
+
+	if (lws_rx_flow_control(wsi, LWS_RXFLOW_REASON_APPLIES_DISABLE |
+				     LWS_RXFLOW_REASON_SPLICE_PENDING))
+		return -1;
+
+	lws_callback_on_writable(sp->peer);
+
+	return 0;
+}
+
+/* wsi became writeable, pass on anything waiting in its peer's pipe */
+
+static int
+lws_raw_splice_drain_to(struct lws *wsi)
+{
+	struct lws *src = wsi->splice->peer;
+
+	if (!src || !src->splice->pending)
+		return LWS_HP_RET_USER_SERVICE;
+
+	switch (lws_raw_splice_flush(src)) {
+	case -1:
+		return LWS_HP_RET_BAIL_DIE;
+	case 1:
+		/* leave POLLOUT active for the rest */
+		return LWS_HP_RET_BAIL_OK;
+	}
+
+	if (src->splice->eof) {
+		/* he's finished now everything he got was passed on */
+		lws_close_free_wsi(src, LWS_CLOSE_STATUS_NOSTATUS,
+				   "splice eof");
+
+		return LWS_HP_RET_USER_SERVICE;
+	}
+
+	lws_rx_flow_control(src, LWS_RXFLOW_REASON_APPLIES_ENABLE |
+				 LWS_RXFLOW_REASON_SPLICE_PENDING |
+				 LWS_RXFLOW_REASON_FLAG_PROCESS_NOW);
+
+	return LWS_HP_RET_USER_SERVICE;
+}
+
+static void
+lws_raw_splice_destroy(struct lws *wsi)
+{
+	struct lws_raw_splice *sp = wsi->splice;
+
+	if (!sp)
+		return;
+
+	/* anything waiting for us in the peer's pipe has nowhere to go */
+	if (sp->peer)
+		sp->peer->splice->peer = NULL;
+
+	close(sp->pipe_fd[0]);
+	close(sp->pipe_fd[1]);
+	lws_free_set_NULL(wsi->splice);
+}
+
+static int
+lws_raw_splice_create(struct lws *wsi, struct lws *peer)
+{
+	struct lws_raw_splice *sp;
+
+	sp = lws_zalloc(sizeof(*sp), "raw splice");
+	if (!sp)
+		return 1;
+
+#if defined(LWS_HAVE_PIPE2)
+	if (pipe2(sp->pipe_fd, O_NONBLOCK)) {
+#else
+	if (pipe(sp->pipe_fd)) {
+#endif
+		lws_free(sp);
+
+		return 1;
+	}
+
+	sp->peer = peer;
+	wsi->splice = sp;
+
+	return 0;
+}
+
+#endif
+
+LWS_VISIBLE int
+lws_raw_proxy_splice(struct lws *wsi, struct lws *peer)
+{
+#if defined(LWS_HAVE_SPLICE)
+	struct lws *w[2] = { wsi, peer };
+	int n;
+
+	for (n = 0; n < 2; n++)
+		if (!lwsi_role_raw_proxy(w[n]) ||
+		    lwsi_state(w[n]) != LRS_ESTABLISHED ||
+		    lws_is_ssl(w[n]) || w[n]->udp || w[n]->splice ||
+		    w[n]->buflist || w[n]->tsi != wsi->tsi)
+			return 1;
+
+	if (lws_raw_splice_create(wsi, peer))
+		return 1;
+
+	if (lws_raw_splice_create(peer, wsi)) {
+		lws_raw_splice_destroy(wsi);
+
+		return 1;
+	}
+
+	lwsl_info("%s: %p <-> %p\n", __func__, wsi, peer);
+
+	return 0;
+#else
+	return 1;
+#endif
+}
+
 static int
 rops_handle_POLLIN_raw_proxy(struct lws_context_per_thread *pt, struct lws *wsi,
 			     struct lws_pollfd *pollfd)
@@ -45,9 +242,21 @@ rops_handle_POLLIN_raw_proxy(struct lws_context_per_thread *pt, struct lws *wsi,
 		return LWS_HPI_RET_HANDLED;
 	}
 
+#if defined(LWS_HAVE_SPLICE)
+	if (wsi->splice) {
+		if ((pollfd->revents & pollfd->events & LWS_POLLIN) &&
+		    lws_raw_splice_rx(wsi))
+			goto fail;
+
+		goto try_pollout;
+	}
+#endif
+
 	if ((pollfd->revents & pollfd->events & LWS_POLLIN) &&
 	    /* any tunnel has to have been established... */
 	    lwsi_state(wsi) != LRS_SSL_ACK_PENDING &&
+	    /* ...and an onward connection adopted, if it sent first */
+	    lwsi_state(wsi) != LRS_WAITING_CONNECT &&
 	    !(wsi->favoured_pollin &&
 	      (pollfd->revents & pollfd->events & LWS_POLLOUT))) {
 
@@ -119,7 +328,15 @@ rops_adoption_bind_raw_proxy(struct lws *wsi, int type,
 {
 	/* no http but socket... must be raw skt */
 	if ((type & LWS_ADOPT_HTTP) || !(type & LWS_ADOPT_SOCKET) ||
-	    !(type & LWS_ADOPT_FLAG_RAW_PROXY) || (type & _LWS_ADOPT_FINISH))
+	    (type & _LWS_ADOPT_FINISH))
+		return 0; /* no match */
+
+	/* ...and adopted as raw proxy, or accepted on a raw proxy vhost */
+	if (!(type & LWS_ADOPT_FLAG_RAW_PROXY) &&
+	    (!lws_check_opt(wsi->vhost->options,
+			LWS_SERVER_OPTION_ADOPT_APPLY_LISTEN_ACCEPT_CONFIG) ||
+	     !wsi->vhost->listen_accept_role ||
+	     strcmp(wsi->vhost->listen_accept_role, role_ops_raw_proxy.name)))
 		return 0; /* no match */
 
 	if (type & LWS_ADOPT_FLAG_UDP)
@@ -169,6 +386,11 @@ rops_client_bind_raw_proxy(struct lws *wsi,
 static int
 rops_handle_POLLOUT_raw_proxy(struct lws *wsi)
 {
+#if defined(LWS_HAVE_SPLICE)
+	if (wsi->splice)
+		return lws_raw_splice_drain_to(wsi);
+#endif
+
 	if (lwsi_state(wsi) == LRS_ESTABLISHED)
 		return LWS_HP_RET_USER_SERVICE;
 
@@ -178,6 +400,24 @@ rops_handle_POLLOUT_raw_proxy(struct lws *wsi)
 	return LWS_HP_RET_BAIL_OK;
 }
 
+#if defined(LWS_HAVE_SPLICE)
+static int
+rops_close_role_raw_proxy(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	lws_raw_splice_destroy(wsi);
+
+	return 0;
+}
+
+static int
+rops_destroy_role_raw_proxy(struct lws *wsi)
+{
+	lws_raw_splice_destroy(wsi);
+
+	return 0;
+}
+#endif
+
 struct lws_role_ops role_ops_raw_proxy = {
 	/* role name */			"raw-proxy",
 	/* alpn id */			NULL,
@@ -196,9 +436,17 @@ struct lws_role_ops role_ops_raw_proxy = {
 	/* encapsulation_parent */	NULL,
 	/* alpn_negotiated */		NULL,
 	/* close_via_role_protocol */	NULL,
+#if defined(LWS_HAVE_SPLICE)
+	/* close_role */		rops_close_role_raw_proxy,
+#else
 	/* close_role */		NULL,
+#endif
 	/* close_kill_connection */	NULL,
+#if defined(LWS_HAVE_SPLICE)
+	/* destroy_role */		rops_destroy_role_raw_proxy,
+#else
 	/* destroy_role */		NULL,
+#endif
 	/* adoption_bind */		rops_adoption_bind_raw_proxy,
 	/* client_bind */		rops_client_bind_raw_proxy,
 	/* adoption_cb clnt, srv */	{ LWS_CALLBACK_RAW_PROXY_CLI_ADOPT,
@@ -25,6 +25,19 @@ extern struct lws_role_ops role_ops_raw_proxy;
 
 #define lwsi_role_raw_proxy(wsi) (wsi->role_ops == &role_ops_raw_proxy)
 
+#if defined(LWS_HAVE_SPLICE)
+/*
+ * Each side of a spliced pair has one of these for the data it received and
+ * hasn't been able to pass on to its peer yet, which waits in the pipe
+ */
+struct lws_raw_splice {
+	struct lws *peer;
+	size_t pending;		/* bytes in the pipe */
+	int pipe_fd[2];
+	char eof;		/* we read everything, close when drained */
+};
+#endif
+
 #if 0
 struct lws_vhost_role_ws {
 	const struct lws_extension *extensions;
@@ -574,7 +574,7 @@ utf8_fail:
 		    lwsi_state(wsi) == LRS_AWAITING_CLOSE_ACK)
 			goto already_done;
 
-		m = wsi->protocol->callback(wsi,
+		m = lws_protocol_cb(wsi->protocol->callback, wsi,
 			(enum lws_callback_reasons)callback_action,
 			wsi->user_space, ebuf.token, ebuf.len);
 
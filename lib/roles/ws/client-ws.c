@@ -152,7 +152,7 @@ lws_generate_client_ws_handshake(struct lws *wsi, char *p, const char *conn1)
 	ext = wsi->vhost->ws.extensions;
 	while (ext && ext->callback) {
 
-		n = wsi->vhost->protocols[0].callback(wsi,
+		n = lws_protocol_cb(wsi->vhost->protocols[0].callback, wsi,
 			LWS_CALLBACK_CLIENT_CONFIRM_EXTENSION_SUPPORTED,
 				wsi->user_space, (char *)ext->name, 0);
 
@@ -567,7 +567,7 @@ check_accept:
 	 * we seem to be good to go, give client last chance to check
 	 * headers and OK it
 	 */
-	if (wsi->protocol->callback(wsi,
+	if (lws_protocol_cb(wsi->protocol->callback, wsi,
 				    LWS_CALLBACK_CLIENT_FILTER_PRE_ESTABLISH,
 				    wsi->user_space, NULL, 0)) {
 		*cce = "HS: Rejected by filter cb";
@@ -618,8 +618,9 @@ check_accept:
 
 	/* call him back to inform him he is up */
 
-	if (wsi->protocol->callback(wsi, LWS_CALLBACK_CLIENT_ESTABLISHED,
-				    wsi->user_space, NULL, 0)) {
+	if (lws_protocol_cb(wsi->protocol->callback, wsi,
+			    LWS_CALLBACK_CLIENT_ESTABLISHED,
+			    wsi->user_space, NULL, 0)) {
 		*cce = "HS: Rejected at CLIENT_ESTABLISHED";
 		goto bail3;
 	}
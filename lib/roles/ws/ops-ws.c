@@ -802,14 +802,15 @@ lws_server_init_wsi_for_ws(struct lws *wsi)
 	/* notify user code that we're ready to roll */
 
 	if (wsi->protocol->callback)
-		if (wsi->protocol->callback(wsi, LWS_CALLBACK_ESTABLISHED,
-					    wsi->user_space,
+		if (lws_protocol_cb(wsi->protocol->callback, wsi,
+				    LWS_CALLBACK_ESTABLISHED,
+				    wsi->user_space,
 #ifdef LWS_WITH_TLS
-					    wsi->tls.ssl,
+				    wsi->tls.ssl,
 #else
-					    NULL,
+				    NULL,
 #endif
-					    wsi->h2_stream_carries_ws))
+				    wsi->h2_stream_carries_ws))
 			return 1;
 
 	lwsl_debug("ws established\n");
@@ -1092,6 +1093,10 @@ read:
 			return LWS_HPI_RET_PLEASE_CLOSE_ME;
 		}
 		// lwsl_notice("Actual RX %d\n", ebuf.len);
+#if defined(LWS_WITH_PEER_LIMITS)
+		if (ebuf.len > 0)
+			lws_peer_ratelimit_charge(wsi, 0, (size_t)ebuf.len);
+#endif
 
 		lws_restart_ws_ping_pong_timer(wsi);
 
@@ -608,8 +608,9 @@ handshake_0405(struct lws_context *context, struct lws *wsi)
 		const struct lws_http_mount *hit =
 			lws_find_mount(wsi, uri_ptr, uri_len);
 		if (hit && hit->cgienv &&
-		    wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP_PMO,
-			wsi->user_space, (void *)hit->cgienv, 0))
+		    lws_protocol_cb(wsi->protocol->callback, wsi,
+				    LWS_CALLBACK_HTTP_PMO, wsi->user_space,
+				    (void *)hit->cgienv, 0))
 			return 1;
 	}
 
@@ -193,7 +193,7 @@ lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 	}
 
 	if (!private_key && !mem_privkey &&
-	    vhost->protocols[0].callback(wsi,
+	    lws_protocol_cb(vhost->protocols[0].callback, wsi,
 			LWS_CALLBACK_OPENSSL_CONTEXT_REQUIRES_PRIVATE_KEY,
 			vhost->tls.ssl_ctx, NULL, 0)) {
 		lwsl_err("ssl private key not set\n");
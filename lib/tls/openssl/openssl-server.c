@@ -56,7 +56,7 @@ OpenSSL_verify_callback(int preverify_ok, X509_STORE_CTX *x509_ctx)
 	else
 		lwsl_info("%s: couldn't get client cert CN\n", __func__);
 
-	n = wsi->vhost->protocols[0].callback(wsi,
+	n = lws_protocol_cb(wsi->vhost->protocols[0].callback, wsi,
 			LWS_CALLBACK_OPENSSL_PERFORM_CLIENT_CERT_VERIFICATION,
 					   x509_ctx, ssl, preverify_ok);
 
@@ -251,7 +251,7 @@ lws_tls_server_certs_load(struct lws_vhost *vhost, struct lws *wsi,
 			return 1;
 		}
 	} else {
-		if (vhost->protocols[0].callback(wsi,
+		if (lws_protocol_cb(vhost->protocols[0].callback, wsi,
 			      LWS_CALLBACK_OPENSSL_CONTEXT_REQUIRES_PRIVATE_KEY,
 						 vhost->tls.ssl_ctx, NULL, 0)) {
 			lwsl_err("ssl private key not set\n");
@@ -245,9 +245,11 @@ lws_ssl_capable_read(struct lws *wsi, unsigned char *buf, int len)
 #endif
 #if defined(LWS_WITH_STATS)
 	if (!wsi->seen_rx && wsi->accept_start_us) {
+		uint64_t ul = lws_time_in_microseconds() - wsi->accept_start_us;
+
                 lws_stats_atomic_bump(wsi->context, pt, LWSSTATS_MS_SSL_RX_DELAY,
-                		      lws_time_in_microseconds() -
-                			      wsi->accept_start_us);
+                		      ul);
+		lws_stats_hist_add(pt, LWSSTATS_H_SSL_RX_DELAY, ul);
                 lws_stats_atomic_bump(wsi->context, pt,
                 		      LWSSTATS_C_SSL_CONNS_HAD_RX, 1);
 		wsi->seen_rx = 1;
@@ -145,7 +145,7 @@ int lws_context_init_client_ssl(const struct lws_context_creation_info *info,
 	wsi.vhost = vhost; /* not a real bound wsi */
 	wsi.context = vhost->context;
 
-	vhost->protocols[0].callback(&wsi,
+	lws_protocol_cb(vhost->protocols[0].callback, &wsi,
 			LWS_CALLBACK_OPENSSL_LOAD_EXTRA_CLIENT_VERIFY_CERTS,
 				     vhost->tls.ssl_client_ctx, NULL, 0);
 
@@ -162,7 +162,7 @@ lws_context_init_server_ssl(const struct lws_context_creation_info *info,
 
 		lws_tls_server_client_cert_verify_config(vhost);
 
-		if (vhost->protocols[0].callback(&wsi,
+		if (lws_protocol_cb(vhost->protocols[0].callback, &wsi,
 			    LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS,
 			    vhost->tls.ssl_ctx, vhost, 0))
 			return -1;
@@ -375,6 +375,7 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 			lws_stats_atomic_bump(wsi->context, pt,
 					      LWSSTATS_C_SSL_CONNECTIONS_FAILED,
 					      1);
+			wsi->vhost->conn_stats.tls_hs_failed++;
 	                lwsl_info("SSL_accept failed socket %u: %d\n",
 	                		wsi->desc.sockfd, n);
 			wsi->socket_is_permanently_unusable = 1;
@@ -386,12 +387,17 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 
 		lws_stats_atomic_bump(wsi->context, pt,
 				      LWSSTATS_C_SSL_CONNECTIONS_ACCEPTED, 1);
+		wsi->vhost->conn_stats.tls_hs++;
 #if defined(LWS_WITH_STATS)
-		if (wsi->accept_start_us)
+		if (wsi->accept_start_us) {
+			uint64_t ul = lws_time_in_microseconds() -
+				      wsi->accept_start_us;
+
 			lws_stats_atomic_bump(wsi->context, pt,
 				      LWSSTATS_MS_SSL_CONNECTIONS_ACCEPTED_DELAY,
-				      lws_time_in_microseconds() -
-					      wsi->accept_start_us);
+				      ul);
+			lws_stats_hist_add(pt, LWSSTATS_H_SSL_ACCEPT_DELAY, ul);
+		}
 		wsi->accept_start_us = lws_time_in_microseconds();
 #endif
 
@@ -10,6 +10,10 @@
 #include <libwebsockets.h>
 #include <getopt.h>
 #include <fcntl.h>
+#include <unistd.h>
+#if defined(LWS_HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 static struct option options[] = {
 	{ "help",	no_argument,		NULL, 'h' },
@@ -18,24 +22,110 @@ static struct option options[] = {
 	{ "debug",	required_argument,	NULL, 'd' },
 	{ "file",	required_argument,	NULL, 'f' },
 	{ "lines",	required_argument,	NULL, 'l' },
+	{ "bench",	required_argument,	NULL, 'b' },
+	{ "no-mmap",	no_argument,		NULL, 'm' },
+	{ "threads",	required_argument,	NULL, 't' },
+	{ "add",	no_argument,		NULL, 'a' },
+	{ "remove",	no_argument,		NULL, 'r' },
+	{ "compact",	no_argument,		NULL, 'k' },
+	{ "segments",	no_argument,		NULL, 's' },
+	{ "compact-add", no_argument,		NULL, 'K' },
 	{ NULL, 0, 0, 0 }
 };
 
 static const char *index_filepath = "/tmp/lws-fts-test-index";
 static char filepath[256];
 
+struct indexer {
+	struct lws_fts *t;
+	char **files;
+	int count_files;
+	int stride;
+	uint64_t bytes;
+	int ret;
+};
+
+static int
+index_file(struct lws_fts *t, const char *path, uint64_t *bytes)
+{
+	char buf[16384];
+	int fi, fd;
+
+	fi = lws_fts_file_index(t, path, strlen(path), 1);
+	if (fi < 0) {
+		lwsl_err("%s: Failed to get file idx for %s\n", __func__, path);
+
+		return 1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		lwsl_err("unable to open %s for read\n", path);
+
+		return 1;
+	}
+
+	do {
+		int n = read(fd, buf, sizeof(buf));
+
+		if (n <= 0)
+			break;
+
+		*bytes += n;
+
+		if (lws_fts_fill(t, fi, buf, n)) {
+			lwsl_err("%s: lws_fts_fill failed\n", __func__);
+			close(fd);
+
+			return 1;
+		}
+
+	} while (1);
+
+	close(fd);
+
+	return 0;
+}
+
+/* index every stride'th file from files[] into our trie or shard */
+
+static void *
+indexer(void *d)
+{
+	struct indexer *ix = (struct indexer *)d;
+	int n;
+
+	for (n = 0; n < ix->count_files; n += ix->stride)
+		if (index_file(ix->t, ix->files[n], &ix->bytes)) {
+			ix->ret = 1;
+			break;
+		}
+
+	return NULL;
+}
+
+#if defined(LWS_HAVE_PTHREAD_H)
+static void *
+compactor(void *d)
+{
+	*(int *)d = lws_fts_compact(index_filepath, 0);
+
+	return NULL;
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	int n, logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE;
-	int fd, fi, ft, createindex = 0, flags = LWSFTS_F_QUERY_AUTOCOMPLETE;
+	int ft, createindex = 0, flags = LWSFTS_F_QUERY_AUTOCOMPLETE;
+	int bench = 0, oflags = 0, threads = 1, update = 0;
 	struct lws_fts_search_params params;
 	struct lws_fts_result *result;
 	struct lws_fts_file *jtf;
 	struct lws_fts *t;
-	char buf[16384];
 
 	do {
-		n = getopt_long(argc, argv, "hd:i:cfl", options, NULL);
+		n = getopt_long(argc, argv, "hd:i:cflb:mt:arksK", options, NULL);
 		if (n < 0)
 			continue;
 		switch (n) {
@@ -58,10 +148,35 @@ int main(int argc, char **argv)
 			flags |= LWSFTS_F_QUERY_FILES |
 				 LWSFTS_F_QUERY_FILE_LINES;
 			break;
+		case 'b':
+			bench = atoi(optarg);
+			break;
+		case 'm':
+			oflags |= LWSFTS_F_OPEN_NO_MMAP;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > 64)
+				threads = 1;
+			break;
+		case 'a':
+		case 'r':
+		case 'k':
+		case 'K':
+			update = n;
+			break;
+		case 's':
+			oflags |= LWSFTS_F_OPEN_SEGMENTS;
+			break;
 		case 'h':
 			fprintf(stderr,
 				"Usage: %s [--createindex]"
 					"[--index=<index filepath>] "
+					"[--bench <iterations>] [--no-mmap] "
+					"[--threads <count>] "
+					"[--add | --remove | --compact | "
+					"--compact-add] "
+					"[--segments] "
 					"[-d <log bitfield>] file1 file2 \n",
 					argv[0]);
 			exit(1);
@@ -71,7 +186,70 @@ int main(int argc, char **argv)
 	lws_set_log_level(logs, NULL);
 	lwsl_user("LWS API selftest: full-text search\n");
 
+	switch (update) {
+	case 'a':
+		/* index the files given in argv into a new delta segment */
+		n = lws_fts_segment_add(index_filepath,
+					(const char * const *)&argv[optind],
+					argc - optind);
+		if (n < 0)
+			goto bail;
+
+		lwsl_notice("%s: added segment %d\n", __func__, n);
+
+		return 0;
+
+	case 'r':
+		/* remove the filepaths given in argv from the results */
+		while (optind < argc)
+			if (lws_fts_tombstone(index_filepath, argv[optind++]))
+				goto bail;
+
+		return 0;
+
+	case 'k':
+		/* fold any delta segments and removals into the base index */
+		if (lws_fts_compact(index_filepath, 0))
+			goto bail;
+
+		return 0;
+
+#if defined(LWS_HAVE_PTHREAD_H)
+	case 'K': {
+		/*
+		 * compact in a thread, and while it's busy reading the input
+		 * files, add the files given in argv as a new segment... the
+		 * add must wait for the compaction and not get lost
+		 */
+		pthread_t ct;
+		int cret = 1;
+
+		if (pthread_create(&ct, NULL, compactor, &cret))
+			goto bail;
+
+		usleep(20000);
+		n = lws_fts_segment_add(index_filepath,
+					(const char * const *)&argv[optind],
+					argc - optind);
+		pthread_join(ct, NULL);
+		if (n < 0 || cret)
+			goto bail;
+
+		lwsl_notice("%s: added segment %d\n", __func__, n);
+
+		return 0;
+	}
+#endif
+	}
+
 	if (createindex) {
+		struct indexer ix[64];
+		lws_usec_t us;
+		uint64_t bytes = 0;
+#if defined(LWS_HAVE_PTHREAD_H)
+		pthread_t pt[64];
+		int started;
+#endif
 
 		lwsl_notice("Creating index\n");
 
@@ -95,64 +273,141 @@ int main(int argc, char **argv)
 			goto bail1;
 		}
 
-		while (optind < argc) {
+		us = lws_now_usecs();
 
-			fi = lws_fts_file_index(t, argv[optind],
-						strlen(argv[optind]), 1);
-			if (fi < 0) {
-				lwsl_err("%s: Failed to get file idx for %s\n",
-					 __func__, argv[optind]);
+		/*
+		 * The first indexer uses the trie directly, if we were asked
+		 * for more threads each of the others indexes into its own
+		 * shard, which is merged into the trie at the end
+		 */
 
-				goto bail1;
-			}
+		memset(ix, 0, sizeof(ix));
+		for (n = 0; n < threads; n++) {
+			ix[n].t = n ? lws_fts_shard_create(t) : t;
+			if (!ix[n].t) {
+				lwsl_err("%s: Unable to create shard\n",
+					 __func__);
 
-			fd = open(argv[optind], O_RDONLY);
-			if (fd < 0) {
-				lwsl_err("unable to open %s for read\n",
-						argv[optind]);
-				goto bail;
+				goto bail2;
 			}
+			ix[n].files = &argv[optind + n];
+			ix[n].count_files = argc - optind - n;
+			ix[n].stride = threads;
+		}
 
-			do {
-				int n = read(fd, buf, sizeof(buf));
+#if defined(LWS_HAVE_PTHREAD_H)
+		started = threads;
+		for (n = 1; n < threads; n++)
+			if (pthread_create(&pt[n], NULL, indexer, &ix[n])) {
+				lwsl_err("%s: thread creation failed, indexing "
+					 "shards %d+ on this thread\n",
+					 __func__, n);
+				started = n;
+				break;
+			}
 
-				if (n <= 0)
-					break;
+		indexer(&ix[0]);
 
-				if (lws_fts_fill(t, fi, buf, n)) {
-					lwsl_err("%s: lws_fts_fill failed\n",
-						 __func__);
-					close(fd);
+		/* the shards we couldn't start a thread for still need doing */
+		for (n = started; n < threads; n++)
+			indexer(&ix[n]);
 
-					goto bail;
-				}
+		for (n = 1; n < started; n++)
+			pthread_join(pt[n], NULL);
+#else
+		for (n = 0; n < threads; n++)
+			indexer(&ix[n]);
+#endif
 
-			} while (1);
+		for (n = 0; n < threads; n++) {
+			bytes += ix[n].bytes;
+			if (ix[n].ret)
+				goto bail2;
+			if (n && lws_fts_shard_merge(t, &ix[n].t)) {
+				lwsl_err("%s: shard merge failed\n", __func__);
 
-			close(fd);
-			optind++;
+				goto bail2;
+			}
 		}
 
 		if (lws_fts_serialize(t)) {
 			lwsl_err("%s: serialize failed\n", __func__);
 
-			goto bail;
+			goto bail2;
 		}
 
+		us = lws_now_usecs() - us;
+
+		lwsl_notice("%s: indexed %dMiB with %d thread(s) in %dms: "
+			    "%dMB/s\n", __func__, (int)(bytes / (1024 * 1024)),
+			    threads, (int)(us / 1000),
+			    (int)(us ? (bytes / (uint64_t)us) : 0));
+
 		lws_fts_destroy(&t);
 		close(ft);
 
 		return 0;
+
+bail2:
+		/* the shards that weren't merged, then the trie */
+		for (n = 1; n < threads; n++)
+			if (ix[n].t)
+				lws_fts_destroy(&ix[n].t);
+		lws_fts_destroy(&t);
+
+		goto bail1;
 	}
 
 	/*
 	 * shift through argv searching for each token
 	 */
 
-	jtf = lws_fts_open(index_filepath);
+	jtf = lws_fts_open_flags(index_filepath, oflags);
 	if (!jtf)
 		goto bail;
 
+	if (bench) {
+		lws_usec_t us;
+
+		/*
+		 * repeat each search without reporting the results, to measure
+		 * the cost of searching the index itself
+		 */
+
+		while (optind < argc) {
+			us = lws_now_usecs();
+			for (n = 0; n < bench; n++) {
+				memset(&params, 0, sizeof(params));
+
+				params.needle = argv[optind];
+				params.flags = flags;
+				params.max_autocomplete = 20;
+				params.max_files = 20;
+
+				result = lws_fts_search(jtf, &params);
+				lwsac_free(&params.results_head);
+				if (!result) {
+					lwsl_err("%s: search failed\n",
+						 __func__);
+					lws_fts_close(jtf);
+					goto bail;
+				}
+			}
+			us = lws_now_usecs() - us;
+
+			lwsl_user("%s: '%s' (%s): %d searches, %dus per "
+				  "search\n", __func__, argv[optind],
+				  oflags & LWSFTS_F_OPEN_NO_MMAP ? "read" :
+								   "mmap",
+				  bench, (int)(us / bench));
+			optind++;
+		}
+
+		lws_fts_close(jtf);
+
+		return 0;
+	}
+
 	while (optind < argc) {
 
 		struct lws_fts_result_autocomplete *ac;
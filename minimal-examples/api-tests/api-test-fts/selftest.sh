@@ -18,7 +18,7 @@
 
 . $5/selftests-library.sh
 
-COUNT_TESTS=4
+COUNT_TESTS=14
 
 FAILS=0
 
@@ -55,4 +55,49 @@ if [ $? -ne 0 ] ; then
 	FAILS=$(( $FAILS + 1 ))
 fi
 
+#
+# the same again, but with Les Mis added to the Dorian index afterwards as a
+# delta segment
+#
+rm -f /tmp/lws-fts-seg.index*
+dotest $1 $2 apitest --add -i /tmp/lws-fts-seg.index \
+   "../minimal-examples/api-tests/api-test-fts/the-picture-of-dorian-gray.txt"
+dotest $1 $2 apitest --add -i /tmp/lws-fts-seg.index \
+   "../minimal-examples/api-tests/api-test-fts/les-mis-utf8.txt"
+
+dotest $1 $2 apitest -i /tmp/lws-fts-seg.index --segments -f -l help
+cat $2/api-test-fts/apitest.log | cut -d' ' -f5- > /tmp/fts3
+diff -urN /tmp/fts3 "../minimal-examples/api-tests/api-test-fts/canned-2.txt"
+if [ $? -ne 0 ] ; then
+	echo "Test 3 failed"
+	FAILS=$(( $FAILS + 1 ))
+fi
+
+#
+# compact Les Mis and a superseding copy of it, while adding Dorian as a new
+# segment... the add must wait for the compaction to finish and survive it,
+# giving the same results as just adding Dorian after Les Mis
+#
+rm -f /tmp/lws-fts-ref.index* /tmp/lws-fts-race.index*
+dotest $1 $2 apitest --add -i /tmp/lws-fts-ref.index \
+   "../minimal-examples/api-tests/api-test-fts/les-mis-utf8.txt"
+dotest $1 $2 apitest --add -i /tmp/lws-fts-ref.index \
+   "../minimal-examples/api-tests/api-test-fts/the-picture-of-dorian-gray.txt"
+dotest $1 $2 apitest -i /tmp/lws-fts-ref.index --segments -f -l help
+cat $2/api-test-fts/apitest.log | cut -d' ' -f5- > /tmp/fts4
+
+dotest $1 $2 apitest --add -i /tmp/lws-fts-race.index \
+   "../minimal-examples/api-tests/api-test-fts/les-mis-utf8.txt"
+dotest $1 $2 apitest --add -i /tmp/lws-fts-race.index \
+   "../minimal-examples/api-tests/api-test-fts/les-mis-utf8.txt"
+dotest $1 $2 apitest --compact-add -i /tmp/lws-fts-race.index \
+   "../minimal-examples/api-tests/api-test-fts/the-picture-of-dorian-gray.txt"
+dotest $1 $2 apitest -i /tmp/lws-fts-race.index --segments -f -l help
+cat $2/api-test-fts/apitest.log | cut -d' ' -f5- > /tmp/fts5
+diff -urN /tmp/fts5 /tmp/fts4
+if [ $? -ne 0 ] ; then
+	echo "Test 4 failed"
+	FAILS=$(( $FAILS + 1 ))
+fi
+
 exit $FAILS
@@ -0,0 +1,258 @@
+/*
+ * lws-api-test-generic-sessions
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * Drives the generic-sessions session cache and its threadpool db writes
+ * against a scratch sqlite3 db.  We check cached lookups are refreshed from
+ * the db after the ttl, and that an entry whose write the db never took is
+ * kept in the cache, and not evicted or refreshed from the db, until a later
+ * write for it succeeds.
+ */
+
+#include "private-lwsgs.h"
+
+#include <unistd.h>
+
+#define DB		"/tmp/lws-api-test-generic-sessions.sqlite3"
+#define CACHE_MAX	4
+#define TTL		1
+
+static struct per_vhost_data__gs vhd;
+
+/* wait for the threadpool to have dealt with all the writes we queued */
+
+static int
+writes_settle(void)
+{
+	unsigned int done;
+	int n;
+
+	for (n = 0; n < 50; n++) {
+		pthread_mutex_lock(&vhd.wlock);
+		done = vhd.wseq_done;
+		pthread_mutex_unlock(&vhd.wlock);
+
+		if (done == vhd.wseq)
+			return 0;
+
+		usleep(100000);
+	}
+
+	lwsl_err("%s: session writes didn't complete\n", __func__);
+
+	return 1;
+}
+
+static struct lwsgs_session_cache_entry *
+cached(const lwsgw_hash *sid)
+{
+	struct lwsgs_session_cache_entry *e = vhd.sc_lru_head;
+
+	while (e && strcmp(e->sid.id, sid->id))
+		e = e->lru_next;
+
+	return e;
+}
+
+/* the expiry the db has for the session, or -1 if it doesn't have it */
+
+static time_t
+db_expire(const lwsgw_hash *sid)
+{
+	sqlite3_stmt *sm;
+	time_t t = -1;
+
+	if (sqlite3_prepare_v2(vhd.pdb, "select expire from sessions where "
+			       "name = ?1;", -1, &sm, NULL) != SQLITE_OK)
+		return -1;
+
+	sqlite3_bind_text(sm, 1, sid->id, -1, SQLITE_STATIC);
+	if (sqlite3_step(sm) == SQLITE_ROW)
+		t = (time_t)sqlite3_column_int64(sm, 0);
+	sqlite3_finalize(sm);
+
+	return t;
+}
+
+int main(int argc, const char **argv)
+{
+	int logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE, e = 1, n;
+	struct lws_context_creation_info info;
+	struct lwsgs_session_cache_entry *ce;
+	lwsgw_hash sid, sid_other, sid_n;
+	char username[32];
+	const char *p;
+	time_t t, t1;
+
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		logs = atoi(p);
+
+	lws_set_log_level(logs, NULL);
+	lwsl_user("LWS API selftest: generic-sessions session cache\n");
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+
+	vhd.context = lws_create_context(&info);
+	if (!vhd.context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	unlink(DB);
+	lws_strncpy(vhd.session_db, DB, sizeof(vhd.session_db));
+	vhd.session_cache_max = CACHE_MAX;
+	vhd.session_cache_ttl_secs = TTL;
+	vhd.timeout_absolute_secs = 7200;
+	vhd.timeout_anon_absolute_secs = 3600;
+
+	if (sqlite3_open_v2(DB, &vhd.pdb, SQLITE_OPEN_READWRITE |
+			    SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+		lwsl_err("Unable to open %s\n", DB);
+		goto bail1;
+	}
+
+	if (sqlite3_exec(vhd.pdb, "create table sessions (name char(40), "
+			 "username varchar(32), expire integer);"
+			 "create table users (username varchar(32), "
+			 "creation_time integer, ip varchar(46), "
+			 "email varchar(100), pwhash varchar(42), "
+			 "pwsalt varchar(42), pwchange_time integer, "
+			 "token varchar(42), verified integer, "
+			 "token_time integer, last_forgot_validated integer, "
+			 "primary key (username));",
+			 NULL, NULL, NULL) != SQLITE_OK) {
+		lwsl_err("Unable to create tables: %s\n",
+			 sqlite3_errmsg(vhd.pdb));
+		goto bail2;
+	}
+
+	if (lwsgs_db_init(&vhd, 1))
+		goto bail2;
+
+	/* 1) a new session goes to the cache and, via the threadpool, the db */
+
+	t = lws_now_secs() + 3600;
+	if (lwsgs_new_session_id(&vhd, &sid, "alice", t) ||
+	    lwsgs_new_session_id(&vhd, &sid_other, "bob", t) || writes_settle())
+		goto bail;
+
+	if (db_expire(&sid) != t || !cached(&sid)) {
+		lwsl_err("%s: new session not in db and cache\n", __func__);
+		goto bail;
+	}
+
+	/* 2) something else removes a session, we see it after the ttl */
+
+	if (sqlite3_exec(vhd.pdb, "delete from sessions where username = "
+			 "'bob';", NULL, NULL, NULL) != SQLITE_OK)
+		goto bail;
+
+	if (lwsgs_lookup_session(&vhd, &sid_other, username,
+				 sizeof(username))) {
+		lwsl_err("%s: cached session not found inside ttl\n",
+			 __func__);
+		goto bail;
+	}
+
+	sleep(TTL + 1);
+
+	if (!lwsgs_lookup_session(&vhd, &sid_other, username,
+				  sizeof(username)) || cached(&sid_other)) {
+		lwsl_err("%s: removed session found after ttl\n", __func__);
+		goto bail;
+	}
+
+	/*
+	 * 3) the db refuses our update to alice's session, on the threadpool's
+	 * connection only.  After it has been retried and given up on, the
+	 * cache must keep what we told the client, despite the ttl passing
+	 * and the cache filling up behind it
+	 */
+
+	if (sqlite3_exec(vhd.pdb_tp, "create temp trigger fail_update before "
+			 "update on sessions begin select raise(fail, "
+			 "'injected'); end;", NULL, NULL, NULL) != SQLITE_OK) {
+		lwsl_err("%s: unable to create trigger: %s\n", __func__,
+			 sqlite3_errmsg(vhd.pdb_tp));
+		goto bail;
+	}
+
+	lwsl_user("%s: expect session write errors...\n", __func__);
+
+	if (lwsgw_update_session(&vhd, &sid, "alice") || !(ce = cached(&sid)))
+		goto bail;
+	t1 = ce->expire;
+
+	if (writes_settle())
+		goto bail;
+
+	sleep(TTL + 1);
+
+	if (lwsgs_lookup_session(&vhd, &sid, username, sizeof(username)) ||
+	    !(ce = cached(&sid)) || !ce->write_failed || ce->expire != t1 ||
+	    db_expire(&sid) != t) {
+		lwsl_err("%s: entry with failed write refreshed from db\n",
+			 __func__);
+		goto bail;
+	}
+
+	for (n = 0; n < CACHE_MAX; n++)
+		if (lwsgs_new_session_id(&vhd, &sid_n, "carol",
+					 lws_now_secs() + 3600))
+			goto bail;
+	if (writes_settle())
+		goto bail;
+
+	if (!(ce = cached(&sid)) || ce->expire != t1) {
+		lwsl_err("%s: entry with failed write evicted\n", __func__);
+		goto bail;
+	}
+
+	/* 4) once a later write for it works, the entry is unpinned */
+
+	if (sqlite3_exec(vhd.pdb_tp, "drop trigger fail_update;",
+			 NULL, NULL, NULL) != SQLITE_OK)
+		goto bail;
+
+	if (lwsgw_update_session(&vhd, &sid, "alice") || writes_settle())
+		goto bail;
+
+	ce = cached(&sid);
+	if (!ce || ce->write_failed || db_expire(&sid) != ce->expire) {
+		lwsl_err("%s: retried write not in db\n", __func__);
+		goto bail;
+	}
+
+	for (n = 0; n < CACHE_MAX; n++)
+		if (lwsgs_new_session_id(&vhd, &sid_n, "carol",
+					 lws_now_secs() + 3600))
+			goto bail;
+	if (writes_settle())
+		goto bail;
+
+	if (cached(&sid)) {
+		lwsl_err("%s: written entry not evicted\n", __func__);
+		goto bail;
+	}
+
+	e = 0;
+
+bail:
+	lwsgs_db_destroy(&vhd);
+bail2:
+	sqlite3_close(vhd.pdb);
+bail1:
+	lws_context_destroy(vhd.context);
+	unlink(DB);
+	unlink(DB "-wal");
+	unlink(DB "-shm");
+
+	lwsl_user("Completed: %s\n", e ? "FAIL" : "PASS");
+
+	return e;
+}
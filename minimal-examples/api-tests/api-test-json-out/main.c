@@ -0,0 +1,266 @@
+/*
+ * lws-api-test-json-out
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * Renders the same document through every output window size from the
+ * smallest the writer supports up to one bigger than the whole document,
+ * repeating each call that returned LWSJO_FULL in a fresh window the way a
+ * WRITEABLE callback would, and checks the result is always identical to
+ * the expected document.
+ */
+
+#include <libwebsockets.h>
+#include <string.h>
+
+enum {
+	JO_OBJ,
+	JO_ARR,
+	JO_END,
+	JO_STR,
+	JO_STRN,
+	JO_INT,
+	JO_UINT,
+	JO_BOOL,
+	JO_NULL,
+	JO_RAW,
+};
+
+struct jo_step {
+	char type;
+	const char *key;
+	const char *s;
+	size_t len;
+	int64_t i;
+	uint64_t u;
+};
+
+static const struct jo_step doc[] = {
+	{ JO_OBJ,  NULL,	NULL, 0, 0, 0 },
+	{ JO_STR,  "name",	"lws \"json\"\n\ttest", 0, 0, 0 },
+	{ JO_INT,  "k\\ey",	NULL, 0, -1234567890123ll, 0 },
+	{ JO_UINT, "max",	NULL, 0, 0, 18446744073709551615ull },
+	{ JO_ARR,  "flags",	NULL, 0, 0, 0 },
+	{ JO_BOOL, NULL,	NULL, 0, 1, 0 },
+	{ JO_BOOL, NULL,	NULL, 0, 0, 0 },
+	{ JO_NULL, NULL,	NULL, 0, 0, 0 },
+	{ JO_RAW,  NULL,	"1.5e3", 0, 0, 0 },
+	{ JO_ARR,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_OBJ,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_OBJ,  "nested",	NULL, 0, 0, 0 },
+	{ JO_OBJ,  "a",		NULL, 0, 0, 0 },
+	{ JO_OBJ,  "b\x1f",	NULL, 0, 0, 0 },
+	{ JO_ARR,  "c",		NULL, 0, 0, 0 },
+	{ JO_STR,  NULL,	"x\x01y\r\b\f", 0, 0, 0 },
+	{ JO_STR,  NULL,	"0123456789abcdef0123456789\\abcdef"
+				"0123456789abcdef\"", 0, 0, 0 },
+	{ JO_STR,  NULL,	"", 0, 0, 0 },
+	{ JO_INT,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+	{ JO_STR,  "utf8",	"caf\xc3\xa9 \xe2\x82\xac", 0, 0, 0 },
+	{ JO_STRN, "part",	"abcdef", 3, 0, 0 },
+	{ JO_STR,  "none",	NULL, 0, 0, 0 },
+	{ JO_END,  NULL,	NULL, 0, 0, 0 },
+};
+
+static const char *expected =
+	"{\"name\":\"lws \\\"json\\\"\\n\\ttest\","
+	"\"k\\\\ey\":-1234567890123,"
+	"\"max\":18446744073709551615,"
+	"\"flags\":[true,false,null,1.5e3,[],{}],"
+	"\"nested\":{\"a\":{\"b\\u001f\":{\"c\":["
+		"\"x\\u0001y\\r\\b\\f\","
+		"\"0123456789abcdef0123456789\\\\abcdef"
+		"0123456789abcdef\\\"\","
+		"\"\",0]}}},"
+	"\"utf8\":\"caf\xc3\xa9 \xe2\x82\xac\","
+	"\"part\":\"abc\","
+	"\"none\":null}";
+
+static int
+step(struct lws_json_out *j, const struct jo_step *s)
+{
+	switch (s->type) {
+	case JO_OBJ:
+		return lws_json_out_obj(j, s->key);
+	case JO_ARR:
+		return lws_json_out_arr(j, s->key);
+	case JO_END:
+		return lws_json_out_end(j);
+	case JO_STR:
+		return lws_json_out_str(j, s->key, s->s);
+	case JO_STRN:
+		return lws_json_out_strn(j, s->key, s->s, s->len);
+	case JO_INT:
+		return lws_json_out_int(j, s->key, s->i);
+	case JO_UINT:
+		return lws_json_out_uint(j, s->key, s->u);
+	case JO_BOOL:
+		return lws_json_out_bool(j, s->key, (int)s->i);
+	case JO_NULL:
+		return lws_json_out_null(j, s->key);
+	case JO_RAW:
+		return lws_json_out_raw(j, s->key, s->s);
+	}
+
+	return LWSJO_ERR;
+}
+
+/*
+ * Render doc into out, using windows of size win.  Returns the length of the
+ * output, or -1 on error.
+ */
+
+static int
+render(char *out, size_t out_len, size_t win)
+{
+	struct lws_json_out j;
+	char window[1024];
+	size_t n, used = 0;
+	int m, r;
+
+	lws_json_out_init(&j, window, win);
+
+	for (n = 0; n < LWS_ARRAY_SIZE(doc); n++) {
+		while ((r = step(&j, &doc[n])) == LWSJO_FULL) {
+			m = lws_ptr_diff(j.p, window);
+			if (!m) {
+				lwsl_err("%s: win %d: no progress at step %d\n",
+					 __func__, (int)win, (int)n);
+				return -1;
+			}
+			if (used + (size_t)m > out_len)
+				return -1;
+
+			/* "send" the window, then repeat the call */
+			memcpy(out + used, window, (size_t)m);
+			used += (size_t)m;
+			lws_json_out_window(&j, window, win);
+		}
+		if (r != LWSJO_OK) {
+			lwsl_err("%s: win %d: step %d failed\n", __func__,
+				 (int)win, (int)n);
+			return -1;
+		}
+	}
+
+	if (!lws_json_out_done(&j)) {
+		lwsl_err("%s: win %d: not done\n", __func__, (int)win);
+		return -1;
+	}
+
+	m = lws_ptr_diff(j.p, window);
+	if (used + (size_t)m > out_len)
+		return -1;
+	memcpy(out + used, window, (size_t)m);
+
+	return (int)(used + (size_t)m);
+}
+
+/* the usage errors are reported rather than producing bad JSON */
+
+static int
+test_errors(void)
+{
+	struct lws_json_out j;
+	char buf[256];
+	int n, e = 0;
+
+	lws_json_out_init(&j, buf, sizeof(buf));
+	if (lws_json_out_end(&j) != LWSJO_ERR)
+		e++;
+	if (lws_json_out_str(&j, "key", "at top level") != LWSJO_ERR)
+		e++;
+	if (lws_json_out_obj(&j, NULL) != LWSJO_OK)
+		e++;
+	if (lws_json_out_int(&j, NULL, 1) != LWSJO_ERR)
+		e++;
+	if (lws_json_out_arr(&j, "a") != LWSJO_OK)
+		e++;
+	if (lws_json_out_int(&j, "in array", 1) != LWSJO_ERR)
+		e++;
+
+	/* nesting too deep */
+
+	for (n = 0; n < LWS_JSON_OUT_MAX_DEPTH; n++)
+		if (lws_json_out_arr(&j, NULL) != LWSJO_OK)
+			break;
+	if (n == LWS_JSON_OUT_MAX_DEPTH)
+		e++;
+
+	if (e)
+		lwsl_err("%s: %d usage errors not reported\n", __func__, e);
+
+	return e;
+}
+
+int main(int argc, const char **argv)
+{
+	int n, len, logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE, e = 0;
+	char one[1024], out[1024];
+	size_t win;
+	const char *p;
+
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		logs = atoi(p);
+
+	lws_set_log_level(logs, NULL);
+	lwsl_user("LWS API selftest: JSON writer\n");
+
+	/* everything in one window */
+
+	len = render(one, sizeof(one), sizeof(one) - 1);
+	if (len < 0)
+		goto bail;
+
+	if ((size_t)len != strlen(expected) || memcmp(one, expected, len)) {
+		lwsl_err("%s: one window render differs\n", __func__);
+		one[len] = '\0';
+		lwsl_err("%s: got %s\n", __func__, one);
+		lwsl_err("%s: exp %s\n", __func__, expected);
+		goto bail;
+	}
+
+	/*
+	 * every window size from the minimum, which is the length of the
+	 * longest escape sequence "\u00xx", up to bigger than the document
+	 */
+
+	for (win = 6; win <= (size_t)len + 1; win++) {
+		n = render(out, sizeof(out), win);
+		if (n != len || memcmp(out, one, len)) {
+			lwsl_err("%s: win %d: render differs\n", __func__,
+				 (int)win);
+			if (n >= 0) {
+				out[n] = '\0';
+				lwsl_err("%s: got %s\n", __func__, out);
+			}
+			e++;
+		}
+	}
+
+	lwsl_notice("%s: %d window sizes from 6 to %d\n", __func__,
+		    len - 4, len + 1);
+
+	e += test_errors();
+	if (e)
+		goto bail;
+
+	lwsl_user("Completed: PASS\n");
+
+	return 0;
+
+bail:
+	lwsl_user("Completed: FAIL\n");
+
+	return 1;
+}
@@ -0,0 +1,206 @@
+/*
+ * lws-api-test-ratelimit
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * A ws client floods a vhost with a byte rate limit, over a connection to
+ * itself.  We check the server side received about what the limit allows in
+ * the time, including the initial burst, and that while its connection is
+ * held the service loop waits in poll() rather than spinning.
+ */
+
+#include <libwebsockets.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define RATE		(64 * 1024)	/* vhost limit in bytes/s */
+#define SECS		3		/* how long we flood for */
+#define CHUNK		4096		/* size of each ws message sent */
+
+static volatile int interrupted;
+static struct lws *client_wsi;
+static size_t rx, tx;
+static int established;
+
+static int
+callback_flood(struct lws *wsi, enum lws_callback_reasons reason,
+	       void *user, void *in, size_t len)
+{
+	uint8_t buf[LWS_PRE + CHUNK];
+
+	switch (reason) {
+
+	/* --- server side --- */
+
+	case LWS_CALLBACK_RECEIVE:
+		rx += len;
+		break;
+
+	/* --- client side --- */
+
+	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+		lwsl_err("%s: client connection error: %s\n", __func__,
+			 in ? (char *)in : "(null)");
+		client_wsi = NULL;
+		interrupted = 1;
+		break;
+
+	case LWS_CALLBACK_CLIENT_ESTABLISHED:
+		established = 1;
+		lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_CLIENT_WRITEABLE:
+		if (interrupted)
+			break;
+		memset(&buf[LWS_PRE], 'x', CHUNK);
+		if (lws_write(wsi, &buf[LWS_PRE], CHUNK, LWS_WRITE_BINARY) <
+								CHUNK)
+			return -1;
+		tx += CHUNK;
+		lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_CLIENT_CLOSED:
+		client_wsi = NULL;
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "lws-flood", callback_flood, 0, CHUNK, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+static lws_usec_t
+cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ((lws_usec_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		LWS_USEC_PER_SEC + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+void sigint_handler(int sig)
+{
+	interrupted = 1;
+}
+
+int main(int argc, const char **argv)
+{
+	int logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE, e = 1;
+	struct lws_context_creation_info info;
+	struct lws_client_connect_info i;
+	lws_usec_t start, cpu, wall;
+	struct lws_context *context;
+	const char *p;
+	time_t t;
+
+	signal(SIGINT, sigint_handler);
+
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		logs = atoi(p);
+
+	lws_set_log_level(logs, NULL);
+	lwsl_user("LWS API selftest: rate limiting\n");
+
+	memset(&info, 0, sizeof info);
+	info.port = 7692;
+	info.iface = "127.0.0.1";
+	info.protocols = protocols;
+	info.vh_limit_byte_rate = RATE;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	memset(&i, 0, sizeof i);
+	i.context = context;
+	i.port = info.port;
+	i.address = "127.0.0.1";
+	i.path = "/";
+	i.host = i.address;
+	i.origin = i.address;
+	i.protocol = protocols[0].name;
+	i.pwsi = &client_wsi;
+
+	if (!lws_client_connect_via_info(&i)) {
+		lwsl_err("%s: client connect failed\n", __func__);
+		goto bail;
+	}
+
+	t = time(NULL) + 5;
+	while (!interrupted && !established && time(NULL) < t)
+		lws_service(context, 50);
+	if (!established) {
+		lwsl_err("%s: client didn't connect\n", __func__);
+		goto bail;
+	}
+
+	/* flood the server for SECS, measuring how hard we worked */
+
+	start = lws_time_in_microseconds();
+	cpu = cpu_us();
+
+	while (!interrupted && client_wsi &&
+	       lws_time_in_microseconds() - start < SECS * LWS_USEC_PER_SEC)
+		lws_service(context, 1000);
+
+	wall = lws_time_in_microseconds() - start;
+	cpu = cpu_us() - cpu;
+
+	lwsl_notice("%s: sent %lu, received %lu in %lldms, cpu %lldms\n",
+		    __func__, (unsigned long)tx, (unsigned long)rx,
+		    (long long)wall / 1000, (long long)cpu / 1000);
+
+	if (!client_wsi) {
+		lwsl_err("%s: client connection closed\n", __func__);
+		goto bail;
+	}
+
+	/*
+	 * The bucket starts full with a second's worth, and may go into debt
+	 * by up to one read, which may include the ws framing
+	 */
+
+	if (rx > (size_t)RATE * (SECS + 1) + 2 * CHUNK) {
+		lwsl_err("%s: received more than the rate allows\n", __func__);
+		goto bail;
+	}
+	if (rx < (size_t)RATE * SECS) {
+		lwsl_err("%s: received much less than the rate allows\n",
+			 __func__);
+		goto bail;
+	}
+
+	/* while the server connection is held, we should be idle in poll() */
+
+	if (cpu > wall / 4) {
+		lwsl_err("%s: service loop busy while held\n", __func__);
+		goto bail;
+	}
+
+	e = 0;
+
+bail:
+	interrupted = 1;
+	lws_context_destroy(context);
+
+	lwsl_user("Completed: %s\n", e ? "FAIL" : "PASS");
+
+	return e;
+}
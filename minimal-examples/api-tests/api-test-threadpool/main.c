@@ -0,0 +1,243 @@
+/*
+ * lws-api-test-threadpool
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * A pool with one worker is kept busy by a blocking task while others are
+ * queued behind it in different priority classes, with and without
+ * deadlines.  We check that a queued task whose deadline passes is expired
+ * by the service thread even though nothing else happens in the pool, and
+ * that when the worker is freed the rest are started by priority, then
+ * deadline, then in the order they were queued.
+ */
+
+#include <libwebsockets.h>
+#include <pthread.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+struct tp_test_task {
+	const char *name;
+	unsigned char priority;
+	lws_usec_t deadline_us;
+	char ran;
+	char cleaned;
+};
+
+static struct tp_test_task tasks[] = {
+	{ "blocker",	0, 0 },
+	{ "expires",	3, 200000 },
+	{ "A",		0, 0 },
+	{ "B",		2, 0 },
+	{ "C",		1, 0 },
+	{ "D",		2, 0 },
+	{ "E",		0, 0 },
+	{ "H",		1, 30 * LWS_USEC_PER_SEC },
+};
+
+/* the order the queued tasks are expected to be started in */
+static const char *expected = "B D H C A E ";
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char order[64];
+static volatile int release, interrupted;
+
+static enum lws_threadpool_task_return
+task_function(void *user, enum lws_threadpool_task_status s)
+{
+	struct tp_test_task *t = (struct tp_test_task *)user;
+
+	if (s != LWS_TP_STATUS_RUNNING)
+		return LWS_TP_RETURN_STOPPED;
+
+	pthread_mutex_lock(&lock);
+	if (!t->ran && t != &tasks[0]) {
+		strcat(order, t->name);
+		strcat(order, " ");
+	}
+	t->ran = 1;
+	pthread_mutex_unlock(&lock);
+
+	if (t == &tasks[0] && !release) {
+		/* hold on to the only worker until we're told to stop */
+		usleep(10000);
+
+		return LWS_TP_RETURN_CHECKING_IN;
+	}
+
+	return LWS_TP_RETURN_FINISHED;
+}
+
+static void
+cleanup_function(struct lws *wsi, void *user)
+{
+	struct tp_test_task *t = (struct tp_test_task *)user;
+
+	pthread_mutex_lock(&lock);
+	t->cleaned = 1;
+	pthread_mutex_unlock(&lock);
+}
+
+static int
+count_cleaned(void)
+{
+	int n, m = 0;
+
+	pthread_mutex_lock(&lock);
+	for (n = 0; n < (int)LWS_ARRAY_SIZE(tasks); n++)
+		m += tasks[n].cleaned;
+	pthread_mutex_unlock(&lock);
+
+	return m;
+}
+
+/* service until test() is true or secs have passed */
+
+static int
+service_until(struct lws_context *context, int (*test)(void), int secs)
+{
+	time_t t = time(NULL) + secs;
+
+	while (!interrupted && time(NULL) < t) {
+		if (test())
+			return 0;
+		lws_service(context, 50);
+	}
+
+	return 1;
+}
+
+static int
+expired(void)
+{
+	return tasks[1].cleaned;
+}
+
+static int
+all_done(void)
+{
+	return count_cleaned() == (int)LWS_ARRAY_SIZE(tasks);
+}
+
+static int
+blocker_running(void)
+{
+	return tasks[0].ran;
+}
+
+void sigint_handler(int sig)
+{
+	interrupted = 1;
+}
+
+int main(int argc, const char **argv)
+{
+	int n, logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE, e = 1;
+	struct lws_threadpool_create_args cargs;
+	struct lws_threadpool_task_args targs;
+	struct lws_threadpool_class_stats cs;
+	struct lws_context_creation_info info;
+	struct lws_context *context;
+	struct lws_threadpool *tp;
+	const char *p;
+
+	signal(SIGINT, sigint_handler);
+
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		logs = atoi(p);
+
+	lws_set_log_level(logs, NULL);
+	lwsl_user("LWS API selftest: threadpool\n");
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	memset(&cargs, 0, sizeof(cargs));
+	cargs.threads = 1;
+	cargs.max_queue_depth = 16;
+
+	tp = lws_threadpool_create(context, &cargs, "tp-test");
+	if (!tp) {
+		lwsl_err("%s: threadpool create failed\n", __func__);
+		goto bail1;
+	}
+
+	for (n = 0; n < (int)LWS_ARRAY_SIZE(tasks); n++) {
+		memset(&targs, 0, sizeof(targs));
+		targs.user = &tasks[n];
+		targs.async_task = 1;
+		targs.task = task_function;
+		targs.cleanup = cleanup_function;
+		targs.priority = tasks[n].priority;
+		targs.deadline_us = tasks[n].deadline_us;
+
+		if (!lws_threadpool_enqueue(tp, &targs, "%s", tasks[n].name)) {
+			lwsl_err("%s: enqueue %s failed\n", __func__,
+				 tasks[n].name);
+			goto bail;
+		}
+
+		/* everything else must queue up behind the blocker */
+
+		if (!n && service_until(context, blocker_running, 5)) {
+			lwsl_err("%s: blocker didn't start\n", __func__);
+			goto bail;
+		}
+	}
+
+	/*
+	 * The worker is busy and nothing else is queued, so it's down to the
+	 * service thread to notice the deadline has passed
+	 */
+
+	if (service_until(context, expired, 5)) {
+		lwsl_err("%s: task with passed deadline not expired\n",
+			 __func__);
+		goto bail;
+	}
+	if (tasks[1].ran) {
+		lwsl_err("%s: task with passed deadline was run\n", __func__);
+		goto bail;
+	}
+	if (lws_threadpool_class_stats(tp, 3, &cs) || cs.expired != 1) {
+		lwsl_err("%s: expiry not counted\n", __func__);
+		goto bail;
+	}
+	lwsl_notice("%s: queued task expired while the worker was busy\n",
+		    __func__);
+
+	release = 1;
+
+	if (service_until(context, all_done, 5)) {
+		lwsl_err("%s: tasks didn't complete\n", __func__);
+		goto bail;
+	}
+
+	lwsl_notice("%s: started in order %s\n", __func__, order);
+	if (strcmp(order, expected)) {
+		lwsl_err("%s: expected order %s\n", __func__, expected);
+		goto bail;
+	}
+
+	e = 0;
+
+bail:
+	lws_threadpool_finish(tp);
+	lws_threadpool_destroy(tp);
+bail1:
+	lws_context_destroy(context);
+
+	lwsl_user("Completed: %s\n", e ? "FAIL" : "PASS");
+
+	return e;
+}
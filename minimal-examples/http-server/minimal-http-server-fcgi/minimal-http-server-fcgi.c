@@ -0,0 +1,118 @@
+/*
+ * lws-minimal-http-server-fcgi
+ *
+ * Copyright (C) 2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * This demonstrates passing requests to an already-running FastCGI worker,
+ * eg, php-fpm, rather than spawning a CGI process for each one.
+ *
+ * It serves "./mount-origin" on /, and passes anything under /fcgi to the
+ * worker listening on the unix domain socket /tmp/lws-fcgi.sock, or the
+ * address given with --fcgi, eg, --fcgi 127.0.0.1:9000
+ */
+
+#include <libwebsockets.h>
+#include <string.h>
+#include <signal.h>
+
+static int interrupted;
+
+/* php-fpm needs to be told which script to run */
+
+static const struct lws_protocol_vhost_options pvo_script = {
+	NULL, NULL, "SCRIPT_FILENAME", "/var/www/fcgi/index.php"
+};
+
+static struct lws_http_mount mount_fcgi = {
+	/* .mount_next */		NULL,		/* linked-list "next" */
+	/* .mountpoint */		"/fcgi",	/* mountpoint URL */
+	/* .origin */			"/tmp/lws-fcgi.sock", /* worker address */
+	/* .def */			NULL,
+	/* .protocol */			NULL,
+	/* .cgienv */			&pvo_script,
+	/* .extra_mimetypes */		NULL,
+	/* .interpret */		NULL,
+	/* .cgi_timeout */		10,
+	/* .cache_max_age */		0,
+	/* .auth_mask */		0,
+	/* .cache_reusable */		0,
+	/* .cache_revalidate */		0,
+	/* .cache_intermediaries */	0,
+	/* .origin_protocol */		LWSMPRO_FCGI,	/* fastcgi worker */
+	/* .mountpoint_len */		5,		/* char count */
+	/* .basic_auth_login_file */	NULL,
+};
+
+static const struct lws_http_mount mount = {
+	/* .mount_next */		&mount_fcgi,	/* linked-list "next" */
+	/* .mountpoint */		"/",		/* mountpoint URL */
+	/* .origin */			"./mount-origin", /* serve from dir */
+	/* .def */			"index.html",	/* default filename */
+	/* .protocol */			NULL,
+	/* .cgienv */			NULL,
+	/* .extra_mimetypes */		NULL,
+	/* .interpret */		NULL,
+	/* .cgi_timeout */		0,
+	/* .cache_max_age */		0,
+	/* .auth_mask */		0,
+	/* .cache_reusable */		0,
+	/* .cache_revalidate */		0,
+	/* .cache_intermediaries */	0,
+	/* .origin_protocol */		LWSMPRO_FILE,	/* files in a dir */
+	/* .mountpoint_len */		1,		/* char count */
+	/* .basic_auth_login_file */	NULL,
+};
+
+void sigint_handler(int sig)
+{
+	interrupted = 1;
+}
+
+int main(int argc, const char **argv)
+{
+	struct lws_context_creation_info info;
+	struct lws_context *context;
+	const char *p;
+	int n = 0, logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE
+			/* for LLL_ verbosity above NOTICE to be built into lws,
+			 * lws must have been configured and built with
+			 * -DCMAKE_BUILD_TYPE=DEBUG instead of =RELEASE */
+			/* | LLL_INFO */ /* | LLL_PARSER */ /* | LLL_HEADER */
+			/* | LLL_EXT */ /* | LLL_CLIENT */ /* | LLL_LATENCY */
+			/* | LLL_DEBUG */;
+
+	signal(SIGINT, sigint_handler);
+
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		logs = atoi(p);
+
+	if ((p = lws_cmdline_option(argc, argv, "--fcgi")))
+		mount_fcgi.origin = p;
+
+	lws_set_log_level(logs, NULL);
+	lwsl_user("LWS minimal http server fcgi | visit http://localhost:7681\n");
+	lwsl_user("  /fcgi is passed to the FastCGI worker at %s\n",
+		  mount_fcgi.origin);
+
+	memset(&info, 0, sizeof info); /* otherwise uninitialized garbage */
+	info.port = 7681;
+	info.mounts = &mount;
+	info.options =
+		LWS_SERVER_OPTION_HTTP_HEADERS_SECURITY_BEST_PRACTICES_ENFORCE;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	while (n >= 0 && !interrupted)
+		n = lws_service(context, 1000);
+
+	lws_context_destroy(context);
+
+	return 0;
+}
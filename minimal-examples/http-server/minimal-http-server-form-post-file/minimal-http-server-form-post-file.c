@@ -10,6 +10,9 @@
  * of parameters and a file upload, all in multipart (mime) form mode.
  * It saves the uploaded file in the current directory, dumps the parameters to
  * the console log and redirects to another page.
+ *
+ * With --dir <dir>, lws saves the uploaded file into <dir> itself, using
+ * lws_spa_set_upload_dir().
  */
 
 #include <libwebsockets.h>
@@ -33,6 +36,7 @@ struct pss {
 };
 
 static int interrupted;
+static const char *upload_dir;
 
 static const char * const param_names[] = {
 	"text1",
@@ -50,6 +54,15 @@ file_upload_cb(void *data, const char *name, const char *filename,
 {
 	struct pss *pss = (struct pss *)data;
 
+	if (upload_dir) {
+		/* lws is saving the file, we're just told about it */
+		if (state == LWS_UFS_FINAL_CONTENT)
+			lwsl_user("%s: upload done, saved %s in %s\n", __func__,
+				  filename, upload_dir);
+
+		return 0;
+	}
+
 	switch (state) {
 	case LWS_UFS_OPEN:
 		/* take a copy of the provided filename */
@@ -130,6 +143,9 @@ callback_http(struct lws *wsi, enum lws_callback_reasons reason, void *user,
 					file_upload_cb, pss);
 			if (!pss->spa)
 				return -1;
+			if (upload_dir &&
+			    lws_spa_set_upload_dir(pss->spa, upload_dir))
+				return -1;
 		}
 
 		/* let it parse the POST data */
@@ -233,6 +249,8 @@ int main(int argc, const char **argv)
 	if ((p = lws_cmdline_option(argc, argv, "-d")))
 		logs = atoi(p);
 
+	upload_dir = lws_cmdline_option(argc, argv, "--dir");
+
 	lws_set_log_level(logs, NULL);
 	lwsl_user("LWS minimal http server POST file | visit http://localhost:7681\n");
 
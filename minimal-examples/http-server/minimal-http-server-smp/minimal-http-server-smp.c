@@ -22,6 +22,7 @@
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #define COUNT_THREADS 8
 
@@ -68,6 +69,7 @@ int main(int argc, const char **argv)
 {
 	pthread_t pthread_service[COUNT_THREADS];
 	struct lws_context_creation_info info;
+	int cpus[COUNT_THREADS];
 	void *retval;
 	const char *p;
 	int n = 0, logs = LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE
@@ -96,6 +98,13 @@ int main(int argc, const char **argv)
 	else
 		info.count_threads = COUNT_THREADS;
 
+	if (lws_cmdline_option(argc, argv, "--pin")) {
+		/* pin the service threads to the cpus in turn */
+		for (n = 0; n < COUNT_THREADS; n++)
+			cpus[n] = n % (int)sysconf(_SC_NPROCESSORS_ONLN);
+		info.pt_cpus = cpus;
+	}
+
 	if (lws_cmdline_option(argc, argv, "-s")) {
 		info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
 		info.ssl_cert_filepath = "localhost-100y.cert";
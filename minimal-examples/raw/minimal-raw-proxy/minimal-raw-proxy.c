@@ -10,6 +10,10 @@
  * cause an outgoing connection to be initiated, and if successfully established
  * then traffic coming in one side is placed on a ringbuffer and sent out the
  * opposite side as soon as possible.
+ *
+ * Where the platform supports it, the plugin has the kernel splice the data
+ * between the two sockets instead, so it is never copied through userspace.
+ * --no-splice makes it use the ringbuffers anyway, for comparison.
  */
 
 #include <libwebsockets.h>
@@ -32,6 +36,13 @@ void sigint_handler(int sig)
 	interrupted = 1;
 }
 
+static struct lws_protocol_vhost_options pvo2 = {
+        NULL,
+        NULL,
+        "no-splice",          /* pvo name */
+        ""    /* pvo value */
+};
+
 static struct lws_protocol_vhost_options pvo1 = {
         NULL,
         NULL,
@@ -68,6 +79,9 @@ int main(int argc, const char **argv)
 		pvo1.value = outward;
 	}
 
+	if (lws_cmdline_option(argc, argv, "--no-splice"))
+		pvo1.next = &pvo2;
+
 	memset(&info, 0, sizeof info); /* otherwise uninitialized garbage */
 	info.port = 7681;
 	info.protocols = protocols;
@@ -330,10 +330,10 @@ lwsgs_handler_change_password(struct per_vhost_data__gs *vhd, struct lws *wsi,
 		lws_callback_vhost_protocols_vhost(lws_get_vhost(wsi),
 						   LWS_CALLBACK_GS_EVENT, &a, 0);
 
+		lwsgs_delete_user_sessions(vhd, u.username);
+
 		lws_snprintf(s, sizeof(s) - 1,
-			 "delete from users where username='%s';"
-			 "delete from sessions where username='%s';",
-			 lws_sql_purify(esc, u.username, sizeof(esc) - 1),
+			 "delete from users where username='%s';",
 			 lws_sql_purify(esc, u.username, sizeof(esc) - 1));
 		goto sql;
 	}
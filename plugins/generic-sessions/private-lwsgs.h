@@ -25,8 +25,15 @@
 
 #include <sqlite3.h>
 #include <string.h>
+#if defined(LWS_WITH_THREADPOOL)
+#include <pthread.h>
+#endif
 
 #define LWSGS_VERIFIED_ACCEPTED 100
+#define LWSGS_SESSION_CACHE_BUCKETS 256
+#define LWSGS_SESSION_WRITE_QUEUE_MAX 1024
+/* attempts at a threadpool session write before giving up on it */
+#define LWSGS_SESSION_WRITE_TRIES 5
 
 enum {
 	FGS_USERNAME,
@@ -61,6 +68,44 @@ struct lwsgs_user {
 	int verified;
 };
 
+/* prepared statements, indexes into the vhd sm[] */
+
+enum {
+	LWSGS_SQL_SESSION_LOOKUP,
+	LWSGS_SQL_USER_LOOKUP,
+
+	/* the ones below are session writes, these may go on the threadpool */
+
+	LWSGS_SQL_SESSION_INSERT,
+	LWSGS_SQL_SESSION_UPDATE,
+	LWSGS_SQL_SESSION_EXPIRE,
+	LWSGS_SQL_SESSION_DELETE_USER,
+
+	LWSGS_SQL_COUNT
+};
+
+struct lwsgs_session_cache_entry {
+	struct lwsgs_session_cache_entry *hash_next;
+	struct lwsgs_session_cache_entry *lru_prev;
+	struct lwsgs_session_cache_entry *lru_next;
+	lwsgw_hash sid;
+	char username[32];
+	time_t expire;		/* session expiry, as in the db */
+	time_t fetched;		/* when we last knew the entry matched the db */
+	unsigned int wseq;	/* seq of the last db write queued for it */
+	uint32_t hash;
+	char write_failed;	/* the db never got that write */
+};
+
+struct lwsgs_user_delete {
+	struct lwsgs_user_delete *next;
+	char username[32];
+	unsigned int seq;	/* of the queued delete of their sessions */
+	char failed;		/* the db never did it */
+};
+
+struct lwsgs_session_write;
+
 struct per_vhost_data__gs {
 	struct lws_email email;
 	struct lwsgs_user u;
@@ -74,6 +119,23 @@ struct per_vhost_data__gs {
 	char email_confirm_url[128];
 	lwsgw_hash admin_password_sha1;
 	sqlite3 *pdb;
+	sqlite3_stmt *sm[LWSGS_SQL_COUNT];
+	struct lwsgs_session_cache_entry *sc_hash[LWSGS_SESSION_CACHE_BUCKETS];
+	struct lwsgs_session_cache_entry *sc_lru_head, *sc_lru_tail;
+#if defined(LWS_WITH_THREADPOOL)
+	struct lws_threadpool *tp;
+	sqlite3 *pdb_tp;	/* session writes on the threadpool use this */
+	sqlite3_stmt *sm_tp[LWSGS_SQL_COUNT];
+	pthread_mutex_t wlock;	/* protects wseq_done and wq_failed */
+	unsigned int wseq_done;
+	struct lwsgs_session_write *wq_failed; /* writes we gave up on */
+	struct lwsgs_user_delete *user_deletes;
+	struct lwsgs_session_write *wq_flush;
+#endif
+	unsigned int wseq;
+	int session_cache_max;
+	int session_cache_ttl_secs;
+	int session_cache_count;
 	int timeout_idle_secs;
 	int timeout_absolute_secs;
 	int timeout_anon_absolute_secs;
@@ -139,6 +201,13 @@ lwsgw_update_session(struct per_vhost_data__gs *vhd,
 		     lwsgw_hash *hash, const char *user);
 int
 lwsgw_expire_old_sessions(struct per_vhost_data__gs *vhd);
+int
+lwsgs_delete_user_sessions(struct per_vhost_data__gs *vhd,
+			   const char *username);
+int
+lwsgs_db_init(struct per_vhost_data__gs *vhd, int threadpool);
+void
+lwsgs_db_destroy(struct per_vhost_data__gs *vhd);
 
 
 /* handlers.c */
@@ -196,7 +196,6 @@ lwsgs_subst(void *data, int index)
 	struct lwsgs_subst_args *a = (struct lwsgs_subst_args *)data;
 	struct lwsgs_user u;
 	lwsgw_hash sid;
-	char esc[50], s[100];
 	int n;
 
 	a->pss->result[0] = '\0';
@@ -207,13 +206,7 @@ lwsgs_subst(void *data, int index)
 			a->pss->delete_session = sid;
 			return NULL;
 		}
-		lws_snprintf(s, sizeof(s) - 1, "select username,email "
-			 "from users where username = '%s';",
-			 lws_sql_purify(esc, a->pss->result, sizeof(esc) - 1));
-		if (sqlite3_exec(a->vhd->pdb, s, lwsgs_lookup_callback_user,
-				 &u, NULL) != SQLITE_OK) {
-			lwsl_err("Unable to lookup token: %s\n",
-				 sqlite3_errmsg(a->vhd->pdb));
+		if (lwsgs_lookup_user(a->vhd, a->pss->result, &u) < 0) {
 			a->pss->delete_session = sid;
 			return NULL;
 		}
@@ -255,7 +248,7 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 	sqlite3_stmt *sm;
 	lwsgw_hash sid;
 	const char *cp;
-	int n;
+	int n, tp = 0;
 
 	switch (reason) {
 	case LWS_CALLBACK_PROTOCOL_INIT: /* per vhost */
@@ -271,6 +264,8 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 		vhd->timeout_absolute_secs = 36000;
 		vhd->timeout_anon_absolute_secs = 1200;
 		vhd->timeout_email_secs = 24 * 3600;
+		vhd->session_cache_max = 1024;
+		vhd->session_cache_ttl_secs = 60;
 		strcpy(vhd->email.email_helo, "unconfigured.com");
 		strcpy(vhd->email.email_from, "noreply@unconfigured.com");
 		strcpy(vhd->email_title, "Registration Email from unconfigured");
@@ -325,6 +320,12 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 				vhd->timeout_anon_absolute_secs = atoi(pvo->value);
 			if (!strcmp(pvo->name, "email-expire"))
 				vhd->timeout_email_secs = atoi(pvo->value);
+			if (!strcmp(pvo->name, "session-cache-size"))
+				vhd->session_cache_max = atoi(pvo->value);
+			if (!strcmp(pvo->name, "session-cache-ttl-secs"))
+				vhd->session_cache_ttl_secs = atoi(pvo->value);
+			if (!strcmp(pvo->name, "session-db-threadpool"))
+				tp = atoi(pvo->value);
 			pvo = pvo->next;
 		}
 		if (!vhd->admin_user[0] ||
@@ -401,6 +402,9 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 			return 1;
 		}
 
+		if (lwsgs_db_init(vhd, tp))
+			return 1;
+
 		lws_email_init(&vhd->email, lws_uv_getloop(vhd->context, 0),
 				LWSGS_EMAIL_CONTENT_SIZE);
 
@@ -410,6 +414,7 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 	case LWS_CALLBACK_PROTOCOL_DESTROY:
 	//	lwsl_notice("gs: LWS_CALLBACK_PROTOCOL_DESTROY: v=%p, ctx=%p\n", vhd, vhd->context);
 		if (vhd->pdb) {
+			lwsgs_db_destroy(vhd);
 			sqlite3_close(vhd->pdb);
 			vhd->pdb = NULL;
 		}
@@ -519,15 +524,9 @@ callback_generic_sessions(struct lws *wsi, enum lws_callback_reasons reason,
 		if (lwsgs_lookup_session(vhd, &sid, username, sizeof(username)))
 			break;
 
-		lws_snprintf(s, sizeof(s) - 1,
-			 "select username, email from users where username='%s';",
-			 username);
-		if (sqlite3_exec(vhd->pdb, s, lwsgs_lookup_callback_user, &u, NULL) !=
-		    SQLITE_OK) {
-			lwsl_err("Unable to lookup token: %s\n",
-				 sqlite3_errmsg(vhd->pdb));
+		u.email[0] = '\0';
+		if (lwsgs_lookup_user(vhd, username, &u) < 0)
 			break;
-		}
 		lws_strncpy(sinfo->username, u.username, sizeof(sinfo->username));
 		lws_strncpy(sinfo->email, u.email, sizeof(sinfo->email));
 		lws_strncpy(sinfo->session, sid.id, sizeof(sinfo->session));
@@ -21,6 +21,9 @@
 
 #include "private-lwsgs.h"
 #include <stdlib.h>
+#if defined(LWS_WITH_THREADPOOL)
+#include <unistd.h>
+#endif
 
 void
 sha1_to_lwsgw_hash(unsigned char *hash, lwsgw_hash *shash)
@@ -77,24 +80,540 @@ lwsgw_cookie_from_session(lwsgw_hash *sid, time_t expires, char **p, char *end)
 	*p += lws_snprintf(*p, end - *p, ";HttpOnly");
 }
 
+/*
+ * The session and user statements we use on every request are prepared once
+ * at init.  The parameters are numbered so every statement can be bound the
+ * same way: ?1 is the session name, ?2 the username and ?3 the expiry time.
+ */
+
+static const char * const lwsgs_sql[] = {
+	"select username, expire from sessions where name = ?1;",
+	"select username, creation_time, ip, email, verified, pwhash, pwsalt, "
+		"last_forgot_validated from users where username = ?2;",
+	"insert into sessions(name, username, expire) values (?1, ?2, ?3);",
+	"update sessions set username = ?2, expire = ?3 where name = ?1;",
+	"delete from sessions where expire <= ?3;",
+	"delete from sessions where username = ?2;",
+};
+
+static void
+lwsgs_sql_bind(sqlite3_stmt *sm, const char *name, const char *username,
+	       time_t t)
+{
+	/* statements not using all three just return SQLITE_RANGE */
+	if (name)
+		sqlite3_bind_text(sm, 1, name, -1, SQLITE_STATIC);
+	if (username)
+		sqlite3_bind_text(sm, 2, username, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(sm, 3, (sqlite3_int64)t);
+}
+
+static void
+lwsgs_sql_done(sqlite3_stmt *sm)
+{
+	sqlite3_reset(sm);
+	sqlite3_clear_bindings(sm);
+}
+
+static void
+lwsgs_sql_column(sqlite3_stmt *sm, int col, char *dest, size_t len)
+{
+	const char *p = (const char *)sqlite3_column_text(sm, col);
+
+	lws_strncpy(dest, p ? p : "", len);
+}
+
+/*
+ * Session writes
+ *
+ * If the vhost was configured to use a threadpool for them, writes to the
+ * sessions table are queued on a one-thread pool, so they happen in order,
+ * using a second db connection.  Each write gets a sequence number, so we can
+ * tell from the service thread which writes the db has seen.
+ *
+ * The service thread never waits for the queue: if it's full, the write fails
+ * and the caller sheds it, eg, the login fails.
+ *
+ * A write that fails on the threadpool, eg, because something else has the db
+ * locked, is tried again a few times, holding up the writes queued behind it.
+ * If it still fails, we give up on it, and the service thread pins the cache
+ * entry or user delete it was for, since the db will never have it.  It isn't
+ * queued again, since it would then overtake later writes.
+ */
+
+struct lwsgs_session_write {
+	struct lwsgs_session_write *next; /* on vhd->wq_flush at shutdown */
+	struct per_vhost_data__gs *vhd;
+	lwsgw_hash sid;
+	char username[32];
+	time_t expire;
+	unsigned int seq;
+	int op;
+	int tries;
+	char done;
+	char failed;
+};
+
+static int
+lwsgs_session_write_exec(sqlite3 *pdb, sqlite3_stmt **sm,
+			 const struct lwsgs_session_write *w)
+{
+	int n;
+
+	lwsgs_sql_bind(sm[w->op], w->sid.id, w->username, w->expire);
+	n = sqlite3_step(sm[w->op]);
+	lwsgs_sql_done(sm[w->op]);
+
+	if (n != SQLITE_DONE) {
+		lwsl_err("%s: session write %d failed: %s\n", __func__, w->op,
+			 sqlite3_errmsg(pdb));
+		return 1;
+	}
+
+	return 0;
+}
+
+#if defined(LWS_WITH_THREADPOOL)
+
+static enum lws_threadpool_task_return
+lwsgs_session_write_task(void *user, enum lws_threadpool_task_status s)
+{
+	struct lwsgs_session_write *w = (struct lwsgs_session_write *)user;
+
+	if (s == LWS_TP_STATUS_STOPPING)
+		/* we're shutting down while retrying, leave it for destroy */
+		return LWS_TP_RETURN_STOPPED;
+
+	if (!lwsgs_session_write_exec(w->vhd->pdb_tp, w->vhd->sm_tp, w)) {
+		w->done = 1;
+
+		return LWS_TP_RETURN_FINISHED;
+	}
+
+	if (++w->tries < LWSGS_SESSION_WRITE_TRIES) {
+		/* our seq isn't done, so the cache keeps the entry meanwhile */
+		usleep(w->tries * 100000);
+
+		return LWS_TP_RETURN_CHECKING_IN;
+	}
+
+	lwsl_err("%s: giving up on session write %u (op %d)\n", __func__,
+		 w->seq, w->op);
+	w->failed = 1;
+
+	return LWS_TP_RETURN_FINISHED;
+}
+
+/*
+ * Writes still queued when the pool is finished are stopped rather than run.
+ * That only happens at shutdown after the worker thread has gone, so we keep
+ * them in seq order and lwsgs_db_destroy() applies them inline.
+ */
+
+static void
+lwsgs_session_write_cleanup(struct lws *wsi, void *user)
+{
+	struct lwsgs_session_write *w = (struct lwsgs_session_write *)user,
+				   **pw;
+	struct per_vhost_data__gs *vhd = w->vhd;
+
+	pthread_mutex_lock(&vhd->wlock);
+	vhd->wseq_done = w->seq;
+	if (w->failed) {
+		/* the service thread pins what it was for, and frees it */
+		w->next = vhd->wq_failed;
+		vhd->wq_failed = w;
+	}
+	pthread_mutex_unlock(&vhd->wlock);
+
+	if (w->failed)
+		return;
+
+	if (w->done) {
+		free(w);
+
+		return;
+	}
+
+	pw = &vhd->wq_flush;
+	while (*pw && (int)(w->seq - (*pw)->seq) > 0)
+		pw = &(*pw)->next;
+
+	w->next = *pw;
+	*pw = w;
+}
+
+static struct lwsgs_session_cache_entry *
+lwsgs_session_cache_find(struct per_vhost_data__gs *vhd, const lwsgw_hash *sid);
+
+/*
+ * Service thread only.  Mark the cache entries and user deletes whose last
+ * write was given up on, so they stay pinned
+ */
+
+static void
+lwsgs_session_writes_failed(struct per_vhost_data__gs *vhd,
+			    struct lwsgs_session_write *w)
+{
+	struct lwsgs_session_cache_entry *e;
+	struct lwsgs_session_write *w1;
+	struct lwsgs_user_delete *d;
+
+	while (w) {
+		w1 = w->next;
+
+		if (w->op == LWSGS_SQL_SESSION_UPDATE) {
+			e = lwsgs_session_cache_find(vhd, &w->sid);
+			if (e && e->wseq == w->seq)
+				e->write_failed = 1;
+		}
+
+		if (w->op == LWSGS_SQL_SESSION_DELETE_USER)
+			for (d = vhd->user_deletes; d; d = d->next)
+				if (d->seq == w->seq)
+					d->failed = 1;
+
+		free(w);
+		w = w1;
+	}
+}
+
+/*
+ * 1 if the db has seen the write with seq, or given up on it.  Callers must
+ * check what they're interested in for having failed afterwards.
+ */
+
+static int
+lwsgs_session_seq_done(struct per_vhost_data__gs *vhd, unsigned int seq)
+{
+	struct lwsgs_session_write *failed;
+	unsigned int done;
+
+	if (!vhd->tp)
+		return 1;
+
+	pthread_mutex_lock(&vhd->wlock);
+	done = vhd->wseq_done;
+	failed = vhd->wq_failed;
+	vhd->wq_failed = NULL;
+	pthread_mutex_unlock(&vhd->wlock);
+
+	if (failed)
+		lwsgs_session_writes_failed(vhd, failed);
+
+	return (int)(seq - done) <= 0;
+}
+
+#endif
+
+/* 1 if the db doesn't have the last write to the entry, yet or at all */
+
+static int
+lwsgs_session_cache_pending(struct per_vhost_data__gs *vhd,
+			    const struct lwsgs_session_cache_entry *e)
+{
+#if defined(LWS_WITH_THREADPOOL)
+	/* seq_done() may mark it failed, so check that after */
+	if (!lwsgs_session_seq_done(vhd, e->wseq))
+		return 1;
+
+	return e->write_failed;
+#else
+	return 0;
+#endif
+}
+
+/* 1 if a session write now would fail because the queue is full */
+
+static int
+lwsgs_session_writes_full(struct per_vhost_data__gs *vhd)
+{
+#if defined(LWS_WITH_THREADPOOL)
+	unsigned int done;
+
+	if (!vhd->tp)
+		return 0;
+
+	pthread_mutex_lock(&vhd->wlock);
+	done = vhd->wseq_done;
+	pthread_mutex_unlock(&vhd->wlock);
+
+	if ((int)(vhd->wseq - done) < LWSGS_SESSION_WRITE_QUEUE_MAX)
+		return 0;
+
+	lwsl_notice("%s: session db write queue full\n", __func__);
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * While a queued delete of a user's sessions hasn't run yet, the db still has
+ * them, so they must not be looked up from there and cached again
+ */
+
+static void
+lwsgs_user_deletes_reap(struct per_vhost_data__gs *vhd)
+{
+#if defined(LWS_WITH_THREADPOOL)
+	struct lwsgs_user_delete **pd = &vhd->user_deletes, *d;
+
+	while (*pd) {
+		d = *pd;
+		if (lwsgs_session_seq_done(vhd, d->seq) && !d->failed) {
+			/* the db has done it, forget about it */
+			*pd = d->next;
+			free(d);
+		} else
+			pd = &d->next;
+	}
+#endif
+}
+
+static int
+lwsgs_user_delete_pending(struct per_vhost_data__gs *vhd, const char *username)
+{
+#if defined(LWS_WITH_THREADPOOL)
+	struct lwsgs_user_delete *d;
+
+	lwsgs_user_deletes_reap(vhd);
+
+	for (d = vhd->user_deletes; d; d = d->next)
+		if (!strcmp(d->username, username))
+			return 1;
+#endif
+
+	return 0;
+}
+
+static int
+lwsgs_session_write(struct per_vhost_data__gs *vhd, int op,
+		    const lwsgw_hash *sid, const char *username, time_t expire,
+		    struct lwsgs_session_cache_entry *e)
+{
+	struct lwsgs_session_write w;
+
+	memset(&w, 0, sizeof(w));
+	w.vhd = vhd;
+	w.op = op;
+	if (sid)
+		w.sid = *sid;
+	if (username)
+		lws_strncpy(w.username, username, sizeof(w.username));
+	w.expire = expire;
+
+#if defined(LWS_WITH_THREADPOOL)
+	if (vhd->tp) {
+		struct lws_threadpool_task_args ta;
+		struct lwsgs_session_write *pw;
+		unsigned int seq = vhd->wseq + 1;
+
+		/* if the db can't keep up, shed the write rather than wait */
+
+		if (lwsgs_session_writes_full(vhd))
+			return 1;
+
+		pw = malloc(sizeof(*pw));
+		if (!pw)
+			return 1;
+		*pw = w;
+		pw->seq = seq;
+
+		memset(&ta, 0, sizeof(ta));
+		ta.user = pw;
+		ta.async_task = 1;
+		ta.task = lwsgs_session_write_task;
+		ta.cleanup = lwsgs_session_write_cleanup;
+
+		if (!lws_threadpool_enqueue(vhd->tp, &ta, "lwsgs-write-%u",
+					    seq)) {
+			lwsl_err("%s: unable to queue session write\n",
+				 __func__);
+			free(pw);
+
+			return 1;
+		}
+
+		vhd->wseq = seq;
+		if (e) {
+			/* pinned by the new seq until the db has it */
+			e->wseq = seq;
+			e->write_failed = 0;
+		}
+
+		return 0;
+	}
+#endif
+
+	return lwsgs_session_write_exec(vhd->pdb, vhd->sm, &w);
+}
+
+/*
+ * Session cache
+ *
+ * Recently used sessions are kept in a hash table with an LRU list, up to
+ * session_cache_max of them, so looking up the session for a request doesn't
+ * usually need the db.  Our own changes to sessions go to the cache and the
+ * db together, but entries are checked against the db again after
+ * session_cache_ttl_secs in case something else changed it.
+ *
+ * An entry whose last write is still queued on the threadpool must not be
+ * evicted or refreshed from the db, since the db doesn't have it yet.
+ */
+
+static uint32_t
+lwsgs_session_cache_hash(const lwsgw_hash *sid)
+{
+	const char *p = sid->id;
+	uint32_t h = 5381;
+
+	while (*p)
+		h = ((h << 5) + h) ^ (uint8_t)*p++;
+
+	return h;
+}
+
+static struct lwsgs_session_cache_entry *
+lwsgs_session_cache_find(struct per_vhost_data__gs *vhd, const lwsgw_hash *sid)
+{
+	uint32_t h = lwsgs_session_cache_hash(sid);
+	struct lwsgs_session_cache_entry *e;
+
+	e = vhd->sc_hash[h % LWSGS_SESSION_CACHE_BUCKETS];
+	while (e) {
+		if (e->hash == h && !strcmp(e->sid.id, sid->id))
+			return e;
+		e = e->hash_next;
+	}
+
+	return NULL;
+}
+
+static void
+lwsgs_session_cache_lru_unlink(struct per_vhost_data__gs *vhd,
+			       struct lwsgs_session_cache_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else if (vhd->sc_lru_head == e)
+		vhd->sc_lru_head = e->lru_next;
+
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else if (vhd->sc_lru_tail == e)
+		vhd->sc_lru_tail = e->lru_prev;
+
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void
+lwsgs_session_cache_lru_add_front(struct per_vhost_data__gs *vhd,
+				  struct lwsgs_session_cache_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = vhd->sc_lru_head;
+	if (vhd->sc_lru_head)
+		vhd->sc_lru_head->lru_prev = e;
+	else
+		vhd->sc_lru_tail = e;
+	vhd->sc_lru_head = e;
+}
+
+static void
+lwsgs_session_cache_drop(struct per_vhost_data__gs *vhd,
+			 struct lwsgs_session_cache_entry *e)
+{
+	lws_start_foreach_llp(struct lwsgs_session_cache_entry **, pe,
+			vhd->sc_hash[e->hash % LWSGS_SESSION_CACHE_BUCKETS]) {
+		if (*pe == e) {
+			*pe = e->hash_next;
+			break;
+		}
+	} lws_end_foreach_llp(pe, hash_next);
+
+	lwsgs_session_cache_lru_unlink(vhd, e);
+	vhd->session_cache_count--;
+	free(e);
+}
+
+/* creates or updates the entry for sid, and makes it the most recently used */
+
+static struct lwsgs_session_cache_entry *
+lwsgs_session_cache_set(struct per_vhost_data__gs *vhd, const lwsgw_hash *sid,
+			const char *username, time_t expire)
+{
+	struct lwsgs_session_cache_entry *e, *t, *prev;
+
+	e = lwsgs_session_cache_find(vhd, sid);
+	if (e) {
+		lwsgs_session_cache_lru_unlink(vhd, e);
+		goto fill;
+	}
+
+	/* make space from the tail, but keep entries the db doesn't have */
+
+	t = vhd->sc_lru_tail;
+	while (t && vhd->session_cache_count >= vhd->session_cache_max) {
+		prev = t->lru_prev;
+		if (!lwsgs_session_cache_pending(vhd, t))
+			lwsgs_session_cache_drop(vhd, t);
+		t = prev;
+	}
+
+	/*
+	 * with threadpool writes, the entry must exist until the db has it,
+	 * so we go over the limit rather than not caching it
+	 */
+
+	if (vhd->session_cache_count >= vhd->session_cache_max
+#if defined(LWS_WITH_THREADPOOL)
+	    && !vhd->tp
+#endif
+	)
+		return NULL;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return NULL;
+
+	memset(e, 0, sizeof(*e));
+	e->sid = *sid;
+	e->hash = lwsgs_session_cache_hash(sid);
+	e->hash_next = vhd->sc_hash[e->hash % LWSGS_SESSION_CACHE_BUCKETS];
+	vhd->sc_hash[e->hash % LWSGS_SESSION_CACHE_BUCKETS] = e;
+	vhd->session_cache_count++;
+
+fill:
+	lws_strncpy(e->username, username, sizeof(e->username));
+	e->expire = expire;
+	e->fetched = lws_now_secs();
+	lwsgs_session_cache_lru_add_front(vhd, e);
+
+	return e;
+}
+
 int
 lwsgw_expire_old_sessions(struct per_vhost_data__gs *vhd)
 {
 	time_t n = lws_now_secs();
-	char s[200];
 
 	if (n - vhd->last_session_expire < 5)
 		return 0;
 
 	vhd->last_session_expire = n;
 
-	lws_snprintf(s, sizeof(s) - 1,
-		 "delete from sessions where "
-		 "expire <= %lu;", (unsigned long)n);
+	lwsgs_user_deletes_reap(vhd);
 
-	if (sqlite3_exec(vhd->pdb, s, NULL, NULL, NULL) != SQLITE_OK) {
-		lwsl_err("Unable to expire sessions: %s\n",
-			 sqlite3_errmsg(vhd->pdb));
+	/*
+	 * cached entries check their own expiry when they are looked up, this
+	 * just stops the expired ones piling up in the db
+	 */
+
+	if (lwsgs_session_write(vhd, LWSGS_SQL_SESSION_EXPIRE, NULL, NULL, n,
+				NULL)) {
+		lwsl_err("Unable to expire sessions\n");
 		return 1;
 	}
 
@@ -105,29 +624,82 @@ int
 lwsgw_update_session(struct per_vhost_data__gs *vhd,
 		     lwsgw_hash *hash, const char *user)
 {
+	struct lwsgs_session_cache_entry *e;
 	time_t n = lws_now_secs();
-	char s[200], esc[50], esc1[50];
+	char username[32];
 
 	if (user[0])
 		n += vhd->timeout_absolute_secs;
 	else
 		n += vhd->timeout_anon_absolute_secs;
 
-	lws_snprintf(s, sizeof(s) - 1,
-		 "update sessions set expire=%lu,username='%s' where name='%s';",
-		 (unsigned long)n,
-		 lws_sql_purify(esc, user, sizeof(esc)),
-		 lws_sql_purify(esc1, hash->id, sizeof(esc1)));
+	/* there's nothing to update if the session is gone */
 
-	if (sqlite3_exec(vhd->pdb, s, NULL, NULL, NULL) != SQLITE_OK) {
-		lwsl_err("Unable to update session: %s\n",
-			 sqlite3_errmsg(vhd->pdb));
+	if (lwsgs_lookup_session(vhd, hash, username, sizeof(username)))
+		return 1;
+
+	/* check first, so we don't change the cache for a shed write */
+	if (lwsgs_session_writes_full(vhd))
+		return 1;
+
+	e = lwsgs_session_cache_set(vhd, hash, user, n);
+
+	if (lwsgs_session_write(vhd, LWSGS_SQL_SESSION_UPDATE, hash, user, n,
+				e)) {
+		lwsl_err("Unable to update session\n");
+		if (e && !lwsgs_session_cache_pending(vhd, e))
+			lwsgs_session_cache_drop(vhd, e);
 		return 1;
 	}
 
 	return 0;
 }
 
+int
+lwsgs_delete_user_sessions(struct per_vhost_data__gs *vhd,
+			   const char *username)
+{
+	struct lwsgs_session_cache_entry *e, *next;
+#if defined(LWS_WITH_THREADPOOL)
+	struct lwsgs_user_delete *d = NULL;
+
+	if (vhd->tp) {
+		d = malloc(sizeof(*d));
+		if (!d)
+			return 1;
+	}
+#endif
+
+	if (lwsgs_session_write(vhd, LWSGS_SQL_SESSION_DELETE_USER, NULL,
+				username, 0, NULL)) {
+		lwsl_err("Unable to delete sessions\n");
+#if defined(LWS_WITH_THREADPOOL)
+		free(d);
+#endif
+		return 1;
+	}
+
+#if defined(LWS_WITH_THREADPOOL)
+	if (d) {
+		/* until the queued delete is done, the db still has them */
+		lws_strncpy(d->username, username, sizeof(d->username));
+		d->seq = vhd->wseq;
+		d->next = vhd->user_deletes;
+		vhd->user_deletes = d;
+	}
+#endif
+
+	e = vhd->sc_lru_head;
+	while (e) {
+		next = e->lru_next;
+		if (!strcmp(e->username, username))
+			lwsgs_session_cache_drop(vhd, e);
+		e = next;
+	}
+
+	return 0;
+}
+
 static int
 lwsgw_session_from_cookie(const char *cookie, lwsgw_hash *sid)
 {
@@ -190,51 +762,65 @@ lwsgs_get_sid_from_wsi(struct lws *wsi, lwsgw_hash *sid)
 	return 0;
 }
 
-struct lla {
-	char *username;
-	int len;
-	int results;
-};
-
-static int
-lwsgs_lookup_callback(void *priv, int cols, char **col_val, char **col_name)
-{
-	struct lla *lla = (struct lla *)priv;
-
-	//lwsl_err("%s: %d\n", __func__, cols);
-
-	if (cols)
-		lla->results = 0;
-	if (col_val && col_val[0]) {
-		lws_strncpy(lla->username, col_val[0], lla->len + 1);
-		lwsl_info("%s: %s\n", __func__, lla->username);
-	}
-
-	return 0;
-}
-
 int
 lwsgs_lookup_session(struct per_vhost_data__gs *vhd,
 		     const lwsgw_hash *sid, char *username, int len)
 {
-	struct lla lla = { username, len, 1 };
-	char s[150], esc[50];
+	sqlite3_stmt *sm = vhd->sm[LWSGS_SQL_SESSION_LOOKUP];
+	struct lwsgs_session_cache_entry *e;
+	time_t now = lws_now_secs(), expire;
+	char user[32];
+	int n;
 
 	lwsgw_expire_old_sessions(vhd);
 
-	lws_snprintf(s, sizeof(s) - 1,
-		 "select username from sessions where name = '%s';",
-		 lws_sql_purify(esc, sid->id, sizeof(esc) - 1));
+	e = lwsgs_session_cache_find(vhd, sid);
+	if (e && (now - e->fetched < vhd->session_cache_ttl_secs ||
+		  lwsgs_session_cache_pending(vhd, e))) {
+		if (e->expire <= now) {
+			lwsgs_session_cache_drop(vhd, e);
+
+			return 1;
+		}
+
+		lwsgs_session_cache_lru_unlink(vhd, e);
+		lwsgs_session_cache_lru_add_front(vhd, e);
+		lws_strncpy(username, e->username, len);
+
+		return 0;
+	}
+
+	/* not cached, or time to check the cached one against the db */
+
+	lwsgs_sql_bind(sm, sid->id, NULL, 0);
+	n = sqlite3_step(sm);
+	if (n == SQLITE_ROW) {
+		lwsgs_sql_column(sm, 0, user, sizeof(user));
+		expire = (time_t)sqlite3_column_int64(sm, 1);
+	}
+	lwsgs_sql_done(sm);
 
-	if (sqlite3_exec(vhd->pdb, s, lwsgs_lookup_callback, &lla, NULL) != SQLITE_OK) {
-		lwsl_err("Unable to create user table: %s\n",
+	if (n != SQLITE_ROW && n != SQLITE_DONE) {
+		lwsl_err("Unable to lookup session: %s\n",
 			 sqlite3_errmsg(vhd->pdb));
 
 		return 1;
 	}
 
+	if (n == SQLITE_DONE || expire <= now ||
+	    lwsgs_user_delete_pending(vhd, user)) {
+		if (e)
+			lwsgs_session_cache_drop(vhd, e);
+
+		return 1;
+	}
+
+	lwsgs_session_cache_set(vhd, sid, user, expire);
+	lws_strncpy(username, user, len);
+	lwsl_info("%s: %s\n", __func__, username);
+
 	/* 0 if found */
-	return lla.results;
+	return 0;
 }
 
 int
@@ -291,16 +877,26 @@ int
 lwsgs_lookup_user(struct per_vhost_data__gs *vhd,
 		  const char *username, struct lwsgs_user *u)
 {
-	char s[150], esc[50];
+	sqlite3_stmt *sm = vhd->sm[LWSGS_SQL_USER_LOOKUP];
+	int n;
 
 	u->username[0] = '\0';
-	lws_snprintf(s, sizeof(s) - 1,
-		 "select username,creation_time,ip,email,verified,pwhash,pwsalt,last_forgot_validated "
-		 "from users where username = '%s';",
-		 lws_sql_purify(esc, username, sizeof(esc) - 1));
 
-	if (sqlite3_exec(vhd->pdb, s, lwsgs_lookup_callback_user, u, NULL) !=
-	    SQLITE_OK) {
+	lwsgs_sql_bind(sm, NULL, username, 0);
+	n = sqlite3_step(sm);
+	if (n == SQLITE_ROW) {
+		lwsgs_sql_column(sm, 0, u->username, sizeof(u->username));
+		u->created = (time_t)sqlite3_column_int64(sm, 1);
+		lwsgs_sql_column(sm, 2, u->ip, sizeof(u->ip));
+		lwsgs_sql_column(sm, 3, u->email, sizeof(u->email));
+		u->verified = sqlite3_column_int(sm, 4);
+		lwsgs_sql_column(sm, 5, u->pwhash.id, sizeof(u->pwhash.id));
+		lwsgs_sql_column(sm, 6, u->pwsalt.id, sizeof(u->pwsalt.id));
+		u->last_forgot_validated = (time_t)sqlite3_column_int64(sm, 7);
+	}
+	lwsgs_sql_done(sm);
+
+	if (n != SQLITE_ROW && n != SQLITE_DONE) {
 		lwsl_err("Unable to lookup user: %s\n",
 			 sqlite3_errmsg(vhd->pdb));
 
@@ -314,9 +910,9 @@ int
 lwsgs_new_session_id(struct per_vhost_data__gs *vhd,
 		     lwsgw_hash *sid, const char *username, int exp)
 {
+	struct lwsgs_session_cache_entry *e;
 	unsigned char sid_rand[20];
 	const char *u;
-	char s[300], esc[50], esc1[50];
 
 	if (username)
 		u = username;
@@ -334,15 +930,15 @@ lwsgs_new_session_id(struct per_vhost_data__gs *vhd,
 
 	sha1_to_lwsgw_hash(sid_rand, sid);
 
-	lws_snprintf(s, sizeof(s) - 1,
-		 "insert into sessions(name, username, expire) "
-		 "values ('%s', '%s', %u);",
-		 lws_sql_purify(esc, sid->id, sizeof(esc) - 1),
-		 lws_sql_purify(esc1, u, sizeof(esc1) - 1), exp);
+	if (lwsgs_session_writes_full(vhd))
+		return 1;
 
-	if (sqlite3_exec(vhd->pdb, s, NULL, NULL, NULL) != SQLITE_OK) {
-		lwsl_err("Unable to insert session: %s\n",
-			 sqlite3_errmsg(vhd->pdb));
+	e = lwsgs_session_cache_set(vhd, sid, u, exp);
+
+	if (lwsgs_session_write(vhd, LWSGS_SQL_SESSION_INSERT, sid, u, exp, e)) {
+		lwsl_err("Unable to insert session\n");
+		if (e)
+			lwsgs_session_cache_drop(vhd, e);
 
 		return 1;
 	}
@@ -442,3 +1038,159 @@ lwsgs_hash_password(struct per_vhost_data__gs *vhd,
 
 	return 0;
 }
+
+static int
+lwsgs_db_prepare(sqlite3 *pdb, sqlite3_stmt **sm, int first)
+{
+	int n;
+
+	for (n = first; n < LWSGS_SQL_COUNT; n++)
+		if (sqlite3_prepare_v2(pdb, lwsgs_sql[n], -1, &sm[n],
+				       NULL) != SQLITE_OK) {
+			lwsl_err("Unable to prepare %s: %s\n", lwsgs_sql[n],
+				 sqlite3_errmsg(pdb));
+
+			return 1;
+		}
+
+	return 0;
+}
+
+int
+lwsgs_db_init(struct per_vhost_data__gs *vhd, int threadpool)
+{
+	/* sessions are looked up by name on every request */
+
+	if (sqlite3_exec(vhd->pdb, "create index if not exists "
+			 "sessions_name on sessions (name);",
+			 NULL, NULL, NULL) != SQLITE_OK) {
+		lwsl_err("Unable to create session index: %s\n",
+			 sqlite3_errmsg(vhd->pdb));
+
+		return 1;
+	}
+
+	if (lwsgs_db_prepare(vhd->pdb, vhd->sm, 0))
+		return 1;
+
+	if (!threadpool)
+		return 0;
+
+#if defined(LWS_WITH_THREADPOOL)
+	{
+		struct lws_threadpool_create_args cta;
+
+		/*
+		 * with WAL, our reads on the service thread don't wait for the
+		 * writes on the threadpool connection
+		 */
+
+		if (sqlite3_exec(vhd->pdb, "pragma journal_mode=wal;",
+				 NULL, NULL, NULL) != SQLITE_OK) {
+			lwsl_err("Unable to set session db to WAL: %s\n",
+				 sqlite3_errmsg(vhd->pdb));
+
+			return 1;
+		}
+
+		if (sqlite3_open_v2(vhd->session_db, &vhd->pdb_tp,
+				    SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+			lwsl_err("Unable to open session db %s: %s\n",
+				 vhd->session_db, sqlite3_errmsg(vhd->pdb_tp));
+
+			return 1;
+		}
+
+		sqlite3_busy_timeout(vhd->pdb, 1000);
+		sqlite3_busy_timeout(vhd->pdb_tp, 5000);
+
+		if (lwsgs_db_prepare(vhd->pdb_tp, vhd->sm_tp,
+				     LWSGS_SQL_SESSION_INSERT))
+			return 1;
+
+		pthread_mutex_init(&vhd->wlock, NULL);
+
+		/* one thread, so the writes happen in the order we made them */
+
+		memset(&cta, 0, sizeof(cta));
+		cta.threads = 1;
+		cta.max_queue_depth = LWSGS_SESSION_WRITE_QUEUE_MAX;
+
+		vhd->tp = lws_threadpool_create(vhd->context, &cta, "lwsgs");
+		if (!vhd->tp) {
+			pthread_mutex_destroy(&vhd->wlock);
+
+			return 1;
+		}
+	}
+#else
+	lwsl_notice("%s: lws built without LWS_WITH_THREADPOOL, "
+		    "session db writes are done inline\n", __func__);
+#endif
+
+	return 0;
+}
+
+void
+lwsgs_db_destroy(struct per_vhost_data__gs *vhd)
+{
+	int n;
+
+#if defined(LWS_WITH_THREADPOOL)
+	if (vhd->tp) {
+		struct lwsgs_session_write *w;
+		struct lwsgs_user_delete *d;
+
+		/*
+		 * Any writes still queued are stopped and collected on
+		 * wq_flush in order, once the worker has exited we can
+		 * apply them here on its connection
+		 */
+
+		lws_threadpool_finish(vhd->tp);
+		lws_threadpool_destroy(vhd->tp);
+		vhd->tp = NULL;
+		pthread_mutex_destroy(&vhd->wlock);
+
+		/* it's too late to apply the ones we gave up on, in order */
+		while (vhd->wq_failed) {
+			w = vhd->wq_failed;
+			vhd->wq_failed = w->next;
+			free(w);
+		}
+
+		while (vhd->wq_flush) {
+			w = vhd->wq_flush;
+			vhd->wq_flush = w->next;
+			lwsgs_session_write_exec(vhd->pdb_tp, vhd->sm_tp, w);
+			free(w);
+		}
+
+		while (vhd->user_deletes) {
+			d = vhd->user_deletes;
+			vhd->user_deletes = d->next;
+			free(d);
+		}
+	}
+
+	for (n = 0; n < LWSGS_SQL_COUNT; n++)
+		if (vhd->sm_tp[n]) {
+			sqlite3_finalize(vhd->sm_tp[n]);
+			vhd->sm_tp[n] = NULL;
+		}
+
+	if (vhd->pdb_tp) {
+		sqlite3_close(vhd->pdb_tp);
+		vhd->pdb_tp = NULL;
+	}
+#endif
+
+	for (n = 0; n < LWSGS_SQL_COUNT; n++)
+		if (vhd->sm[n]) {
+			sqlite3_finalize(vhd->sm[n]);
+			vhd->sm[n] = NULL;
+		}
+
+	while (vhd->sc_lru_head)
+		lwsgs_session_cache_drop(vhd, vhd->sc_lru_head);
+}
@@ -36,10 +36,19 @@ struct fobj {
 
 struct per_session_data__tbl_dir {
 	struct fobj base;
+	struct lws_json_out jo;
 	char strings[64 * 1024];
 	char reldir[256];
+	char reldir_req[256];
 	char *p;
 	const char *dir;
+	struct fobj *f;		/* next file entry to send */
+	int crumb;		/* offset in reldir of next breadcrumb */
+	unsigned char stage;	/* which part of the JSON we are sending */
+	unsigned char sub;	/* json calls already done for this entry */
+	char sending;		/* a view update is partway through */
+	char first_frag;
+	char rescan;		/* a new view update is wanted */
 
 #if UV_VERSION_MAJOR > 0
 	uv_fs_event_t *event_req;
@@ -55,8 +64,10 @@ mon_cb(uv_fs_event_t *handle, const char *filename, int events, int status)
 
 	//lwsl_notice("%s\n", __func__);
 
-	if (pss && pss->wsi)
+	if (pss && pss->wsi) {
+		pss->rescan = 1;
 		lws_callback_on_writable(pss->wsi);
+	}
 }
 
 static void lws_uv_close_cb(uv_handle_t *handle)
@@ -190,16 +201,142 @@ free_scan_dir(struct per_session_data__tbl_dir *pss)
 	pss->base.next = NULL;
 }
 
+/*
+ * Work out the name and url for the breadcrumb starting at pss->crumb in
+ * pss->reldir.  Returns the offset of the following breadcrumb, or -1 if
+ * this is the last one (which has no url).
+ */
+
+static int
+crumb(struct per_session_data__tbl_dir *pss, char *s, char *s1, int len)
+{
+	const char *q = pss->reldir + pss->crumb, *q1;
+	int n, first = !pss->crumb;
+
+	s1[0] = '\0';
+
+	if (!pss->reldir[0]) {
+		lws_strncpy(s, "top", len);
+		return -1;
+	}
+
+	q1 = strchr(q, '/');
+	if (!q1) {
+		lws_strncpy(s, first ? "top1" : q, len);
+		return -1;
+	}
+
+	n = lws_ptr_diff(q1, q);
+	if (n > len - 1)
+		n = len - 1;
+	if (first) {
+		strcpy(s1, "/");
+		strcpy(s, "top");
+	} else {
+		lws_strncpy(s, q, n + 1);
+
+		n = lws_ptr_diff(q1, pss->reldir);
+		if (n > len - 1)
+			n = len - 1;
+		lws_strncpy(s1, pss->reldir, n + 1);
+	}
+
+	if (!q1[1])
+		return -1;
+
+	return lws_ptr_diff(q1 + 1, pss->reldir);
+}
+
+/*
+ * A json writer call either completes or tells us the window is full, when it
+ * must be repeated with the same args in the next window.  pss->sub counts
+ * the calls already completed for the entry we are on.
+ */
+
+#define JO_STEP(_n, _cond, _call) \
+	if (pss->sub == _n) { \
+		if ((_cond) && (r = _call)) \
+			return r; \
+		pss->sub++; \
+	}
+
+/*
+ * Continue the view update JSON in the writer's current window.  Returns
+ * LWSJO_OK when it is complete, LWSJO_FULL when the window should be sent and
+ * we should be called again, or LWSJO_ERR.
+ */
+
+static int
+dirlisting_json(struct per_session_data__tbl_dir *pss)
+{
+	struct lws_json_out *j = &pss->jo;
+	char s[384], s1[384], size[24];
+	const char *w;
+	int r, next;
+
+	switch (pss->stage) {
+	case 0:
+		JO_STEP(0, 1, lws_json_out_obj(j, NULL));
+		JO_STEP(1, 1, lws_json_out_arr(j, "breadcrumbs"));
+		pss->sub = 0;
+		pss->stage++;
+		/* fallthru */
+	case 1:
+		while (pss->crumb >= 0) {
+			next = crumb(pss, s, s1, sizeof(s));
+			w = s1;
+			while (w[0] == '/' && w[1] == '/')
+				w++;
+
+			JO_STEP(0, 1, lws_json_out_obj(j, NULL));
+			JO_STEP(1, 1, lws_json_out_str(j, "name", s));
+			JO_STEP(2, next >= 0, lws_json_out_str(j, "url", w));
+			JO_STEP(3, 1, lws_json_out_end(j));
+			pss->sub = 0;
+			pss->crumb = next;
+		}
+		pss->stage++;
+		/* fallthru */
+	case 2:
+		JO_STEP(0, 1, lws_json_out_end(j));
+		JO_STEP(1, 1, lws_json_out_arr(j, "data"));
+		pss->sub = 0;
+		pss->stage++;
+		/* fallthru */
+	case 3:
+		while (pss->f) {
+			lws_snprintf(size, sizeof(size), "%lu", pss->f->size);
+
+			JO_STEP(0, 1, lws_json_out_obj(j, NULL));
+			JO_STEP(1, 1, lws_json_out_str(j, "Icon", pss->f->icon));
+			JO_STEP(2, 1, lws_json_out_str(j, "Date", pss->f->date));
+			JO_STEP(3, 1, lws_json_out_str(j, "Size", size));
+			JO_STEP(4, !!pss->f->uri,
+				lws_json_out_str(j, "uri", pss->f->uri));
+			JO_STEP(5, 1, lws_json_out_str(j, "Name", pss->f->name));
+			JO_STEP(6, 1, lws_json_out_end(j));
+			pss->sub = 0;
+			pss->f = pss->f->next;
+		}
+		pss->stage++;
+		/* fallthru */
+	case 4:
+		JO_STEP(0, 1, lws_json_out_end(j));
+		JO_STEP(1, 1, lws_json_out_end(j));
+		break;
+	}
+
+	return LWSJO_OK;
+}
+
 static int
 callback_lws_table_dirlisting(struct lws *wsi, enum lws_callback_reasons reason,
 			      void *user, void *in, size_t len)
 {
 	struct per_session_data__tbl_dir *pss = (struct per_session_data__tbl_dir *)user;
-	char j[LWS_PRE + 16384], *p = j + LWS_PRE, *start = p, *q, *q1, *w,
-		*end = j + sizeof(j) - LWS_PRE, e[384], s[384], s1[384];
+	char buf[LWS_PRE + 4096], *start = buf + LWS_PRE;
 	const struct lws_protocol_vhost_options *pmo;
-	struct fobj *f;
-	int n, first = 1;
+	int n;
 
 	switch (reason) {
 	case LWS_CALLBACK_PROTOCOL_INIT: /* per vhost */
@@ -223,111 +360,76 @@ callback_lws_table_dirlisting(struct lws *wsi, enum lws_callback_reasons reason,
 			return -1;
 
 		/* send a view update next */
+		pss->rescan = 1;
 		lws_callback_on_writable(wsi);
 		break;
 
 	case LWS_CALLBACK_RECEIVE:
-		if (len > sizeof(pss->reldir) - 1)
-			len = sizeof(pss->reldir) - 1;
+		/* taken up when any view update in progress has finished */
+		if (len > sizeof(pss->reldir_req) - 1)
+			len = sizeof(pss->reldir_req) - 1;
 		if (!strstr(in, "..") && !strchr(in, '~'))
-			lws_strncpy(pss->reldir, in, len + 1);
+			lws_strncpy(pss->reldir_req, in, len + 1);
 		else
 			len = 0;
-		pss->reldir[len] = '\0';
-		if (pss->reldir[0] == '/' && !pss->reldir[1])
-			pss->reldir[0] = '\0';
-		lwsl_info("%s\n", pss->reldir);
+		pss->reldir_req[len] = '\0';
+		if (pss->reldir_req[0] == '/' && !pss->reldir_req[1])
+			pss->reldir_req[0] = '\0';
+		lwsl_info("%s\n", pss->reldir_req);
+		pss->rescan = 1;
 		lws_callback_on_writable(wsi);
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
+		/*
+		 * The view update can be much bigger than our buffer, so we
+		 * stream it out as ws fragments, one per writeable callback
+		 */
 
-		if (scan_dir(wsi, pss))
-			return 1;
-
-		p += lws_snprintf(p, end - p, "{\"breadcrumbs\":[");
-		q = pss->reldir;
-
-		if (!q[0])
-			p += lws_snprintf(p, end - p, "{\"name\":\"top\"}");
-
-		while (*q) {
-
-			q1 = strchr(q, '/');
-			if (!q1) {
-				if (first)
-					strcpy(s, "top1");
-				else
-					strcpy(s, q);
-				s1[0] = '\0';
-				q += strlen(q);
-			} else {
-				n = lws_ptr_diff(q1, q);
-				if (n > (int)sizeof(s) - 1)
-					n = sizeof(s) - 1;
-				if (first) {
-					strcpy(s1, "/");
-					strcpy(s, "top");
-				} else {
-					lws_strncpy(s, q, n + 1);
-
-					n = lws_ptr_diff(q1, pss->reldir);
-					if (n > (int)sizeof(s1) - 1)
-						n = sizeof(s1) - 1;
-					lws_strncpy(s1, pss->reldir, n + 1);
-				}
-				q = q1 + 1;
-			}
-			if (!first)
-				p += lws_snprintf(p, end - p, ",");
-			else
-				first = 0;
-
-			p += lws_snprintf(p, end - p, "{\"name\":\"%s\"",
-					lws_json_purify(e, s, sizeof(e)));
-			if (*q) {
-				w = s1;
-				while (w[0] == '/' && w[1] == '/')
-					w++;
-				p += lws_snprintf(p, end - p, ",\"url\":\"%s\"",
-					lws_json_purify(e, w, sizeof(e)));
-			}
-			p += lws_snprintf(p, end - p, "}");
-			if (!q1)
+		if (!pss->sending) {
+			if (!pss->rescan)
 				break;
-		}
+			pss->rescan = 0;
+			strcpy(pss->reldir, pss->reldir_req);
+
+			if (scan_dir(wsi, pss))
+				return 1;
+
+			lws_json_out_init(&pss->jo, start, sizeof(buf) - LWS_PRE);
+			pss->f = pss->base.next;
+			pss->crumb = 0;
+			pss->stage = 0;
+			pss->sub = 0;
+			pss->first_frag = 1;
+			pss->sending = 1;
+		} else
+			lws_json_out_window(&pss->jo, start,
+					    sizeof(buf) - LWS_PRE);
+
+		n = dirlisting_json(pss);
+		if (n < 0)
+			return -1;
 
-		p += lws_snprintf(p, end - p, "],\"data\":[");
-
-		f = pss->base.next;
-		while (f) {
-			/* format in JSON */
-			p += lws_snprintf(p, end - p, "{\"Icon\":\"%s\",",
-					lws_json_purify(e, f->icon, sizeof(e)));
-			p += lws_snprintf(p, end - p, " \"Date\":\"%s\",",
-				lws_json_purify(e, f->date, sizeof(e)));
-			p += lws_snprintf(p, end - p, " \"Size\":\"%ld\",",
-				f->size);
-			if (f->uri)
-				p += lws_snprintf(p, end - p, " \"uri\":\"%s\",",
-						lws_json_purify(e, f->uri, sizeof(e)));
-			p += lws_snprintf(p, end - p, " \"Name\":\"%s\"}",
-				lws_json_purify(e, f->name, sizeof(e)));
-
-			f = f->next;
-
-			if (f)
-				p += lws_snprintf(p, end - p, ",");
-		}
+		if (lws_write(wsi, (unsigned char *)start,
+			      lws_ptr_diff(pss->jo.p, start),
+			      lws_write_ws_flags(LWS_WRITE_TEXT, pss->first_frag,
+						 n == LWSJO_OK)) < 0)
+			return -1;
 
-		p += lws_snprintf(p, end - p, "]}");
+		pss->first_frag = 0;
 
-		free_scan_dir(pss);
+		if (n == LWSJO_OK) {
+			pss->sending = 0;
+			free_scan_dir(pss);
+			if (!pss->rescan)
+				break;
+		}
 
-		if (lws_write(wsi, (unsigned char *)start, p - start,
-			      LWS_WRITE_TEXT) < 0)
-			return -1;
+		lws_callback_on_writable(wsi);
+		break;
 
+	case LWS_CALLBACK_CLOSED:
+		free_scan_dir(pss);
 		break;
 
 	case LWS_CALLBACK_HTTP_PMO:
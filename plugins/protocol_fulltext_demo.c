@@ -108,7 +108,9 @@ callback_fts(struct lws *wsi, enum lws_callback_reasons reason, void *user,
 		params.max_autocomplete = 10;
 		params.max_files = 10;
 
-		jtf = lws_fts_open(vhd->indexpath);
+		/* include any files added to the index since it was made */
+		jtf = lws_fts_open_flags(vhd->indexpath,
+					 LWSFTS_F_OPEN_SEGMENTS);
 		if (!jtf) {
 			lwsl_err("unable to open %s\n", vhd->indexpath);
 			/* we'll inform the client in the JSON */
@@ -0,0 +1,142 @@
+/*
+ * http protocol handler plugin serving lws stats for Prometheus to scrape
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * The person who associated a work with this deed has dedicated
+ * the work to the public domain by waiving all of his or her rights
+ * to the work worldwide under copyright law, including all related
+ * and neighboring rights, to the extent allowed by law. You can copy,
+ * modify, distribute and perform the work, even for commercial purposes,
+ * all without asking permission.
+ *
+ * These test plugins are intended to be adapted for use in your code, which
+ * may be proprietary.  So unlike the library itself, they are licensed
+ * Public Domain.
+ *
+ * Mount it with "origin": "callback://lws-metrics" and point the Prometheus
+ * scrape config at the mountpoint.
+ */
+
+#if !defined (LWS_PLUGIN_STATIC)
+#define LWS_DLL
+#define LWS_INTERNAL
+#include <libwebsockets.h>
+#endif
+
+#include <string.h>
+
+struct pss_metrics {
+	struct lws_metrics_render r;
+	char started;
+};
+
+static int
+callback_lws_metrics(struct lws *wsi, enum lws_callback_reasons reason,
+		     void *user, void *in, size_t len)
+{
+	struct pss_metrics *pss = (struct pss_metrics *)user;
+	uint8_t buf[LWS_PRE + 4096], *start = &buf[LWS_PRE], *p = start,
+		*end = &buf[sizeof(buf) - 1];
+	char accept[128];
+	int n;
+
+	switch (reason) {
+
+	case LWS_CALLBACK_HTTP:
+		memset(&pss->r, 0, sizeof(pss->r));
+
+		/* Prometheus asks for OpenMetrics if it can parse it */
+
+		if (lws_hdr_copy(wsi, accept, sizeof(accept),
+				 WSI_TOKEN_HTTP_ACCEPT) > 0 &&
+		    strstr(accept, "application/openmetrics-text"))
+			pss->r.openmetrics = 1;
+
+		if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK,
+				pss->r.openmetrics ?
+					"application/openmetrics-text; "
+					"version=1.0.0; charset=utf-8" :
+					"text/plain; version=0.0.4",
+				LWS_ILLEGAL_HTTP_CONTENT_LEN, &p, end))
+			return 1;
+
+		if (lws_finalize_write_http_header(wsi, start, &p, end))
+			return 1;
+
+		pss->started = 1;
+		lws_callback_on_writable(wsi);
+		return 0;
+
+	case LWS_CALLBACK_HTTP_WRITEABLE:
+		if (!pss || !pss->started)
+			break;
+
+		/* render straight into the write buffer, a chunk at a time */
+
+		n = lws_metrics_render(lws_get_context(wsi), &pss->r,
+				       (char *)start, lws_ptr_diff(end, start));
+
+		if (lws_write(wsi, start, n, pss->r.done ?
+				LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) != n)
+			return 1;
+
+		if (pss->r.done) {
+			pss->started = 0;
+			if (lws_http_transaction_completed(wsi))
+				return -1;
+		} else
+			lws_callback_on_writable(wsi);
+
+		return 0;
+
+	default:
+		break;
+	}
+
+	return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+#define LWS_PLUGIN_PROTOCOL_LWS_METRICS \
+	{ \
+		"lws-metrics", \
+		callback_lws_metrics, \
+		sizeof(struct pss_metrics), \
+		0, \
+		0, NULL, 0 \
+	}
+
+#if !defined (LWS_PLUGIN_STATIC)
+
+static const struct lws_protocols protocols[] = {
+	LWS_PLUGIN_PROTOCOL_LWS_METRICS
+};
+
+LWS_EXTERN LWS_VISIBLE int
+init_protocol_lws_metrics(struct lws_context *context,
+			  struct lws_plugin_capability *c)
+{
+	if (c->api_magic != LWS_PLUGIN_API_MAGIC) {
+		lwsl_err("Plugin API %d, library API %d", LWS_PLUGIN_API_MAGIC,
+			 c->api_magic);
+		return 1;
+	}
+
+	c->protocols = protocols;
+	c->count_protocols = LWS_ARRAY_SIZE(protocols);
+	c->extensions = NULL;
+	c->count_extensions = 0;
+
+	return 0;
+}
+
+LWS_EXTERN LWS_VISIBLE int
+destroy_protocol_lws_metrics(struct lws_context *context)
+{
+	return 0;
+}
+
+#endif
@@ -32,14 +32,26 @@ struct lws_ss_filepath {
 	char filepath[128];
 };
 
+/*
+ * The dump is built once per update into a buffer that grows as needed, and
+ * each connection sends it as a ws message in fragments of LWS_SS_CHUNK.  A
+ * new dump isn't built while anyone is part way through sending the last one.
+ */
+
+#define LWS_SS_DUMP_INITIAL	32768
+#define LWS_SS_DUMP_MAX		(4 * 1024 * 1024)
+#define LWS_SS_CHUNK		4096
+
 struct lws_ss_dumps {
-	char buf[32768];
+	char *buf; /* LWS_PRE, then the JSON */
+	size_t size;
 	int length;
+	int ver;
 };
 
 struct per_session_data__server_status {
-	int ver;
-	int pos;
+	int ver; /* version of the dump we are sending */
+	int pos; /* how much of it we sent, 0 if we are not sending */
 };
 
 struct per_vhost_data__lws_server_status {
@@ -47,62 +59,97 @@ struct per_vhost_data__lws_server_status {
 	int hide_vhosts;
 	int tow_flag;
 	int period_us;
+	int senders; /* connections part way through sending the dump */
+	char update_pending;
 	struct lws_ss_dumps d;
 	struct lws_ss_filepath *fp;
 };
 
 static const struct lws_protocols protocols[1];
 
-static void
-update(struct per_vhost_data__lws_server_status *v)
+static int
+dump_files(struct per_vhost_data__lws_server_status *v, struct lws_json_out *j)
 {
 	struct lws_ss_filepath *fp;
-	char *p = v->d.buf + LWS_PRE, contents[256], pure[256];
-	int n, l, first = 1, fd;
+	char contents[256];
+	int n, fd;
 
-	l = sizeof(v->d.buf) - LWS_PRE - 1;
+	if (lws_json_out_arr(j, NULL))
+		return 1;
 
-	n = lws_snprintf(p, l, "{\"i\":");
-	p += n;
-	l -= n;
+	for (fp = v->fp; fp; fp = fp->next) {
+		fd = lws_open(fp->filepath, LWS_O_RDONLY);
+		if (fd < 0)
+			continue;
+		n = read(fd, contents, sizeof(contents) - 1);
+		close(fd);
+		if (n < 0)
+			continue;
+
+		if (lws_json_out_obj(j, NULL) ||
+		    lws_json_out_str(j, "path", fp->filepath) ||
+		    lws_json_out_strn(j, "val", contents, n) ||
+		    lws_json_out_end(j))
+			return 1;
+	}
+
+	return !!lws_json_out_end(j);
+}
+
+static void
+update(struct per_vhost_data__lws_server_status *v)
+{
+	size_t size = v->d.size ? v->d.size : LWS_SS_DUMP_INITIAL;
+	struct lws_json_out j;
+	char *p, *end;
+	int n;
+
+	if (v->senders) {
+		v->update_pending = 1;
+		return;
+	}
+	v->update_pending = 0;
+
+	while (1) {
+		if (size != v->d.size) {
+			p = realloc(v->d.buf, LWS_PRE + size);
+			if (!p) {
+				lwsl_err("%s: OOM\n", __func__);
+				return;
+			}
+			v->d.buf = p;
+			v->d.size = size;
+		}
 
-	n = lws_json_dump_context(v->context, p, l, v->hide_vhosts);
-	p += n;
-	l -= n;
+		/* leave room for the closing } */
 
-	n = lws_snprintf(p, l, ", \"files\": [");
-	p += n;
-	l -= n;
+		p = v->d.buf + LWS_PRE;
+		end = p + size - 1;
 
-	fp = v->fp;
-	while (fp) {
-		if (!first) {
-			n = lws_snprintf(p, l, ",");
+		p += lws_snprintf(p, end - p, "{\"i\":");
+		n = lws_json_dump_context(v->context, p, lws_ptr_diff(end, p),
+					  v->hide_vhosts);
+		if (n >= 0) {
 			p += n;
-			l -= n;
+			p += lws_snprintf(p, end - p, ",\"files\":");
+			lws_json_out_init(&j, p, lws_ptr_diff(end, p));
+			if (!dump_files(v, &j))
+				break;
 		}
-		fd = lws_open(fp->filepath, LWS_O_RDONLY);
-		if (fd >= 0) {
-			n = read(fd, contents, sizeof(contents) - 1);
-			if (n >= 0) {
-				contents[n] = '\0';
-				lws_json_purify(pure, contents, sizeof(pure));
-
-				n = lws_snprintf(p, l,
-					"{\"path\":\"%s\",\"val\":\"%s\"}",
-						fp->filepath, pure);
-				p += n;
-				l -= n;
-				first = 0;
-			}
-			close(fd);
+
+		if (size >= LWS_SS_DUMP_MAX) {
+			lwsl_err("%s: status is over %d bytes\n", __func__,
+				 LWS_SS_DUMP_MAX);
+			v->d.length = 0;
+			return;
 		}
-		fp = fp->next;
+		size *= 2;
 	}
-	n = lws_snprintf(p, l, "]}");
-	p += n;
 
-	v->d.length = p - (v->d.buf + LWS_PRE);
+	*j.p++ = '}';
+
+	v->d.length = lws_ptr_diff(j.p, v->d.buf + LWS_PRE);
+	v->d.ver++;
 
 	lws_callback_on_writable_all_protocol(v->context, &protocols[0]);
 }
@@ -117,17 +164,31 @@ callback_lws_server_status(struct lws *wsi, enum lws_callback_reasons reason,
 			(struct per_vhost_data__lws_server_status *)
 			lws_protocol_vh_priv_get(lws_get_vhost(wsi),
 					lws_get_protocol(wsi));
+	struct per_session_data__server_status *pss =
+			(struct per_session_data__server_status *)user;
+	unsigned char buf[LWS_PRE + LWS_SS_CHUNK];
 	struct lws_ss_filepath *fp, *fp1, **fp_old;
-	int m;
+	int m, n;
 
 	switch (reason) {
 
 	case LWS_CALLBACK_ESTABLISHED:
 		lwsl_info("%s: LWS_CALLBACK_ESTABLISHED\n", __func__);
 		lws_set_timer_usecs(wsi, v->period_us);
+		if (!v->d.length)
+			update(v);
 		lws_callback_on_writable(wsi);
 		break;
 
+	case LWS_CALLBACK_CLOSED:
+		if (!pss->pos)
+			break;
+		/* we were part way through sending the dump */
+		pss->pos = 0;
+		if (!--v->senders && v->update_pending)
+			update(v);
+		break;
+
 	case LWS_CALLBACK_PROTOCOL_INIT: /* per vhost */
 		if (v)
 			break;
@@ -172,13 +233,42 @@ callback_lws_server_status(struct lws *wsi, enum lws_callback_reasons reason,
 			free(fp);
 			fp = fp1;
 		}
+		free(v->d.buf);
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
-		m = lws_write(wsi, (unsigned char *)v->d.buf + LWS_PRE,
-			      v->d.length, LWS_WRITE_TEXT);
-		if (m < 0)
+		if (!pss->pos) {
+			if (pss->ver == v->d.ver || !v->d.length)
+				break;
+			pss->ver = v->d.ver;
+			v->senders++;
+		}
+
+		/*
+		 * lws_write() needs LWS_PRE of its own in front of what it
+		 * sends, so each fragment goes out of a copy
+		 */
+
+		n = v->d.length - pss->pos;
+		if (n > LWS_SS_CHUNK)
+			n = LWS_SS_CHUNK;
+		memcpy(buf + LWS_PRE, v->d.buf + LWS_PRE + pss->pos, n);
+
+		m = lws_write(wsi, buf + LWS_PRE, n,
+			      lws_write_ws_flags(LWS_WRITE_TEXT, !pss->pos,
+						 pss->pos + n == v->d.length));
+		if (m < n)
 			return -1;
+
+		pss->pos += n;
+		if (pss->pos < v->d.length) {
+			lws_callback_on_writable(wsi);
+			break;
+		}
+
+		pss->pos = 0;
+		if (!--v->senders && v->update_pending)
+			update(v);
 		break;
 
 	case LWS_CALLBACK_TIMER:
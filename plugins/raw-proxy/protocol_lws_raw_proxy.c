@@ -65,6 +65,7 @@ struct conn {
 	char rx_enabled[2];
 	char closed[2];
 	char established[2];
+	char spliced;
 };
 
 struct raw_pss {
@@ -77,6 +78,7 @@ struct raw_vhd {
 	char addr[128];
 	uint16_t port;
 	char ipv6;
+	char no_splice;
 };
 
 static void
@@ -230,6 +232,9 @@ callback_raw_proxy(struct lws *wsi, enum lws_callback_reasons reason,
 		lwsl_notice("%s: vh %s: onward %s:%s:%d\n", __func__,
 			    lws_get_vhost_name(lws_get_vhost(wsi)),
 			    vhd->ipv6 ? "ipv6": "ipv4", vhd->addr, vhd->port);
+
+		/* optionally always relay through the rings, eg, to compare */
+		vhd->no_splice = !lws_pvo_get_str(in, "no-splice", &cp);
 		break;
 
 bad_onward:
@@ -260,6 +265,16 @@ bad_onward:
 		/* he disabled his rx while waiting for use to be established */
 		flow_control(conn, ACC, 1);
 
+		/*
+		 * If both sides are plain sockets, the kernel can move the
+		 * data between them directly, and we never see the rx.
+		 */
+		if (!vhd->no_splice &&
+		    !lws_raw_proxy_splice(conn->wsi[ACC], wsi)) {
+			lwsl_info("%s: relaying by splice\n", __func__);
+			conn->spliced = 1;
+		}
+
 		lws_callback_on_writable(wsi);
 		lws_set_timeout(wsi, NO_PENDING_TIMEOUT, 0);
 		break;
@@ -273,6 +288,9 @@ bad_onward:
 
 		if (conn->closed[ACC])
 			destroy_conn(vhd, pss);
+		else
+			/* the accepted side closes when it sent everything */
+			lws_callback_on_writable(conn->wsi[ACC]);
 
 		break;
 
@@ -317,13 +335,16 @@ bad_onward:
 		if (!ppkt) {
 			lwsl_info("%s: CLI_WRITABLE had nothing in acc ring\n",
 				  __func__);
+			if (conn->closed[ACC])
+				return lws_raw_transaction_completed(wsi);
 			break;
 		}
 
 		if (ppkt->ticket != conn->ticket_retired + 1) {
 			lwsl_info("%s: acc ring has %d but next %d\n", __func__,
 				  ppkt->ticket, conn->ticket_retired + 1);
-			lws_callback_on_writable(conn->wsi[ACC]);
+			if (!conn->closed[ACC])
+				lws_callback_on_writable(conn->wsi[ACC]);
 			break;
 		}
 
@@ -419,6 +440,10 @@ bad_onward:
 		conn->closed[ACC] = 1;
 		if (conn->closed[ONW])
 			destroy_conn(vhd, pss);
+		else
+			if (conn->established[ONW])
+				/* onward closes when it sent everything */
+				lws_callback_on_writable(conn->wsi[ONW]);
 		break;
 
 	case LWS_CALLBACK_RAW_PROXY_SRV_RX:
@@ -463,20 +488,23 @@ bad_onward:
 	case LWS_CALLBACK_RAW_PROXY_SRV_WRITEABLE:
 		lwsl_debug("LWS_CALLBACK_RAW_PROXY_SRV_WRITEABLE\n");
 
-		if (!conn->established[ONW] || conn->closed[ONW])
+		if (!conn->established[ONW])
 			break;
 
 		ppkt = lws_ring_get_element(conn->r[ONW], &conn->t[ONW]);
 		if (!ppkt) {
 			lwsl_info("%s: SRV_WRITABLE nothing in onw ring\n",
 				  __func__);
+			if (conn->closed[ONW])
+				return lws_raw_transaction_completed(wsi);
 			break;
 		}
 
 		if (ppkt->ticket != conn->ticket_retired + 1) {
 			lwsl_info("%s: onw ring has %d but next %d\n", __func__,
 				  ppkt->ticket, conn->ticket_retired + 1);
-			lws_callback_on_writable(conn->wsi[ONW]);
+			if (!conn->closed[ONW])
+				lws_callback_on_writable(conn->wsi[ONW]);
 			break;
 		}
 
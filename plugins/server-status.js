@@ -29,6 +29,33 @@ function humanize(s)
 	return s;
 }
 
+/* callback and role handler latencies, if lws was built with the profiler */
+
+function callback_profile(cp)
+{
+	var s = "<table style=\"margin-left:16px\"><tr><td class=t>Callback</td>" +
+		"<td class=t>Count</td><td class=t>Mean us</td><td class=t>p50</td>" +
+		"<td class=t>p99</td><td class=t>p99.9</td><td class=t>Max</td>" +
+		"<td class=t>Stalls</td></tr>", m;
+
+	for (m = 0; m < cp.length; m++) {
+		s = s + "<tr><td><span class=\"m1\">";
+		if (cp[m].role)
+			s = s + san(cp[m].role) + " " + san(cp[m].handler);
+		else
+			s = s + san(cp[m].protocol) + " reason " + san(cp[m].reason);
+		s = s + "</span></td><td>" + san(cp[m].count) +
+			"</td><td>" + san(cp[m].mean_us) +
+			"</td><td>" + san(cp[m].p50_us) +
+			"</td><td>" + san(cp[m].p99_us) +
+			"</td><td>" + san(cp[m].p999_us) +
+			"</td><td>" + san(cp[m].max_us) +
+			"</td><td>" + san(cp[m].stalls) + "</td></tr>";
+	}
+
+	return s + "</table>";
+}
+
 	var pos = 0;
 
 function get_appropriate_ws_url()
@@ -154,6 +181,8 @@ function ws_open_server_status()
 					s = s + "<span class=n>ah pool:</span> <span class=v>" + san(jso.i.contexts[ci].pt[n].ah_pool_inuse) + " / " +
 						      san(jso.i.contexts[ci].ah_pool_max) + "</span>, " +
 					"<span class=n>ah waiting list:</span> <span class=v>" + san(jso.i.contexts[ci].pt[n].ah_wait_list);
+					if (jso.i.contexts[ci].pt[n].stalls)
+						s = s + "</span>, <span class=n>stalls:</span> <span class=v>" + san(jso.i.contexts[ci].pt[n].stalls);
 	
 					s = s + "</span></td></tr>";
 	
@@ -208,6 +237,8 @@ function ws_open_server_status()
 						s = s + "</span></td></tr>";
 					}
 					s = s + "</table>";
+					if (jso.i.contexts[ci].vhosts[n].callback_profile)
+						s = s + callback_profile(jso.i.contexts[ci].vhosts[n].callback_profile);
 					s = s + "</td></tr>";
 				}
 
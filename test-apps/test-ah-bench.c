@@ -0,0 +1,336 @@
+/*
+ * libwebsockets-test-ah-bench - http header table benchmark
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * Runs an lws http server in this process, and forks a client that keeps a
+ * number of keepalive connections busy with pipelined, browser-like requests
+ * for a tiny dynamic response.  The client reports how many requests per
+ * second the server parsed and answered, and the server side reports the
+ * peak heap used for header tables ("ah" allocations), measured with a
+ * counting allocator.
+ *
+ *  $ libwebsockets-test-ah-bench -n 100000 -c 64 -d 4
+ *
+ * -x <n> adds n repeated X-Forwarded-For headers to each request, to exercise
+ * requests using more header fragments than the ah keeps inline.
+ *
+ * -l <file> appends an access log line for each request to file, with --json
+ * in the json format, so the cost of access logging can be seen in the
+ * requests per second.
+ */
+
+#include <libwebsockets.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CONNS 1024
+
+struct bench_alloc {
+	size_t len;
+	int ah;
+	int pad;
+};
+
+struct bench_conn {
+	int fd;
+	int sent;	/* requests sent on this connection */
+	int answered;	/* responses seen on this connection */
+	int match;	/* progress through the end of response pattern */
+};
+
+static size_t ah_heap, ah_heap_peak, heap, heap_peak;
+static struct bench_conn conns[MAX_CONNS];
+static struct pollfd pfds[MAX_CONNS];
+static char req[8192];
+static int req_len;
+
+/* the response body is "ok", so every response ends with this */
+static const char resp_end[] = "\x0d\x0a\x0d\x0aok";
+
+static void *
+bench_realloc(void *ptr, size_t size, const char *reason)
+{
+	struct bench_alloc *ba = NULL;
+
+	if (ptr) {
+		ba = (struct bench_alloc *)ptr - 1;
+		heap -= ba->len;
+		if (ba->ah)
+			ah_heap -= ba->len;
+	}
+
+	if (!size) {
+		free(ba);
+
+		return NULL;
+	}
+
+	ba = realloc(ba, sizeof(*ba) + size);
+	if (!ba)
+		return NULL;
+
+	ba->len = size;
+	ba->ah = reason && !strncmp(reason, "ah ", 3);
+
+	heap += size;
+	if (heap > heap_peak)
+		heap_peak = heap;
+	if (ba->ah) {
+		ah_heap += size;
+		if (ah_heap > ah_heap_peak)
+			ah_heap_peak = ah_heap;
+	}
+
+	return ba + 1;
+}
+
+static int
+callback_bench(struct lws *wsi, enum lws_callback_reasons reason,
+	       void *user, void *in, size_t len)
+{
+	uint8_t buf[LWS_PRE + 256], *start = &buf[LWS_PRE], *p = start,
+		*end = &buf[sizeof(buf) - 1];
+
+	switch (reason) {
+	case LWS_CALLBACK_HTTP:
+		if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK,
+						"text/plain", 2, &p, end))
+			return 1;
+		if (lws_finalize_write_http_header(wsi, start, &p, end))
+			return 1;
+
+		memcpy(start, "ok", 2);
+		if (lws_write(wsi, start, 2, LWS_WRITE_HTTP_FINAL) != 2)
+			return 1;
+
+		if (lws_http_transaction_completed(wsi))
+			return -1;
+
+		return 0;
+
+	default:
+		break;
+	}
+
+	return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+static struct lws_protocols protocols[] = {
+	{ "http", callback_bench, 0, 0 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static int
+bench_send(int n, int total, int *started, int depth)
+{
+	while (conns[n].sent - conns[n].answered < depth && *started < total) {
+		if (write(conns[n].fd, req, req_len) != req_len)
+			return 1;
+		conns[n].sent++;
+		(*started)++;
+	}
+
+	return 0;
+}
+
+/* runs in the forked child: plain sockets, no lws */
+
+static int
+bench_client(int port, int total, int count, int depth)
+{
+	int n, m, started = 0, answered = 0, active;
+	struct sockaddr_in sa;
+	lws_usec_t start, us;
+	char buf[16384];
+	ssize_t r, i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (n = 0; n < count; n++) {
+		conns[n].fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (conns[n].fd < 0 ||
+		    connect(conns[n].fd, (struct sockaddr *)&sa, sizeof(sa))) {
+			fprintf(stderr, "client: connect failed: %d\n", errno);
+			return 1;
+		}
+		pfds[n].fd = conns[n].fd;
+		pfds[n].events = POLLIN;
+	}
+
+	start = lws_now_usecs();
+
+	for (n = 0; n < count; n++)
+		if (bench_send(n, total, &started, depth))
+			return 1;
+
+	do {
+		m = poll(pfds, count, 5000);
+		if (m <= 0) {
+			if (m < 0 && errno == EINTR)
+				continue;
+			fprintf(stderr, "client: stalled at %d\n", answered);
+			return 1;
+		}
+
+		for (n = 0; n < count && m > 0; n++) {
+			if (!pfds[n].revents)
+				continue;
+			m--;
+
+			r = read(conns[n].fd, buf, sizeof(buf));
+			if (r <= 0) {
+				fprintf(stderr, "client: server closed conn\n");
+				return 1;
+			}
+
+			for (i = 0; i < r; i++) {
+				if (buf[i] == resp_end[conns[n].match])
+					conns[n].match++;
+				else
+					conns[n].match = buf[i] == '\x0d';
+
+				if (conns[n].match ==
+						(int)sizeof(resp_end) - 1) {
+					conns[n].match = 0;
+					conns[n].answered++;
+					answered++;
+				}
+			}
+
+			if (bench_send(n, total, &started, depth))
+				return 1;
+		}
+
+		active = 0;
+		for (n = 0; n < count; n++)
+			if (conns[n].answered != conns[n].sent)
+				active++;
+	} while (active);
+
+	us = lws_now_usecs() - start;
+	if (!us)
+		us = 1;
+
+	lwsl_user("%d requests (%d bytes each) on %d conns, depth %d: "
+		  "%llums, %llu req/s\n", answered, req_len, count, depth,
+		  (unsigned long long)us / 1000,
+		  (unsigned long long)answered * 1000000 / us);
+
+	for (n = 0; n < count; n++)
+		close(conns[n].fd);
+
+	return 0;
+}
+
+int main(int argc, const char **argv)
+{
+	int n, total = 100000, count = 64, depth = 4, port = 7682, extra = 0,
+	    status = 1;
+	struct lws_context_creation_info info;
+	struct lws_context *context;
+	const char *p, *log;
+	pid_t pid;
+
+	lws_set_log_level(LLL_USER | LLL_ERR | LLL_WARN, NULL);
+	lwsl_user("libwebsockets header table benchmark\n");
+
+	if ((p = lws_cmdline_option(argc, argv, "-p")))
+		port = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-n")))
+		total = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-c")))
+		count = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-d")))
+		depth = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-x")))
+		extra = atoi(p);
+	log = lws_cmdline_option(argc, argv, "-l");
+
+	if (count < 1 || count > MAX_CONNS || depth < 1 || total < 1 ||
+	    extra < 0 || extra > 64) {
+		lwsl_err("usage: %s [-p <port>] [-n <requests>] "
+			 "[-c <conns, max %d>] [-d <pipeline depth>] "
+			 "[-x <extra headers, max 64>] [-l <access log> "
+			 "[--json]]\n", argv[0], MAX_CONNS);
+		return 1;
+	}
+
+	req_len = lws_snprintf(req, sizeof(req),
+		"GET /bench/index.html?a=1&b=2 HTTP/1.1\x0d\x0a"
+		"Host: 127.0.0.1:%d\x0d\x0a"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:62.0) "
+			"Gecko/20100101 Firefox/62.0\x0d\x0a"
+		"Accept: text/html,application/xhtml+xml,application/xml;"
+			"q=0.9,*/*;q=0.8\x0d\x0a"
+		"Accept-Language: en-US,en;q=0.5\x0d\x0a"
+		"Accept-Encoding: identity\x0d\x0a"
+		"Referer: http://127.0.0.1/\x0d\x0a"
+		"Cookie: session=0123456789abcdef; theme=dark\x0d\x0a"
+		"Cache-Control: max-age=0\x0d\x0a"
+		"Connection: keep-alive\x0d\x0a", port);
+	for (n = 0; n < extra; n++)
+		req_len += lws_snprintf(req + req_len, sizeof(req) - req_len,
+					"X-Forwarded-For: 10.0.0.%d\x0d\x0a", n);
+	req_len += lws_snprintf(req + req_len, sizeof(req) - req_len,
+				"\x0d\x0a");
+
+	lws_set_allocator(bench_realloc);
+
+	memset(&info, 0, sizeof info);
+	info.port = port;
+	info.protocols = protocols;
+	info.iface = "127.0.0.1";
+	/* one ah per connection, so nobody waits for one */
+	info.max_http_header_pool = (unsigned short)count;
+	info.keepalive_timeout = 60;
+	info.log_filepath = log;
+	if (lws_cmdline_option(argc, argv, "--json"))
+		info.access_log_format = LWS_ACCESS_LOG_FORMAT_JSON;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("lws init failed\n");
+		return 1;
+	}
+
+	pid = fork();
+	if (pid < 0)
+		goto bail;
+	if (!pid)
+		_exit(bench_client(port, total, count, depth));
+
+	while (lws_service(context, 50) >= 0) {
+		n = waitpid(pid, &status, WNOHANG);
+		if (n == pid)
+			break;
+	}
+
+	lwsl_user("ah heap peak %llu bytes (%llu per conn), "
+		  "total heap peak %llu bytes\n",
+		  (unsigned long long)ah_heap_peak,
+		  (unsigned long long)ah_heap_peak / count,
+		  (unsigned long long)heap_peak);
+
+bail:
+	lws_context_destroy(context);
+
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
@@ -0,0 +1,243 @@
+/*
+ * libwebsockets-test-connect-storm - connect storm benchmark
+ *
+ * Copyright (C) 2010-2018 Andy Green <andy@warmcat.com>
+ *
+ * This file is made available under the Creative Commons CC0 1.0
+ * Universal Public Domain Dedication.
+ *
+ * Keeps a number of tcp connections in flight to a server as fast as it can,
+ * each one making a new connection, sending a small http request, and reading
+ * until the server closes it.  At the end it reports how many connections
+ * per second completed, and the connection and request latency.
+ *
+ * It doesn't use lws for the connections, so it measures the server side
+ * rather than the client.  For example, against the test server:
+ *
+ *  $ libwebsockets-test-connect-storm -p 7681 -n 20000 -c 256
+ */
+
+#include <libwebsockets.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_INFLIGHT 4096
+
+enum {
+	CS_CONNECTING,
+	CS_READING,
+};
+
+struct storm_conn {
+	lws_usec_t started;
+	lws_usec_t connected;
+	int state;
+};
+
+static struct storm_conn conns[MAX_INFLIGHT];
+static struct pollfd pfds[MAX_INFLIGHT];
+static struct sockaddr_in sa;
+static char req[256];
+static int req_len, quiet_close;
+
+static unsigned long long total_connect_us, total_req_us, worst_connect_us;
+static int done, failed, started, connected;
+
+static int
+storm_start(int n)
+{
+	int fd;
+
+	started++;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return 1;
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		close(fd);
+		return 1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 &&
+	    errno != EINPROGRESS) {
+		close(fd);
+		return 1;
+	}
+
+	conns[n].started = lws_now_usecs();
+	conns[n].state = CS_CONNECTING;
+	pfds[n].fd = fd;
+	pfds[n].events = POLLOUT;
+	pfds[n].revents = 0;
+
+	return 0;
+}
+
+static void
+storm_finish(int n, int ok)
+{
+	lws_usec_t now = lws_now_usecs();
+	struct linger lin = { 1, 0 };
+
+	if (ok) {
+		done++;
+		total_req_us += now - conns[n].connected;
+	} else
+		failed++;
+
+	if (quiet_close)
+		/* reset rather than leave our side in TIME_WAIT */
+		setsockopt(pfds[n].fd, SOL_SOCKET, SO_LINGER, &lin,
+			   sizeof(lin));
+
+	close(pfds[n].fd);
+	pfds[n].fd = -1;
+}
+
+static void
+storm_service(int n)
+{
+	char buf[4096];
+	socklen_t len;
+	int e = 0;
+
+	if (conns[n].state == CS_CONNECTING) {
+		len = sizeof(e);
+		if (getsockopt(pfds[n].fd, SOL_SOCKET, SO_ERROR, &e, &len) ||
+		    e) {
+			storm_finish(n, 0);
+			return;
+		}
+
+		conns[n].connected = lws_now_usecs();
+		connected++;
+		total_connect_us += conns[n].connected - conns[n].started;
+		if ((unsigned long long)(conns[n].connected -
+					 conns[n].started) > worst_connect_us)
+			worst_connect_us = conns[n].connected -
+					   conns[n].started;
+
+		if (write(pfds[n].fd, req, req_len) != req_len) {
+			storm_finish(n, 0);
+			return;
+		}
+
+		conns[n].state = CS_READING;
+		pfds[n].events = POLLIN;
+
+		return;
+	}
+
+	/* read until the server closes it */
+
+	e = (int)read(pfds[n].fd, buf, sizeof(buf));
+	if (e > 0)
+		return;
+
+	if (e < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	storm_finish(n, !e);
+}
+
+int main(int argc, const char **argv)
+{
+	int n, inflight = 64, total = 10000, port = 7681, m, active;
+	const char *p, *address = "127.0.0.1", *path = "/";
+	lws_usec_t start, us;
+
+	lws_set_log_level(LLL_USER | LLL_ERR | LLL_WARN | LLL_NOTICE, NULL);
+	lwsl_user("libwebsockets connect storm benchmark\n");
+
+	if ((p = lws_cmdline_option(argc, argv, "-s")))
+		address = p;
+	if ((p = lws_cmdline_option(argc, argv, "-p")))
+		port = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-n")))
+		total = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "-c")))
+		inflight = atoi(p);
+	if ((p = lws_cmdline_option(argc, argv, "--path")))
+		path = p;
+	quiet_close = !!lws_cmdline_option(argc, argv, "--rst");
+
+	if (inflight < 1 || inflight > MAX_INFLIGHT || total < 1) {
+		lwsl_err("usage: %s [-s <server ip>] [-p <port>] "
+			 "[-n <connections>] [-c <in flight, max %d>] "
+			 "[--path <url path>] [--rst]\n", argv[0],
+			 MAX_INFLIGHT);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &sa.sin_addr) != 1) {
+		lwsl_err("%s: bad ipv4 address %s\n", __func__, address);
+		return 1;
+	}
+
+	req_len = lws_snprintf(req, sizeof(req), "GET %s HTTP/1.1\x0d\x0a"
+			       "Host: %s\x0d\x0a"
+			       "Connection: close\x0d\x0a\x0d\x0a", path,
+			       address);
+
+	for (n = 0; n < MAX_INFLIGHT; n++)
+		pfds[n].fd = -1;
+
+	start = lws_now_usecs();
+
+	do {
+		/* keep the requested number of connections in flight */
+
+		active = 0;
+		for (n = 0; n < inflight; n++) {
+			if (pfds[n].fd < 0 && started < total &&
+			    storm_start(n))
+				failed++;
+			if (pfds[n].fd >= 0)
+				active++;
+		}
+
+		if (!active)
+			break;
+
+		m = poll(pfds, inflight, 1000);
+		if (m < 0 && errno != EINTR)
+			break;
+
+		for (n = 0; n < inflight && m > 0; n++)
+			if (pfds[n].fd >= 0 && pfds[n].revents) {
+				m--;
+				storm_service(n);
+			}
+
+	} while (1);
+
+	us = lws_now_usecs() - start;
+	if (!us)
+		us = 1;
+
+	lwsl_user("%d connections (%d failed) in %llums: %llu conn/s\n",
+		  done, failed, (unsigned long long)us / 1000,
+		  (unsigned long long)done * 1000000 / us);
+	if (done)
+		lwsl_user("  connect: avg %lluus, worst %lluus; "
+			  "request to close: avg %lluus\n",
+			  total_connect_us / connected, worst_connect_us,
+			  total_req_us / done);
+
+	return failed != 0;
+}
@@ -21,6 +21,7 @@
 
 #include <libwebsockets.h>
 #include <string.h>
+#include <stdlib.h>
 
 
 static const char * const reason_names[] = {
@@ -83,19 +84,109 @@ cb(struct lejp_ctx *ctx, char reason)
 	return 0;
 }
 
+static int bench_values;
+
+static signed char
+cb_bench(struct lejp_ctx *ctx, char reason)
+{
+	if (reason & LEJP_FLAG_CB_IS_VALUE)
+		bench_values++;
+
+	return 0;
+}
+
+/*
+ * Parse a generated, pretty-printed JSON document of about mb megabytes a few
+ * times, fed in 4KB pieces like ws fragments, and report the throughput
+ */
+
+static int
+bench(int mb, int chunk)
+{
+	static const char text[] = "Lorem ipsum dolor sit amet, consectetur "
+		"adipiscing elit, sed do eiusmod tempor incididunt ut labore "
+		"et dolore magna aliqua.  Ut enim ad minim veniam, quis nostrud "
+		"exercitation ullamco laboris nisi ut aliquip ex ea commodo.";
+	size_t size = (size_t)mb * 1024 * 1024, len = 0, n;
+	struct lejp_ctx ctx;
+	lws_usec_t start, us;
+	int m, loops = 5, ret = 1, id = 0;
+	char *json;
+
+	json = malloc(size + 1024);
+	if (!json)
+		return 1;
+
+	len = lws_snprintf(json, size, "{\n\t\"items\": [");
+	while (len < size) {
+		len += lws_snprintf(json + len, size + 1024 - len,
+			"%s\n\t\t{\n"
+			"\t\t\t\"id\": %d,\n"
+			"\t\t\t\"name\": \"item %d\",\n"
+			"\t\t\t\"ratio\": 0.%d,\n"
+			"\t\t\t\"text\": \"%s\\n%s %s\\u00e9\",\n"
+			"\t\t\t\"ok\": true\n"
+			"\t\t}", id ? "," : "", id, id, id, text, text, text);
+		id++;
+	}
+	len += lws_snprintf(json + len, size + 1024 - len, "\n\t]\n}\n");
+
+	start = lws_now_usecs();
+	while (loops--) {
+		lejp_construct(&ctx, cb_bench, NULL, tok, LWS_ARRAY_SIZE(tok));
+		if (chunk)
+			lejp_set_string_chunk(&ctx, chunk);
+		for (n = 0; n < len; n += 4096) {
+			m = lejp_parse(&ctx, (uint8_t *)json + n,
+				       len - n < 4096 ? (int)(len - n) : 4096);
+			if (m < 0 && m != LEJP_CONTINUE) {
+				lwsl_err("bench parse failed %d\n", m);
+				goto bail;
+			}
+		}
+		lejp_destruct(&ctx);
+	}
+	us = lws_now_usecs() - start;
+	if (!us)
+		us = 1;
+
+	lwsl_notice("parsed %d x %lu bytes (%d values) in %llums: %llu MB/s\n",
+		    5, (unsigned long)len, bench_values / 5,
+		    (unsigned long long)us / 1000,
+		    (unsigned long long)len * 5 / us);
+	ret = 0;
+
+bail:
+	free(json);
+
+	return ret;
+}
+
 int
-main(int argc, char *argv[])
+main(int argc, const char *argv[])
 {
-	int fd, n = 1, ret = 1, m;
+	int fd, n = 1, ret = 1, m, chunk = 0;
 	struct lejp_ctx ctx;
+	const char *p;
 	char buf[128];
 
 	lws_set_log_level(7, NULL);
 
 	lwsl_notice("libwebsockets-test-lejp  (C) 2017 - 2018 andy@warmcat.com\n");
-	lwsl_notice("  usage: cat my.json | libwebsockets-test-lejp\n\n");
+	lwsl_notice("  usage: cat my.json | libwebsockets-test-lejp "
+		    "[--chunk <string chunk>]\n"
+		    "         libwebsockets-test-lejp --bench <MB> "
+		    "[--chunk <string chunk>]\n\n");
+
+	if ((p = lws_cmdline_option(argc, argv, "--chunk")))
+		chunk = atoi(p);
+
+	if ((p = lws_cmdline_option(argc, argv, "--bench")))
+		return bench(atoi(p), chunk);
 
 	lejp_construct(&ctx, cb, NULL, tok, LWS_ARRAY_SIZE(tok));
+	if (chunk)
+		lejp_set_string_chunk(&ctx, chunk);
 
 	fd = 0;
 